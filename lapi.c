@@ -426,6 +426,8 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
     luaC_checkGC(L);
     o = index2value(L, idx);  /* previous call may reallocate the stack */
   }
+  else
+    luaS_fixstr(L, tsvalue(o), 1);  /* contents must be a stable C string */
   lua_unlock(L);
   if (len != NULL)
     return getlstr(tsvalue(o), *len);
@@ -567,6 +569,21 @@ LUA_API const char *lua_pushexternalstring (lua_State *L,
 }
 
 
+LUA_API void lua_pushsubstring (lua_State *L, int idx,
+                                const char *s, size_t len) {
+  TString *ts;
+  const TValue *o;
+  lua_lock(L);
+  o = index2value(L, idx);
+  api_check(L, ttisstring(o), "string expected");
+  ts = luaS_newsubstr(L, tsvalue(o), s, len);
+  setsvalue2s(L, L->top.p, ts);
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+
 LUA_API const char *lua_pushstring (lua_State *L, const char *s) {
   lua_lock(L);
   if (s == NULL)
@@ -802,6 +819,34 @@ LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
 }
 
 
+LUA_API void lua_clonetable (lua_State *L, int idx) {
+  Table *t, *nt;
+  lua_lock(L);
+  t = gettable(L, idx);
+  nt = luaH_new(L);
+  sethvalue2s(L, L->top.p, nt);
+  api_incr_top(L);
+  luaH_copy(L, nt, t);
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_freeze (lua_State *L, int idx) {
+  Table *t;
+  lua_lock(L);
+  t = gettable(L, idx);
+  setfrozen(t);
+  lua_unlock(L);
+}
+
+
+LUA_API int lua_isfrozen (lua_State *L, int idx) {
+  const TValue *o = index2value(L, idx);
+  return ttistable(o) && isfrozen(hvalue(o));
+}
+
+
 LUA_API int lua_getmetatable (lua_State *L, int objindex) {
   const TValue *obj;
   Table *mt;
@@ -975,6 +1020,9 @@ LUA_API int lua_setmetatable (lua_State *L, int objindex) {
   }
   switch (ttype(obj)) {
     case LUA_TTABLE: {
+      if (l_unlikely(isfrozen(hvalue(obj))))
+        luaG_runerror(L, "cannot change the metatable of a frozen table");
+      luaH_changed(L, hvalue(obj));  /* it may be in an '__index' chain */
       hvalue(obj)->metatable = mt;
       if (mt) {
         luaC_objbarrier(L, gcvalue(obj), mt);
@@ -1021,6 +1069,76 @@ LUA_API int lua_setiuservalue (lua_State *L, int idx, int n) {
 }
 
 
+/*
+** Create the table of userdata layouts, which maps metatables to their
+** layouts. Its keys are weak, so that it does not keep metatables
+** alive. Lua code cannot reach this table or the layouts in it.
+*/
+static Table *newlayouts (lua_State *L) {
+  global_State *g = G(L);
+  Table *layouts = luaH_new(L);
+  Table *wmt;
+  TValue key;
+  sethvalue2s(L, L->top.p, layouts);  /* anchor it */
+  api_incr_top(L);
+  wmt = luaH_new(L);
+  layouts->metatable = wmt;
+  luaC_objbarrier(L, layouts, wmt);
+  setsvalue2s(L, L->top.p, luaS_newliteral(L, "k"));  /* anchor mode */
+  api_incr_top(L);
+  setsvalue(L, &key, g->tmname[TM_MODE]);
+  luaH_set(L, wmt, &key, s2v(L->top.p - 1));  /* wmt.__mode = "k" */
+  invalidateTMcache(wmt);
+  luaC_barrierback(L, obj2gco(wmt), s2v(L->top.p - 1));
+  g->layouts = layouts;
+  L->top.p -= 2;
+  return layouts;
+}
+
+
+/*
+** Add field 'k' to the layout of the userdata metatable at 'idx'. The
+** layout is a table mapping field names to their descriptors, kept in
+** 'G(L)->layouts' (and not in the metatable, where Lua code could change
+** it). Bit BITLAYOUT in the metatable tells the VM whether to look for
+** a layout. (New tables are anchored in the stack while being changed.)
+*/
+LUA_API void lua_layoutfield (lua_State *L, int idx, const char *k,
+                              size_t offset, int type) {
+  Table *mt;
+  Table *layouts;
+  Table *layout;
+  TValue key, desc;
+  lua_lock(L);
+  mt = gettable(L, idx);
+  api_check(L, LUA_FINT <= type && type <= LUA_FBOOLEAN,
+               "invalid field type");
+  api_check(L, offset <= MAXLAYOUTOFFSET, "field offset too large");
+  layouts = G(L)->layouts;
+  if (layouts == NULL)  /* first layout? */
+    layouts = newlayouts(L);
+  sethvalue(L, &key, mt);
+  if (haslayout(mt) && luaH_get(layouts, &key, &desc) == LUA_VTABLE)
+    layout = hvalue(&desc);
+  else {  /* create the layout */
+    layout = luaH_new(L);
+    sethvalue2s(L, L->top.p, layout);
+    api_incr_top(L);
+    luaH_set(L, layouts, &key, s2v(L->top.p - 1));
+    luaC_barrierback(L, obj2gco(layouts), s2v(L->top.p - 1));
+    setlayout(mt);
+    L->top.p--;
+  }
+  setsvalue2s(L, L->top.p, luaS_new(L, k));
+  api_incr_top(L);
+  setivalue(&desc, layoutdesc(offset, type));
+  luaH_set(L, layout, s2v(L->top.p - 1), &desc);
+  luaC_barrierback(L, obj2gco(layout), s2v(L->top.p - 1));
+  L->top.p--;
+  lua_unlock(L);
+}
+
+
 /*
 ** 'load' and 'call' functions (run Lua code)
 */
@@ -1285,6 +1403,73 @@ LUA_API int lua_next (lua_State *L, int idx) {
 }
 
 
+LUA_API int lua_rawmove (lua_State *L, int idx1, lua_Integer f,
+                         lua_Integer e, lua_Integer t, int idx2) {
+  Table *src, *dst;
+  int res;
+  lua_lock(L);
+  src = gettable(L, idx1);
+  dst = gettable(L, idx2);
+  res = (e < f ||
+         luaH_movearray(L, src, l_castS2U(f), l_castS2U(e) - l_castS2U(f) + 1,
+                           dst, l_castS2U(t)));
+  lua_unlock(L);
+  return res;
+}
+
+
+LUA_API int lua_rawunpack (lua_State *L, int idx, lua_Integer i,
+                                                  lua_Integer e) {
+  Table *t;
+  int res;
+  lua_lock(L);
+  t = gettable(L, idx);
+  if (e < i)
+    res = 1;  /* nothing to push */
+  else {
+    lua_Unsigned n = l_castS2U(e) - l_castS2U(i) + 1;
+    api_check(L, n <= cast(lua_Unsigned, L->ci->top.p - L->top.p),
+                 "not enough stack space");
+    res = luaH_unpackarray(L, t, l_castS2U(i), n);
+  }
+  lua_unlock(L);
+  return res;
+}
+
+
+LUA_API int lua_rawconcat (lua_State *L, int idx, lua_Integer i,
+                           lua_Integer j, const char *sep, size_t lsep) {
+  Table *t;
+  TString *ts = NULL;
+  lua_lock(L);
+  t = gettable(L, idx);
+  if (i <= j)
+    ts = luaH_concatarray(L, t, l_castS2U(i), l_castS2U(j) - l_castS2U(i) + 1,
+                                sep, lsep);
+  if (ts != NULL) {
+    setsvalue2s(L, L->top.p, ts);
+    api_incr_top(L);
+    luaC_checkGC(L);
+  }
+  lua_unlock(L);
+  return (ts != NULL);
+}
+
+
+LUA_API int lua_rawsort (lua_State *L, int idx, lua_Integer n,
+                         int nw, lua_Parallel pf, void *ud) {
+  Table *t;
+  int res;
+  lua_lock(L);
+  t = gettable(L, idx);
+  if (pf == NULL)
+    nw = 1;  /* no parallel sort */
+  res = (n >= 0 && luaH_sortarray(L, t, l_castS2U(n), nw, pf, ud));
+  lua_unlock(L);
+  return res;
+}
+
+
 LUA_API void lua_toclose (lua_State *L, int idx) {
   StkId o;
   lua_lock(L);
@@ -1339,6 +1524,13 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
 }
 
 
+void lua_setnextf (lua_State *L, lua_CFunction f) {
+  lua_lock(L);
+  G(L)->nextf = f;
+  lua_unlock(L);
+}
+
+
 void lua_setwarnf (lua_State *L, lua_WarnFunction f, void *ud) {
   lua_lock(L);
   G(L)->ud_warn = ud;
@@ -540,18 +540,20 @@ static void newbox (lua_State *L) {
 
 
 /*
-** Compute new size for buffer 'B', enough to accommodate extra 'sz'
-** bytes plus one for a terminating zero.
+** Compute new size for a buffer with 'size' bytes, 'n' of them in use,
+** enough to accommodate extra 'sz' bytes plus one for a terminating
+** zero.
 */
-static size_t newbuffsize (luaL_Buffer *B, size_t sz) {
-  size_t newsize = B->size;
-  if (l_unlikely(sz >= MAX_SIZE - B->n))
-    return cast_sizet(luaL_error(B->L, "resulting string too large"));
-  /* else  B->n + sz + 1 <= MAX_SIZE */
+static size_t newbuffsize (lua_State *L, size_t size, size_t n,
+                                         size_t sz) {
+  size_t newsize = size;
+  if (l_unlikely(sz >= MAX_SIZE - n))
+    return cast_sizet(luaL_error(L, "resulting string too large"));
+  /* else  n + sz + 1 <= MAX_SIZE */
   if (newsize <= MAX_SIZE/3 * 2)  /* no overflow? */
     newsize += (newsize >> 1);  /* new size *= 1.5 */
-  if (newsize < B->n + sz + 1)  /* not big enough? */
-    newsize = B->n + sz + 1;
+  if (newsize < n + sz + 1)  /* not big enough? */
+    newsize = n + sz + 1;
   return newsize;
 }
 
@@ -568,7 +570,7 @@ static char *prepbuffsize (luaL_Buffer *B, size_t sz, int boxidx) {
   else {
     lua_State *L = B->L;
     char *newbuff;
-    size_t newsize = newbuffsize(B, sz);
+    size_t newsize = newbuffsize(L, B->size, B->n, sz);
     /* create larger buffer */
     if (buffonstack(B))  /* buffer already has a box? */
       newbuff = (char *)resizebox(L, boxidx, newsize);  /* resize it */
@@ -675,6 +677,49 @@ LUALIB_API char *luaL_buffinitsize (lua_State *L, luaL_Buffer *B, size_t sz) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** String buffers
+** =======================================================
+*/
+
+/*
+** Returns a pointer to a free area with at least 'sz' bytes at the end
+** of the contents of 'sb'. Bytes removed from the beginning of the
+** contents are reclaimed, by moving the contents, only when they are
+** at least as many as the bytes still in use, so that moves cost
+** amortized constant time per byte. Otherwise, the block grows like
+** the blocks of a 'luaL_Buffer'.
+*/
+LUALIB_API char *luaL_prepstrbuf (lua_State *L, luaL_StrBuf *sb,
+                                  size_t sz) {
+  size_t len = luaL_strbuflen(sb);
+  if (sb->size - sb->n >= sz)  /* enough space? */
+    return sb->b + sb->n;
+  else if (sb->r >= len && sb->size - len >= sz) {  /* space after move? */
+    memmove(sb->b, sb->b + sb->r, len * sizeof(char));
+    sb->r = 0;
+    sb->n = len;
+    return sb->b + len;
+  }
+  else {
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    size_t newsize = newbuffsize(L, sb->size, sb->n, sz);
+    char *newb = (char *)allocf(ud, sb->b, sb->size, newsize);
+    if (l_unlikely(newb == NULL)) {  /* allocation error? */
+      lua_pushliteral(L, "not enough memory");
+      lua_error(L);  /* raise a memory error */
+    }
+    sb->b = newb;
+    sb->size = newsize;
+    return newb + sb->n;
+  }
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Reference system
@@ -979,6 +1024,16 @@ LUALIB_API void luaL_setfuncs (lua_State *L, const luaL_Reg *l, int nup) {
 }
 
 
+/*
+** add fields from list 'l' to the layout of the userdata metatable
+** at the top of the stack
+*/
+LUALIB_API void luaL_setlayout (lua_State *L, const luaL_Field *l) {
+  for (; l->name != NULL; l++)
+    lua_layoutfield(L, -1, l->name, l->offset, l->type);
+}
+
+
 /*
 ** ensure that stack[idx][fname] has a table and push that table
 ** into the stack
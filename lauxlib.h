@@ -41,6 +41,13 @@ typedef struct luaL_Reg {
 } luaL_Reg;
 
 
+typedef struct luaL_Field {
+  const char *name;
+  size_t offset;
+  int type;
+} luaL_Field;
+
+
 #define LUAL_NUMSIZES	(sizeof(lua_Integer)*16 + sizeof(lua_Number))
 
 LUALIB_API void (luaL_checkversion_) (lua_State *L, lua_Number ver, size_t sz);
@@ -114,6 +121,8 @@ LUALIB_API const char *(luaL_gsub) (lua_State *L, const char *s,
 
 LUALIB_API void (luaL_setfuncs) (lua_State *L, const luaL_Reg *l, int nup);
 
+LUALIB_API void (luaL_setlayout) (lua_State *L, const luaL_Field *l);
+
 LUALIB_API int (luaL_getsubtable) (lua_State *L, int idx, const char *fname);
 
 LUALIB_API void (luaL_traceback) (lua_State *L, lua_State *L1,
@@ -244,6 +253,42 @@ typedef struct luaL_Stream {
 /* }====================================================== */
 
 
+
+/*
+** {======================================================
+** String buffers
+** =======================================================
+*/
+
+/*
+** A string buffer is a userdata with metatable 'LUA_STRBUFHANDLE' and
+** structure 'luaL_StrBuf'. Its contents are the bytes from 'b + r' to
+** 'b + n'. The block 'b', with 'size' bytes, is allocated with the
+** allocation function of the state (and it is NULL when 'size' is 0).
+*/
+
+#define LUA_STRBUFHANDLE	"string buffer"
+
+
+typedef struct luaL_StrBuf {
+  char *b;  /* block with the contents */
+  size_t size;  /* size of the block */
+  size_t r;  /* start of the contents */
+  size_t n;  /* end of the contents */
+} luaL_StrBuf;
+
+
+#define luaL_strbufaddr(sb)	((sb)->b + (sb)->r)
+#define luaL_strbuflen(sb)	((sb)->n - (sb)->r)
+
+#define luaL_strbufaddsize(sb,s)	((sb)->n += (s))
+
+LUALIB_API char *(luaL_prepstrbuf) (lua_State *L, luaL_StrBuf *sb,
+                                    size_t sz);
+
+/* }====================================================== */
+
+
 /*
 ** {============================================================
 ** Compatibility with deprecated conversions
@@ -551,6 +551,8 @@ LUAMOD_API int luaopen_base (lua_State *L) {
   /* set global _G */
   lua_pushvalue(L, -1);
   lua_setfield(L, -2, LUA_GNAME);
+  /* let generic 'for' loops over 'next' run without calling it */
+  lua_setnextf(L, luaB_next);
   /* set global _VERSION */
   lua_pushliteral(L, LUA_VERSION);
   lua_setfield(L, -2, "_VERSION");
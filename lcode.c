@@ -31,10 +31,6 @@
 #include "lvm.h"
 
 
-/* (note that expressions VJMP also have jumps.) */
-#define hasjumps(e)	((e)->t != (e)->f)
-
-
 static int codesJ (FuncState *fs, OpCode o, int sj, int k);
 
 
@@ -812,6 +808,37 @@ void luaK_vapar2local (FuncState *fs, expdesc *var) {
 }
 
 
+/*
+** Global caches: when the option is on, the lookup of a global
+** variable (a field of an upvalue '_ENV') is preceded by an
+** OP_GETCACHE, which skips it when its result is already known.
+** ('upv' is the index of the upvalue with the table.)
+*/
+static void opencache (FuncState *fs, int upv) {
+  if ((fs->ls->opts & LUAY_OPTGCACHE) && fs->ncache <= MAXARG_C &&
+      fs->f->upvalues[upv].name == fs->ls->envn)
+    fs->lastcache = luaK_codeABC(fs, OP_GETCACHE, 0, 1, fs->ncache++);
+}
+
+
+/*
+** A field access over the result of a cached lookup (which must be
+** the previous instruction) is added to that lookup. ('t' is the
+** register with the table; it must be a temporary, as the lookup
+** is skipped when the cache is valid.)
+*/
+static void extendcache (FuncState *fs, int t) {
+  if (fs->lastcache != NO_JUMP) {
+    Instruction *gc = &fs->f->code[fs->lastcache];
+    int n = GETARG_B(*gc);  /* lookups already covered */
+    if (fs->lastcache + n == fs->pc - 1 &&  /* last one just coded? */
+        GETARG_A(fs->f->code[fs->pc - 1]) == t &&  /* with result in 't'? */
+        t >= luaY_nvarstack(fs) && n < MAXARG_B)
+      SETARG_B(*gc, n + 1);  /* next instruction is part of the lookup */
+  }
+}
+
+
 /*
 ** Ensure that expression 'e' is not a variable (nor a <const>).
 ** (Expression still may have jump lists.)
@@ -837,6 +864,7 @@ void luaK_dischargevars (FuncState *fs, expdesc *e) {
       break;
     }
     case VINDEXUP: {
+      opencache(fs, e->u.ind.t);
       e->u.info = luaK_codeABC(fs, OP_GETTABUP, 0, e->u.ind.t, e->u.ind.idx);
       e->k = VRELOC;
       break;
@@ -849,6 +877,7 @@ void luaK_dischargevars (FuncState *fs, expdesc *e) {
     }
     case VINDEXSTR: {
       freereg(fs, e->u.ind.t);
+      extendcache(fs, e->u.ind.t);
       e->u.info = luaK_codeABC(fs, OP_GETFIELD, 0, e->u.ind.t, e->u.ind.idx);
       e->k = VRELOC;
       break;
@@ -874,6 +903,58 @@ void luaK_dischargevars (FuncState *fs, expdesc *e) {
 }
 
 
+/*
+** Try to change the last instruction coded, which put a value in
+** register 'from', so that it puts that value directly in register
+** 'reg', avoiding a move. That instruction may be followed by an
+** OP_EXTRAARG (table constructors) or by an OP_MMBIN* (the result of
+** a metamethod also goes to the register in the previous instruction).
+** There cannot be a jump to a position after that instruction, as a
+** path through that jump would skip it.
+** Instructions that can run a collection step (OP_NEWTABLE and
+** OP_CLOSURE) assume that everything above their destination register
+** is dead, so they can be changed only when 'reg' is right below
+** 'from'.
+*/
+static int retarget (FuncState *fs, int from, int reg) {
+  int pc = fs->pc - 1;
+  Instruction *i;
+  if (pc <= fs->lasttarget)
+    return 0;  /* jump to the last instruction (or there is none) */
+  i = &fs->f->code[pc];
+  if (GET_OPCODE(*i) == OP_EXTRAARG || testMMMode(GET_OPCODE(*i))) {
+    pc--;  /* check the previous instruction */
+    i--;
+  }
+  if (GETARG_A(*i) != from)
+    return 0;
+  switch (GET_OPCODE(*i)) {
+    case OP_NEWTABLE:
+      if (pc != fs->pc - 2 || reg + 1 != from) return 0;
+      break;
+    case OP_CLOSURE:
+      if (pc != fs->pc - 1 || reg + 1 != from) return 0;
+      break;
+    case OP_ADDI: case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK:
+    case OP_POWK: case OP_DIVK: case OP_IDIVK: case OP_BANDK: case OP_BORK:
+    case OP_BXORK: case OP_SHLI: case OP_SHRI: case OP_ADD: case OP_SUB:
+    case OP_MUL: case OP_MOD: case OP_POW: case OP_DIV: case OP_IDIV:
+    case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
+      if (pc != fs->pc - 2) return 0;  /* must be followed by MMBIN */
+      break;
+    case OP_MOVE: case OP_LOADI: case OP_LOADF: case OP_LOADK:
+    case OP_LOADFALSE: case OP_LOADTRUE: case OP_GETUPVAL:
+    case OP_GETTABUP: case OP_GETTABLE: case OP_GETI: case OP_GETFIELD:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+      if (pc != fs->pc - 1) return 0;  /* must be the last instruction */
+      break;
+    default: return 0;
+  }
+  SETARG_A(*i, reg);
+  return 1;
+}
+
+
 /*
 ** Ensure expression value is in register 'reg', making 'e' a
 ** non-relocatable expression.
@@ -915,7 +996,9 @@ static void discharge2reg (FuncState *fs, expdesc *e, int reg) {
       break;
     }
     case VNONRELOC: {
-      if (reg != e->u.info)
+      if (reg != e->u.info &&  /* value in another register? */
+          !(e->u.info == fs->freereg &&  /* in a free temporary and */
+            retarget(fs, e->u.info, reg)))  /* could not code it in 'reg'? */
         luaK_codeABC(fs, OP_MOVE, reg, e->u.info, 0);
       break;
     }
@@ -1969,3 +2052,325 @@ void luaK_finish (FuncState *fs) {
     }
   }
 }
+
+
+/*
+** {======================================================================
+** Inlining of calls to small local functions
+** =======================================================================
+*/
+
+/* maximum size (in instructions) of a function to be inlined */
+#define MAXINLINE	32
+
+
+/*
+** Check whether some instruction of function 'p' can go to position
+** 'pc' other than by falling through.
+*/
+static int isjumptarget (const Proto *p, int pc) {
+  const Instruction *code = p->code;
+  int i;
+  for (i = 0; i < p->sizecode; i++) {
+    Instruction ins = code[i];
+    switch (GET_OPCODE(ins)) {
+      case OP_JMP:
+        if (i + 1 + GETARG_sJ(ins) == pc) return 1;
+        break;
+      case OP_FORPREP:  /* skips the loop */
+        if (i + 2 + GETARG_Bx(ins) == pc) return 1;
+        break;
+      case OP_FORLOOP:  /* goes back to the loop body */
+        if (i + 1 - GETARG_Bx(ins) == pc) return 1;
+        break;
+      case OP_LFALSESKIP:  /* skips the next instruction */
+        if (i + 2 == pc) return 1;
+        break;
+      default:
+        if (testTMode(GET_OPCODE(ins)) && i + 2 == pc)
+          return 1;  /* a test can skip its jump */
+        break;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Check whether the instruction at position 'pc' of function 'p' can
+** be reached, either by falling through the previous instruction or
+** by a jump.
+*/
+static int isreachable (const Proto *p, int pc) {
+  if (pc == 0)
+    return 1;  /* function entry */
+  else {
+    OpCode op = GET_OPCODE(p->code[pc - 1]);
+    if (op != OP_JMP && op != OP_RETURN1)
+      return 1;  /* previous instruction can fall through */
+    return isjumptarget(p, pc);
+  }
+}
+
+
+/*
+** Check whether the value returned by the final OP_RETURN1 of function
+** 'p', at position 'pc', is computed by the instruction(s) right
+** before it, with no jumps into or after them; in that case, 'retarget'
+** can send that value directly to its final place.
+*/
+static int isplainreturn (const Proto *p, int pc) {
+  int i = pc - 1;  /* instruction that computes the value */
+  if (i >= 0 && (GET_OPCODE(p->code[i]) == OP_EXTRAARG ||
+                 testMMMode(GET_OPCODE(p->code[i]))))
+    i--;  /* value computed by the previous instruction */
+  if (i < 0)
+    return 0;  /* value computed before the body */
+  for (i++; i <= pc; i++) {
+    if (isjumptarget(p, i))
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** Check whether function 'p' can be inlined. It must be small, cannot
+** be vararg, cannot create closures (so it has no upvalues to close),
+** and must return exactly one value on all paths, through OP_RETURN1.
+** (The final OP_RETURN0 added by the parser must be dead code.) This
+** last restriction ensures that an inlined call always produces one
+** value, whatever the number of results the caller asks. Generic
+** 'for' loops, tail calls, and long constant indices (OP_LOADKX) are
+** not handled.
+*/
+static int caninline (const Proto *p) {
+  int i;
+  int last = p->sizecode - 1;  /* final return */
+  if (p->sizecode > MAXINLINE || isvararg(p) || p->sizep > 0 ||
+      p->sizek > MAXINDEXRK + 1)
+    return 0;
+  for (i = 0; i < last; i++) {
+    switch (GET_OPCODE(p->code[i])) {
+      case OP_LOADKX: case OP_CLOSE: case OP_TBC: case OP_TAILCALL:
+      case OP_RETURN: case OP_RETURN0: case OP_TFORPREP: case OP_TFORCALL:
+      case OP_TFORLOOP: case OP_CLOSURE: case OP_VARARG: case OP_GETVARG:
+      case OP_ERRNNIL: case OP_VARARGPREP: case OP_GETCACHE:
+        return 0;
+      default: break;
+    }
+  }
+  return (GET_OPCODE(p->code[last]) == OP_RETURN0 && !isreachable(p, last));
+}
+
+
+/*
+** Add constant 'v' (from another prototype) to the list of constants
+** and return its index.
+*/
+static int constK (FuncState *fs, const TValue *v) {
+  switch (ttypetag(v)) {
+    case LUA_VNUMINT: return luaK_intK(fs, ivalue(v));
+    case LUA_VNUMFLT: return luaK_numberK(fs, fltvalue(v));
+    case LUA_VFALSE: return boolF(fs);
+    case LUA_VTRUE: return boolT(fs);
+    case LUA_VNIL: return nilK(fs);
+    default: {
+      lua_assert(ttisstring(v));
+      return stringK(fs, tsvalue(v));
+    }
+  }
+}
+
+
+/*
+** Translate instruction 'ins' from an inlined function to the caller:
+** registers are shifted by 'off', constants are remapped through
+** 'kmap', and upvalues of the inlined function become either registers
+** (for locals of the caller) or upvalues of the caller.
+*/
+static Instruction inlineins (const Proto *p, Instruction ins, int off,
+                              const int *kmap) {
+  OpCode op = GET_OPCODE(ins);
+  int a = GETARG_A(ins);
+  switch (op) {
+    case OP_GETUPVAL: case OP_GETTABUP: {
+      const Upvaldesc *up = &p->upvalues[GETARG_B(ins)];
+      if (op == OP_GETUPVAL)
+        return (up->instack)
+               ? CREATE_ABCk(OP_MOVE, a + off, up->idx, 0, 0)
+               : CREATE_ABCk(OP_GETUPVAL, a + off, up->idx, 0, 0);
+      else
+        return CREATE_ABCk(up->instack ? OP_GETFIELD : OP_GETTABUP,
+                           a + off, up->idx, kmap[GETARG_C(ins)], 0);
+    }
+    case OP_SETUPVAL: {
+      const Upvaldesc *up = &p->upvalues[GETARG_B(ins)];
+      return (up->instack)
+             ? CREATE_ABCk(OP_MOVE, up->idx, a + off, 0, 0)
+             : CREATE_ABCk(OP_SETUPVAL, a + off, up->idx, 0, 0);
+    }
+    case OP_SETTABUP: {
+      const Upvaldesc *up = &p->upvalues[a];
+      int k = GETARG_k(ins);
+      int c = (k) ? kmap[GETARG_C(ins)] : GETARG_C(ins) + off;
+      return CREATE_ABCk(up->instack ? OP_SETFIELD : OP_SETTABUP,
+                         up->idx, kmap[GETARG_B(ins)], c, k);
+    }
+    case OP_EXTRAARG:
+      return ins;  /* no registers */
+    default:
+      break;
+  }
+  SETARG_A(ins, a + off);  /* all other opcodes have a register in A */
+  switch (op) {
+    case OP_LOADK:
+      SETARG_Bx(ins, kmap[GETARG_Bx(ins)]);
+      break;
+    case OP_GETTABLE: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+    case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR:
+    case OP_BXOR: case OP_SHL: case OP_SHR:  /* R[B] and R[C] */
+      SETARG_C(ins, GETARG_C(ins) + off);
+    /* FALLTHROUGH */
+    case OP_MOVE: case OP_GETI: case OP_ADDI: case OP_SHLI: case OP_SHRI:
+    case OP_MMBIN: case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+    case OP_EQ: case OP_LT: case OP_LE: case OP_TESTSET:  /* R[B] */
+      SETARG_B(ins, GETARG_B(ins) + off);
+      break;
+    case OP_GETFIELD: case OP_SELF: case OP_ADDK: case OP_SUBK:
+    case OP_MULK: case OP_MODK: case OP_POWK: case OP_DIVK: case OP_IDIVK:
+    case OP_BANDK: case OP_BORK: case OP_BXORK:  /* R[B] and K[C] */
+      SETARG_B(ins, GETARG_B(ins) + off);
+      SETARG_C(ins, kmap[GETARG_C(ins)]);
+      break;
+    case OP_EQK: case OP_MMBINK:  /* K[B] */
+      SETARG_B(ins, kmap[GETARG_B(ins)]);
+      break;
+    case OP_SETTABLE: case OP_SETI: case OP_SETFIELD: {  /* RK(C) */
+      if (op == OP_SETTABLE)
+        SETARG_B(ins, GETARG_B(ins) + off);
+      else if (op == OP_SETFIELD)
+        SETARG_B(ins, kmap[GETARG_B(ins)]);
+      if (GETARG_k(ins))
+        SETARG_C(ins, kmap[GETARG_C(ins)]);
+      else
+        SETARG_C(ins, GETARG_C(ins) + off);
+      break;
+    }
+    default: break;  /* only register A */
+  }
+  return ins;
+}
+
+
+/*
+** Register the code in [startpc, fs->pc) as an inlined call to 'p'.
+** ('p' cannot have inlined calls itself, as it has no nested
+** functions.)
+*/
+static void saveinline (FuncState *fs, const Proto *p, int startpc,
+                        int freg, int callline) {
+  Proto *f = fs->f;
+  InlineInfo *inl;
+  int np = 0;
+  while (f->p[np] != p)  /* find index of 'p' */
+    np++;
+  lua_assert(np < fs->np && p->sizeinlineinfo == 0);
+  luaM_growvector(fs->ls->L, f->inlineinfo, fs->ninlineinfo,
+                  f->sizeinlineinfo, InlineInfo, INT_MAX, "inlined calls");
+  inl = &f->inlineinfo[fs->ninlineinfo++];
+  inl->startpc = startpc;
+  inl->endpc = fs->pc;
+  inl->line = callline;
+  inl->proto = np;
+  inl->reg = freg;
+}
+
+
+/*
+** Try to inline a call to function 'p', whose arguments are in
+** the 'nargs' registers after 'base'. The body of 'p' is copied with
+** its registers starting at 'base + 1' (where a call would put its
+** frame) and its result goes to 'base'. Each instruction keeps
+** the line of the original one, so that errors inside the inlined
+** code point to the function body. The copied code is registered in
+** the caller's 'inlineinfo' (with the closure register 'freg' and the
+** line 'callline' of the call), so that debug functions can still show the call as a
+** frame. Returns false (and codes nothing) if 'p' cannot be inlined.
+** (As in 'luaK_exp2K', constants of 'p' added to the caller may end up
+** unused, if their new indices do not fit in an R/K operand.)
+*/
+int luaK_inline (FuncState *fs, const Proto *p, int base, int nargs,
+                 int freg, int callline) {
+  int newpc[MAXINLINE];  /* new position of each instruction */
+  int kmap[MAXINDEXRK + 1];  /* new index of each constant */
+  int off = base + 1;  /* register for first parameter */
+  int n = p->sizecode - 1;  /* instructions to copy (final one is dead) */
+  int exits = NO_JUMP;  /* list of jumps from returns to the end */
+  int i, pc, startpc;
+  if (off + p->maxstacksize > MAX_FSTACK || !caninline(p))
+    return 0;
+  for (i = 0; i < p->sizek; i++) {
+    kmap[i] = constK(fs, &p->k[i]);
+    if (kmap[i] > MAXINDEXRK)  /* does not fit in an R/K operand? */
+      return 0;
+  }
+  luaK_checkstack(fs, off + p->maxstacksize - fs->freereg);
+  if (nargs < p->numparams)  /* missing arguments? */
+    luaK_nil(fs, off + nargs, p->numparams - nargs);
+  pc = startpc = fs->pc;
+  for (i = 0; i < n; i++) {  /* compute new positions */
+    newpc[i] = pc;
+    /* a return needs a jump to the end, unless it is the last one */
+    pc += (GET_OPCODE(p->code[i]) == OP_RETURN1 && i < n - 1) ? 2 : 1;
+  }
+  for (i = 0; i < n; i++) {
+    Instruction ins = p->code[i];
+    int line = luaG_getfuncline(p, i);
+    lua_assert(fs->pc == newpc[i]);
+    switch (GET_OPCODE(ins)) {
+      case OP_RETURN1: {  /* move result to its place and go to the end */
+        if (i == n - 1 && isplainreturn(p, i) &&
+            retarget(fs, GETARG_A(ins) + off, base))
+          continue;  /* result already computed in its place */
+        luaK_codeABC(fs, OP_MOVE, base, GETARG_A(ins) + off, 0);
+        luaK_fixline(fs, line);
+        if (i < n - 1) {
+          luaK_concat(fs, &exits, luaK_jump(fs));
+          luaK_fixline(fs, line);
+        }
+        continue;
+      }
+      case OP_JMP: {
+        int target = i + 1 + GETARG_sJ(ins);
+        ins = CREATE_sJ(OP_JMP, newpc[target] - (newpc[i] + 1) + OFFSET_sJ,
+                                GETARG_k(ins));
+        break;
+      }
+      case OP_FORPREP: {
+        int target = i + 1 + GETARG_Bx(ins);  /* its OP_FORLOOP */
+        ins = inlineins(p, ins, off, kmap);
+        SETARG_Bx(ins, newpc[target] - newpc[i] - 1);
+        break;
+      }
+      case OP_FORLOOP: {
+        int target = i + 1 - GETARG_Bx(ins);  /* start of loop body */
+        ins = inlineins(p, ins, off, kmap);
+        SETARG_Bx(ins, newpc[i] + 1 - newpc[target]);
+        break;
+      }
+      default: {
+        ins = inlineins(p, ins, off, kmap);
+        break;
+      }
+    }
+    luaK_code(fs, ins);
+    luaK_fixline(fs, line);
+  }
+  luaK_patchtohere(fs, exits);  /* also avoids optimizations across end */
+  if (fs->pc > startpc)  /* some code copied? */
+    saveinline(fs, p, startpc, freg, callline);
+  return 1;
+}
+
+/* }====================================================================== */
@@ -54,6 +54,9 @@ typedef enum UnOpr { OPR_MINUS, OPR_BNOT, OPR_NOT, OPR_LEN, OPR_NOUNOPR } UnOpr;
 /* get (pointer to) instruction of given 'expdesc' */
 #define getinstruction(fs,e)	((fs)->f->code[(e)->u.info])
 
+/* (note that expressions VJMP also have jumps.) */
+#define hasjumps(e)	((e)->t != (e)->f)
+
 
 #define luaK_setmultret(fs,e)	luaK_setreturns(fs, e, LUA_MULTRET)
 
@@ -99,6 +102,8 @@ LUAI_FUNC void luaK_settablesize (FuncState *fs, int pc,
                                   int ra, int asize, int hsize);
 LUAI_FUNC void luaK_setlist (FuncState *fs, int base, int nelems, int tostore);
 LUAI_FUNC void luaK_finish (FuncState *fs);
+LUAI_FUNC int luaK_inline (FuncState *fs, const Proto *p, int base, int nargs,
+                           int freg, int callline);
 LUAI_FUNC l_noret luaK_semerror (LexState *ls, const char *fmt, ...);
 
 
@@ -102,6 +102,47 @@ static int getcurrentline (CallInfo *ci) {
 }
 
 
+/*
+** Get the inlined call (see 'luaK_inline') whose code contains
+** instruction 'pc', or NULL if there is none. Inlined calls are sorted
+** by position and do not overlap.
+*/
+static const InlineInfo *getinline (const Proto *p, int pc) {
+  int lo = 0;
+  int hi = p->sizeinlineinfo;
+  while (lo < hi) {  /* find first call starting after 'pc' */
+    int m = (lo + hi) / 2;
+    if (p->inlineinfo[m].startpc <= pc)
+      lo = m + 1;
+    else
+      hi = m;
+  }
+  if (lo > 0 && pc < p->inlineinfo[lo - 1].endpc)
+    return &p->inlineinfo[lo - 1];
+  else
+    return NULL;
+}
+
+
+/*
+** If the Lua function in 'ci' is running an inlined call, return the
+** index (plus one) of that call in its 'inlineinfo'; otherwise return
+** zero. Debug functions show such a call as an extra (virtual) level
+** above 'ci'.
+*/
+int luaG_inlinedcall (CallInfo *ci) {
+  if (isLua(ci)) {
+    const Proto *p = ci_func(ci)->p;
+    if (p->sizeinlineinfo > 0) {
+      const InlineInfo *inl = getinline(p, currentpc(ci));
+      if (inl != NULL)
+        return cast_int(inl - p->inlineinfo) + 1;
+    }
+  }
+  return 0;
+}
+
+
 /*
 ** Set 'trap' for all active Lua frames.
 ** This function can be called during a signal, under "reasonable"
@@ -159,18 +200,30 @@ LUA_API int lua_gethookcount (lua_State *L) {
 }
 
 
+/*
+** A frame running an inlined call counts as two levels: the inlined
+** call (with 'i_inl' set) and the frame itself.
+*/
 LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar) {
-  int status;
+  int status = 0;  /* no such level (yet) */
   CallInfo *ci;
   if (level < 0) return 0;  /* invalid (negative) level */
   lua_lock(L);
-  for (ci = L->ci; level > 0 && ci != &L->base_ci; ci = ci->previous)
-    level--;
-  if (level == 0 && ci != &L->base_ci) {  /* level found? */
-    status = 1;
-    ar->i_ci = ci;
+  for (ci = L->ci; ci != &L->base_ci; ci = ci->previous) {
+    int inl = luaG_inlinedcall(ci);
+    if (inl != 0 && level-- == 0) {  /* level is the inlined call? */
+      status = 1;
+      ar->i_ci = ci;
+      ar->i_inl = inl;
+      break;
+    }
+    if (level-- == 0) {  /* level is the frame itself? */
+      status = 1;
+      ar->i_ci = ci;
+      ar->i_inl = 0;
+      break;
+    }
   }
-  else status = 0;  /* no such level */
   lua_unlock(L);
   return status;
 }
@@ -228,6 +281,8 @@ LUA_API const char *lua_getlocal (lua_State *L, const lua_Debug *ar, int n) {
     else  /* consider live variables at function start (parameters) */
       name = luaF_getlocalname(clLvalue(s2v(L->top.p - 1))->p, n, 0);
   }
+  else if (ar->i_inl != 0)  /* inlined call? */
+    name = NULL;  /* its locals are not accessible */
   else {  /* active function; get information through 'ar' */
     StkId pos = NULL;  /* to avoid warnings */
     name = luaG_findlocal(L, ar->i_ci, n, &pos);
@@ -245,7 +300,10 @@ LUA_API const char *lua_setlocal (lua_State *L, const lua_Debug *ar, int n) {
   StkId pos = NULL;  /* to avoid warnings */
   const char *name;
   lua_lock(L);
-  name = luaG_findlocal(L, ar->i_ci, n, &pos);
+  if (ar->i_inl != 0)  /* inlined call? */
+    name = NULL;  /* its locals are not accessible */
+  else
+    name = luaG_findlocal(L, ar->i_ci, n, &pos);
   if (name) {
     api_checkpop(L, 1);
     setobjs2s(L, pos, L->top.p - 1);
@@ -328,8 +386,38 @@ static const char *getfuncname (lua_State *L, CallInfo *ci, const char **name) {
 }
 
 
+/*
+** Current line of the Lua function in 'ci'. When it is running an
+** inlined call (and it is not the level 'inl' of that call), its
+** current line is the line of the call.
+*/
+static int frameline (CallInfo *ci, const InlineInfo *inl) {
+  if (inl == NULL) {
+    inl = getinline(ci_func(ci)->p, currentpc(ci));
+    if (inl != NULL)  /* running an inlined call? */
+      return inl->line;
+  }
+  return getcurrentline(ci);
+}
+
+
+/*
+** The name of an inlined call is the name of the local variable that
+** holds its function.
+*/
+static const char *inlinename (CallInfo *ci, const InlineInfo *inl,
+                               const char **name) {
+  *name = luaF_getlocalname(ci_func(ci)->p, inl->reg + 1, inl->startpc);
+  return (*name != NULL) ? "local" : NULL;
+}
+
+
+/*
+** Fill 'ar' with the information about closure 'f' running in 'ci'.
+** 'inl' is not NULL when 'f' is an inlined call running in 'ci'.
+*/
 static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
-                       Closure *f, CallInfo *ci) {
+                       Closure *f, CallInfo *ci, const InlineInfo *inl) {
   int status = 1;
   for (; *what; what++) {
     switch (*what) {
@@ -338,7 +426,7 @@ static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
         break;
       }
       case 'l': {
-        ar->currentline = (ci && isLua(ci)) ? getcurrentline(ci) : -1;
+        ar->currentline = (ci && isLua(ci)) ? frameline(ci, inl) : -1;
         break;
       }
       case 'u': {
@@ -354,7 +442,7 @@ static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
         break;
       }
       case 't': {
-        if (ci != NULL) {
+        if (ci != NULL && inl == NULL) {
           ar->istailcall = !!(ci->callstatus & CIST_TAIL);
           ar->extraargs =
                    cast_uchar((ci->callstatus & MAX_CCMT) >> CIST_CCMT);
@@ -366,7 +454,10 @@ static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
         break;
       }
       case 'n': {
-        ar->namewhat = getfuncname(L, ci, &ar->name);
+        if (inl != NULL)
+          ar->namewhat = inlinename(ci, inl, &ar->name);
+        else
+          ar->namewhat = getfuncname(L, ci, &ar->name);
         if (ar->namewhat == NULL) {
           ar->namewhat = "";  /* not found */
           ar->name = NULL;
@@ -374,7 +465,7 @@ static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
         break;
       }
       case 'r': {
-        if (ci == NULL || !(ci->callstatus & CIST_HOOKED))
+        if (ci == NULL || inl != NULL || !(ci->callstatus & CIST_HOOKED))
           ar->ftransfer = ar->ntransfer = 0;
         else {
           ar->ftransfer = L->transferinfo.ftransfer;
@@ -396,6 +487,7 @@ LUA_API int lua_getinfo (lua_State *L, const char *what, lua_Debug *ar) {
   int status;
   Closure *cl;
   CallInfo *ci;
+  const InlineInfo *inl = NULL;
   TValue *func;
   lua_lock(L);
   if (*what == '>') {
@@ -407,11 +499,16 @@ LUA_API int lua_getinfo (lua_State *L, const char *what, lua_Debug *ar) {
   }
   else {
     ci = ar->i_ci;
-    func = s2v(ci->func.p);
+    if (ar->i_inl == 0)
+      func = s2v(ci->func.p);
+    else {  /* inlined call; its function is in a local variable */
+      inl = &ci_func(ci)->p->inlineinfo[ar->i_inl - 1];
+      func = s2v(ci->func.p + 1 + inl->reg);
+    }
     lua_assert(ttisfunction(func));
   }
   cl = ttisclosure(func) ? clvalue(func) : NULL;
-  status = auxgetinfo(L, what, ar, cl, ci);
+  status = auxgetinfo(L, what, ar, cl, ci, inl);
   if (strchr(what, 'f')) {
     setobj2s(L, L->top.p, func);
     api_incr_top(L);
@@ -921,6 +1018,30 @@ int luaG_tracecall (lua_State *L) {
 }
 
 
+/*
+** Call the hooks for the inlined calls (see 'luaK_inline') left and
+** entered when going from instruction 'oldpc' to instruction 'npci'.
+** (When entering a new function, 'npci' is zero and 'oldpc' is
+** meaningless.) The return hook runs with the function still at
+** 'oldpc', so that the inlined call is still visible to it.
+*/
+static void traceinline (lua_State *L, CallInfo *ci, int oldpc, int npci) {
+  const Proto *p = ci_func(ci)->p;
+  const InlineInfo *from = (npci == 0) ? NULL : getinline(p, oldpc);
+  const InlineInfo *to = getinline(p, npci);
+  if (from != to) {
+    if (from != NULL && (L->hookmask & LUA_MASKRET)) {
+      const Instruction *pc = ci->u.l.savedpc;
+      ci->u.l.savedpc = p->code + oldpc + 1;
+      luaD_hook(L, LUA_HOOKRET, -1, 0, 0);  /* return from inlined call */
+      ci->u.l.savedpc = pc;
+    }
+    if (to != NULL && (L->hookmask & LUA_MASKCALL))
+      luaD_hook(L, LUA_HOOKCALL, -1, 0, 0);  /* call inlined function */
+  }
+}
+
+
 /*
 ** Traces the execution of a Lua function. Called before the execution
 ** of each opcode, when debug is on. 'L->oldpc' stores the last
@@ -930,6 +1051,8 @@ int luaG_tracecall (lua_State *L) {
 ** a function without setting 'oldpc'. In that case, 'oldpc' may be
 ** invalid; if so, use zero as a valid value. (A wrong but valid 'oldpc'
 ** at most causes an extra call to a line hook.)
+** Call and return hooks also need to trace functions with inlined
+** calls, to see these calls start and end.
 ** This function is not "Protected" when called, so it should correct
 ** 'L->top.p' before calling anything that can run the GC.
 */
@@ -938,7 +1061,9 @@ int luaG_traceexec (lua_State *L, const Instruction *pc) {
   lu_byte mask = cast_byte(L->hookmask);
   const Proto *p = ci_func(ci)->p;
   int counthook;
-  if (!(mask & (LUA_MASKLINE | LUA_MASKCOUNT))) {  /* no hooks? */
+  int inlinehook = (mask & (LUA_MASKCALL | LUA_MASKRET)) &&
+                   p->sizeinlineinfo > 0;
+  if (!(mask & (LUA_MASKLINE | LUA_MASKCOUNT)) && !inlinehook) {
     ci->u.l.trap = 0;  /* don't need to stop again */
     return 0;  /* turn off 'trap' */
   }
@@ -947,7 +1072,7 @@ int luaG_traceexec (lua_State *L, const Instruction *pc) {
   counthook = (mask & LUA_MASKCOUNT) && (--L->hookcount == 0);
   if (counthook)
     resethookcount(L);  /* reset count */
-  else if (!(mask & LUA_MASKLINE))
+  else if (!(mask & LUA_MASKLINE) && !inlinehook)
     return 1;  /* no line hook and count != 0; nothing to be done now */
   if (ci->callstatus & CIST_HOOKYIELD) {  /* hook yielded last time? */
     ci->callstatus &= ~CIST_HOOKYIELD;  /* erase mark */
@@ -955,6 +1080,14 @@ int luaG_traceexec (lua_State *L, const Instruction *pc) {
   }
   if (!luaP_isIT(*(ci->u.l.savedpc - 1)))  /* top not being used? */
     L->top.p = ci->top.p;  /* correct top */
+  if (inlinehook) {
+    /* 'L->oldpc' may be invalid; use zero in this case */
+    int oldpc = (L->oldpc < p->sizecode) ? L->oldpc : 0;
+    int npci = pcRel(pc, p);
+    traceinline(L, ci, oldpc, npci);
+    if (!(mask & LUA_MASKLINE))
+      L->oldpc = npci;  /* keep track of last instruction traced */
+  }
   if (counthook)
     luaD_hook(L, LUA_HOOKCOUNT, -1, 0, 0);  /* call count hook */
   if (mask & LUA_MASKLINE) {
@@ -455,6 +455,7 @@ void luaD_hook (lua_State *L, int event, int line,
     ar.event = event;
     ar.currentline = line;
     ar.i_ci = ci;
+    ar.i_inl = luaG_inlinedcall(ci);
     L->transferinfo.ftransfer = ftransfer;
     L->transferinfo.ntransfer = ntransfer;
     if (isLua(ci) && L->top.p < ci->top.p)
@@ -1128,6 +1129,19 @@ static void checkmode (lua_State *L, const char *mode, const char *x) {
 }
 
 
+/*
+** Translate the optional letters in 'mode' into compiler options.
+*/
+static int compileropts (const char *mode) {
+  int opts = 0;
+  if (strchr(mode, 'i') != NULL)
+    opts |= LUAY_OPTINLINE;
+  if (strchr(mode, 'g') != NULL)
+    opts |= LUAY_OPTGCACHE;
+  return opts;
+}
+
+
 static void f_parser (lua_State *L, void *ud) {
   LClosure *cl;
   struct SParser *p = cast(struct SParser *, ud);
@@ -1143,7 +1157,8 @@ static void f_parser (lua_State *L, void *ud) {
   }
   else {
     checkmode(L, mode, "text");
-    cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
+    cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c,
+                     compileropts(mode));
   }
   lua_assert(cl->nupvalues == cl->p->sizeupvalues);
   luaF_initupvals(L, cl);
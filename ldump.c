@@ -237,6 +237,15 @@ static void dumpDebug (DumpState *D, const Proto *f) {
     dumpAlign(D, sizeof(int));
     dumpVector(D, f->abslineinfo, cast_uint(n));
   }
+  n = (D->strip) ? 0 : f->sizeinlineinfo;
+  dumpInt(D, n);
+  for (i = 0; i < n; i++) {
+    dumpInt(D, f->inlineinfo[i].startpc);
+    dumpInt(D, f->inlineinfo[i].endpc);
+    dumpInt(D, f->inlineinfo[i].line);
+    dumpInt(D, f->inlineinfo[i].proto);
+    dumpInt(D, f->inlineinfo[i].reg);
+  }
   n = (D->strip) ? 0 : f->sizelocvars;
   dumpInt(D, n);
   for (i = 0; i < n; i++) {
@@ -20,6 +20,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 
 
@@ -253,6 +254,8 @@ Proto *luaF_newproto (lua_State *L) {
   f->sizelineinfo = 0;
   f->abslineinfo = NULL;
   f->sizeabslineinfo = 0;
+  f->inlineinfo = NULL;
+  f->sizeinlineinfo = 0;
   f->upvalues = NULL;
   f->sizeupvalues = 0;
   f->numparams = 0;
@@ -260,6 +263,8 @@ Proto *luaF_newproto (lua_State *L) {
   f->maxstacksize = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
+  f->cache = NULL;
+  f->sizecache = 0;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
@@ -267,12 +272,39 @@ Proto *luaF_newproto (lua_State *L) {
 }
 
 
+/*
+** Create the global-cache slots used by the OP_GETCACHE instructions
+** of prototype 'p'. Their number is computed from the code, so that
+** it does not need to be kept in precompiled chunks.
+*/
+void luaF_initcache (lua_State *L, Proto *p) {
+  int i;
+  int n = 0;
+  for (i = 0; i < p->sizecode; i++) {
+    Instruction inst = p->code[i];
+    if (GET_OPCODE(inst) == OP_GETCACHE && GETARG_C(inst) >= n)
+      n = GETARG_C(inst) + 1;
+  }
+  if (n > 0) {
+    p->cache = luaM_newvector(L, n, CacheSlot);
+    p->sizecache = n;
+    for (i = 0; i < n; i++) {
+      setnilvalue(&p->cache[i].v);
+      p->cache[i].env = NULL;  /* slot is empty */
+      p->cache[i].version = 0;
+    }
+  }
+}
+
+
 lu_mem luaF_protosize (Proto *p) {
   lu_mem sz = cast(lu_mem, sizeof(Proto))
             + cast_uint(p->sizep) * sizeof(Proto*)
             + cast_uint(p->sizek) * sizeof(TValue)
             + cast_uint(p->sizelocvars) * sizeof(LocVar)
-            + cast_uint(p->sizeupvalues) * sizeof(Upvaldesc);
+            + cast_uint(p->sizeupvalues) * sizeof(Upvaldesc)
+            + cast_uint(p->sizeinlineinfo) * sizeof(InlineInfo)
+            + cast_uint(p->sizecache) * sizeof(CacheSlot);
   if (!(p->flag & PF_FIXED)) {
     sz += cast_uint(p->sizecode) * sizeof(Instruction);
     sz += cast_uint(p->sizelineinfo) * sizeof(lu_byte);
@@ -292,6 +324,8 @@ void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->k, cast_sizet(f->sizek));
   luaM_freearray(L, f->locvars, cast_sizet(f->sizelocvars));
   luaM_freearray(L, f->upvalues, cast_sizet(f->sizeupvalues));
+  luaM_freearray(L, f->inlineinfo, cast_sizet(f->sizeinlineinfo));
+  luaM_freearray(L, f->cache, cast_sizet(f->sizecache));
   luaM_free(L, f);
 }
 
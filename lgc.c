@@ -148,6 +148,8 @@ static l_mem objsize (GCObject *o) {
     case LUA_VLNGSTR: {
       TString *ts = gco2ts(o);
       res = luaS_sizelngstr(ts->u.lnglen, ts->shrlen);
+      if (ts->shrlen == LSTRAPP)  /* string in a shared block? */
+        res += luaS_sizeappblock(ts);
       break;
     }
     case LUA_VUPVAL: {
@@ -331,19 +333,26 @@ GCObject *luaC_newobj (lua_State *L, lu_byte tt, size_t sz) {
 ** 'twups' list, so they don't go to the gray list; nevertheless, they
 ** are kept gray to avoid barriers, as their values will be revisited
 ** by the thread or by 'remarkupvals'.  Other objects are added to the
-** gray list to be visited (and turned black) later.  Both userdata and
-** upvalues can call this function recursively, but this recursion goes
-** for at most two levels: An upvalue cannot refer to another upvalue
-** (only closures can), and a userdata's metatable must be a table.
+** gray list to be visited (and turned black) later.  Userdata,
+** upvalues, and string views can call this function recursively, but
+** this recursion goes for at most two levels: An upvalue cannot refer
+** to another upvalue (only closures can), a userdata's metatable must
+** be a table, and the parent of a view is never a view.
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
   g->GCmarked += objsize(o);
   switch (o->tt) {
-    case LUA_VSHRSTR:
-    case LUA_VLNGSTR: {
+    case LUA_VSHRSTR: {
       set2black(o);  /* nothing to visit */
       break;
     }
+    case LUA_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      set2black(o);
+      if (ts->shrlen == LSTRVIEW)  /* a view? */
+        markobject(g, getviewparent(ts));  /* keep its contents */
+      break;
+    }
     case LUA_VUPVAL: {
       UpVal *uv = gco2upv(o);
       if (upisopen(uv))
@@ -373,12 +382,13 @@ static void reallymarkobject (global_State *g, GCObject *o) {
 
 
 /*
-** mark metamethods for basic types
+** mark metamethods for basic types (and the table of userdata layouts)
 */
 static void markmt (global_State *g) {
   int i;
   for (i=0; i < LUA_NUMTYPES; i++)
     markobjectN(g, g->mt[i]);
+  markobjectN(g, g->layouts);
 }
 
 
@@ -597,9 +607,11 @@ static int getmode (global_State *g, Table *h) {
   if (mode == NULL || !ttisstring(mode))
     return 0;  /* ignore non-string modes */
   else {
-    const char *smode = getstr(tsvalue(mode));
-    const char *weakkey = strchr(smode, 'k');
-    const char *weakvalue = strchr(smode, 'v');
+    size_t len;
+    /* contents may not end with a '\0' (see 'LSTRAPP' and 'LSTRVIEW') */
+    const char *smode = getlstr(tsvalue(mode), len);
+    const char *weakkey = (const char *)memchr(smode, 'k', len);
+    const char *weakvalue = (const char *)memchr(smode, 'v', len);
     return ((weakkey != NULL) << 1) | (weakvalue != NULL);
   }
 }
@@ -654,7 +666,12 @@ static l_mem traverseproto (global_State *g, Proto *f) {
     markobjectN(g, f->p[i]);
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
-  return 1 + f->sizek + f->sizeupvalues + f->sizep + f->sizelocvars;
+  for (i = 0; i < f->sizecache; i++) {  /* mark cached values */
+    markobjectN(g, f->cache[i].env);
+    markvalue(g, &f->cache[i].v);
+  }
+  return 1 + f->sizek + f->sizeupvalues + f->sizep + f->sizelocvars +
+             f->sizecache;
 }
 
 
@@ -826,6 +843,24 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
 }
 
 
+/*
+** Clear the '__index' cache. Entries that are out of date or that
+** refer to objects about to be collected are emptied, so that later
+** objects allocated at the same addresses cannot match them.
+*/
+static void clearidxcache (global_State *g) {
+  int i;
+  for (i = 0; i < IDXCACHE_N; i++) {
+    IdxCache *c = &g->idxcache[i];
+    if (c->mt != NULL &&
+        (c->version != g->cacheversion ||
+         iswhite(c->mt) || iswhite(c->key) ||
+         (iscollectable(&c->v) && iswhite(gcvalue(&c->v)))))
+      c->mt = NULL;  /* empty entry */
+  }
+}
+
+
 static void freeupval (lua_State *L, UpVal *uv) {
   if (upisopen(uv))
     luaF_unlinkupval(uv);
@@ -873,6 +908,8 @@ static void freeobj (lua_State *L, GCObject *o) {
       TString *ts = gco2ts(o);
       if (ts->shrlen == LSTRMEM)  /* must free external string? */
         (*ts->falloc)(ts->ud, ts->contents, ts->u.lnglen + 1, 0);
+      else if (ts->shrlen == LSTRAPP)  /* string in a shared block? */
+        luaS_freeappstr(L, ts);
       luaM_freemem(L, ts, luaS_sizelngstr(ts->u.lnglen, ts->shrlen));
       break;
     }
@@ -1576,6 +1613,7 @@ static void atomic (lua_State *L) {
   clearbyvalues(g, g->weak, origweak);
   clearbyvalues(g, g->allweak, origall);
   luaS_clearcache(g);
+  clearidxcache(g);
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   lua_assert(g->gray == NULL);
 }
@@ -565,9 +565,126 @@ static int read_chars (lua_State *L, FILE *f, size_t n) {
 }
 
 
+/*
+** {======================================================
+** Reading into string buffers: each function appends what it reads
+** to buffer 'sb' and returns true iff the read succeeded, as the
+** corresponding function above.
+** =======================================================
+*/
+
+static int readbuf_line (lua_State *L, FILE *f, luaL_StrBuf *sb,
+                                                int chop) {
+  size_t total = 0;  /* number of bytes read */
+  int c;
+  do {  /* may need to read several chunks to get whole line */
+    char *buff = luaL_prepstrbuf(L, sb, LUAL_BUFFERSIZE);
+    unsigned i = 0;
+    l_lockfile(f);  /* no memory errors can happen inside the lock */
+    while (i < LUAL_BUFFERSIZE && (c = l_getc(f)) != EOF && c != '\n')
+      buff[i++] = cast_char(c);  /* read up to end of line or buffer limit */
+    l_unlockfile(f);
+    luaL_strbufaddsize(sb, i);
+    total += i;
+  } while (c != EOF && c != '\n');  /* repeat until end of line */
+  if (!chop && c == '\n') {  /* want a newline and have one? */
+    *luaL_prepstrbuf(L, sb, 1) = '\n';  /* add ending newline */
+    luaL_strbufaddsize(sb, 1);
+  }
+  return (c == '\n' || total > 0);
+}
+
+
+static void readbuf_all (lua_State *L, FILE *f, luaL_StrBuf *sb) {
+  size_t nr, sz;
+  do {  /* read file in chunks filling all free space in the buffer */
+    char *p = luaL_prepstrbuf(L, sb, LUAL_BUFFERSIZE);
+    sz = sb->size - sb->n;
+    nr = fread(p, sizeof(char), sz, f);
+    luaL_strbufaddsize(sb, nr);
+  } while (nr == sz);
+}
+
+
+static int readbuf_chars (lua_State *L, FILE *f, luaL_StrBuf *sb,
+                                                 size_t n) {
+  size_t nr;  /* number of chars actually read */
+  if (n == 0) {  /* test end of file */
+    int c = getc(f);
+    ungetc(c, f);  /* no-op when c == EOF */
+    return (c != EOF);
+  }
+  nr = fread(luaL_prepstrbuf(L, sb, n), sizeof(char), n, f);
+  luaL_strbufaddsize(sb, nr);
+  return (nr > 0);  /* true iff read something */
+}
+
+
+/*
+** Read into the buffer at index 'first'; the formats follow it. Each
+** successful format returns the buffer.
+*/
+static int g_readbuf (lua_State *L, FILE *f, luaL_StrBuf *sb,
+                                             int first) {
+  int nargs = lua_gettop(L) - 2;
+  int n, success;
+  clearerr(f);
+  errno = 0;
+  if (nargs == 0) {  /* no formats? */
+    success = readbuf_line(L, f, sb, 1);
+    lua_pushvalue(L, first);
+    n = first + 2;  /* to return 1 result */
+  }
+  else {
+    luaL_checkstack(L, nargs+LUA_MINSTACK, "too many arguments");
+    success = 1;
+    for (n = first + 1; nargs-- && success; n++) {
+      if (lua_type(L, n) == LUA_TNUMBER) {
+        size_t l = (size_t)luaL_checkinteger(L, n);
+        success = readbuf_chars(L, f, sb, l);
+      }
+      else {
+        const char *p = luaL_checkstring(L, n);
+        if (*p == '*') p++;  /* skip optional '*' (for compatibility) */
+        switch (*p) {
+          case 'l':  /* line */
+            success = readbuf_line(L, f, sb, 1);
+            break;
+          case 'L':  /* line with end-of-line */
+            success = readbuf_line(L, f, sb, 0);
+            break;
+          case 'a':  /* file */
+            readbuf_all(L, f, sb);  /* read entire file */
+            success = 1; /* always success */
+            break;
+          default:  /* also 'n' */
+            return luaL_argerror(L, n, "invalid format");
+        }
+      }
+      lua_pushvalue(L, first);  /* result is the buffer */
+    }
+  }
+  if (ferror(f))
+    return luaL_fileresult(L, 0, NULL);
+  if (!success) {
+    lua_pop(L, 1);  /* remove last result */
+    luaL_pushfail(L);  /* push nil instead */
+  }
+  return n - first - 1;
+}
+
+/* }====================================================== */
+
+
 static int g_read (lua_State *L, FILE *f, int first) {
   int nargs = lua_gettop(L) - 1;
   int n, success;
+  if (lua_type(L, first) == LUA_TUSERDATA) {  /* reading into a buffer? */
+    luaL_StrBuf *sb = (luaL_StrBuf *)luaL_testudata(L, first,
+                                                    LUA_STRBUFHANDLE);
+    if (sb != NULL)
+      return g_readbuf(L, f, sb, first);
+  }
   clearerr(f);
   errno = 0;
   if (nargs == 0) {  /* no arguments? */
@@ -673,6 +790,12 @@ static int g_write (lua_State *L, FILE *f, int arg) {
       s = buff;
       len--;
     }
+    else if (lua_type(L, arg) == LUA_TUSERDATA &&
+             luaL_testudata(L, arg, LUA_STRBUFHANDLE) != NULL) {
+      luaL_StrBuf *sb = (luaL_StrBuf *)lua_touserdata(L, arg);
+      s = luaL_strbufaddr(sb);  /* write its contents without copying */
+      len = luaL_strbuflen(sb);
+    }
     else  /* must be a string */
       s = luaL_checklstring(L, arg, &len);
     numbytes = fwrite(s, sizeof(char), len, f);
@@ -36,6 +36,7 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_LOADNIL,
 &&L_OP_GETUPVAL,
 &&L_OP_SETUPVAL,
+&&L_OP_GETCACHE,
 &&L_OP_GETTABUP,
 &&L_OP_GETTABLE,
 &&L_OP_GETI,
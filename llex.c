@@ -72,6 +72,85 @@ static void save (LexState *ls, int c) {
 }
 
 
+/*
+** {======================================================
+** Fast paths: scanning spans of chars directly in the current
+** block of the input stream, instead of one char at a time
+** =======================================================
+*/
+
+/*
+** Set 'l' to the length of the longest prefix of the unread part of
+** the current block whose chars 'c' satisfy 'cond'.
+*/
+#define spanblock(ls,l,cond)  \
+  { const char *p_ = (ls)->z->p; size_t n_ = (ls)->z->n;  \
+    for (l = 0; l < n_; l++) { int c = cast_uchar(p_[l]); if (!(cond)) break; } }
+
+
+/* horizontal spaces */
+#define ishspace(c)	((c) == ' ' || (c) == '\t' || (c) == '\f' || (c) == '\v')
+
+
+/*
+** Return the length of the prefix of the unread part of the current
+** block without any of the chars '\n', '\r', and 'c'. (Uses 'memchr',
+** usually much faster than a loop, and stops at the first newline
+** so that the total work is linear.)
+*/
+static size_t spanline (LexState *ls, int c) {
+  const char *p = ls->z->p;
+  size_t l = ls->z->n;
+  const char *e;
+  if (l == 0)
+    return 0;
+  if ((e = (const char *)memchr(p, '\n', l)) != NULL)
+    l = cast_sizet(e - p);
+  if ((e = (const char *)memchr(p, '\r', l)) != NULL)
+    l = cast_sizet(e - p);
+  if (c != EOZ && (e = (const char *)memchr(p, c, l)) != NULL)
+    l = cast_sizet(e - p);
+  return l;
+}
+
+
+/*
+** Skip the current char plus the next 'l' chars in the current block
+** and read the char after them.
+*/
+static void skipspan (LexState *ls, size_t l) {
+  ZIO *z = ls->z;
+  lua_assert(l <= z->n);
+  z->p += l;
+  z->n -= l;
+  next(ls);
+}
+
+
+/*
+** Save the current char plus the next 'l' chars in the current block
+** and read the char after them.
+*/
+static void savespan (LexState *ls, size_t l) {
+  Mbuffer *b = ls->buff;
+  save(ls, ls->current);
+  if (luaZ_sizebuffer(b) - luaZ_bufflen(b) < l) {
+    size_t newsize = luaZ_sizebuffer(b);  /* get old size */
+    do {
+      if (newsize >= (MAX_SIZE/3 * 2))  /* larger than MAX_SIZE/1.5 ? */
+        lexerror(ls, "lexical element too long", 0);
+      newsize += (newsize >> 1);  /* new size is 1.5 times the old one */
+    } while (newsize - luaZ_bufflen(b) < l);
+    luaZ_resizebuffer(ls->L, b, newsize);
+  }
+  memcpy(b->buffer + luaZ_bufflen(b), ls->z->p, l);
+  luaZ_bufflen(b) += l;
+  skipspan(ls, l);
+}
+
+/* }====================================================== */
+
+
 void luaX_init (lua_State *L) {
   int i;
   TString *e = luaS_newliteral(L, LUA_ENV);  /* create env name */
@@ -252,8 +331,11 @@ static int read_numeral (LexState *ls, SemInfo *seminfo) {
   for (;;) {
     if (check_next2(ls, expo))  /* exponent mark? */
       check_next2(ls, "-+");  /* optional exponent sign */
-    else if (lisxdigit(ls->current) || ls->current == '.')  /* '%x|%.' */
-      save_and_next(ls);
+    else if (lisxdigit(ls->current) || ls->current == '.') {  /* '%x|%.' */
+      size_t l;
+      spanblock(ls, l, lisdigit(c));  /* following decimal digits */
+      savespan(ls, l);
+    }
     else break;
   }
   if (lislalpha(ls->current))  /* is numeral touching a letter? */
@@ -321,9 +403,10 @@ static void read_long_string (LexState *ls, SemInfo *seminfo, size_t sep) {
         if (!seminfo) luaZ_resetbuffer(ls->buff);  /* avoid wasting space */
         break;
       }
-      default: {
-        if (seminfo) save_and_next(ls);
-        else next(ls);
+      default: {  /* handle all chars until next ']' or newline */
+        size_t l = spanline(ls, ']');
+        if (seminfo) savespan(ls, l);
+        else skipspan(ls, l);
       }
     }
   } endloop:
@@ -454,8 +537,11 @@ static void read_string (LexState *ls, int del, SemInfo *seminfo) {
          /* go through */
        no_save: break;
       }
-      default:
-        save_and_next(ls);
+      default: {  /* save all chars until a special one */
+        size_t l;
+        spanblock(ls, l, c != del && c != '\\' && c != '\n' && c != '\r');
+        savespan(ls, l);
+      }
     }
   }
   save_and_next(ls);  /* skip delimiter */
@@ -473,7 +559,9 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         break;
       }
       case ' ': case '\f': case '\t': case '\v': {  /* spaces */
-        next(ls);
+        size_t l;
+        spanblock(ls, l, ishspace(c));
+        skipspan(ls, l);
         break;
       }
       case '-': {  /* '-' or '--' (comment) */
@@ -492,7 +580,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         }
         /* else short comment */
         while (!currIsNewline(ls) && ls->current != EOZ)
-          next(ls);  /* skip until end of line (or end of file) */
+          skipspan(ls, spanline(ls, EOZ));  /* skip until end of line */
         break;
       }
       case '[': {  /* long string or simply '[' */
@@ -561,9 +649,11 @@ static int llex (LexState *ls, SemInfo *seminfo) {
       default: {
         if (lislalpha(ls->current)) {  /* identifier or reserved word? */
           TString *ts;
-          do {
-            save_and_next(ls);
-          } while (lislalnum(ls->current));
+          do {  /* save the name chars in the current block */
+            size_t l;
+            spanblock(ls, l, lislalnum(c));
+            savespan(ls, l);
+          } while (lislalnum(ls->current));  /* continues in next block? */
           /* find or create string */
           ts = luaS_newlstr(ls->L, luaZ_buffer(ls->buff),
                                    luaZ_bufflen(ls->buff));
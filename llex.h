@@ -77,6 +77,7 @@ typedef struct LexState {
   TString *envn;  /* environment variable name */
   TString *brkn;  /* "break" name (used as a label) */
   TString *glbn;  /* "global" name (when not a reserved word) */
+  lu_byte opts;  /* compiler options ('LUAY_OPT*') */
 } LexState;
 
 
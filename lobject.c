@@ -208,6 +208,46 @@ static int isneg (const char **s) {
 }
 
 
+/*
+** {==================================================================
+** Arithmetic for Lua's own conversions between doubles and decimal
+** numerals (see LUAI_NUMSHORTEST and LUAI_NUMFASTREAD)
+** ===================================================================
+*/
+
+#if LUAI_NUMSHORTEST || LUAI_NUMFASTREAD	/* { */
+
+#if DBL_MANT_DIG != 53 || DBL_MAX_EXP != 1024
+#error "LUAI_NUMSHORTEST and LUAI_NUMFASTREAD need IEEE 754 doubles"
+#endif
+
+typedef unsigned long long l_uint64;
+
+#include "lpow5tab.h"
+
+/* number of bits in the entries of 'pow5' and 'pow5inv' */
+#define POW5BITS	125
+
+/* number of bits of 5^e, for 0 <= e <= 3528 */
+#define pow5bits(e)	(cast_int((cast_uint(e) * 1217359u) >> 19) + 1)
+
+
+/* 64x64-bit multiplication; returns the low half, the high half in 'hi' */
+static l_uint64 umul128 (l_uint64 a, l_uint64 b, l_uint64 *hi) {
+  l_uint64 alo = a & 0xffffffffu, ahi = a >> 32;
+  l_uint64 blo = b & 0xffffffffu, bhi = b >> 32;
+  l_uint64 b00 = alo * blo, b01 = alo * bhi;
+  l_uint64 b10 = ahi * blo, b11 = ahi * bhi;
+  l_uint64 mid1 = b10 + (b00 >> 32);
+  l_uint64 mid2 = b01 + (mid1 & 0xffffffffu);
+  *hi = b11 + (mid1 >> 32) + (mid2 >> 32);
+  return (mid2 << 32) | (b00 & 0xffffffffu);
+}
+
+#endif					/* } */
+
+/* }================================================================== */
+
 
 /*
 ** {==================================================================
@@ -278,6 +318,148 @@ static lua_Number lua_strx2number (const char *s, char **endptr) {
 /* }====================================================== */
 
 
+#if LUAI_NUMFASTREAD	/* { */
+
+/*
+** {==================================================================
+** Conversion of decimal numerals to doubles
+** ===================================================================
+*/
+
+/* maximum number of significant digits that fit in 64 bits */
+#define MAXDECDIG	19
+
+/* number of leading zeros of 'x' (> 0) */
+static int nlz (l_uint64 x) {
+  int n = 0;
+  if (!(x >> 32)) { n += 32; x <<= 32; }
+  if (!(x >> 48)) { n += 16; x <<= 16; }
+  if (!(x >> 56)) { n += 8; x <<= 8; }
+  if (!(x >> 60)) { n += 4; x <<= 4; }
+  if (!(x >> 62)) { n += 2; x <<= 2; }
+  if (!(x >> 63)) n += 1;
+  return n;
+}
+
+
+/*
+** Compute the double nearest to 'w' * 10^'q', for a 'w' > 0, putting
+** its bits in '*bits'. Return 0 when it cannot decide that number: the
+** result is out of the range of normal doubles, or it is too close to
+** a tie for the precision used. (This is the idea of Clinger's and
+** Eisel-Lemire's algorithms: most numerals are far from ties.) 10^q is
+** approximated by 't' * 2^'et', with the 64 high bits 't' of the
+** entries of the tables of powers of 5. The error of 't' is less than
+** one unit, and 't' is exact for 0 <= q <= 27. So, with 'w' shifted to
+** have 64 bits, the 128-bit product 'hi':'lo' of 'w' and 't' is off by
+** less than one unit of 'hi', which cannot change the rounding unless
+** the bits below the 54 high bits of 'hi' are all zeros or all ones.
+*/
+static int decimal2bits (l_uint64 w, int q, l_uint64 *bits) {
+  l_uint64 t, hi, lo, m, rest;
+  int et, lz, sh, e2;
+  int exact = 0;
+  if (q >= 0) {
+    if (q >= POW5TABSIZE) return 0;
+    t = (pow5[q][1] << (128 - POW5BITS)) | (pow5[q][0] >> (POW5BITS - 64));
+    et = q + pow5bits(q) - 64;
+    exact = (q <= 27);  /* 5^q fits in 64 bits? */
+  }
+  else {
+    if (-q >= POW5INVTABSIZE) return 0;
+    t = (pow5inv[-q][1] << (128 - POW5BITS)) |
+        (pow5inv[-q][0] >> (POW5BITS - 64));
+    et = q - (pow5bits(-q) - 1 + POW5BITS) + (POW5BITS - 64);
+  }
+  lz = nlz(w);
+  lo = umul128(w << lz, t, &hi);  /* hi >= 2^62 */
+  sh = 9 + cast_int(hi >> 63);  /* bits of 'hi' below its 54 high bits */
+  m = hi >> sh;  /* 53 bits of mantissa plus a rounding bit */
+  rest = hi & ((cast(l_uint64, 1) << sh) - 1);
+  if (!exact) {
+    if (rest == 0 || rest == (cast(l_uint64, 1) << sh) - 1)
+      return 0;  /* too close to a tie or to a representable number */
+    m = (m >> 1) + (m & 1);  /* round */
+  }
+  else if ((m & 1) && rest == 0 && lo == 0)  /* a tie? */
+    m = (m >> 1) + ((m >> 1) & 1);  /* round to even */
+  else
+    m = (m >> 1) + (m & 1);  /* round */
+  e2 = sh + 1 + 64 + et - lz;  /* number is 'm' * 2^e2 */
+  if (m >> 53) {  /* rounding carried to a new bit? */
+    m >>= 1;
+    e2++;
+  }
+  e2 += 52 + 1023;  /* biased exponent */
+  if (e2 < 1 || e2 > 2046)  /* subnormal or overflow? */
+    return 0;  /* let 'lua_str2number' handle it */
+  *bits = (cast(l_uint64, e2) << 52) | (m & ((cast(l_uint64, 1) << 52) - 1));
+  return 1;
+}
+
+
+/*
+** Convert a decimal numeral, with a dot as its radix mark, to a double,
+** exactly as 'strtod' would. Return NULL when 's' is not such numeral
+** or the conversion is a hard case (more than MAXDECDIG significant
+** digits, ties, subnormals, overflows); 'l_str2d' then uses
+** 'lua_str2number'.
+*/
+static const char *l_str2dfast (const char *s, lua_Number *result) {
+  l_uint64 w = 0;  /* significant digits */
+  l_uint64 bits;
+  int nd = 0;  /* number of significant digits */
+  int e = 0;  /* decimal exponent */
+  int empty = 1;  /* no digits yet? */
+  int hasdot = 0;
+  int neg;
+  while (lisspace(cast_uchar(*s))) s++;  /* skip initial spaces */
+  neg = isneg(&s);
+  for (;; s++) {
+    if (*s == '.' && !hasdot)
+      hasdot = 1;
+    else if (lisdigit(cast_uchar(*s))) {
+      int d = *s - '0';
+      empty = 0;
+      if (hasdot) e--;
+      if (nd > 0 || d != 0) {  /* significant digit? */
+        if (nd++ == MAXDECDIG)
+          return NULL;  /* too many digits */
+        w = w * 10 + cast_uint(d);
+      }
+    }
+    else break;
+  }
+  if (empty) return NULL;
+  if (*s == 'e' || *s == 'E') {  /* exponent part? */
+    int exp1 = 0;
+    int neg1;
+    s++;  /* skip 'e' */
+    neg1 = isneg(&s);
+    if (!lisdigit(cast_uchar(*s)))
+      return NULL;  /* invalid; must have at least one digit */
+    for (; lisdigit(cast_uchar(*s)); s++) {
+      if (exp1 < 100000)  /* avoid overflows; larger exponents are hard */
+        exp1 = exp1 * 10 + *s - '0';
+    }
+    e += (neg1) ? -exp1 : exp1;
+  }
+  while (lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
+  if (*s != '\0') return NULL;
+  if (w == 0)
+    bits = 0;
+  else if (!decimal2bits(w, e, &bits))
+    return NULL;
+  if (neg) bits |= cast(l_uint64, 1) << 63;
+  memcpy(result, &bits, sizeof(bits));
+  return s;
+}
+
+/* }================================================================== */
+
+#endif					/* } */
+
+
 /* maximum length of a numeral to be converted to a number */
 #if !defined (L_MAXLENNUM)
 #define L_MAXLENNUM	200
@@ -313,8 +495,14 @@ static const char *l_str2dloc (const char *s, lua_Number *result, int mode) {
 */
 static const char *l_str2d (const char *s, lua_Number *result) {
   const char *endptr;
-  const char *pmode = strpbrk(s, ".xXnN");  /* look for special chars */
-  int mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
+  const char *pmode;
+  int mode;
+#if LUAI_NUMFASTREAD
+  if ((endptr = l_str2dfast(s, result)) != NULL)  /* common case? */
+    return endptr;
+#endif
+  pmode = strpbrk(s, ".xXnN");  /* look for special chars */
+  mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
   if (mode == 'n')  /* reject 'inf' and 'nan' */
     return NULL;
   endptr = l_str2dloc(s, result, mode);  /* try to convert */
@@ -416,23 +604,299 @@ int luaO_utf8esc (char *buff, l_uint32 x) {
 
 
 /*
-** Convert a float to a string, adding it to a buffer. First try with
-** a not too large number of digits, to avoid noise (for instance,
-** 1.1 going to "1.1000000000000001"). If that lose precision, so
-** that reading the result back gives a different number, then do the
+** {==================================================================
+** Conversion of numbers to decimal numerals
+** ===================================================================
+*/
+
+/* pairs of decimal digits, "00" to "99" */
+static const char digitpairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+
+#if !defined(lua_integer2str)
+
+/*
+** Convert an integer to a string (as LUA_INTEGER_FMT does), writing
+** its digits from right to left, two at a time.
+*/
+static int tostringbuffInt (lua_Integer i, char *buff) {
+  char temp[LUA_N2SBUFFSZ];
+  char *p = temp + sizeof(temp);  /* digits go from the end backward */
+  lua_Unsigned u = l_castS2U(i);
+  int len;
+  if (i < 0) u = 0u - u;  /* absolute value */
+  while (u >= 100) {
+    unsigned r = cast_uint(u % 100);
+    u /= 100;
+    p -= 2;
+    memcpy(p, digitpairs + 2 * r, 2);
+  }
+  if (u >= 10) {
+    p -= 2;
+    memcpy(p, digitpairs + 2 * cast_uint(u), 2);
+  }
+  else
+    *--p = cast_char('0' + cast_int(u));
+  if (i < 0)
+    *--p = '-';
+  len = cast_int(temp + sizeof(temp) - p);
+  memcpy(buff, p, cast_sizet(len));
+  buff[len] = '\0';
+  return len;
+}
+
+#define lua_integer2str(s,sz,n)		((void)(sz), tostringbuffInt(n, s))
+
+#endif
+
+
+#if LUAI_NUMSHORTEST	/* { */
+
+/* floor(log10(2^e)), for 0 <= e <= 1650 */
+#define log10pow2(e)	cast_int((cast_uint(e) * 78913u) >> 18)
+
+/* floor(log10(5^e)), for 0 <= e <= 2620 */
+#define log10pow5(e)	cast_int((cast_uint(e) * 732923u) >> 20)
+
+
+/* (m * mul) >> j, for a 128-bit 'mul' and 64 < j < 128 */
+static l_uint64 mulshift (l_uint64 m, const l_uint64 *mul, int j) {
+  l_uint64 high0, high1, sum;
+  l_uint64 low1 = umul128(m, mul[1], &high1);
+  umul128(m, mul[0], &high0);
+  sum = high0 + low1;
+  if (sum < high0)
+    high1++;  /* carry */
+  j -= 64;
+  return (high1 << (64 - j)) | (sum >> j);
+}
+
+
+/* is 'v' (> 0) a multiple of 5^p? */
+static int multipleofpow5 (l_uint64 v, int p) {
+  int count = 0;
+  while (v % 5 == 0) {
+    v /= 5;
+    count++;
+  }
+  return (count >= p);
+}
+
+
+/*
+** Ryu (Ulf Adams, PLDI 2018): compute the shortest decimal numeral
+** 'digits' * 10^'*e10' that reads back as the positive finite double
+** with biased exponent 'ieeee' and mantissa 'ieeem'. Among numerals with
+** that length, it chooses the one closest to the number. With 'mv' the
+** number, the interval of numerals that read back as it goes from 'vm'
+** to 'vp'; after scaling all three by a power of 10 (computed with the
+** tables of powers of 5), it removes digits while the interval still
+** contains a numeral. The flags '*trailingzeros' tell whether the
+** scaled values are exact, which matters for ties.
+*/
+static l_uint64 ryu (l_uint64 ieeem, int ieeee, int *e10) {
+  l_uint64 m2, mv, mm, vr, vp, vm;
+  int e2, e, removed = 0, lastremoved = 0;
+  int vmtrailingzeros = 0, vrtrailingzeros = 0;
+  int acceptbounds, mmshift;
+  if (ieeee == 0) {  /* subnormal? */
+    e2 = 1 - 1023 - 52 - 2;
+    m2 = ieeem;
+  }
+  else {
+    e2 = ieeee - 1023 - 52 - 2;
+    m2 = ((l_uint64)1 << 52) | ieeem;
+  }
+  acceptbounds = ((m2 & 1) == 0);  /* bounds round to even 'm2' */
+  mv = 4 * m2;
+  mmshift = (ieeem != 0 || ieeee <= 1);  /* lower gap is not halved? */
+  mm = mv - 1 - (mmshift ? 1u : 0u);  /* lower bound */
+  if (e2 >= 0) {
+    int q = log10pow2(e2) - (e2 > 3);
+    int i = -e2 + q + POW5BITS + pow5bits(q) - 1;
+    e = q;
+    vr = mulshift(mv, pow5inv[q], i);
+    vp = mulshift(mv + 2, pow5inv[q], i);
+    vm = mulshift(mm, pow5inv[q], i);
+    if (q <= 21) {  /* values may be exact multiples of 10^q? */
+      /* only one of 'mm', 'mv', and 'mv + 2' can be */
+      if (mv % 5 == 0)
+        vrtrailingzeros = multipleofpow5(mv, q);
+      else if (acceptbounds)
+        vmtrailingzeros = multipleofpow5(mm, q);
+      else if (multipleofpow5(mv + 2, q))
+        vp--;
+    }
+  }
+  else {
+    int q = log10pow5(-e2) - (-e2 > 1);
+    int i = -e2 - q;
+    int j = q - (pow5bits(i) - POW5BITS);
+    e = q + e2;
+    vr = mulshift(mv, pow5[i], j);
+    vp = mulshift(mv + 2, pow5[i], j);
+    vm = mulshift(mm, pow5[i], j);
+    if (q <= 1) {  /* 'mv' has at least 'q' trailing 0 bits */
+      vrtrailingzeros = 1;
+      if (acceptbounds)
+        vmtrailingzeros = (mmshift == 1);
+      else
+        vp--;
+    }
+    else if (q < 63)  /* 'vr' is exact if 'mv' has 'q' trailing 0 bits */
+      vrtrailingzeros = ((mv & (((l_uint64)1 << q) - 1)) == 0);
+  }
+  if (vmtrailingzeros || vrtrailingzeros) {  /* general case (rare) */
+    while (vp / 10 > vm / 10) {
+      vmtrailingzeros &= (vm % 10 == 0);
+      vrtrailingzeros &= (lastremoved == 0);
+      lastremoved = cast_int(vr % 10);
+      vr /= 10; vp /= 10; vm /= 10;
+      removed++;
+    }
+    if (vmtrailingzeros) {  /* lower bound is exact and acceptable? */
+      while (vm % 10 == 0) {
+        vrtrailingzeros &= (lastremoved == 0);
+        lastremoved = cast_int(vr % 10);
+        vr /= 10; vp /= 10; vm /= 10;
+        removed++;
+      }
+    }
+    if (vrtrailingzeros && lastremoved == 5 && vr % 2 == 0)
+      lastremoved = 4;  /* exactly halfway; round to even */
+    *e10 = e + removed;
+    return vr + ((vr == vm && (!acceptbounds || !vmtrailingzeros)) ||
+                 lastremoved >= 5);
+  }
+  else {  /* common case */
+    int roundup = 0;
+    while (vp / 10 > vm / 10) {
+      roundup = (vr % 10 >= 5);
+      vr /= 10; vp /= 10; vm /= 10;
+      removed++;
+    }
+    *e10 = e + removed;
+    return vr + (vr == vm || roundup);
+  }
+}
+
+
+/*
+** Convert a finite float to the shortest numeral that reads back as
+** the same number. The layout is the one of "%.15g" (LUA_NUMBER_FMT)
+** when the numeral has up to 15 digits, which is then what "%.15g"
+** writes, and of "%.17g" (LUA_NUMBER_FMT_N) otherwise, which for 17
+** digits is again what "%.17g" writes. Return -1 for inf and NaN.
+*/
+static int tostringshortest (lua_Number n, char *buff) {
+  char digits[20];  /* decimal digits of the numeral */
+  char *p = digits + sizeof(digits);  /* they go from the end backward */
+  l_uint64 bits, v;
+  int ieeee, nd, x, len = 0;
+  char point = lua_getlocaledecpoint();
+  memcpy(&bits, &n, sizeof(bits));
+  ieeee = cast_int((bits >> 52) & 0x7ff);
+  if (ieeee == 0x7ff)  /* inf or NaN? */
+    return -1;
+  if ((bits & 0x7fffffffffffffffULL) == 0)  /* zero? */
+    v = 0, x = 0;
+  else
+    v = ryu(bits & (((l_uint64)1 << 52) - 1), ieeee, &x);
+  while (v >= 100) {
+    unsigned r = cast_uint(v % 100);
+    v /= 100;
+    p -= 2;
+    memcpy(p, digitpairs + 2 * r, 2);
+  }
+  if (v >= 10) {
+    p -= 2;
+    memcpy(p, digitpairs + 2 * cast_uint(v), 2);
+  }
+  else
+    *--p = cast_char('0' + cast_int(v));
+  nd = cast_int(digits + sizeof(digits) - p);
+  x += nd - 1;  /* decimal exponent of the first digit */
+  if (bits >> 63)  /* negative? */
+    buff[len++] = '-';
+  if (x < -4 || x >= ((nd <= 15) ? 15 : 17)) {  /* exponential format */
+    int ax = (x < 0) ? -x : x;
+    buff[len++] = p[0];
+    if (nd > 1) {
+      buff[len++] = point;
+      memcpy(buff + len, p + 1, cast_sizet(nd - 1));
+      len += nd - 1;
+    }
+    buff[len++] = 'e';
+    buff[len++] = (x < 0) ? '-' : '+';
+    if (ax >= 100) {
+      buff[len++] = cast_char('0' + ax / 100);
+      ax %= 100;
+    }
+    memcpy(buff + len, digitpairs + 2 * ax, 2);
+    len += 2;
+  }
+  else if (x < 0) {  /* 0.000ddd */
+    buff[len++] = '0';
+    buff[len++] = point;
+    memset(buff + len, '0', cast_sizet(-x - 1));
+    len += -x - 1;
+    memcpy(buff + len, p, cast_sizet(nd));
+    len += nd;
+  }
+  else if (nd <= x + 1) {  /* ddd000 */
+    memcpy(buff + len, p, cast_sizet(nd));
+    len += nd;
+    memset(buff + len, '0', cast_sizet(x + 1 - nd));
+    len += x + 1 - nd;
+  }
+  else {  /* ddd.ddd */
+    memcpy(buff + len, p, cast_sizet(x + 1));
+    len += x + 1;
+    buff[len++] = point;
+    memcpy(buff + len, p + x + 1, cast_sizet(nd - x - 1));
+    len += nd - x - 1;
+  }
+  buff[len] = '\0';
+  return len;
+}
+
+#else					/* }{ */
+
+#define tostringshortest(n,buff)	((void)(n), (void)(buff), -1)
+
+#endif					/* } */
+
+/* }================================================================== */
+
+
+/*
+** Convert a float to a string, adding it to a buffer. Use the shortest
+** numeral that reads back as the number, when available. Otherwise,
+** first try with a not too large number of digits, to avoid noise (for
+** instance, 1.1 going to "1.1000000000000001"). If that lose precision,
+** so that reading the result back gives a different number, then do the
 ** conversion again with extra precision. Moreover, if the numeral looks
 ** like an integer (without a decimal point or an exponent), add ".0" to
 ** its end.
 */
 static int tostringbuffFloat (lua_Number n, char *buff) {
-  /* first conversion */
-  int len = l_sprintf(buff, LUA_N2SBUFFSZ, LUA_NUMBER_FMT,
-                            (LUAI_UACNUMBER)n);
-  lua_Number check = lua_str2number(buff, NULL);  /* read it back */
-  if (check != n) {  /* not enough precision? */
-    /* convert again with more precision */
-    len = l_sprintf(buff, LUA_N2SBUFFSZ, LUA_NUMBER_FMT_N,
+  int len = tostringshortest(n, buff);
+  if (len < 0) {  /* no shortest conversion? */
+    /* first conversion */
+    lua_Number check;
+    len = l_sprintf(buff, LUA_N2SBUFFSZ, LUA_NUMBER_FMT,
                           (LUAI_UACNUMBER)n);
+    check = lua_str2number(buff, NULL);  /* read it back */
+    if (check != n) {  /* not enough precision? */
+      /* convert again with more precision */
+      len = l_sprintf(buff, LUA_N2SBUFFSZ, LUA_NUMBER_FMT_N,
+                            (LUAI_UACNUMBER)n);
+    }
   }
   /* looks like an integer? */
   if (buff[strspn(buff, "-0123456789")] == '\0') {
@@ -397,6 +397,8 @@ typedef struct GCObject {
 #define LSTRREG		-1  /* regular long string */
 #define LSTRFIX		-2  /* fixed external long string */
 #define LSTRMEM		-3  /* external long string with deallocation */
+#define LSTRAPP		-4  /* long string in an appendable block */
+#define LSTRVIEW	-5  /* slice of another long string */
 
 
 /*
@@ -413,7 +415,8 @@ typedef struct TString {
   } u;
   char *contents;  /* pointer to content in long strings */
   lua_Alloc falloc;  /* deallocation function for external strings */
-  void *ud;  /* user data for external strings */
+  void *ud;  /* user data for external strings; block for appendable ones;
+                parent string for views */
 } TString;
 
 
@@ -580,6 +583,34 @@ typedef struct AbsLineInfo {
 } AbsLineInfo;
 
 
+/*
+** Description of a call inlined by the compiler (see 'luaK_inline'):
+** instructions in [startpc, endpc) are the code of the nested function
+** 'p[proto]', called at line 'line' through the local variable in
+** register 'reg'. Debug functions use it to show the call as a frame.
+*/
+typedef struct InlineInfo {
+  int startpc;
+  int endpc;
+  int line;
+  int proto;
+  int reg;
+} InlineInfo;
+
+
+/*
+** Slot of a global cache, which keeps the result of a chain of raw
+** lookups starting at a global table (see OP_GETCACHE). The value is
+** valid while 'version' is equal to the global cache version and the
+** lookup starts again at table 'env'.
+*/
+typedef struct CacheSlot {
+  TValue v;  /* cached value */
+  struct Table *env;  /* table where the lookups started */
+  lua_Unsigned version;  /* global cache version when 'v' was stored */
+} CacheSlot;
+
+
 /*
 ** Flags in Prototypes
 */
@@ -611,6 +642,8 @@ typedef struct Proto {
   int sizep;  /* size of 'p' */
   int sizelocvars;
   int sizeabslineinfo;  /* size of 'abslineinfo' */
+  int sizeinlineinfo;  /* size of 'inlineinfo' */
+  int sizecache;  /* size of 'cache' */
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
@@ -619,7 +652,9 @@ typedef struct Proto {
   Upvaldesc *upvalues;  /* upvalue information */
   ls_byte *lineinfo;  /* information about source lines (debug information) */
   AbsLineInfo *abslineinfo;  /* idem */
+  InlineInfo *inlineinfo;  /* inlined calls (debug information) */
   LocVar *locvars;  /* information about local variables (debug information) */
+  CacheSlot *cache;  /* slots for OP_GETCACHE */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -776,7 +811,7 @@ typedef union Node {
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
-  lu_byte lsizenode;  /* log2 of number of slots of 'node' array */
+  lu_byte lsizenode;  /* log2 of size of 'node' array, plus BITLAYOUT */
   unsigned int asize;  /* number of slots in 'array' array */
   Value *array;  /* array part */
   Node *node;
@@ -825,8 +860,19 @@ typedef struct Table {
 	(check_exp((size&(size-1))==0, (cast_uint(s) & cast_uint((size)-1))))
 
 
+/*
+** The log2 of the size of the node array needs only the lower bits of
+** 'lsizenode'. Its highest bit (BITLAYOUT) marks a metatable that has
+** a layout for userdata fields (see 'lua_layoutfield'). This bit is set
+** only by the API and never cleared.
+*/
+#define BITLAYOUT	(1 << 7)
+#define logsizenode(t)	((t)->lsizenode & (BITLAYOUT - 1))
+#define haslayout(t)	((t)->lsizenode & BITLAYOUT)
+#define setlayout(t)	((t)->lsizenode |= BITLAYOUT)
+
 #define twoto(x)	(1u<<(x))
-#define sizenode(t)	(twoto((t)->lsizenode))
+#define sizenode(t)	(twoto(logsizenode(t)))
 
 
 /* size of buffer for 'luaO_utf8esc' function */
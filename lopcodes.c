@@ -32,6 +32,7 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_LOADNIL */
  ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETUPVAL */
  ,opmode(0, 0, 0, 0, 0, iABC)		/* OP_SETUPVAL */
+ ,opmode(0, 0, 0, 0, 0, iABC)		/* OP_GETCACHE */
  ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABUP */
  ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABLE */
  ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETI */
@@ -244,6 +244,7 @@ OP_LOADNIL,/*	A B	R[A], R[A+1], ..., R[A+B] := nil		*/
 OP_GETUPVAL,/*	A B	R[A] := UpValue[B]				*/
 OP_SETUPVAL,/*	A B	UpValue[B] := R[A]				*/
 
+OP_GETCACHE,/*	B C	if cache[C] is valid then R[X] := cache[C]; pc += B	*/
 OP_GETTABUP,/*	A B C	R[A] := UpValue[B][K[C]:shortstring]		*/
 OP_GETTABLE,/*	A B C	R[A] := R[B][R[C]]				*/
 OP_GETI,/*	A B C	R[A] := R[B][C]					*/
@@ -387,6 +388,12 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   power of 2) plus 1, or zero for size zero. If not k, the array size
   is vC. Otherwise, the array size is EXTRAARG _ vC.
 
+  (*) OP_GETCACHE is followed by the B instructions of a global
+  lookup (an OP_GETTABUP followed by zero or more OP_GETFIELD), whose
+  result goes to register X, the register A of the last one. Slot
+  cache[C] of the function prototype keeps the result of these lookups
+  while no table involved in them changes (see 'BITWATCH').
+
   (*) In OP_ERRNNIL, (Bx == 0) means index of global name doesn't
   fit in Bx. (So, that name is not available for the error message.)
 
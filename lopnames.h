@@ -24,6 +24,7 @@ static const char *const opnames[] = {
   "LOADNIL",
   "GETUPVAL",
   "SETUPVAL",
+  "GETCACHE",
   "GETTABUP",
   "GETTABLE",
   "GETI",
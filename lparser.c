@@ -199,6 +199,7 @@ static int new_varkind (LexState *ls, TString *name, lu_byte kind) {
   luaM_growvector(L, dyd->actvar.arr, dyd->actvar.n + 1,
              dyd->actvar.size, Vardesc, SHRT_MAX, "variable declarations");
   var = &dyd->actvar.arr[dyd->actvar.n++];
+  setnilvalue(&var->k);  /* no known value */
   var->vd.kind = kind;  /* default */
   var->vd.name = name;
   return dyd->actvar.n - 1 - fs->firstlocal;
@@ -806,9 +807,12 @@ static void open_func (LexState *ls, FuncState *fs, BlockCnt *bl) {
   fs->previousline = f->linedefined;
   fs->iwthabs = 0;
   fs->lasttarget = 0;
+  fs->lastcache = NO_JUMP;
+  fs->ncache = 0;
   fs->freereg = 0;
   fs->nk = 0;
   fs->nabslineinfo = 0;
+  fs->ninlineinfo = 0;
   fs->np = 0;
   fs->nups = 0;
   fs->ndebugvars = 0;
@@ -839,10 +843,13 @@ static void close_func (LexState *ls) {
   luaM_shrinkvector(L, f->lineinfo, f->sizelineinfo, fs->pc, ls_byte);
   luaM_shrinkvector(L, f->abslineinfo, f->sizeabslineinfo,
                        fs->nabslineinfo, AbsLineInfo);
+  luaM_shrinkvector(L, f->inlineinfo, f->sizeinlineinfo,
+                       fs->ninlineinfo, InlineInfo);
   luaM_shrinkvector(L, f->k, f->sizek, fs->nk, TValue);
   luaM_shrinkvector(L, f->p, f->sizep, fs->np, Proto *);
   luaM_shrinkvector(L, f->locvars, f->sizelocvars, fs->ndebugvars, LocVar);
   luaM_shrinkvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
+  luaF_initcache(L, f);
   ls->fs = fs->prev;
   L->top.p--;  /* pop kcache table */
   luaC_checkGC(L);
@@ -1135,7 +1142,56 @@ static int explist (LexState *ls, expdesc *v) {
 }
 
 
-static void funcargs (LexState *ls, expdesc *f) {
+/*
+** Return the prototype of the closure in variable 'v' if a call to it
+** is a candidate for inlining (that is, inlining is on and 'v' is a
+** read-only local of the current function initialized with a closure);
+** otherwise return NULL. The call may still not be inlined, if the
+** body of the function is not suitable (see 'luaK_inline').
+*/
+static Proto *inlinecandidate (LexState *ls, expdesc *v) {
+  FuncState *fs = ls->fs;
+  if ((ls->opts & LUAY_OPTINLINE) && v->k == VLOCAL) {
+    Vardesc *vd = getlocalvardesc(fs, v->u.var.vidx);
+    if (vd->vd.kind == RDKCONST && ttisinteger(&vd->k))
+      return fs->f->p[ivalue(&vd->k)];
+  }
+  return NULL;
+}
+
+
+/*
+** Move the function in register 'freg' to the base register of a call
+** whose arguments are already coded. For a multi-result last argument,
+** the move must come before the instruction producing it, so that
+** this instruction stays just before the call that consumes its
+** results. Both instructions have the same line, so they can swap
+** positions without disturbing the line information. (A jump to that
+** instruction will execute both.)
+*/
+static void loadinlinefunc (FuncState *fs, expdesc *args, int base,
+                            int freg) {
+  int line = fs->previousline;  /* line of last instruction */
+  luaK_codeABC(fs, OP_MOVE, base, freg, 0);
+  luaK_fixline(fs, line);
+  if (hasmultret(args->k)) {
+    Instruction *code = fs->f->code;
+    Instruction temp = code[fs->pc - 1];
+    lua_assert(args->u.info == fs->pc - 2);
+    code[fs->pc - 1] = code[fs->pc - 2];
+    code[fs->pc - 2] = temp;
+    args->u.info = fs->pc - 1;  /* multi-result instruction moved down */
+  }
+}
+
+
+/*
+** Code the arguments and the call to function 'f'. If 'ip' is not
+** NULL, 'f' is an inline candidate whose closure was not loaded in the
+** base register (it is still in register 'freg'). Return true if the
+** call was inlined.
+*/
+static int funcargs (LexState *ls, expdesc *f, Proto *ip, int freg) {
   FuncState *fs = ls->fs;
   expdesc args;
   int base, nparams;
@@ -1147,8 +1203,13 @@ static void funcargs (LexState *ls, expdesc *f) {
         args.k = VVOID;
       else {
         explist(ls, &args);
-        if (hasmultret(args.k))
+        if (hasmultret(args.k)) {
+          if (ip != NULL) {  /* cannot inline with a variable # of args. */
+            loadinlinefunc(fs, &args, f->u.info, freg);
+            ip = NULL;
+          }
           luaK_setmultret(fs, &args);
+        }
       }
       check_match(ls, ')', '(', line);
       break;
@@ -1175,11 +1236,20 @@ static void funcargs (LexState *ls, expdesc *f) {
       luaK_exp2nextreg(fs, &args);  /* close last argument */
     nparams = fs->freereg - (base+1);
   }
+  if (ip != NULL) {
+    if (luaK_inline(fs, ip, base, nparams, freg, line)) {  /* inlined? */
+      init_exp(f, VNONRELOC, base);  /* its single result is in 'base' */
+      fs->freereg = cast_byte(base + 1);
+      return 1;
+    }
+    loadinlinefunc(fs, &args, base, freg);  /* do a regular call */
+  }
   init_exp(f, VCALL, luaK_codeABC(fs, OP_CALL, base, nparams+1, 2));
   luaK_fixline(fs, line);
   /* call removes function and arguments and leaves one result (unless
      changed later) */
   fs->freereg = cast_byte(base + 1);
+  return 0;
 }
 
 
@@ -1214,10 +1284,15 @@ static void primaryexp (LexState *ls, expdesc *v) {
 }
 
 
-static void suffixedexp (LexState *ls, expdesc *v) {
+/*
+** Returns true if the expression is an inlined call (which must be
+** accepted as a statement).
+*/
+static int suffixedexp (LexState *ls, expdesc *v) {
   /* suffixedexp ->
        primaryexp { '.' NAME | '[' exp ']' | ':' NAME funcargs | funcargs } */
   FuncState *fs = ls->fs;
+  int inlined = 0;
   primaryexp(ls, v);
   for (;;) {
     switch (ls->t.token) {
@@ -1237,16 +1312,26 @@ static void suffixedexp (LexState *ls, expdesc *v) {
         luaX_next(ls);
         codename(ls, &key);
         luaK_self(fs, v, &key);
-        funcargs(ls, v);
+        funcargs(ls, v, NULL, 0);
         break;
       }
       case '(': case TK_STRING: case '{' /*}*/: {  /* funcargs */
-        luaK_exp2nextreg(fs, v);
-        funcargs(ls, v);
+        Proto *ip = inlinecandidate(ls, v);
+        int freg = 0;
+        if (ip == NULL)
+          luaK_exp2nextreg(fs, v);
+        else {  /* closure will be loaded only if the call is not inlined */
+          freg = v->u.var.ridx;
+          init_exp(v, VNONRELOC, fs->freereg);
+          luaK_reserveregs(fs, 1);
+        }
+        inlined = funcargs(ls, v, ip, freg);
         break;
       }
-      default: return;
+      default: return inlined;
     }
+    if (v->k != VNONRELOC)
+      inlined = 0;
   }
 }
 
@@ -1787,13 +1872,33 @@ static void ifstat (LexState *ls, int line) {
 }
 
 
+/*
+** If expression 'e' was just coded as a closure, keep the index of its
+** prototype in variable 'var', so that calls through that (read-only)
+** variable can be inlined. (With pending jumps, as in 'g or function
+** ... end', the variable may get some other value.)
+*/
+static void checkinline (LexState *ls, Vardesc *var, expdesc *e) {
+  FuncState *fs = ls->fs;
+  if ((ls->opts & LUAY_OPTINLINE) && var->vd.kind == RDKCONST &&
+      e->k == VNONRELOC && !hasjumps(e) && fs->pc > 0) {
+    Instruction i = fs->f->code[fs->pc - 1];
+    if (GET_OPCODE(i) == OP_CLOSURE && GETARG_A(i) == e->u.info)
+      setivalue(&var->k, GETARG_Bx(i));
+  }
+}
+
+
 static void localfunc (LexState *ls) {
   expdesc b;
   FuncState *fs = ls->fs;
   int fvar = fs->nactvar;  /* function's variable index */
-  new_localvar(ls, str_checkname(ls));  /* new local variable */
+  /* when inlining, the variable is read-only */
+  lu_byte kind = (ls->opts & LUAY_OPTINLINE) ? RDKCONST : VDKREG;
+  new_varkind(ls, str_checkname(ls), kind);  /* new local variable */
   adjustlocalvars(ls, 1);  /* enter its scope */
   body(ls, &b, 0, ls->linenumber);  /* function created in next register */
+  checkinline(ls, getlocalvardesc(fs, fvar), &b);
   /* debug information will only see the variable after this point! */
   localdebuginfo(fs, fvar)->startpc = fs->pc;
 }
@@ -1861,6 +1966,8 @@ static void localstat (LexState *ls) {
     fs->nactvar++;  /* but count it */
   }
   else {
+    if (nvars == nexps)  /* no adjustments? */
+      checkinline(ls, var, &e);
     adjust_assign(ls, nvars, nexps, &e);
     adjustlocalvars(ls, nvars);
   }
@@ -2009,17 +2116,17 @@ static void exprstat (LexState *ls) {
   /* stat -> func | assignment */
   FuncState *fs = ls->fs;
   struct LHS_assign v;
-  suffixedexp(ls, &v.v);
+  int inlined = suffixedexp(ls, &v.v);
   if (ls->t.token == '=' || ls->t.token == ',') { /* stat -> assignment ? */
     v.prev = NULL;
     restassign(ls, &v, 1);
   }
-  else {  /* stat -> func */
+  else if (!inlined) {  /* stat -> func */
     Instruction *inst;
     check_condition(ls, v.v.k == VCALL, "syntax error");
     inst = &getinstruction(fs, &v.v);
     SETARG_C(*inst, 1);  /* call statement uses no results */
-  }
+  }  /* else inlined call; its result will be discarded */
 }
 
 
@@ -2175,7 +2282,8 @@ static void mainfunc (LexState *ls, FuncState *fs) {
 
 
 LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
-                       Dyndata *dyd, const char *name, int firstchar) {
+                       Dyndata *dyd, const char *name, int firstchar,
+                       int opts) {
   LexState lexstate;
   FuncState funcstate;
   LClosure *cl = luaF_newLclosure(L, 1);  /* create main closure */
@@ -2192,6 +2300,7 @@ LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
   lexstate.dyd = dyd;
   dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
   luaX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
+  lexstate.opts = cast_byte(opts);
   mainfunc(&lexstate, &funcstate);
   lua_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
   /* all scopes should be correctly finished */
@@ -171,10 +171,13 @@ typedef struct FuncState {
   Table *kcache;  /* cache for reusing constants */
   int pc;  /* next position to code (equivalent to 'ncode') */
   int lasttarget;   /* 'label' of last 'jump label' */
+  int lastcache;  /* pc of last OP_GETCACHE (or NO_JUMP) */
+  int ncache;  /* number of slots used by OP_GETCACHE */
   int previousline;  /* last line that was saved in 'lineinfo' */
   int nk;  /* number of elements in 'k' */
   int np;  /* number of elements in 'p' */
   int nabslineinfo;  /* number of elements in 'abslineinfo' */
+  int ninlineinfo;  /* number of elements in 'inlineinfo' */
   int firstlocal;  /* index of first local var (in Dyndata array) */
   int firstlabel;  /* index of first label (in 'dyd->label->arr') */
   short ndebugvars;  /* number of elements in 'f->locvars' */
@@ -186,11 +189,19 @@ typedef struct FuncState {
 } FuncState;
 
 
+/*
+** Compiler options (selected by letters in the 'mode' of a load)
+*/
+#define LUAY_OPTINLINE	1   /* 'i': inline calls to small local functions */
+#define LUAY_OPTGCACHE	2   /* 'g': cache values of global variables */
+
+
 LUAI_FUNC lu_byte luaY_nvarstack (FuncState *fs);
 LUAI_FUNC void luaY_checklimit (FuncState *fs, int v, int l,
                                 const char *what);
 LUAI_FUNC LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
-                                 Dyndata *dyd, const char *name, int firstchar);
+                                 Dyndata *dyd, const char *name, int firstchar,
+                                 int opts);
 
 
 #endif
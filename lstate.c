@@ -357,6 +357,9 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   g->warnf = NULL;
   g->ud_warn = NULL;
   g->seed = seed;
+  g->cacheversion = 0;
+  for (i = 0; i < IDXCACHE_N; i++)
+    g->idxcache[i].mt = NULL;  /* empty '__index' cache */
   g->gcstp = GCSTPGC;  /* no GC while building state */
   g->strt.size = g->strt.nuse = 0;
   g->strt.hash = NULL;
@@ -384,6 +387,8 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud, unsigned seed) {
   setgcparam(g, MINORMAJOR, LUAI_MINORMAJOR);
   setgcparam(g, MAJORMINOR, LUAI_MAJORMINOR);
   for (i=0; i < LUA_NUMTYPES; i++) g->mt[i] = NULL;
+  g->layouts = NULL;
+  g->nextf = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
     close_state(L);
@@ -407,19 +412,43 @@ void luaE_warning (lua_State *L, const char *msg, int tocont) {
 }
 
 
+/*
+** Generate a piece of a warning with string 'ts', up to its first
+** '\0' (if any). Its contents may not be followed by a '\0' (see
+** 'LSTRAPP' and 'LSTRVIEW'), and fixing that could need memory, so
+** they go in parts through a buffer.
+*/
+static void warnstr (lua_State *L, TString *ts) {
+  char buff[LUAI_MAXSHORTLEN + 1];
+  size_t len;
+  const char *s = getlstr(ts, len);
+  const char *z = (const char *)memchr(s, '\0', len);
+  if (z != NULL)
+    len = cast_sizet(z - s);  /* stop at first zero */
+  while (len > 0) {
+    size_t n = (len < sizeof(buff)) ? len : sizeof(buff) - 1;
+    memcpy(buff, s, n);
+    buff[n] = '\0';
+    luaE_warning(L, buff, 1);
+    s += n;
+    len -= n;
+  }
+}
+
+
 /*
 ** Generate a warning from an error message
 */
 void luaE_warnerror (lua_State *L, const char *where) {
   TValue *errobj = s2v(L->top.p - 1);  /* error object */
-  const char *msg = (ttisstring(errobj))
-                  ? getstr(tsvalue(errobj))
-                  : "error object is not a string";
   /* produce warning "error in %s (%s)" (where, msg) */
   luaE_warning(L, "error in ", 1);
   luaE_warning(L, where, 1);
   luaE_warning(L, " (", 1);
-  luaE_warning(L, msg, 1);
+  if (ttisstring(errobj))
+    warnstr(L, tsvalue(errobj));
+  else
+    luaE_warning(L, "error object is not a string", 1);
   luaE_warning(L, ")", 0);
 }
 
@@ -153,6 +153,15 @@ struct lua_longjmp;  /* defined in ldo.c */
 #endif
 
 
+/*
+** Size of the cache for '__index' chains (see 'luaV_finishget'). It
+** must be a power of 2.
+*/
+#if !defined(IDXCACHE_N)
+#define IDXCACHE_N              256
+#endif
+
+
 #define BASIC_STACK_SIZE        (2*LUA_MINSTACK)
 
 #define stacksize(th)	cast_int((th)->stack_last.p - (th)->stack.p)
@@ -171,6 +180,20 @@ typedef struct stringtable {
 } stringtable;
 
 
+/*
+** Entry of the cache for '__index' chains: 'v' is the result of
+** indexing with 'key' an object with metatable 'mt' and without that
+** key, while the global cache version is equal to 'version'. ('mt' is
+** NULL in empty entries.)
+*/
+typedef struct IdxCache {
+  struct Table *mt;
+  TString *key;
+  TValue v;
+  lua_Unsigned version;
+} IdxCache;
+
+
 /*
 ** Information about a call.
 ** About union 'u':
@@ -335,6 +358,7 @@ typedef struct global_State {
   TValue l_registry;
   TValue nilvalue;  /* a nil value */
   unsigned int seed;  /* randomized seed for hashes */
+  lua_Unsigned cacheversion;  /* version of global caches (see 'BITWATCH') */
   lu_byte gcparams[LUA_GCPN];
   lu_byte currentwhite;
   lu_byte gcstate;  /* state of garbage collector */
@@ -365,7 +389,10 @@ typedef struct global_State {
   TString *memerrmsg;  /* message for memory-allocation errors */
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTYPES];  /* metatables for basic types */
+  struct Table *layouts;  /* userdata layouts, keyed by their metatables */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+  IdxCache idxcache[IDXCACHE_N];  /* cache for '__index' chains */
+  lua_CFunction nextf;  /* primitive 'next' (see 'lua_setnextf') */
   lua_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
   LX mainth;  /* main thread of this state */
@@ -154,8 +154,8 @@ size_t luaS_sizelngstr (size_t len, int kind) {
     case LSTRFIX:  /* fixed external long string */
       /* don't need 'falloc'/'ud' */
       return offsetof(TString, falloc);
-    default:  /* external long string with deallocation */
-      lua_assert(kind == LSTRMEM);
+    default:  /* external with deallocation, appendable, or view */
+      lua_assert(kind == LSTRMEM || kind == LSTRAPP || kind == LSTRVIEW);
       return sizeof(TString);
   }
 }
@@ -351,3 +351,252 @@ TString *luaS_normstr (lua_State *L, TString *ts) {
   }
 }
 
+
+
+/*
+** {==================================================================
+** Appendable strings
+** ===================================================================
+*/
+
+/*
+** A concatenation whose first operand is a long string creates its
+** result with kind LSTRAPP, in a block that can be shared by several
+** strings: Each string in a block is a prefix of the longest one,
+** whose length is 'used', or a substring of another string in the
+** block (see 'luaS_newsubstr'). When a string that ends at 'used' is
+** again the first operand of a concatenation and the block has enough
+** space, the other operands are copied in place after it, so that the
+** new result shares the block too. This way, a loop like 's = s .. x'
+** takes linear time. Only strings ending at 'used' are sure to be
+** followed by a '\0'; 'luaS_fixappstr' ensures that for the others.
+** A block is frozen when the contents of a string ending at 'used' are
+** exported as a C string, as appending to it would overwrite their
+** ending '\0'.
+*/
+typedef struct StrBlock {
+  size_t size;  /* size of 'buff' */
+  size_t used;  /* length of the longest string in the block */
+  size_t nref;  /* number of strings using the block */
+  int frozen;  /* true if strings cannot be appended to the block */
+  char buff[1];
+} StrBlock;
+
+
+#define sizeblock(n)	(offsetof(StrBlock, buff) + (n) * sizeof(char))
+
+#define getblock(ts)	check_exp((ts)->shrlen == LSTRAPP, \
+				cast(StrBlock *, (ts)->ud))
+
+
+static void setused (StrBlock *b, size_t l) {
+  lua_assert(l < b->size);
+  b->used = l;
+  b->buff[l] = '\0';  /* ending 0 */
+}
+
+
+/*
+** Create a new block with 'size' bytes, initialized with the 'l'
+** bytes from 's'.
+*/
+static StrBlock *newblock (lua_State *L, size_t size,
+                           const char *s, size_t l) {
+  StrBlock *b = cast(StrBlock *, luaM_malloc_(L, sizeblock(size), 0));
+  b->size = size;
+  b->nref = 0;
+  b->frozen = 0;
+  memcpy(b->buff, s, l * sizeof(char));
+  setused(b, l);
+  return b;
+}
+
+
+static void unrefblock (lua_State *L, StrBlock *b) {
+  lua_assert(b->nref > 0);
+  if (--b->nref == 0)  /* no more strings using the block? */
+    luaM_freemem(L, b, sizeblock(b->size));
+}
+
+
+/* position in its block of the end of string 'ts' */
+#define endinblock(b,ts)	(ct_diff2sz((ts)->contents - (b)->buff) + \
+				 (ts)->u.lnglen)
+
+
+/*
+** Create a header for a string with length 'l' in block 'b', starting
+** at 's'.
+*/
+static TString *newappstr (lua_State *L, StrBlock *b,
+                           const char *s, size_t l) {
+  size_t totalsize = luaS_sizelngstr(l, LSTRAPP);
+  TString *ts = createstrobj(L, totalsize, LUA_VLNGSTR, G(L)->seed);
+  ts->shrlen = LSTRAPP;
+  ts->u.lnglen = l;
+  ts->contents = cast_charp(s);
+  ts->ud = b;
+  b->nref++;
+  return ts;
+}
+
+
+struct NewApp {
+  StrBlock *b;
+  size_t l;
+  TString *ts;  /* output */
+};
+
+
+static void f_newapp (lua_State *L, void *ud) {
+  struct NewApp *na = cast(struct NewApp *, ud);
+  na->ts = newappstr(L, na->b, na->b->buff, na->l);
+}
+
+
+/*
+** Create the result of a concatenation with length 'l' whose first
+** operand is the long string 'ts1'. The result already starts with
+** the contents of 'ts1'; the caller must fill in the rest.
+*/
+TString *luaS_appendlngstr (lua_State *L, TString *ts1, size_t l) {
+  size_t l1 = ts1->u.lnglen;
+  size_t size = l + 1;
+  struct NewApp na;
+  lua_assert(!strisshr(ts1) && l1 < l);
+  if (ts1->shrlen == LSTRAPP) {
+    StrBlock *b = getblock(ts1);
+    size_t start = endinblock(b, ts1) - l1;  /* position of 'ts1' */
+    if (b->used == start + l1 && !b->frozen &&
+        l < b->size - start) {  /* fits after it? */
+      TString *ts = newappstr(L, b, ts1->contents, l);
+      setused(b, start + l);
+      return ts;
+    }
+    else if (l < MAX_SIZE / 3)  /* 'ts1' is growing; */
+      size += l / 2;  /* leave space for the next appends */
+  }
+  na.b = newblock(L, size, getlngstr(ts1), l1);
+  na.l = l;
+  if (luaD_rawrunprotected(L, f_newapp, &na) != LUA_OK) {  /* mem. error? */
+    luaM_freemem(L, na.b, sizeblock(size));
+    luaM_error(L);  /* re-raise memory error */
+  }
+  setused(na.b, l);
+  return na.ts;
+}
+
+
+/*
+** Make sure that the contents of the appendable string 'ts' are
+** followed by a '\0', moving them to a block of their own if needed.
+** If 'fix' is true, also ensure that this '\0' stays there.
+*/
+void luaS_fixappstr (lua_State *L, TString *ts, int fix) {
+  StrBlock *b = getblock(ts);
+  size_t l = ts->u.lnglen;
+  size_t end = endinblock(b, ts);
+  if (end < b->used && b->buff[end] != '\0') {  /* not followed by '\0'? */
+    StrBlock *nb = newblock(L, l + 1, ts->contents, l);
+    nb->nref = 1;
+    ts->contents = nb->buff;
+    ts->ud = nb;
+    unrefblock(L, b);
+  }
+  else if (fix && end == b->used)  /* ends with the longest string? */
+    b->frozen = 1;  /* its '\0' cannot be overwritten */
+}
+
+
+void luaS_freeappstr (lua_State *L, TString *ts) {
+  unrefblock(L, getblock(ts));
+}
+
+
+/*
+** Memory that would be released by freeing string 'ts': its block,
+** if it is the only string using it.
+*/
+size_t luaS_sizeappblock (TString *ts) {
+  StrBlock *b = getblock(ts);
+  return (b->nref == 1) ? sizeblock(b->size) : 0;
+}
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Substring views
+** ===================================================================
+*/
+
+/*
+** A long substring can be created as a view (kind LSTRVIEW): a header
+** pointing into the contents of its parent string, which it keeps
+** alive (the collector marks the parent together with the view). Only
+** strings whose contents never move and are owned by Lua can be parents
+** of views: regular strings and external strings allocated with the
+** allocator of the state (as those from 'luaL_pushresult'). A view of
+** a view uses the same parent. A substring of an appendable string
+** (whose contents may move) is another string in the same block.
+** As with appendable strings, the contents of a view are not always
+** followed by a '\0'; 'luaS_fixview' moves them to a block of their
+** own when needed.
+*/
+
+static int canbeparent (lua_State *L, TString *ts) {
+  global_State *g = G(L);
+  return (ts->shrlen == LSTRREG ||
+          (ts->shrlen == LSTRMEM && ts->falloc == g->frealloc &&
+                                    ts->ud == g->ud));
+}
+
+
+/*
+** Create a string with the 'l' bytes at 's', which must be inside the
+** contents of string 'ts'. If the substring is long enough, it is
+** created as a view of 'ts' (or of its parent).
+*/
+TString *luaS_newsubstr (lua_State *L, TString *ts, const char *s, size_t l) {
+  if (l >= LUAI_MINVIEWLEN && !strisshr(ts)) {
+    if (ts->shrlen == LSTRVIEW)
+      ts = getviewparent(ts);  /* share the parent of 'ts' */
+    if (ts->shrlen == LSTRAPP)  /* share the block of 'ts' */
+      return newappstr(L, getblock(ts), s, l);
+    else if (canbeparent(L, ts)) {
+      size_t totalsize = luaS_sizelngstr(l, LSTRVIEW);
+      TString *view = createstrobj(L, totalsize, LUA_VLNGSTR, G(L)->seed);
+      lua_assert(getlngstr(ts) <= s && l <= ts->u.lnglen &&
+                 ct_diff2sz(s - getlngstr(ts)) <= ts->u.lnglen - l);
+      view->shrlen = LSTRVIEW;
+      view->u.lnglen = l;
+      view->contents = cast_charp(s);
+      view->ud = ts;
+      return view;
+    }
+  }
+  return luaS_newlstr(L, s, l);
+}
+
+
+/*
+** Make sure that the contents of view 'ts' are followed by a '\0',
+** moving them to a block of their own (and making 'ts' an appendable
+** string) if needed. As the contents of parents do not change, a '\0'
+** already there stays there.
+*/
+void luaS_fixview (lua_State *L, TString *ts, int fix) {
+  size_t l = ts->u.lnglen;
+  if (ts->contents[l] != '\0') {  /* not followed by a '\0'? */
+    StrBlock *b = newblock(L, l + 1, ts->contents, l);
+    b->nref = 1;
+    b->frozen = fix;
+    ts->shrlen = LSTRAPP;
+    ts->contents = b->buff;
+    ts->ud = b;  /* 'ts' no longer needs its parent */
+  }
+}
+
+/* }================================================================== */
+
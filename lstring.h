@@ -30,6 +30,15 @@
 #endif
 
 
+/*
+** Minimum length for a substring to share the contents of its parent
+** string (see 'luaS_newsubstr')
+*/
+#if !defined(LUAI_MINVIEWLEN)
+#define LUAI_MINVIEWLEN		128
+#endif
+
+
 /*
 ** Size of a short TString: Size of the header plus space for the string
 ** itself (including final '\0').
@@ -54,6 +63,20 @@
 #define eqshrstr(a,b)	check_exp((a)->tt == LUA_VSHRSTR, (a) == (b))
 
 
+/* parent of a view */
+#define getviewparent(ts)  \
+	check_exp((ts)->shrlen == LSTRVIEW, cast(TString *, (ts)->ud))
+
+
+/*
+** make sure that the contents of string 'ts' are followed by a '\0'
+** (see 'luaS_fixappstr' and 'luaS_fixview')
+*/
+#define luaS_fixstr(L,ts,fix)  \
+	((ts)->shrlen == LSTRAPP ? luaS_fixappstr(L, ts, fix) : \
+	 (ts)->shrlen == LSTRVIEW ? luaS_fixview(L, ts, fix) : (void)0)
+
+
 LUAI_FUNC unsigned luaS_hashlongstr (TString *ts);
 LUAI_FUNC int luaS_eqstr (TString *a, TString *b);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
@@ -69,5 +92,12 @@ LUAI_FUNC TString *luaS_newextlstr (lua_State *L,
 		const char *s, size_t len, lua_Alloc falloc, void *ud);
 LUAI_FUNC size_t luaS_sizelngstr (size_t len, int kind);
 LUAI_FUNC TString *luaS_normstr (lua_State *L, TString *ts);
+LUAI_FUNC TString *luaS_appendlngstr (lua_State *L, TString *ts1, size_t l);
+LUAI_FUNC void luaS_fixappstr (lua_State *L, TString *ts, int fix);
+LUAI_FUNC void luaS_freeappstr (lua_State *L, TString *ts);
+LUAI_FUNC size_t luaS_sizeappblock (TString *ts);
+LUAI_FUNC TString *luaS_newsubstr (lua_State *L, TString *ts,
+                                   const char *s, size_t l);
+LUAI_FUNC void luaS_fixview (lua_State *L, TString *ts, int fix);
 
 #endif
@@ -88,7 +88,7 @@ static int str_sub (lua_State *L) {
   size_t start = posrelatI(luaL_checkinteger(L, 2), l);
   size_t end = getendpos(L, 3, -1, l);
   if (start <= end)
-    lua_pushlstring(L, s + start - 1, (end - start) + 1);
+    lua_pushsubstring(L, 1, s + start - 1, (end - start) + 1);
   else lua_pushliteral(L, "");
   return 1;
 }
@@ -357,11 +357,77 @@ static const luaL_Reg stringmetamethods[] = {
 #define CAP_POSITION	(-2)
 
 
+/*
+** Patterns used by 'find', 'match', 'gmatch', and 'gsub' are compiled
+** into arrays of items, so that the matcher does not parse the pattern
+** again for each position of the subject. Each state keeps the last
+** COMPCACHESIZE compiled patterns (as user values of an upvalue shared
+** by the library functions), replacing the least recently used one.
+** Patterns longer than MAXPATCOMP and malformed patterns are not
+** compiled; they are interpreted by 'match', which raises their errors
+** only if the matcher reaches them. 'cmatch' does the same recursive
+** calls as 'match', so both have the same limit MAXCCALLS.
+*/
+
+#if !defined(COMPCACHESIZE)
+#define COMPCACHESIZE	8
+#endif
+
+#if !defined(MAXPATCOMP)
+#define MAXPATCOMP	128
+#endif
+
+
+/* kinds of items in a compiled pattern */
+#define PI_CHAR		0	/* literal character */
+#define PI_ANY		1	/* '.' */
+#define PI_CLASS	2	/* '%' plus a letter */
+#define PI_SET		3	/* '[set]' */
+#define PI_OPEN		4	/* '(' */
+#define PI_POSITION	5	/* '()' */
+#define PI_CLOSE	6	/* ')' */
+#define PI_BALANCE	7	/* '%bxy' */
+#define PI_FRONTIER	8	/* '%f[set]' */
+#define PI_BACKREF	9	/* '%0'-'%9' */
+#define PI_EOS		10	/* '$' at the end of the pattern */
+#define PI_END		11	/* end of pattern */
+
+/* does item match a single character (with an optional suffix)? */
+#define issingle(it)	((it)->kind <= PI_SET)
+
+/* does item have to match the next character (no empty match)? */
+#define needschar(it)  \
+	(issingle(it) && ((it)->rep == '\0' || (it)->rep == '+'))
+
+/* size of the bitmap of a set */
+#define SETSIZE		(UCHAR_MAX / CHAR_BIT + 1)
+
+
+typedef struct PatItem {
+  unsigned char kind;
+  unsigned char rep;  /* suffix ('*', '+', '-', or '?') or '\0' */
+  unsigned char c;  /* character, class, or capture index */
+  const unsigned char *set;  /* bitmap of a set (NULL if none) */
+  const char *p;  /* item in the pattern ('[' for sets, 'xy' for '%b') */
+  const char *ec;  /* closing ']' of a set */
+} PatItem;
+
+
+typedef struct Pattern {
+  const PatItem *first;  /* first item after the opening captures */
+  const char *prefix;  /* literal prefix of the pattern */
+  size_t lprefix;  /* its length */
+  PatItem item[1];  /* items, ending with a PI_END */
+} Pattern;
+
+
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end ('\0') of source string */
   const char *p_end;  /* end ('\0') of pattern */
+  const PatItem *items;  /* compiled pattern (NULL if not compiled) */
   lua_State *L;
+  int src_idx;  /* index of source string (for captures) */
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   int level;  /* total number of captures (finished or unfinished) */
   struct {
@@ -402,19 +468,23 @@ static int capture_to_close (MatchState *ms) {
 }
 
 
-static const char *classend (MatchState *ms, const char *p) {
+/*
+** Return the end of the single-char class at 'p', or NULL if the class
+** is malformed.
+*/
+static const char *findclassend (const char *p, const char *p_end) {
   switch (*p++) {
     case L_ESC: {
-      if (l_unlikely(p == ms->p_end))
-        luaL_error(ms->L, "malformed pattern (ends with '%%')");
+      if (l_unlikely(p == p_end))
+        return NULL;  /* pattern ends with '%' */
       return p+1;
     }
     case '[': {
       if (*p == '^') p++;
       do {  /* look for a ']' */
-        if (l_unlikely(p == ms->p_end))
-          luaL_error(ms->L, "malformed pattern (missing ']')");
-        if (*(p++) == L_ESC && p < ms->p_end)
+        if (l_unlikely(p == p_end))
+          return NULL;  /* missing ']' */
+        if (*(p++) == L_ESC && p < p_end)
           p++;  /* skip escapes (e.g. '%]') */
       } while (*p != ']');
       return p+1;
@@ -426,6 +496,18 @@ static const char *classend (MatchState *ms, const char *p) {
 }
 
 
+static const char *classend (MatchState *ms, const char *p) {
+  const char *ep = findclassend(p, ms->p_end);
+  if (l_unlikely(ep == NULL)) {
+    if (*p == L_ESC)
+      luaL_error(ms->L, "malformed pattern (ends with '%%')");
+    else
+      luaL_error(ms->L, "malformed pattern (missing ']')");
+  }
+  return ep;
+}
+
+
 static int match_class (int c, int cl) {
   int res;
   switch (tolower(cl)) {
@@ -485,10 +567,9 @@ static int singlematch (MatchState *ms, const char *s, const char *p,
 }
 
 
-static const char *matchbalance (MatchState *ms, const char *s,
-                                   const char *p) {
-  if (l_unlikely(p >= ms->p_end - 1))
-    luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
+/* match a balanced string with delimiters 'p[0]' and 'p[1]' */
+static const char *balance (MatchState *ms, const char *s,
+                              const char *p) {
   if (*s != *p) return NULL;
   else {
     int b = *p;
@@ -505,6 +586,14 @@ static const char *matchbalance (MatchState *ms, const char *s,
 }
 
 
+static const char *matchbalance (MatchState *ms, const char *s,
+                                   const char *p) {
+  if (l_unlikely(p >= ms->p_end - 1))
+    luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
+  return balance(ms, s, p);
+}
+
+
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
@@ -672,28 +761,615 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+/*
+** Two-Way string matching (Crochemore-Perrin): find 'n' (with length
+** 'ln' > 1) in 'h' (with length 'lh'), in time linear on 'lh' and using
+** constant space. The needle is split in two halves, at its critical
+** factorization; the right half is compared from left to right and the
+** left half from right to left. For periodic needles, 'mem' remembers
+** the prefix already known to match after a shift by the period. The
+** last byte of each window is checked first, to shift the window as in
+** Boyer-Moore-Horspool when that byte cannot end a match.
+** This is an adaptation of 'twoway_memmem' from musl libc
+** (src/string/memmem.c), distributed under the following notice:
+**
+** Copyright (C) 2005-2020 Rich Felker, et al.
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+static const char *twoway (const char *h, size_t lh,
+                           const char *n, size_t ln) {
+  const unsigned char *uh = (const unsigned char *)h;
+  const unsigned char *un = (const unsigned char *)n;
+  const unsigned char *eh = uh + lh;
+  size_t shift[UCHAR_MAX + 1];  /* last position of each byte, plus one */
+  unsigned char inneedle[SETSIZE];  /* bytes present in the needle */
+  size_t i, j, k, p, ms, p0, mem, mem0;
+  memset(inneedle, 0, sizeof(inneedle));
+  for (i = 0; i < ln; i++) {
+    inneedle[un[i] / CHAR_BIT] |= cast_byte(1u << (un[i] % CHAR_BIT));
+    shift[un[i]] = i + 1;
+  }
+  /* compute maximal suffix for '<' ('i' starts at -1 modulo 2^n) */
+  i = ~(size_t)0; j = 0; k = p = 1;
+  while (j + k < ln) {
+    if (un[i + k] == un[j + k]) {
+      if (k == p) { j += p; k = 1; }
+      else k++;
+    }
+    else if (un[i + k] > un[j + k]) { j += k; k = 1; p = j - i; }
+    else { i = j++; k = p = 1; }
+  }
+  ms = i; p0 = p;
+  /* and for '>' */
+  i = ~(size_t)0; j = 0; k = p = 1;
+  while (j + k < ln) {
+    if (un[i + k] == un[j + k]) {
+      if (k == p) { j += p; k = 1; }
+      else k++;
+    }
+    else if (un[i + k] < un[j + k]) { j += k; k = 1; p = j - i; }
+    else { i = j++; k = p = 1; }
+  }
+  if (i + 1 > ms + 1) ms = i;  /* keep the longest suffix */
+  else p = p0;
+  if (memcmp(un, un + p, ms + 1) != 0) {  /* not periodic? */
+    mem0 = 0;
+    p = ((ms > ln - ms - 1) ? ms : ln - ms - 1) + 1;
+  }
+  else mem0 = ln - p;
+  mem = 0;
+  while (ct_diff2sz(eh - uh) >= ln) {
+    int c = uh[ln - 1];  /* last byte of the window */
+    if (!((inneedle[c / CHAR_BIT] >> (c % CHAR_BIT)) & 1)) {
+      uh += ln;  /* no match can contain that byte */
+      mem = 0;
+      continue;
+    }
+    k = ln - shift[c];
+    if (k != 0) {  /* shift to align its last occurrence in the needle */
+      uh += (k < mem) ? mem : k;
+      mem = 0;
+      continue;
+    }
+    /* compare right half */
+    for (k = (ms + 1 > mem) ? ms + 1 : mem; k < ln && un[k] == uh[k]; k++)
+      ;
+    if (k < ln) {
+      uh += k - ms;
+      mem = 0;
+      continue;
+    }
+    /* compare left half */
+    for (k = ms + 1; k > mem && un[k - 1] == uh[k - 1]; k--)
+      ;
+    if (k <= mem)
+      return (const char *)uh;
+    uh += p;
+    mem = mem0;
+  }
+  return NULL;  /* not found */
+}
+
+
+/*
+** Work (in bytes compared) that 'lmemfind' allows in its simple loop
+** besides the length already searched, before changing to 'twoway'.
+*/
+#define MEMFINDWORK	256
+
+
+/*
+** Find 's2' inside 's1'. The simple search with 'memchr' for the first
+** byte is the fastest for most inputs, but it is quadratic when there
+** are too many partial matches (e.g., "aaab" in "aaaa...a"). So, it
+** counts the bytes compared by 'memcmp' and, when they exceed the
+** length already searched (plus MEMFINDWORK), it finishes the search
+** with 'twoway', keeping the search linear.
+*/
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
+  else if (l2 == 1) return (const char *)memchr(s1, *s2, l1);
   else {
-    const char *init;  /* to search for a '*s2' inside 's1' */
-    l2--;  /* 1st char will be checked by 'memchr' */
-    l1 = l1-l2;  /* 's2' cannot be found after that */
-    while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
-      init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
-        return init-1;
-      else {  /* correct 'l1' and 's1' to try again */
-        l1 -= ct_diff2sz(init - s1);
-        s1 = init;
+    const char *init = s1;  /* start of the search */
+    const char *end = s1 + (l1 - l2) + 1;  /* 's2' cannot start after it */
+    size_t work = 0;  /* bytes compared by 'memcmp' */
+    const char *p;  /* to search for a '*s2' inside 's1' */
+    while (s1 < end &&
+           (p = (const char *)memchr(s1, *s2, ct_diff2sz(end - s1))) != NULL) {
+      if (p[l2 - 1] == s2[l2 - 1]) {  /* last byte matches, too? */
+        if (memcmp(p + 1, s2 + 1, l2 - 2) == 0)
+          return p;
+        work += l2;
+        if (work > ct_diff2sz(p - init) + MEMFINDWORK)  /* too slow? */
+          return twoway(p, l1 - ct_diff2sz(p - init), s2, l2);
       }
+      s1 = p + 1;  /* try again after 'p' */
     }
     return NULL;  /* not found */
   }
 }
 
 
+/*
+** {======================================================
+** Compiled patterns
+** =======================================================
+*/
+
+/* is 'c' a valid suffix of a single-char class? */
+#define isrep(c)	((c) == '*' || (c) == '+' || (c) == '-' || (c) == '?')
+
+
+static int inset (const PatItem *it, int c) {
+  if (it->set != NULL)
+    return (it->set[c / CHAR_BIT] >> (c % CHAR_BIT)) & 1;
+  else  /* set uses classes, which depend on the locale */
+    return matchbracketclass(c, it->p, it->ec);
+}
+
+
+static int csinglematch (MatchState *ms, const char *s,
+                         const PatItem *it) {
+  if (s >= ms->src_end)
+    return 0;
+  else {
+    int c = cast_uchar(*s);
+    switch (it->kind) {
+      case PI_CHAR: return (it->c == c);
+      case PI_ANY: return 1;  /* matches any char */
+      case PI_CLASS: return match_class(c, it->c);
+      default: lua_assert(it->kind == PI_SET); return inset(it, c);
+    }
+  }
+}
+
+
+/*
+** True when a match of item 'it' at 's' surely fails at its first
+** character, so that calling 'cmatch' is useless. (The call is done
+** anyway when it would raise a "pattern too complex" error.)
+*/
+#define cannotmatch(ms,s,it)  \
+	(needschar(it) && (ms)->matchdepth > 0 && !csinglematch(ms, s, it))
+
+
+/* recursive function */
+static const char *cmatch (MatchState *ms, const char *s,
+                           const PatItem *it);
+
+
+static const char *cmax_expand (MatchState *ms, const char *s,
+                                  const PatItem *it) {
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  while (csinglematch(ms, s + i, it))
+    i++;
+  /* keeps trying to match with the maximum repetitions */
+  while (i>=0) {
+    if (!cannotmatch(ms, s + i, it + 1)) {
+      const char *res = cmatch(ms, (s+i), it + 1);
+      if (res) return res;
+    }
+    i--;  /* else didn't match; reduce 1 repetition to try again */
+  }
+  return NULL;
+}
+
+
+static const char *cmin_expand (MatchState *ms, const char *s,
+                                  const PatItem *it) {
+  for (;;) {
+    if (!cannotmatch(ms, s, it + 1)) {
+      const char *res = cmatch(ms, s, it + 1);
+      if (res != NULL)
+        return res;
+    }
+    if (csinglematch(ms, s, it))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *cstart_capture (MatchState *ms, const char *s,
+                                     const PatItem *it, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=cmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *cend_capture (MatchState *ms, const char *s,
+                                   const PatItem *it) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = cmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+/*
+** Same as 'match', for a compiled pattern.
+*/
+static const char *cmatch (MatchState *ms, const char *s,
+                           const PatItem *it) {
+  if (l_unlikely(ms->matchdepth-- == 0))
+    luaL_error(ms->L, "pattern too complex");
+  init: /* using goto to optimize tail recursion */
+  switch (it->kind) {
+    case PI_END: break;  /* end of pattern */
+    case PI_OPEN: {  /* start capture */
+      s = cstart_capture(ms, s, it + 1, CAP_UNFINISHED);
+      break;
+    }
+    case PI_POSITION: {  /* start position capture */
+      s = cstart_capture(ms, s, it + 1, CAP_POSITION);
+      break;
+    }
+    case PI_CLOSE: {  /* end capture */
+      s = cend_capture(ms, s, it + 1);
+      break;
+    }
+    case PI_EOS: {  /* check end of string */
+      s = (s == ms->src_end) ? s : NULL;
+      break;
+    }
+    case PI_BALANCE: {
+      s = balance(ms, s, it->p);
+      if (s != NULL) {
+        it++; goto init;  /* return cmatch(ms, s, it + 1); */
+      }  /* else fail (s == NULL) */
+      break;
+    }
+    case PI_FRONTIER: {
+      int previous = (s == ms->src_init) ? '\0' : cast_uchar(*(s - 1));
+      if (!inset(it, previous) && inset(it, cast_uchar(*s))) {
+        it++; goto init;  /* return cmatch(ms, s, it + 1); */
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case PI_BACKREF: {
+      s = match_capture(ms, s, it->c);
+      if (s != NULL) {
+        it++; goto init;  /* return cmatch(ms, s, it + 1); */
+      }
+      break;
+    }
+    default: {  /* single-char class plus optional suffix */
+      /* does not match at least once? */
+      if (!csinglematch(ms, s, it)) {
+        if (it->rep == '*' || it->rep == '?' || it->rep == '-') {
+          it++; goto init;  /* accept empty */
+        }
+        else  /* '+' or no suffix */
+          s = NULL;  /* fail */
+      }
+      else {  /* matched once */
+        switch (it->rep) {  /* handle optional suffix */
+          case '?': {  /* optional */
+            const char *res;
+            if ((res = cmatch(ms, s + 1, it + 1)) != NULL)
+              s = res;
+            else {
+              it++; goto init;  /* else return cmatch(ms, s, it + 1); */
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+            /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = cmax_expand(ms, s, it);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = cmin_expand(ms, s, it);
+            break;
+          default:  /* no suffix */
+            s++; it++; goto init;  /* return cmatch(ms, s + 1, it + 1); */
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+
+/*
+** Compile the set 'p'..'ec' (from '[' to ']') into a bitmap. Sets with
+** classes ('%a', etc.) are left to 'matchbracketclass', as the result of
+** a class depends on the current locale.
+*/
+static void compileset (PatItem *it, unsigned char *set,
+                        const char *p, const char *ec) {
+  const char *q;
+  int c;
+  it->p = p; it->ec = ec;
+  for (q = p + 1; q < ec; q++) {
+    if (*q == L_ESC && isalpha(cast_uchar(*++q))) {
+      it->set = NULL;  /* use 'matchbracketclass' */
+      return;
+    }
+  }
+  memset(set, 0, SETSIZE);
+  for (c = 0; c <= UCHAR_MAX; c++) {
+    if (matchbracketclass(c, p, ec))
+      set[c / CHAR_BIT] |= cast_byte(1u << (c % CHAR_BIT));
+  }
+  it->set = set;
+}
+
+
+/* size of a compiled pattern for a pattern of length 'lp' */
+#define sizepattern(lp)  \
+	(sizeof(Pattern) + (lp) * sizeof(PatItem) + ((lp) / 3) * SETSIZE + (lp))
+
+
+/*
+** Compile pattern 'p' into 'pat', which must have 'sizepattern(lp)'
+** bytes. Each item uses at least one character of the pattern, and
+** each set at least three, so 'pat' has space for all of them. Return
+** false if the pattern is malformed. A leading '^' is compiled as a
+** plain character, so that 'pat->item + 1' is the pattern without its
+** anchor; patterns where this is not true (a '^' followed by a suffix)
+** are not compiled.
+*/
+static int compile (Pattern *pat, const char *p, size_t lp) {
+  const char *p_end = p + lp;
+  PatItem *it = pat->item;
+  unsigned char *set = (unsigned char *)(pat->item + lp + 1);
+  char *prefix = (char *)(set + (lp / 3) * SETSIZE);
+  if (*p == '^' && isrep(*(p + 1)) && p + 1 < p_end)
+    return 0;
+  for (; p < p_end; it++) {
+    it->rep = '\0';
+    it->set = NULL;
+    switch (*p) {
+      case '(': {
+        if (*(p + 1) == ')') {  /* position capture? */
+          it->kind = PI_POSITION; p += 2;
+        }
+        else {
+          it->kind = PI_OPEN; p++;
+        }
+        break;
+      }
+      case ')': {
+        it->kind = PI_CLOSE; p++;
+        break;
+      }
+      case '$': {
+        if ((p + 1) != p_end)  /* is the '$' the last char in pattern? */
+          goto dflt;  /* no; go to default */
+        it->kind = PI_EOS; p++;
+        break;
+      }
+      case L_ESC: {
+        switch (*(p + 1)) {
+          case 'b': {
+            if (p + 2 >= p_end - 1)
+              return 0;  /* missing arguments to '%b' */
+            it->kind = PI_BALANCE; it->p = p + 2; p += 4;
+            break;
+          }
+          case 'f': {
+            const char *ep;
+            p += 2;
+            if (*p != '[' || (ep = findclassend(p, p_end)) == NULL)
+              return 0;
+            it->kind = PI_FRONTIER;
+            compileset(it, set, p, ep - 1);
+            set += SETSIZE;
+            p = ep;
+            break;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            it->kind = PI_BACKREF; it->c = cast_uchar(*(p + 1)); p += 2;
+            break;
+          }
+          default: goto dflt;
+        }
+        break;
+      }
+      default: dflt: {
+        const char *ep = findclassend(p, p_end);
+        if (ep == NULL)
+          return 0;  /* malformed class */
+        switch (*p) {
+          case '.': it->kind = PI_ANY; break;
+          case L_ESC: {  /* a class only when followed by a letter */
+            it->kind = isalpha(cast_uchar(*(p + 1))) ? PI_CLASS : PI_CHAR;
+            it->c = cast_uchar(*(p + 1));
+            break;
+          }
+          case '[': {
+            it->kind = PI_SET;
+            compileset(it, set, p, ep - 1);
+            set += SETSIZE;
+            break;
+          }
+          default: it->kind = PI_CHAR; it->c = cast_uchar(*p); break;
+        }
+        if (isrep(*ep))
+          it->rep = cast_uchar(*ep++);
+        p = ep;
+        break;
+      }
+    }
+  }
+  it->kind = PI_END;
+  for (it = pat->item; it->kind == PI_OPEN || it->kind == PI_POSITION; it++) {
+    if (it - pat->item == LUA_MAXCAPTURES)
+      break;  /* next one will raise an error */
+  }
+  pat->first = it;
+  pat->prefix = prefix;
+  pat->lprefix = 0;
+  for (; it->kind == PI_CHAR && it->rep == '\0'; it++)
+    prefix[pat->lprefix++] = cast_char(it->c);
+  return 1;
+}
+
+
+/*
+** Return the first position from 's' where a match for 'pat' can start,
+** or NULL if there is none: after its opening captures, a match must
+** start with the literal prefix of the pattern or, at least, with a
+** character matching its first item.
+*/
+static const char *firstpos (MatchState *ms, const Pattern *pat,
+                             const char *s) {
+  if (pat->lprefix > 0)
+    return lmemfind(s, ct_diff2sz(ms->src_end - s),
+                       pat->prefix, pat->lprefix);
+  else if (needschar(pat->first)) {
+    for (; s < ms->src_end; s++) {
+      if (csinglematch(ms, s, pat->first))
+        return s;
+    }
+    return NULL;
+  }
+  else
+    return s;
+}
+
+
+/*
+** Cache of compiled strings (patterns or formats). Entries are kept
+** alive by the user values of the cache.
+*/
+typedef struct CompCache {
+  size_t clock;  /* counts uses of the cache */
+  struct {
+    const char *p;  /* source string (kept alive by its compiled form) */
+    size_t lp;  /* length of the source string */
+    size_t time;  /* last use of this entry */
+    const void *comp;  /* compiled form (NULL if entry is empty) */
+  } entry[COMPCACHESIZE];
+} CompCache;
+
+
+static void newcompcache (lua_State *L) {
+  CompCache *cc = (CompCache *)lua_newuserdatauv(L, sizeof(CompCache),
+                                                    COMPCACHESIZE);
+  int i;
+  cc->clock = 0;
+  for (i = 0; i < COMPCACHESIZE; i++) {
+    cc->entry[i].p = NULL;
+    cc->entry[i].lp = 0;
+    cc->entry[i].time = 0;
+    cc->entry[i].comp = NULL;
+  }
+}
+
+
+/* function to compile a string into a block; returns false on errors */
+typedef int (*Compiler) (lua_State *L, void *comp, const char *p, size_t lp);
+
+
+/*
+** Get the compiled form of string 'p' (with length 'lp', at index 'arg'
+** of the stack), from the cache at upvalue 'cache' of the calling
+** function or compiling it with 'compile' into a new block of 'size'
+** bytes. Push the userdata with the compiled form, to keep it alive
+** while in use, or nil if the string cannot be compiled.
+*/
+static const void *getcompiled (lua_State *L, int cache, int arg,
+                                const char *p, size_t lp,
+                                size_t size, Compiler compilef) {
+  int idx = lua_upvalueindex(cache);
+  CompCache *cc = (CompCache *)lua_touserdata(L, idx);
+  void *comp;
+  int i, lru = 0;
+  for (i = 0; i < COMPCACHESIZE; i++) {
+    if (cc->entry[i].comp != NULL && cc->entry[i].lp == lp &&
+        (cc->entry[i].p == p || memcmp(cc->entry[i].p, p, lp) == 0)) {
+      cc->entry[i].time = ++cc->clock;
+      lua_getiuservalue(L, idx, i + 1);
+      return cc->entry[i].comp;
+    }
+    else if (cc->entry[i].time < cc->entry[lru].time)
+      lru = i;
+  }
+  comp = lua_newuserdatauv(L, size, 1);
+  if (!compilef(L, comp, p, lp)) {  /* malformed string? */
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    return NULL;  /* let the interpreter raise the errors */
+  }
+  lua_pushvalue(L, arg);
+  lua_setiuservalue(L, -2, 1);  /* keep the string in its compiled form */
+  lua_pushvalue(L, -1);
+  lua_setiuservalue(L, idx, lru + 1);  /* replace entry */
+  cc->entry[lru].p = p;
+  cc->entry[lru].lp = lp;
+  cc->entry[lru].time = ++cc->clock;
+  cc->entry[lru].comp = comp;
+  return comp;
+}
+
+
+static int compilepattern (lua_State *L, void *comp,
+                           const char *p, size_t lp) {
+  (void)L;  /* not used */
+  return compile((Pattern *)comp, p, lp);
+}
+
+
+/*
+** Get the compiled form of pattern 'p' (see 'getcompiled'). The cache
+** of patterns is the first upvalue of the calling function.
+*/
+static const Pattern *getpattern (lua_State *L, int arg,
+                                  const char *p, size_t lp) {
+  if (lp > MAXPATCOMP) {  /* too long? */
+    lua_pushnil(L);
+    return NULL;  /* do not compile it */
+  }
+  return (const Pattern *)getcompiled(L, 1, arg, p, lp, sizepattern(lp),
+                                      compilepattern);
+}
+
+
+/* match against the compiled pattern, if there is one */
+#define domatch(ms,s,p)  \
+	((ms)->items ? cmatch(ms, s, (ms)->items) : match(ms, s, p))
+
+/* }====================================================== */
+
+
+
 /*
 ** get information about the i-th capture. If there are no captures
 ** and 'i==0', return information about the whole match, which
@@ -730,7 +1406,7 @@ static void push_onecapture (MatchState *ms, int i, const char *s,
   const char *cap;
   ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
   if (l != CAP_POSITION)
-    lua_pushlstring(ms->L, cap, cast_sizet(l));
+    lua_pushsubstring(ms->L, ms->src_idx, cap, cast_sizet(l));
   /* else position was already pushed */
 }
 
@@ -760,10 +1436,12 @@ static int nospecials (const char *p, size_t l) {
 static void prepstate (MatchState *ms, lua_State *L,
                        const char *s, size_t ls, const char *p, size_t lp) {
   ms->L = L;
+  ms->src_idx = 1;  /* source is the first argument */
   ms->matchdepth = MAXCCALLS;
   ms->src_init = s;
   ms->src_end = s + ls;
   ms->p_end = p + lp;
+  ms->items = NULL;
 }
 
 
@@ -795,15 +1473,20 @@ static int str_find_aux (lua_State *L, int find) {
   else {
     MatchState ms;
     const char *s1 = s + init;
+    const Pattern *pat = getpattern(L, 2, p, lp);
     int anchor = (*p == '^');
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
     prepstate(&ms, L, s, ls, p, lp);
+    if (pat != NULL)
+      ms.items = pat->item + anchor;
     do {
       const char *res;
+      if (pat != NULL && !anchor && (s1 = firstpos(&ms, pat, s1)) == NULL)
+        break;  /* pattern cannot match anywhere else */
       reprepstate(&ms);
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if ((res=domatch(&ms, s1, p)) != NULL) {
         if (find) {
           lua_pushinteger(L, ct_diff2S(s1 - s) + 1);  /* start */
           lua_pushinteger(L, ct_diff2S(res - s));   /* end */
@@ -834,6 +1517,7 @@ typedef struct GMatchState {
   const char *src;  /* current position */
   const char *p;  /* pattern */
   const char *lastmatch;  /* end of last match */
+  const Pattern *pat;  /* compiled pattern (NULL if not compiled) */
   MatchState ms;  /* match state */
 } GMatchState;
 
@@ -844,8 +1528,10 @@ static int gmatch_aux (lua_State *L) {
   gm->ms.L = L;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
+    if (gm->pat != NULL && (src = firstpos(&gm->ms, gm->pat, src)) == NULL)
+      break;  /* pattern cannot match anywhere else */
     reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
+    if ((e = domatch(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
       return push_captures(&gm->ms, src, e);
     }
@@ -865,8 +1551,12 @@ static int gmatch (lua_State *L) {
   if (init > ls)  /* start after string's end? */
     init = ls + 1;  /* avoid overflows in 's + init' */
   prepstate(&gm->ms, L, s, ls, p, lp);
+  gm->ms.src_idx = lua_upvalueindex(1);
   gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
-  lua_pushcclosure(L, gmatch_aux, 3);
+  gm->pat = getpattern(L, 2, p, lp);  /* keep it on closure, too */
+  if (gm->pat != NULL)
+    gm->ms.items = gm->pat->item;  /* no anchors in 'gmatch' */
+  lua_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -953,20 +1643,31 @@ static int str_gsub (lua_State *L) {
   int anchor = (*p == '^');
   lua_Integer n = 0;  /* replacement count */
   int changed = 0;  /* change flag */
+  const Pattern *pat;
   MatchState ms;
   luaL_Buffer b;
   luaL_argexpected(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table");
+  pat = getpattern(L, 2, p, lp);
   luaL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
   prepstate(&ms, L, src, srcl, p, lp);
+  if (pat != NULL)
+    ms.items = pat->item + anchor;
   while (n < max_s) {
     const char *e;
+    if (pat != NULL && !anchor) {
+      const char *f = firstpos(&ms, pat, src);
+      if (f == NULL)
+        break;  /* pattern cannot match anywhere else */
+      luaL_addlstring(&b, src, ct_diff2sz(f - src));  /* skip to 'f' */
+      src = f;
+    }
     reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+    if ((e = domatch(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
       n++;
       changed = add_value(&ms, &b, src, e, tr) || changed;
       src = lastmatch = e;
@@ -1123,7 +1824,22 @@ static int lua_number2strx (lua_State *L, char *buff, unsigned sz,
 #define MAX_FORMAT	32
 
 
-static void addquoted (luaL_Buffer *b, const char *s, size_t len) {
+/*
+** Convert an integer to decimal, as LUA_INTEGER_FMT does, without the
+** cost of 'sprintf': 'lua_numbertocstring' uses the conversion of the
+** core (see 'lua_integer2str'). Used by the common formats '%d' and
+** '%q'. Returns the length of the result (without the final zero).
+*/
+static int int2dec (lua_State *L, char *buff, lua_Integer n) {
+  int len;
+  lua_pushinteger(L, n);
+  len = cast_int(lua_numbertocstring(L, -1, buff)) - 1;  /* minus '\0' */
+  lua_pop(L, 1);
+  return len;
+}
+
+
+static void addquoted (luaL_Buffer *b, const char *s, size_t len) {
   luaL_addchar(b, '"');
   while (len--) {
     if (*s == '"' || *s == '\\' || *s == '\n') {
@@ -1148,7 +1864,9 @@ static void addquoted (luaL_Buffer *b, const char *s, size_t len) {
 
 /*
 ** Serialize a floating-point number in such a way that it can be
-** scanned back by Lua. Use hexadecimal format for "common" numbers
+** scanned back by Lua. "Common" numbers use the shortest decimal
+** numeral that reads back as the same number, when Lua has that
+** conversion (see LUAI_NUMSHORTEST), or else the hexadecimal format
 ** (to preserve precision); inf, -inf, and NaN are handled separately.
 ** (NaN cannot be expressed as a numeral, so we write '(0/0)' for it.)
 */
@@ -1160,9 +1878,20 @@ static int quotefloat (lua_State *L, char *buff, lua_Number n) {
     s = "-1e9999";
   else if (n != n)  /* NaN? */
     s = "(0/0)";
-  else {  /* format number as hexadecimal */
+  else {
+#if LUAI_NUMSHORTEST
+    size_t len;
+    int nb;
+    lua_pushnumber(L, n);  /* let 'lua_tolstring' convert it */
+    s = lua_tolstring(L, -1, &len);
+    memcpy(buff, s, len);
+    nb = cast_int(len);
+    lua_pop(L, 1);
+#else
+    /* format number as hexadecimal */
     int  nb = lua_number2strx(L, buff, MAX_ITEM,
                                  "%" LUA_NUMBER_FRMLEN "a", n);
+#endif
     /* ensures that 'buff' string uses a dot as the radix character */
     if (memchr(buff, '.', cast_uint(nb)) == NULL) {  /* no dot? */
       char point = lua_getlocaledecpoint();  /* try locale point */
@@ -1191,10 +1920,11 @@ static void addliteral (lua_State *L, luaL_Buffer *b, int arg) {
         nb = quotefloat(L, buff, lua_tonumber(L, arg));
       else {  /* integers */
         lua_Integer n = lua_tointeger(L, arg);
-        const char *format = (n == LUA_MININTEGER)  /* corner case? */
-                           ? "0x%" LUA_INTEGER_FRMLEN "x"  /* use hex */
-                           : LUA_INTEGER_FMT;  /* else use default format */
-        nb = l_sprintf(buff, MAX_ITEM, format, (LUAI_UACINT)n);
+        if (n == LUA_MININTEGER)  /* corner case? */
+          nb = l_sprintf(buff, MAX_ITEM, "0x%" LUA_INTEGER_FRMLEN "x",
+                                         (LUAI_UACINT)n);  /* use hex */
+        else  /* else use default format */
+          nb = int2dec(L, buff, n);
       }
       luaL_addsize(b, cast_uint(nb));
       break;
@@ -1226,8 +1956,8 @@ static const char *get2digits (const char *s) {
 ** be a valid conversion specifier. 'flags' are the accepted flags;
 ** 'precision' signals whether to accept a precision.
 */
-static void checkformat (lua_State *L, const char *form, const char *flags,
-                                       int precision) {
+static int validformat (const char *form, const char *flags,
+                                          int precision) {
   const char *spec = form + 1;  /* skip '%' */
   spec += strspn(spec, flags);  /* skip flags */
   if (*spec != '0') {  /* a width cannot start with '0' */
@@ -1237,7 +1967,13 @@ static void checkformat (lua_State *L, const char *form, const char *flags,
       spec = get2digits(spec);  /* skip precision */
     }
   }
-  if (!isalpha(cast_uchar(*spec)))  /* did not go to the end? */
+  return isalpha(cast_uchar(*spec));  /* went to the end? */
+}
+
+
+static void checkformat (lua_State *L, const char *form, const char *flags,
+                                       int precision) {
+  if (!validformat(form, flags, precision))
     luaL_error(L, "invalid conversion specification: '%s'", form);
 }
 
@@ -1274,109 +2010,634 @@ static void addlenmod (char *form, const char *lenmod) {
 }
 
 
-static int str_format (lua_State *L) {
-  int top = lua_gettop(L);
-  int arg = 1;
+/*
+** Add to buffer 'b' the result of the conversion specification 'form'
+** applied to the value at index 'arg'.
+*/
+static void addconv (lua_State *L, luaL_Buffer *b, int arg, char *form) {
+  unsigned maxitem = MAX_ITEM;  /* maximum length for the result */
+  char *buff = luaL_prepbuffsize(b, maxitem);  /* to put result */
+  int nb = 0;  /* number of bytes in result */
+  const char *flags;
+  switch (form[strlen(form) - 1]) {
+    case 'c': {
+      checkformat(L, form, L_FMTFLAGSC, 0);
+      nb = l_sprintf(buff, maxitem, form, (int)luaL_checkinteger(L, arg));
+      break;
+    }
+    case 'd': case 'i':
+      if (form[2] == '\0') {  /* no modifiers? */
+        nb = int2dec(L, buff, luaL_checkinteger(L, arg));
+        break;
+      }
+      flags = L_FMTFLAGSI;
+      goto intcase;
+    case 'u':
+      flags = L_FMTFLAGSU;
+      goto intcase;
+    case 'o': case 'x': case 'X':
+      flags = L_FMTFLAGSX;
+     intcase: {
+      lua_Integer n = luaL_checkinteger(L, arg);
+      checkformat(L, form, flags, 1);
+      addlenmod(form, LUA_INTEGER_FRMLEN);
+      nb = l_sprintf(buff, maxitem, form, (LUAI_UACINT)n);
+      break;
+    }
+    case 'a': case 'A':
+      checkformat(L, form, L_FMTFLAGSF, 1);
+      addlenmod(form, LUA_NUMBER_FRMLEN);
+      nb = lua_number2strx(L, buff, maxitem, form,
+                              luaL_checknumber(L, arg));
+      break;
+    case 'f':
+      maxitem = MAX_ITEMF;  /* extra space for '%f' */
+      buff = luaL_prepbuffsize(b, maxitem);
+      /* FALLTHROUGH */
+    case 'e': case 'E': case 'g': case 'G': {
+      lua_Number n = luaL_checknumber(L, arg);
+      checkformat(L, form, L_FMTFLAGSF, 1);
+      addlenmod(form, LUA_NUMBER_FRMLEN);
+      nb = l_sprintf(buff, maxitem, form, (LUAI_UACNUMBER)n);
+      break;
+    }
+    case 'p': {
+      const void *p = lua_topointer(L, arg);
+      checkformat(L, form, L_FMTFLAGSC, 0);
+      if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
+        p = "(null)";  /* result */
+        form[strlen(form) - 1] = 's';  /* format it as a string */
+      }
+      nb = l_sprintf(buff, maxitem, form, p);
+      break;
+    }
+    case 'q': {
+      if (form[2] != '\0')  /* modifiers? */
+        luaL_error(L, "specifier '%%q' cannot have modifiers");
+      addliteral(L, b, arg);
+      break;
+    }
+    case 's': {
+      size_t l;
+      const char *s = luaL_tolstring(L, arg, &l);
+      if (form[2] == '\0')  /* no modifiers? */
+        luaL_addvalue(b);  /* keep entire string */
+      else {
+        luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+        checkformat(L, form, L_FMTFLAGSC, 1);
+        if (strchr(form, '.') == NULL && l >= 100) {
+          /* no precision and string is too long to be formatted */
+          luaL_addvalue(b);  /* keep entire string */
+        }
+        else {  /* format the string into 'buff' */
+          nb = l_sprintf(buff, maxitem, form, s);
+          lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
+        }
+      }
+      break;
+    }
+    default: {  /* also treat cases 'pnLlh' */
+      luaL_error(L, "invalid conversion '%s' to 'format'", form);
+    }
+  }
+  lua_assert(cast_uint(nb) < maxitem);
+  luaL_addsize(b, cast_uint(nb));
+}
+
+
+/*
+** Formats used by 'format' and 'putf' are compiled into arrays of
+** items, each one with a literal text and a conversion. Compiled
+** formats are kept in a cache like the one for patterns (the second
+** upvalue of the library functions). Common conversions ('%d', '%i',
+** '%x', '%X', '%s', and '%f', with their flags, width, and precision)
+** are done directly, without 'sprintf'. Formats longer than MAXFMTCOMP
+** and malformed formats are not compiled; they are interpreted by
+** 'addformat', which raises their errors in the right order.
+*/
+
+#if !defined(MAXFMTCOMP)
+#define MAXFMTCOMP	256
+#endif
+
+
+/* kinds of conversions in a compiled format */
+#define FMTNONE		0	/* no conversion ('%%' or end of format) */
+#define FMTINT		1	/* '%d' or '%i' */
+#define FMTHEX		2	/* '%x' or '%X' */
+#define FMTSTR		3	/* '%s' */
+#define FMTFIX		4	/* '%f' */
+#define FMTOTHER	5	/* other conversions, done by 'addconv' */
+
+/* flags of a conversion */
+#define FLLEFT		1	/* '-' */
+#define FLPLUS		2	/* '+' */
+#define FLSPACE		4	/* ' ' */
+#define FLZERO		8	/* '0' */
+
+
+typedef struct FmtItem {
+  size_t lit;  /* position of the literal text before the conversion */
+  size_t llit;  /* length of that text */
+  size_t spec;  /* position of the conversion specification */
+  unsigned char lspec;  /* its length (without the '%') */
+  unsigned char kind;  /* kind of conversion */
+  unsigned char flags;
+  signed char width;  /* minimum width of the result */
+  signed char prec;  /* precision (-1 if absent) */
+} FmtItem;
+
+
+typedef struct Format {
+  int nitems;
+  FmtItem item[1];  /* the last item has no conversion */
+} Format;
+
+
+/* each conversion uses at least two characters of the format */
+#define sizeformat(lf)	(sizeof(Format) + ((lf) / 2) * sizeof(FmtItem))
+
+
+/*
+** Check a conversion specification 'form' with specifier 'conv' and
+** return its kind, or -1 if it is invalid.
+*/
+static int convkind (const char *form, int conv) {
+  switch (conv) {
+    case 'c': case 'p':
+      return validformat(form, L_FMTFLAGSC, 0) ? FMTOTHER : -1;
+    case 'd': case 'i':
+      return validformat(form, L_FMTFLAGSI, 1) ? FMTINT : -1;
+    case 'u':
+      return validformat(form, L_FMTFLAGSU, 1) ? FMTOTHER : -1;
+    case 'x': case 'X':
+      if (!validformat(form, L_FMTFLAGSX, 1)) return -1;
+      return (strchr(form, '#') == NULL) ? FMTHEX : FMTOTHER;
+    case 'o':
+      return validformat(form, L_FMTFLAGSX, 1) ? FMTOTHER : -1;
+    case 'f':
+      if (!validformat(form, L_FMTFLAGSF, 1)) return -1;
+      return (strchr(form, '#') == NULL) ? FMTFIX : FMTOTHER;
+    case 'a': case 'A': case 'e': case 'E': case 'g': case 'G':
+      return validformat(form, L_FMTFLAGSF, 1) ? FMTOTHER : -1;
+    case 'q':
+      return (form[2] == '\0') ? FMTOTHER : -1;
+    case 's':
+      return validformat(form, L_FMTFLAGSC, 1) ? FMTSTR : -1;
+    default:
+      return -1;
+  }
+}
+
+
+/*
+** Get the flags, width, and precision of the (valid) conversion
+** specification 'spec' (without its '%').
+*/
+static void getmodifiers (FmtItem *it, const char *spec) {
+  it->flags = 0;
+  it->width = 0;
+  it->prec = -1;
+  for (;; spec++) {
+    switch (*spec) {
+      case '-': it->flags |= FLLEFT; continue;
+      case '+': it->flags |= FLPLUS; continue;
+      case ' ': it->flags |= FLSPACE; continue;
+      case '0': it->flags |= FLZERO; continue;
+      case '#': continue;
+    }
+    break;
+  }
+  while (isdigit(cast_uchar(*spec)))
+    it->width = cast(signed char, it->width * 10 + (*spec++ - '0'));
+  if (*spec == '.') {
+    it->prec = 0;
+    while (isdigit(cast_uchar(*++spec)))
+      it->prec = cast(signed char, it->prec * 10 + (*spec - '0'));
+  }
+  /* '-' overrides '0'; integers also ignore '0' with a precision */
+  if ((it->flags & FLLEFT) ||
+      (it->prec >= 0 && (it->kind == FMTINT || it->kind == FMTHEX)))
+    it->flags &= cast(unsigned char, ~FLZERO);
+  if (it->flags & FLPLUS)  /* '+' overrides ' ' */
+    it->flags &= cast(unsigned char, ~FLSPACE);
+}
+
+
+/*
+** Compile format 'strfrmt' into 'comp', which must have
+** 'sizeformat(sfl)' bytes. Return false if the format is not valid,
+** following the same rules as 'getformat' and 'addconv'.
+*/
+static int compileformat (lua_State *L, void *comp,
+                          const char *strfrmt, size_t sfl) {
+  Format *fmt = (Format *)comp;
+  FmtItem *it = fmt->item;
+  size_t i = 0;
+  (void)L;  /* not used */
+  it->lit = 0;
+  for (;;) {
+    while (i < sfl && strfrmt[i] != L_ESC)
+      i++;  /* skip literal text */
+    if (i >= sfl)
+      break;  /* end of format */
+    else if (++i < sfl && strfrmt[i] == L_ESC) {  /* '%%'? */
+      it->llit = i - it->lit;  /* literal text includes one '%' */
+      it->kind = FMTNONE;
+    }
+    else {  /* conversion */
+      char form[MAX_FORMAT];
+      size_t len;
+      int kind;
+      if (i >= sfl)
+        return 0;  /* format ends with a '%' */
+      it->llit = i - 1 - it->lit;  /* literal text does not include '%' */
+      len = strspn(strfrmt + i, L_FMTFLAGSF "123456789.") + 1;
+      if (len >= MAX_FORMAT - 10 || i + len > sfl)
+        return 0;  /* too long or missing specifier */
+      form[0] = '%';
+      memcpy(form + 1, strfrmt + i, len);
+      form[len + 1] = '\0';
+      kind = convkind(form, cast_uchar(strfrmt[i + len - 1]));
+      if (kind < 0)
+        return 0;  /* invalid conversion */
+      it->spec = i;
+      it->lspec = cast(unsigned char, len);
+      it->kind = cast(unsigned char, kind);
+      getmodifiers(it, form + 1);
+      i += len - 1;
+    }
+    i++;  /* skip specifier (or second '%') */
+    (++it)->lit = i;  /* next item starts after it */
+  }
+  it->llit = sfl - it->lit;
+  it->kind = FMTNONE;
+  fmt->nitems = cast_int(it - fmt->item) + 1;
+  return 1;
+}
+
+
+/*
+** Get the compiled form of the format at index 'arg', pushing it (or
+** nil) on the stack to keep it alive while in use. The cache of
+** formats is the second upvalue of the calling function.
+*/
+static const Format *getformatcomp (lua_State *L, int arg) {
   size_t sfl;
   const char *strfrmt = luaL_checklstring(L, arg, &sfl);
+  if (sfl > MAXFMTCOMP) {  /* too long? */
+    lua_pushnil(L);
+    return NULL;  /* do not compile it */
+  }
+  return (const Format *)getcompiled(L, 2, arg, strfrmt, sfl,
+                                     sizeformat(sfl), compileformat);
+}
+
+
+/*
+** Put in 'buff' a converted number with sign 'sign' (or '\0' if it
+** has no sign), digits 'd' with length 'ld' preceded by 'zeros' zeros,
+** padded to the width of 'it'. Return the length of the result.
+*/
+static int padnum (const FmtItem *it, char *buff, char sign,
+                   int zeros, const char *d, int ld) {
+  char *p = buff;
+  int pad = it->width - (sign != '\0') - zeros - ld;
+  if (pad > 0 && !(it->flags & (FLLEFT | FLZERO))) {
+    memset(p, ' ', cast_sizet(pad));  /* pad on the left */
+    p += pad;
+  }
+  if (sign != '\0')
+    *p++ = sign;
+  if (pad > 0 && (it->flags & FLZERO))
+    zeros += pad;  /* pad with zeros after the sign */
+  memset(p, '0', cast_sizet(zeros));
+  p += zeros;
+  memcpy(p, d, cast_sizet(ld));
+  p += ld;
+  if (pad > 0 && (it->flags & FLLEFT)) {
+    memset(p, ' ', cast_sizet(pad));  /* pad on the right */
+    p += pad;
+  }
+  return cast_int(p - buff);
+}
+
+
+/* size of buffers for digits of integers */
+#define MAXDIGITS	(3 * sizeof(lua_Unsigned) + 1)
+
+
+/*
+** Convert 'u' to digits in base 'base' ('digits' has the symbols),
+** ending at 'end'. Return the address of the first digit.
+*/
+static char *udigits (char *end, lua_Unsigned u, unsigned base,
+                      const char *digits) {
+  do {
+    *--end = digits[u % base];
+    u /= base;
+  } while (u != 0);
+  return end;
+}
+
+
+/* convert an integer for a conversion '%d', '%i', '%x', or '%X' */
+static int fmtint (const FmtItem *it, char *buff, lua_Integer n, int conv) {
+  char temp[MAXDIGITS];
+  char *end = temp + sizeof(temp);
+  char *d;
+  char sign = '\0';
+  int ld;
+  lua_Unsigned u = l_castS2U(n);
+  if (conv == 'x')
+    d = udigits(end, u, 16, "0123456789abcdef");
+  else if (conv == 'X')
+    d = udigits(end, u, 16, "0123456789ABCDEF");
+  else {
+    if (n < 0) {
+      u = 0u - u;  /* absolute value */
+      sign = '-';
+    }
+    else if (it->flags & FLPLUS)
+      sign = '+';
+    else if (it->flags & FLSPACE)
+      sign = ' ';
+    d = udigits(end, u, 10, "0123456789");
+  }
+  ld = cast_int(end - d);
+  if (it->prec == 0 && n == 0)
+    ld = 0;  /* a zero precision converts zero to no digits */
+  return padnum(it, buff, sign, (it->prec > ld) ? it->prec - ld : 0, d, ld);
+}
+
+
+/*
+** Convert a non-negative float 'x' to a numeral with 'prec' digits
+** after the decimal point, rounding its exact value as 'sprintf' does
+** (to nearest, ties to even). Put its digits in 'd' (ending at the end
+** of 'temp') and return their number, or -1 if the numeral does not
+** fit in a 'lua_Unsigned' (then 'sprintf' must do the conversion).
+** The value is 'm * 2^-s', so it is enough to divide 'm * 10^prec'
+** by '2^s' and insert the decimal point. The product has twice the
+** bits of a 'lua_Unsigned', so any float with a mantissa of up to
+** UBITS bits fits, as long as the result fits.
+*/
+#if (LUA_MAXUNSIGNED >> (l_floatatt(MANT_DIG) - 1)) >= 2
+
+#define UBITS	cast_int(sizeof(lua_Unsigned) * CHAR_BIT)
+
+/* all bits set below bit 'n' (0 < n < UBITS) */
+#define lowbits(n)	((~(lua_Unsigned)0) >> (UBITS - (n)))
+
+
+/*
+** Full product 'a * b': return its lower half and put its higher half
+** in '*hi'.
+*/
+static lua_Unsigned umul (lua_Unsigned a, lua_Unsigned b,
+                          lua_Unsigned *hi) {
+  const int h = UBITS / 2;
+  lua_Unsigned a0 = a & lowbits(h), a1 = a >> h;
+  lua_Unsigned b0 = b & lowbits(h), b1 = b >> h;
+  lua_Unsigned p00 = a0 * b0, p01 = a0 * b1;
+  lua_Unsigned p10 = a1 * b0, p11 = a1 * b1;
+  lua_Unsigned mid = (p00 >> h) + (p01 & lowbits(h)) + (p10 & lowbits(h));
+  *hi = p11 + (p01 >> h) + (p10 >> h) + (mid >> h);
+  return (mid << h) | (p00 & lowbits(h));
+}
+
+
+static int fix2dec (char *temp, char **d, lua_Number x, int prec) {
+  char *end = temp + MAXDIGITS + 1;  /* space for the decimal point */
+  char *p;
+  lua_Unsigned p10 = 1;
+  lua_Unsigned m, hi, lo;
+  lua_Unsigned rhi, rlo, halfhi, halflo;  /* remainder and half */
+  int e, s, i;
+  for (i = 0; i < prec; i++) {
+    if (p10 > LUA_MAXUNSIGNED / 10)
+      return -1;  /* too many digits */
+    p10 *= 10;
+  }
+  x = l_mathop(frexp)(x, &e);  /* 0.5 <= x < 1, or x == 0 */
+  m = (lua_Unsigned)l_mathop(ldexp)(x, l_floatatt(MANT_DIG));
+  e -= l_floatatt(MANT_DIG);
+  if (e > 0) {  /* integral value? */
+    if (e >= UBITS || m > (LUA_MAXUNSIGNED >> e))
+      return -1;  /* too large */
+    m <<= e;
+    e = 0;
+  }
+  s = -e;
+  while (s > 0 && !(m & 1)) {  /* remove trailing zero bits */
+    m >>= 1;
+    s--;
+  }
+  if (s >= 2 * UBITS)
+    return -1;  /* too small */
+  lo = umul(m, p10, &hi);
+  if (s == 0) {  /* integral value */
+    if (hi != 0)
+      return -1;  /* too many digits */
+    m = lo;
+  }
+  else {  /* round '(hi,lo) / 2^s' */
+    if (s < UBITS) {
+      if ((hi >> s) != 0)
+        return -1;  /* too many digits */
+      m = (lo >> s) | (hi << (UBITS - s));
+      rhi = 0; rlo = lo & lowbits(s);
+      halfhi = 0; halflo = (lua_Unsigned)1 << (s - 1);
+    }
+    else if (s == UBITS) {
+      m = hi;
+      rhi = 0; rlo = lo;
+      halfhi = 0; halflo = (lua_Unsigned)1 << (UBITS - 1);
+    }
+    else {
+      m = hi >> (s - UBITS);
+      rhi = hi & lowbits(s - UBITS); rlo = lo;
+      halfhi = (lua_Unsigned)1 << (s - UBITS - 1); halflo = 0;
+    }
+    if (rhi > halfhi ||
+        (rhi == halfhi && (rlo > halflo || (rlo == halflo && (m & 1))))) {
+      if (m == LUA_MAXUNSIGNED)
+        return -1;  /* too many digits */
+      m++;
+    }
+  }
+  p = udigits(end, m, 10, "0123456789");
+  while (end - p <= prec)
+    *--p = '0';  /* at least one digit before the decimal point */
+  if (prec > 0) {  /* insert the decimal point before last 'prec' digits */
+    memmove(p - 1, p, cast_sizet(end - prec - p));  /* move integral part */
+    p--;
+    end[-prec - 1] = lua_getlocaledecpoint();
+  }
+  *d = p;
+  return cast_int(end - p);
+}
+
+#else
+
+static int fix2dec (char *temp, char **d, lua_Number x, int prec) {
+  (void)temp; (void)d; (void)x; (void)prec;
+  return -1;  /* floats too large for 'lua_Unsigned'; use 'sprintf' */
+}
+
+#endif
+
+
+/*
+** Convert a float for a conversion '%f'. Return -1 if the conversion
+** must be done by 'sprintf' (inf, NaN, -0.0, and values that do not
+** fit in 'fix2dec').
+*/
+static int fmtfix (const FmtItem *it, char *buff, lua_Number x) {
+  char temp[MAXDIGITS + 1];
+  char *d;
+  char sign = '\0';
+  int ld;
+  if (x != x || x == (lua_Number)HUGE_VAL || x == -(lua_Number)HUGE_VAL)
+    return -1;  /* inf or NaN */
+  else if (x < 0) {
+    x = -x;
+    sign = '-';
+  }
+  else if (x == 0 && (lua_Number)1 / x < 0)
+    return -1;  /* -0.0 */
+  else if (it->flags & FLPLUS)
+    sign = '+';
+  else if (it->flags & FLSPACE)
+    sign = ' ';
+  ld = fix2dec(temp, &d, x, (it->prec < 0) ? 6 : it->prec);
+  if (ld < 0)
+    return -1;
+  return padnum(it, buff, sign, 0, d, ld);
+}
+
+
+/* convert a string for a conversion '%s' with modifiers */
+static int fmtstr (const FmtItem *it, char *buff, const char *s, size_t l) {
+  int ls = (it->prec >= 0 && cast_sizet(it->prec) < l)
+         ? it->prec : cast_int(l);
+  int pad = (it->width > ls) ? it->width - ls : 0;
+  char *p = buff;
+  if (!(it->flags & FLLEFT)) {
+    memset(p, ' ', cast_sizet(pad));
+    p += pad;
+  }
+  memcpy(p, s, cast_sizet(ls));
+  p += ls;
+  if (it->flags & FLLEFT) {
+    memset(p, ' ', cast_sizet(pad));
+    p += pad;
+  }
+  return cast_int(p - buff);
+}
+
+
+/*
+** Add to buffer 'b' the result of formatting the values from index
+** 'arg' + 1 to 'top' following the compiled format 'fmt', whose source
+** is 'strfrmt'.
+*/
+static void addcompformat (lua_State *L, luaL_Buffer *b, const Format *fmt,
+                           const char *strfrmt, int arg, int top) {
+  const FmtItem *it = fmt->item;
+  const FmtItem *lastit = it + fmt->nitems - 1;
+  for (;; it++) {
+    char *buff;
+    int nb = -1;
+    int conv;
+    luaL_addlstring(b, strfrmt + it->lit, it->llit);
+    if (it == lastit)
+      break;
+    else if (it->kind == FMTNONE)
+      continue;
+    if (++arg > top)
+      luaL_argerror(L, arg, "no value");
+    conv = strfrmt[it->spec + it->lspec - 1];
+    buff = luaL_prepbuffsize(b, MAX_ITEM);
+    switch (it->kind) {
+      case FMTINT: case FMTHEX: {
+        nb = fmtint(it, buff, luaL_checkinteger(L, arg), conv);
+        break;
+      }
+      case FMTFIX: {
+        nb = fmtfix(it, buff, luaL_checknumber(L, arg));
+        break;
+      }
+      case FMTSTR: {
+        size_t l;
+        const char *s = luaL_tolstring(L, arg, &l);
+        if (it->lspec == 1)  /* no modifiers? */
+          luaL_addvalue(b);  /* keep entire string */
+        else {
+          luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+          if (it->prec < 0 && l >= 100)  /* too long to be formatted? */
+            luaL_addvalue(b);  /* keep entire string */
+          else {
+            nb = fmtstr(it, buff, s, l);
+            lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
+          }
+        }
+        if (nb < 0)
+          continue;  /* string already added */
+        break;
+      }
+    }
+    if (nb >= 0) {
+      lua_assert(nb < MAX_ITEM);
+      luaL_addsize(b, cast_uint(nb));
+    }
+    else {  /* let 'addconv' do the conversion */
+      char form[MAX_FORMAT];
+      form[0] = '%';
+      memcpy(form + 1, strfrmt + it->spec, it->lspec);
+      form[it->lspec + 1] = '\0';
+      addconv(L, b, arg, form);
+    }
+  }
+}
+
+
+/*
+** Add to buffer 'b' the result of formatting the values from index
+** 'arg' + 1 to 'top' following the format at index 'arg', which was
+** compiled into 'fmt' (NULL if it could not be compiled).
+*/
+static void addformat (lua_State *L, luaL_Buffer *b, const Format *fmt,
+                                     int arg, int top) {
+  size_t sfl;
+  const char *strfrmt = lua_tolstring(L, arg, &sfl);
   const char *strfrmt_end = strfrmt+sfl;
-  const char *flags;
-  luaL_Buffer b;
-  luaL_buffinit(L, &b);
+  if (fmt != NULL) {
+    addcompformat(L, b, fmt, strfrmt, arg, top);
+    return;
+  }
   while (strfrmt < strfrmt_end) {
     if (*strfrmt != L_ESC)
-      luaL_addchar(&b, *strfrmt++);
+      luaL_addchar(b, *strfrmt++);
     else if (*++strfrmt == L_ESC)
-      luaL_addchar(&b, *strfrmt++);  /* %% */
+      luaL_addchar(b, *strfrmt++);  /* %% */
     else { /* format item */
       char form[MAX_FORMAT];  /* to store the format ('%...') */
-      unsigned maxitem = MAX_ITEM;  /* maximum length for the result */
-      char *buff = luaL_prepbuffsize(&b, maxitem);  /* to put result */
-      int nb = 0;  /* number of bytes in result */
       if (++arg > top)
-        return luaL_argerror(L, arg, "no value");
-      strfrmt = getformat(L, strfrmt, form);
-      switch (*strfrmt++) {
-        case 'c': {
-          checkformat(L, form, L_FMTFLAGSC, 0);
-          nb = l_sprintf(buff, maxitem, form, (int)luaL_checkinteger(L, arg));
-          break;
-        }
-        case 'd': case 'i':
-          flags = L_FMTFLAGSI;
-          goto intcase;
-        case 'u':
-          flags = L_FMTFLAGSU;
-          goto intcase;
-        case 'o': case 'x': case 'X':
-          flags = L_FMTFLAGSX;
-         intcase: {
-          lua_Integer n = luaL_checkinteger(L, arg);
-          checkformat(L, form, flags, 1);
-          addlenmod(form, LUA_INTEGER_FRMLEN);
-          nb = l_sprintf(buff, maxitem, form, (LUAI_UACINT)n);
-          break;
-        }
-        case 'a': case 'A':
-          checkformat(L, form, L_FMTFLAGSF, 1);
-          addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = lua_number2strx(L, buff, maxitem, form,
-                                  luaL_checknumber(L, arg));
-          break;
-        case 'f':
-          maxitem = MAX_ITEMF;  /* extra space for '%f' */
-          buff = luaL_prepbuffsize(&b, maxitem);
-          /* FALLTHROUGH */
-        case 'e': case 'E': case 'g': case 'G': {
-          lua_Number n = luaL_checknumber(L, arg);
-          checkformat(L, form, L_FMTFLAGSF, 1);
-          addlenmod(form, LUA_NUMBER_FRMLEN);
-          nb = l_sprintf(buff, maxitem, form, (LUAI_UACNUMBER)n);
-          break;
-        }
-        case 'p': {
-          const void *p = lua_topointer(L, arg);
-          checkformat(L, form, L_FMTFLAGSC, 0);
-          if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
-            p = "(null)";  /* result */
-            form[strlen(form) - 1] = 's';  /* format it as a string */
-          }
-          nb = l_sprintf(buff, maxitem, form, p);
-          break;
-        }
-        case 'q': {
-          if (form[2] != '\0')  /* modifiers? */
-            return luaL_error(L, "specifier '%%q' cannot have modifiers");
-          addliteral(L, &b, arg);
-          break;
-        }
-        case 's': {
-          size_t l;
-          const char *s = luaL_tolstring(L, arg, &l);
-          if (form[2] == '\0')  /* no modifiers? */
-            luaL_addvalue(&b);  /* keep entire string */
-          else {
-            luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
-            checkformat(L, form, L_FMTFLAGSC, 1);
-            if (strchr(form, '.') == NULL && l >= 100) {
-              /* no precision and string is too long to be formatted */
-              luaL_addvalue(&b);  /* keep entire string */
-            }
-            else {  /* format the string into 'buff' */
-              nb = l_sprintf(buff, maxitem, form, s);
-              lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
-            }
-          }
-          break;
-        }
-        default: {  /* also treat cases 'pnLlh' */
-          return luaL_error(L, "invalid conversion '%s' to 'format'", form);
-        }
-      }
-      lua_assert(cast_uint(nb) < maxitem);
-      luaL_addsize(&b, cast_uint(nb));
+        luaL_argerror(L, arg, "no value");
+      strfrmt = getformat(L, strfrmt, form) + 1;
+      addconv(L, b, arg, form);
     }
   }
+}
+
+
+static int str_format (lua_State *L) {
+  int top = lua_gettop(L);
+  const Format *fmt = getformatcomp(L, 1);
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  addformat(L, &b, fmt, 1, top);
   luaL_pushresult(&b);
   return 1;
 }
@@ -1535,15 +2796,15 @@ static KOption getoption (Header *h, const char **fmt, size_t *size) {
 
 /*
 ** Read, classify, and fill other details about the next option.
-** 'psize' is filled with option's size, 'notoalign' with its
-** alignment requirements.
+** 'psize' is filled with option's size, 'palign' with its alignment
+** (0 or 1 if it needs no alignment).
 ** Local variable 'size' gets the size to be aligned. (Kpadal option
 ** always gets its full alignment, other options are limited by
 ** the maximum alignment ('maxalign'). Kchar option needs no alignment
 ** despite its size.
 */
-static KOption getdetails (Header *h, size_t totalsize, const char **fmt,
-                           size_t *psize, unsigned *ntoalign) {
+static KOption getoptalign (Header *h, const char **fmt,
+                            size_t *psize, size_t *palign) {
   KOption opt = getoption(h, fmt, psize);
   size_t align = *psize;  /* usually, alignment follows size */
   if (opt == Kpaddalign) {  /* 'X' gets alignment from following option */
@@ -1551,20 +2812,35 @@ static KOption getdetails (Header *h, size_t totalsize, const char **fmt,
       luaL_argerror(h->L, 1, "invalid next option for option 'X'");
   }
   if (align <= 1 || opt == Kchar)  /* need no alignment? */
-    *ntoalign = 0;
+    align = 0;
   else {
     if (align > h->maxalign)  /* enforce maximum alignment */
       align = h->maxalign;
-    if (l_unlikely(!ispow2(align))) {  /* not a power of 2? */
-      *ntoalign = 0;  /* to avoid warnings */
+    if (l_unlikely(!ispow2(align)))  /* not a power of 2? */
       luaL_argerror(h->L, 1, "format asks for alignment not power of 2");
-    }
-    else {
-      /* 'szmoda' = totalsize % align */
-      unsigned szmoda = cast_uint(totalsize & (align - 1));
-      *ntoalign = cast_uint((align - szmoda) & (align - 1));
-    }
   }
+  *palign = align;
+  return opt;
+}
+
+
+/* number of padding bytes to align position 'pos' to 'align' */
+#define ntoalign(pos,align)  \
+	(((align) <= 1) ? 0u \
+	                : cast_uint(((align) - ((pos) & ((align) - 1))) \
+	                            & ((align) - 1)))
+
+
+/*
+** Read, classify, and fill other details about the next option.
+** 'psize' is filled with option's size, 'notoalign' with its
+** alignment requirements.
+*/
+static KOption getdetails (Header *h, size_t totalsize, const char **fmt,
+                           size_t *psize, unsigned *pntoalign) {
+  size_t align;
+  KOption opt = getoptalign(h, fmt, psize, &align);
+  *pntoalign = ntoalign(totalsize, align);
   return opt;
 }
 
@@ -1579,14 +2855,18 @@ static void packint (luaL_Buffer *b, lua_Unsigned n,
                      int islittle, unsigned size, int neg) {
   char *buff = luaL_prepbuffsize(b, size);
   unsigned i;
-  buff[islittle ? 0 : size - 1] = (char)(n & MC);  /* first byte */
-  for (i = 1; i < size; i++) {
-    n >>= NB;
-    buff[islittle ? i : size - 1 - i] = (char)(n & MC);
-  }
-  if (neg && size > SZINT) {  /* negative number need sign extension? */
-    for (i = SZINT; i < size; i++)  /* correct extra bytes */
-      buff[islittle ? i : size - 1 - i] = (char)MC;
+  if (islittle && nativeendian.little && size <= SZINT)  /* native? */
+    memcpy(buff, &n, size);  /* copy its first bytes */
+  else {
+    buff[islittle ? 0 : size - 1] = (char)(n & MC);  /* first byte */
+    for (i = 1; i < size; i++) {
+      n >>= NB;
+      buff[islittle ? i : size - 1 - i] = (char)(n & MC);
+    }
+    if (neg && size > SZINT) {  /* negative number need sign extension? */
+      for (i = SZINT; i < size; i++)  /* correct extra bytes */
+        buff[islittle ? i : size - 1 - i] = (char)MC;
+    }
   }
   luaL_addsize(b, size);  /* add result to buffer */
 }
@@ -1608,48 +2888,457 @@ static void copywithendian (char *dest, const char *src,
 }
 
 
-static int str_pack (lua_State *L) {
-  luaL_Buffer b;
-  Header h;
-  const char *fmt = luaL_checkstring(L, 1);  /* format string */
-  int arg = 1;  /* current argument to pack */
-  size_t totalsize = 0;  /* accumulate total size of result */
-  initheader(L, &h);
-  lua_pushnil(L);  /* mark to separate arguments from string buffer */
-  luaL_buffinit(L, &b);
-  while (*fmt != '\0') {
-    unsigned ntoalign;
-    size_t size;
-    KOption opt = getdetails(&h, totalsize, &fmt, &size, &ntoalign);
-    luaL_argcheck(L, size + ntoalign <= MAX_SIZE - totalsize, arg,
-                     "result too long");
-    totalsize += ntoalign + size;
-    while (ntoalign-- > 0)
-     luaL_addchar(&b, LUAL_PACKPADBYTE);  /* fill alignment */
-    arg++;
-    switch (opt) {
-      case Kint: {  /* signed integers */
-        lua_Integer n = luaL_checkinteger(L, arg);
-        if (size < SZINT) {  /* need overflow check? */
-          lua_Integer lim = (lua_Integer)1 << ((size * NB) - 1);
-          luaL_argcheck(L, -lim <= n && n < lim, arg, "integer overflow");
-        }
-        packint(&b, (lua_Unsigned)n, h.islittle, cast_uint(size), (n < 0));
-        break;
-      }
-      case Kuint: {  /* unsigned integers */
-        lua_Integer n = luaL_checkinteger(L, arg);
-        if (size < SZINT)  /* need overflow check? */
-          luaL_argcheck(L, (lua_Unsigned)n < ((lua_Unsigned)1 << (size * NB)),
-                           arg, "unsigned overflow");
-        packint(&b, (lua_Unsigned)n, h.islittle, cast_uint(size), 0);
-        break;
-      }
-      case Kfloat: {  /* C float */
-        float f = (float)luaL_checknumber(L, arg);  /* get argument */
-        char *buff = luaL_prepbuffsize(&b, sizeof(f));
-        /* move 'f' to final result, correcting endianness if needed */
-        copywithendian(buff, (char *)&f, sizeof(f), h.islittle);
+/*
+** Unpack an integer with 'size' bytes and 'islittle' endianness.
+** If size is smaller than the size of a Lua integer and integer
+** is signed, must do sign extension (propagating the sign to the
+** higher bits); if size is larger than the size of a Lua integer,
+** it must check the unread bytes to see whether they do not cause an
+** overflow.
+*/
+static lua_Integer unpackint (lua_State *L, const char *str,
+                              int islittle, int size, int issigned) {
+  lua_Unsigned res = 0;
+  int i;
+  int limit = (size  <= SZINT) ? size : SZINT;
+  if (islittle && nativeendian.little && size <= SZINT)  /* native? */
+    memcpy(&res, str, cast_uint(size));  /* fill its first bytes */
+  else {
+    for (i = limit - 1; i >= 0; i--) {
+      res <<= NB;
+      res |= (lua_Unsigned)(unsigned char)str[islittle ? i : size - 1 - i];
+    }
+  }
+  if (size < SZINT) {  /* real size smaller than lua_Integer? */
+    if (issigned) {  /* needs sign extension? */
+      lua_Unsigned mask = (lua_Unsigned)1 << (size*NB - 1);
+      res = ((res ^ mask) - mask);  /* do sign extension */
+    }
+  }
+  else if (size > SZINT) {  /* must check unread bytes */
+    int mask = (!issigned || (lua_Integer)res >= 0) ? 0 : MC;
+    for (i = limit; i < size; i++) {
+      if (l_unlikely((unsigned char)str[islittle ? i : size - 1 - i] != mask))
+        luaL_error(L, "%d-byte integer does not fit into Lua Integer", size);
+    }
+  }
+  return (lua_Integer)res;
+}
+
+
+/*
+** Formats for 'pack' and 'unpack' are compiled into arrays with the
+** option, size, alignment, and endianness of each item, and cached like
+** patterns (in the third upvalue of the library functions). The
+** compiler uses the same functions as the interpreter, in protected
+** mode. Formats with errors are not compiled, so that the interpreter
+** raises their errors in the usual order; formats longer than
+** MAXPACKCOMP are compiled only by 'packmany' and 'unpackmany', and
+** not cached.
+*/
+
+#if !defined(MAXPACKCOMP)
+#define MAXPACKCOMP	256
+#endif
+
+
+typedef struct PackItem {
+  size_t size;
+  unsigned char opt;  /* option (a KOption) */
+  unsigned char align;  /* alignment (0 if none) */
+  unsigned char islittle;
+} PackItem;
+
+
+typedef struct PackFmt {
+  int nitems;
+  int nvalues;  /* number of values in a record */
+  size_t minsize;  /* minimum size of a record (saturated at MAX_SIZE) */
+  PackItem item[1];
+} PackFmt;
+
+
+/* each item uses at least one character of the format */
+#define sizepackfmt(lf)	(sizeof(PackFmt) + (lf) * sizeof(PackItem))
+
+/* check whether an option packs a value */
+#define hasvalue(opt)	((opt) <= Kzstr)
+
+
+static void compilepackfmt (lua_State *L, PackFmt *pf, const char *fmt) {
+  PackItem *it = pf->item;
+  Header h;
+  initheader(L, &h);
+  pf->nvalues = 0;
+  pf->minsize = 0;
+  while (*fmt != '\0') {
+    size_t size, align;
+    KOption opt = getoptalign(&h, &fmt, &size, &align);
+    if (opt != Knop) {
+      it->size = size;
+      it->opt = cast(unsigned char, opt);
+      it->align = cast(unsigned char, align);
+      it->islittle = cast(unsigned char, h.islittle);
+      if (hasvalue(opt))
+        pf->nvalues++;
+      if (size <= MAX_SIZE - pf->minsize)
+        pf->minsize += size;
+      else  /* records do not fit in memory; avoid a wrap around */
+        pf->minsize = MAX_SIZE;
+      it++;
+    }
+  }
+  pf->nitems = cast_int(it - pf->item);
+}
+
+
+static int f_compilepack (lua_State *L) {
+  compilepackfmt(L, (PackFmt *)lua_touserdata(L, 1),
+                    (const char *)lua_touserdata(L, 2));
+  return 0;
+}
+
+
+static int compilepack (lua_State *L, void *comp,
+                        const char *fmt, size_t lf) {
+  (void)lf;  /* not used; format ends at its first zero */
+  lua_pushcfunction(L, f_compilepack);
+  lua_pushlightuserdata(L, comp);
+  lua_pushlightuserdata(L, cast_voidp(fmt));
+  if (lua_pcall(L, 2, 0, 0) != LUA_OK) {  /* errors in the format? */
+    lua_pop(L, 1);  /* remove error message */
+    return 0;  /* let the interpreter raise the error */
+  }
+  return 1;
+}
+
+
+/*
+** Get the compiled form of the format at index 'arg', pushing it (or
+** nil) on the stack to keep it alive while in use. If 'force' is true,
+** compile formats that cannot be cached and raise errors in the format.
+*/
+static const PackFmt *getpackfmt (lua_State *L, int arg, int force) {
+  size_t lf;
+  const char *fmt = luaL_checklstring(L, arg, &lf);
+  const PackFmt *pf = NULL;
+  if (lf <= MAXPACKCOMP)
+    pf = (const PackFmt *)getcompiled(L, 3, arg, fmt, lf,
+                                      sizepackfmt(lf), compilepack);
+  else
+    lua_pushnil(L);
+  if (pf == NULL && force) {
+    PackFmt *npf;
+    lua_pop(L, 1);
+    npf = (PackFmt *)lua_newuserdatauv(L, sizepackfmt(lf), 0);
+    compilepackfmt(L, npf, fmt);  /* raise its errors, if any */
+    pf = npf;
+  }
+  return pf;
+}
+
+
+/*
+** State for packing values, either from the arguments of 'pack' or
+** from a table (in 'packmany').
+*/
+typedef struct PackState {
+  lua_State *L;
+  luaL_Buffer b;
+  size_t totalsize;  /* accumulate total size of result */
+  int arg;  /* last argument packed, or slot for values from the table */
+  int t;  /* index of the table with the values (0 if none) */
+  lua_Integer k;  /* index in the table of the last value packed */
+} PackState;
+
+
+static int packerror (PackState *ps, int arg, const char *msg) {
+  if (ps->t == 0)
+    return luaL_argerror(ps->L, arg, msg);
+  else
+    return luaL_error(ps->L, "invalid value (at index %I) in table for "
+                             "'packmany' (%s)", (LUAI_UACINT)ps->k, msg);
+}
+
+
+static int packtypeerror (PackState *ps, int arg, const char *tname) {
+  if (ps->t == 0)
+    return luaL_typeerror(ps->L, arg, tname);
+  else
+    return packerror(ps, arg, lua_pushfstring(ps->L, "%s expected, got %s",
+                                       tname, luaL_typename(ps->L, arg)));
+}
+
+
+/* get the index of the next value to be packed */
+static int nextvalue (PackState *ps) {
+  if (ps->t == 0)
+    return ++ps->arg;
+  else {  /* move value from the table to its slot, below the buffer */
+    lua_rawgeti(ps->L, ps->t, ++ps->k);
+    lua_replace(ps->L, ps->arg);
+    return ps->arg;
+  }
+}
+
+
+static lua_Integer packcheckint (PackState *ps, int arg) {
+  int isnum;
+  lua_Integer n = lua_tointegerx(ps->L, arg, &isnum);
+  if (l_unlikely(!isnum)) {
+    if (lua_isnumber(ps->L, arg))
+      packerror(ps, arg, "number has no integer representation");
+    else
+      packtypeerror(ps, arg, "number");
+  }
+  return n;
+}
+
+
+static lua_Number packchecknum (PackState *ps, int arg) {
+  int isnum;
+  lua_Number n = lua_tonumberx(ps->L, arg, &isnum);
+  if (l_unlikely(!isnum))
+    packtypeerror(ps, arg, "number");
+  return n;
+}
+
+
+static const char *packcheckstr (PackState *ps, int arg, size_t *len) {
+  const char *s = lua_tolstring(ps->L, arg, len);
+  if (l_unlikely(s == NULL))
+    packtypeerror(ps, arg, "string");
+  return s;
+}
+
+
+/* pack one record with the compiled format 'pf' */
+static void packrec (PackState *ps, const PackFmt *pf) {
+  luaL_Buffer *b = &ps->b;
+  const PackItem *it;
+  for (it = pf->item; it < pf->item + pf->nitems; it++) {
+    size_t size = it->size;
+    unsigned ntoal = ntoalign(ps->totalsize, it->align);
+    int arg;
+    if (l_unlikely(size + ntoal > MAX_SIZE - ps->totalsize))
+      packerror(ps, ps->arg, "result too long");
+    ps->totalsize += ntoal + size;
+    while (ntoal-- > 0)
+     luaL_addchar(b, LUAL_PACKPADBYTE);  /* fill alignment */
+    switch (it->opt) {
+      case Kint: {  /* signed integers */
+        lua_Integer n = packcheckint(ps, arg = nextvalue(ps));
+        if (size < SZINT) {  /* need overflow check? */
+          lua_Integer lim = (lua_Integer)1 << ((size * NB) - 1);
+          if (!(-lim <= n && n < lim))
+            packerror(ps, arg, "integer overflow");
+        }
+        packint(b, (lua_Unsigned)n, it->islittle, cast_uint(size), (n < 0));
+        break;
+      }
+      case Kuint: {  /* unsigned integers */
+        lua_Integer n = packcheckint(ps, arg = nextvalue(ps));
+        if (size < SZINT &&  /* need overflow check? */
+            (lua_Unsigned)n >= ((lua_Unsigned)1 << (size * NB)))
+          packerror(ps, arg, "unsigned overflow");
+        packint(b, (lua_Unsigned)n, it->islittle, cast_uint(size), 0);
+        break;
+      }
+      case Kfloat: {  /* C float */
+        float f = (float)packchecknum(ps, nextvalue(ps));
+        char *buff = luaL_prepbuffsize(b, sizeof(f));
+        /* move 'f' to final result, correcting endianness if needed */
+        copywithendian(buff, (char *)&f, sizeof(f), it->islittle);
+        luaL_addsize(b, size);
+        break;
+      }
+      case Knumber: {  /* Lua float */
+        lua_Number f = packchecknum(ps, nextvalue(ps));
+        char *buff = luaL_prepbuffsize(b, sizeof(f));
+        /* move 'f' to final result, correcting endianness if needed */
+        copywithendian(buff, (char *)&f, sizeof(f), it->islittle);
+        luaL_addsize(b, size);
+        break;
+      }
+      case Kdouble: {  /* C double */
+        double f = (double)packchecknum(ps, nextvalue(ps));
+        char *buff = luaL_prepbuffsize(b, sizeof(f));
+        /* move 'f' to final result, correcting endianness if needed */
+        copywithendian(buff, (char *)&f, sizeof(f), it->islittle);
+        luaL_addsize(b, size);
+        break;
+      }
+      case Kchar: {  /* fixed-size string */
+        size_t len;
+        const char *s = packcheckstr(ps, arg = nextvalue(ps), &len);
+        if (len > size)
+          packerror(ps, arg, "string longer than given size");
+        luaL_addlstring(b, s, len);  /* add string */
+        if (len < size) {  /* does it need padding? */
+          size_t psize = size - len;  /* pad size */
+          char *buff = luaL_prepbuffsize(b, psize);
+          memset(buff, LUAL_PACKPADBYTE, psize);
+          luaL_addsize(b, psize);
+        }
+        break;
+      }
+      case Kstring: {  /* strings with length count */
+        size_t len;
+        const char *s = packcheckstr(ps, arg = nextvalue(ps), &len);
+        if (!(size >= sizeof(lua_Unsigned) ||
+              len < ((lua_Unsigned)1 << (size * NB))))
+          packerror(ps, arg, "string length does not fit in given size");
+        /* pack length */
+        packint(b, (lua_Unsigned)len, it->islittle, cast_uint(size), 0);
+        luaL_addlstring(b, s, len);
+        ps->totalsize += len;
+        break;
+      }
+      case Kzstr: {  /* zero-terminated string */
+        size_t len;
+        const char *s = packcheckstr(ps, arg = nextvalue(ps), &len);
+        if (strlen(s) != len)
+          packerror(ps, arg, "string contains zeros");
+        luaL_addlstring(b, s, len);
+        luaL_addchar(b, '\0');  /* add zero at the end */
+        ps->totalsize += len + 1;
+        break;
+      }
+      case Kpadding: luaL_addchar(b, LUAL_PACKPADBYTE);  /* FALLTHROUGH */
+      default:  /* Kpaddalign */
+        break;
+    }
+  }
+}
+
+
+/*
+** Unpack one record with the compiled format 'pf' from string 'data'
+** (with length 'ld'), starting at position 'pos'. Push the values on
+** the stack or, if 't' is not zero, store them in the table at index
+** 't', after index '*k'. Return the position after the record.
+*/
+static size_t unpackrec (lua_State *L, const PackFmt *pf,
+                         const char *data, size_t ld, size_t pos,
+                         int t, lua_Integer *k) {
+  const PackItem *it;
+  for (it = pf->item; it < pf->item + pf->nitems; it++) {
+    size_t size = it->size;
+    unsigned ntoal = ntoalign(pos, it->align);
+    luaL_argcheck(L, ntoal + size <= ld - pos, 2, "data string too short");
+    pos += ntoal;  /* skip alignment */
+    switch (it->opt) {
+      case Kint:
+      case Kuint: {
+        lua_Integer res = unpackint(L, data + pos, it->islittle,
+                                       cast_int(size), (it->opt == Kint));
+        lua_pushinteger(L, res);
+        break;
+      }
+      case Kfloat: {
+        float f;
+        copywithendian((char *)&f, data + pos, sizeof(f), it->islittle);
+        lua_pushnumber(L, (lua_Number)f);
+        break;
+      }
+      case Knumber: {
+        lua_Number f;
+        copywithendian((char *)&f, data + pos, sizeof(f), it->islittle);
+        lua_pushnumber(L, f);
+        break;
+      }
+      case Kdouble: {
+        double f;
+        copywithendian((char *)&f, data + pos, sizeof(f), it->islittle);
+        lua_pushnumber(L, (lua_Number)f);
+        break;
+      }
+      case Kchar: {
+        lua_pushlstring(L, data + pos, size);
+        break;
+      }
+      case Kstring: {
+        lua_Unsigned len = (lua_Unsigned)unpackint(L, data + pos,
+                                          it->islittle, cast_int(size), 0);
+        luaL_argcheck(L, len <= ld - pos - size, 2, "data string too short");
+        lua_pushlstring(L, data + pos + size, cast_sizet(len));
+        pos += cast_sizet(len);  /* skip string */
+        break;
+      }
+      case Kzstr: {
+        size_t len = strlen(data + pos);
+        luaL_argcheck(L, pos + len < ld, 2,
+                         "unfinished string for format 'z'");
+        lua_pushlstring(L, data + pos, len);
+        pos += len + 1;  /* skip string plus final '\0' */
+        break;
+      }
+      default:  /* Kpaddalign, Kpadding */
+        pos += size;
+        continue;  /* no value */
+    }
+    if (t != 0)
+      lua_rawseti(L, t, ++*k);
+    pos += size;
+  }
+  return pos;
+}
+
+
+static int str_pack (lua_State *L) {
+  luaL_Buffer b;
+  Header h;
+  const char *fmt = luaL_checkstring(L, 1);  /* format string */
+  int arg = 1;  /* current argument to pack */
+  size_t totalsize = 0;  /* accumulate total size of result */
+  const PackFmt *pf = getpackfmt(L, 1, 0);
+  if (pf != NULL) {  /* compiled format? */
+    PackState ps;
+    lua_replace(L, 1);  /* keep compiled format alive */
+    ps.L = L; ps.totalsize = 0; ps.arg = 1; ps.t = 0; ps.k = 0;
+    lua_pushnil(L);  /* mark to separate arguments from string buffer */
+    luaL_buffinit(L, &ps.b);
+    packrec(&ps, pf);
+    luaL_pushresult(&ps.b);
+    return 1;
+  }
+  lua_pop(L, 1);  /* remove nil */
+  initheader(L, &h);
+  lua_pushnil(L);  /* mark to separate arguments from string buffer */
+  luaL_buffinit(L, &b);
+  while (*fmt != '\0') {
+    unsigned ntoalign;
+    size_t size;
+    KOption opt = getdetails(&h, totalsize, &fmt, &size, &ntoalign);
+    luaL_argcheck(L, size + ntoalign <= MAX_SIZE - totalsize, arg,
+                     "result too long");
+    totalsize += ntoalign + size;
+    while (ntoalign-- > 0)
+     luaL_addchar(&b, LUAL_PACKPADBYTE);  /* fill alignment */
+    arg++;
+    switch (opt) {
+      case Kint: {  /* signed integers */
+        lua_Integer n = luaL_checkinteger(L, arg);
+        if (size < SZINT) {  /* need overflow check? */
+          lua_Integer lim = (lua_Integer)1 << ((size * NB) - 1);
+          luaL_argcheck(L, -lim <= n && n < lim, arg, "integer overflow");
+        }
+        packint(&b, (lua_Unsigned)n, h.islittle, cast_uint(size), (n < 0));
+        break;
+      }
+      case Kuint: {  /* unsigned integers */
+        lua_Integer n = luaL_checkinteger(L, arg);
+        if (size < SZINT)  /* need overflow check? */
+          luaL_argcheck(L, (lua_Unsigned)n < ((lua_Unsigned)1 << (size * NB)),
+                           arg, "unsigned overflow");
+        packint(&b, (lua_Unsigned)n, h.islittle, cast_uint(size), 0);
+        break;
+      }
+      case Kfloat: {  /* C float */
+        float f = (float)luaL_checknumber(L, arg);  /* get argument */
+        char *buff = luaL_prepbuffsize(&b, sizeof(f));
+        /* move 'f' to final result, correcting endianness if needed */
+        copywithendian(buff, (char *)&f, sizeof(f), h.islittle);
         luaL_addsize(&b, size);
         break;
       }
@@ -1735,40 +3424,6 @@ static int str_packsize (lua_State *L) {
 }
 
 
-/*
-** Unpack an integer with 'size' bytes and 'islittle' endianness.
-** If size is smaller than the size of a Lua integer and integer
-** is signed, must do sign extension (propagating the sign to the
-** higher bits); if size is larger than the size of a Lua integer,
-** it must check the unread bytes to see whether they do not cause an
-** overflow.
-*/
-static lua_Integer unpackint (lua_State *L, const char *str,
-                              int islittle, int size, int issigned) {
-  lua_Unsigned res = 0;
-  int i;
-  int limit = (size  <= SZINT) ? size : SZINT;
-  for (i = limit - 1; i >= 0; i--) {
-    res <<= NB;
-    res |= (lua_Unsigned)(unsigned char)str[islittle ? i : size - 1 - i];
-  }
-  if (size < SZINT) {  /* real size smaller than lua_Integer? */
-    if (issigned) {  /* needs sign extension? */
-      lua_Unsigned mask = (lua_Unsigned)1 << (size*NB - 1);
-      res = ((res ^ mask) - mask);  /* do sign extension */
-    }
-  }
-  else if (size > SZINT) {  /* must check unread bytes */
-    int mask = (!issigned || (lua_Integer)res >= 0) ? 0 : MC;
-    for (i = limit; i < size; i++) {
-      if (l_unlikely((unsigned char)str[islittle ? i : size - 1 - i] != mask))
-        luaL_error(L, "%d-byte integer does not fit into Lua Integer", size);
-    }
-  }
-  return (lua_Integer)res;
-}
-
-
 static int str_unpack (lua_State *L) {
   Header h;
   const char *fmt = luaL_checkstring(L, 1);
@@ -1776,7 +3431,16 @@ static int str_unpack (lua_State *L) {
   const char *data = luaL_checklstring(L, 2, &ld);
   size_t pos = posrelatI(luaL_optinteger(L, 3, 1), ld) - 1;
   int n = 0;  /* number of results */
+  const PackFmt *pf;
   luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
+  pf = getpackfmt(L, 1, 0);
+  /* compiled format? (with stack space for results + next position) */
+  if (pf != NULL && lua_checkstack(L, pf->nvalues + 1)) {
+    pos = unpackrec(L, pf, data, ld, pos, 0, NULL);
+    lua_pushinteger(L, cast_st2S(pos) + 1);  /* next position */
+    return pf->nvalues + 1;
+  }
+  lua_pop(L, 1);  /* remove compiled format */
   initheader(L, &h);
   while (*fmt != '\0') {
     unsigned ntoalign;
@@ -1844,6 +3508,325 @@ static int str_unpack (lua_State *L) {
   return n + 1;
 }
 
+
+/*
+** string.packmany(fmt, t [, i [, j]]): pack the values t[i], ..., t[j]
+** as a sequence of records with format 'fmt'.
+*/
+static int str_packmany (lua_State *L) {
+  const PackFmt *pf;
+  lua_Integer i, j;
+  lua_Unsigned n;  /* number of values */
+  PackState ps;
+  lua_settop(L, 4);  /* compiled format goes to index 5 */
+  pf = getpackfmt(L, 1, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  i = luaL_optinteger(L, 3, 1);
+  j = luaL_opt(L, luaL_checkinteger, 4, l_castU2S(lua_rawlen(L, 2)));
+  n = (i <= j) ? l_castS2U(j) - l_castS2U(i) + 1 : 0;
+  luaL_argcheck(L, pf->nvalues > 0, 1, "format has no values");
+  luaL_argcheck(L, n % cast_uint(pf->nvalues) == 0, 2,
+                   "number of values is not a multiple of record size");
+  ps.L = L; ps.totalsize = 0; ps.t = 2; ps.k = i - 1;
+  lua_pushnil(L);  /* slot for each value */
+  ps.arg = lua_gettop(L);
+  luaL_buffinit(L, &ps.b);
+  for (n /= cast_uint(pf->nvalues); n > 0; n--)
+    packrec(&ps, pf);
+  luaL_pushresult(&ps.b);
+  return 1;
+}
+
+
+/*
+** string.unpackmany(fmt, s [, pos [, n [, t]]]): unpack 'n' records
+** with format 'fmt' (or, by default, all records until the end of 's'),
+** storing their values in sequence in table 't' (or in a new table).
+** Returns the table and the position after the last record.
+*/
+static int str_unpackmany (lua_State *L) {
+  const PackFmt *pf;
+  size_t ld, pos;
+  const char *data;
+  lua_Integer n;  /* number of records (negative for all) */
+  lua_Integer k = 0;  /* index of last value stored */
+  int t;
+  lua_settop(L, 5);  /* compiled format goes to index 6 */
+  pf = getpackfmt(L, 1, 1);
+  data = luaL_checklstring(L, 2, &ld);
+  pos = posrelatI(luaL_optinteger(L, 3, 1), ld) - 1;
+  n = luaL_optinteger(L, 4, -1);
+  luaL_argcheck(L, pos <= ld, 3, "initial position out of string");
+  luaL_argcheck(L, n >= 0 || lua_isnoneornil(L, 4), 4, "out of range");
+  luaL_argcheck(L, pf->nvalues > 0, 1, "format has no values");
+  if (lua_isnoneornil(L, 5)) {
+    /* records that the data may hold */
+    size_t nrec = (pf->minsize == 0) ? 0 : (ld - pos) / pf->minsize;
+    if (n >= 0 && l_castS2U(n) < nrec)
+      nrec = cast_sizet(n);
+    nrec *= cast_sizet(pf->nvalues);  /* values that the data may hold */
+    lua_createtable(L, (nrec < INT_MAX) ? cast_int(nrec) : INT_MAX, 0);
+  }
+  else {
+    luaL_checktype(L, 5, LUA_TTABLE);
+    lua_pushvalue(L, 5);
+  }
+  t = lua_gettop(L);
+  if (n < 0) {  /* unpack until the end of the data? */
+    while (pos < ld) {
+      size_t npos = unpackrec(L, pf, data, ld, pos, t, &k);
+      if (npos == pos)  /* empty record? */
+        break;  /* avoid an infinite loop */
+      pos = npos;
+    }
+  }
+  else {
+    for (; n > 0; n--)
+      pos = unpackrec(L, pf, data, ld, pos, t, &k);
+  }
+  lua_pushinteger(L, cast_st2S(pos) + 1);  /* next position */
+  return 2;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** STRING BUFFERS
+** =======================================================
+*/
+
+#define checkstrbuf(L,i)  \
+	((luaL_StrBuf *)luaL_checkudata(L, i, LUA_STRBUFHANDLE))
+
+
+static void addtostrbuf (lua_State *L, luaL_StrBuf *sb, const char *s,
+                                                        size_t l) {
+  if (l > 0) {  /* avoid 'memcpy' when 's' can be NULL */
+    char *p = luaL_prepstrbuf(L, sb, l);
+    memcpy(p, s, l * sizeof(char));
+    luaL_strbufaddsize(sb, l);
+  }
+}
+
+
+/* remove the first 'l' bytes of buffer 'sb' */
+static void consumestrbuf (luaL_StrBuf *sb, size_t l) {
+  if (l < luaL_strbuflen(sb))
+    sb->r += l;
+  else  /* buffer becomes empty */
+    sb->r = sb->n = 0;
+}
+
+
+/* free the block of buffer 'sb' */
+static void freestrbuf (lua_State *L, luaL_StrBuf *sb) {
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  allocf(ud, sb->b, sb->size, 0);
+  sb->b = NULL;
+  sb->size = sb->r = sb->n = 0;
+}
+
+
+static int buf_new (lua_State *L) {
+  lua_Integer size = luaL_optinteger(L, 1, 0);
+  luaL_StrBuf *sb;
+  luaL_argcheck(L, 0 <= size && l_castS2U(size) <= MAX_SIZE, 1,
+                   "out of range");
+  sb = (luaL_StrBuf *)lua_newuserdatauv(L, sizeof(luaL_StrBuf), 0);
+  sb->b = NULL;
+  sb->size = sb->r = sb->n = 0;
+  luaL_setmetatable(L, LUA_STRBUFHANDLE);
+  if (size > 0)
+    luaL_prepstrbuf(L, sb, cast_sizet(size));
+  return 1;
+}
+
+
+static int buf_put (lua_State *L) {
+  luaL_StrBuf *sb = checkstrbuf(L, 1);
+  int top = lua_gettop(L);
+  int arg;
+  for (arg = 2; arg <= top; arg++) {
+    luaL_StrBuf *other;
+    char buff[LUA_N2SBUFFSZ];
+    size_t len = lua_numbertocstring(L, arg, buff);  /* try as a number */
+    if (len > 0)  /* was it a number? */
+      addtostrbuf(L, sb, buff, len - 1);
+    else if (lua_type(L, arg) == LUA_TUSERDATA &&
+             (other = (luaL_StrBuf *)luaL_testudata(L, arg,
+                                              LUA_STRBUFHANDLE)) != NULL) {
+      /* 'other' may be 'sb'; get its address only after the 'prep' */
+      len = luaL_strbuflen(other);
+      if (len > 0) {
+        char *p = luaL_prepstrbuf(L, sb, len);
+        memcpy(p, luaL_strbufaddr(other), len * sizeof(char));
+        luaL_strbufaddsize(sb, len);
+      }
+    }
+    else {
+      const char *s = luaL_checklstring(L, arg, &len);
+      addtostrbuf(L, sb, s, len);
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_putf (lua_State *L) {
+  luaL_StrBuf *sb = checkstrbuf(L, 1);
+  int top = lua_gettop(L);
+  const Format *fmt = getformatcomp(L, 2);
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  addformat(L, &b, fmt, 2, top);
+  addtostrbuf(L, sb, luaL_buffaddr(&b), luaL_bufflen(&b));
+  lua_settop(L, 1);  /* also closes the box of 'b', if there is one */
+  return 1;
+}
+
+
+static int buf_reserve (lua_State *L) {
+  luaL_StrBuf *sb = checkstrbuf(L, 1);
+  lua_Integer n = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, 0 <= n && l_castS2U(n) <= MAX_SIZE, 2, "out of range");
+  luaL_prepstrbuf(L, sb, cast_sizet(n));
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** The result is always a copy: the contents of a buffer are mutable, so
+** a view over them (see 'lua_pushsubstring') could change later.
+*/
+static int buf_sub (lua_State *L) {
+  luaL_StrBuf *sb = checkstrbuf(L, 1);
+  size_t l = luaL_strbuflen(sb);
+  size_t start = posrelatI(luaL_checkinteger(L, 2), l);
+  size_t end = getendpos(L, 3, -1, l);
+  if (start <= end)
+    lua_pushlstring(L, luaL_strbufaddr(sb) + start - 1, (end - start) + 1);
+  else lua_pushliteral(L, "");
+  return 1;
+}
+
+
+static int buf_skip (lua_State *L) {
+  luaL_StrBuf *sb = checkstrbuf(L, 1);
+  lua_Integer n = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, n >= 0, 2, "out of range");
+  consumestrbuf(sb, (l_castS2U(n) < luaL_strbuflen(sb)) ? cast_sizet(n)
+                                                       : luaL_strbuflen(sb));
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** Remove the first 'n' bytes of the buffer (all by default) and return
+** them as a string. When the result is the whole block and it is
+** larger than a 'luaL_Buffer' can hold without a box, Lua takes the
+** block as an external string, without copying it. (Then the buffer
+** starts over with no block.)
+*/
+static int buf_get (lua_State *L) {
+  luaL_StrBuf *sb = checkstrbuf(L, 1);
+  size_t l = luaL_strbuflen(sb);
+  lua_Integer n = luaL_optinteger(L, 2, cast_st2S(l));
+  luaL_argcheck(L, n >= 0, 2, "out of range");
+  if (l_castS2U(n) < l)
+    l = cast_sizet(n);
+  else if (sb->r == 0 && l > LUAL_BUFFERSIZE) {  /* whole large block? */
+    void *ud;
+    lua_Alloc allocf = lua_getallocf(L, &ud);
+    char *s = (char *)allocf(ud, sb->b, sb->size, l + 1);  /* fit block */
+    if (l_unlikely(s == NULL))
+      return luaL_error(L, "not enough memory");
+    s[l] = '\0';  /* add ending zero */
+    sb->b = NULL;  /* Lua takes control of the block */
+    sb->size = sb->r = sb->n = 0;
+    lua_pushexternalstring(L, s, l, allocf, ud);
+    lua_gc(L, LUA_GCSTEP, l);
+    return 1;
+  }
+  lua_pushlstring(L, luaL_strbufaddr(sb), l);
+  consumestrbuf(sb, l);
+  return 1;
+}
+
+
+static int buf_reset (lua_State *L) {
+  luaL_StrBuf *sb = checkstrbuf(L, 1);
+  sb->r = sb->n = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_len (lua_State *L) {
+  luaL_StrBuf *sb = checkstrbuf(L, 1);
+  lua_pushinteger(L, cast_st2S(luaL_strbuflen(sb)));
+  return 1;
+}
+
+
+static int buf_tostring (lua_State *L) {
+  luaL_StrBuf *sb = checkstrbuf(L, 1);
+  lua_pushlstring(L, luaL_strbufaddr(sb), luaL_strbuflen(sb));
+  return 1;
+}
+
+
+static int buf_gc (lua_State *L) {
+  freestrbuf(L, checkstrbuf(L, 1));
+  return 0;
+}
+
+
+/*
+** methods for string buffers
+*/
+static const luaL_Reg bufmeth[] = {
+  {"put", buf_put},
+  {"putf", buf_putf},
+  {"reserve", buf_reserve},
+  {"sub", buf_sub},
+  {"skip", buf_skip},
+  {"get", buf_get},
+  {"reset", buf_reset},
+  {"tostring", buf_tostring},
+  {NULL, NULL}
+};
+
+
+/*
+** metamethods for string buffers
+*/
+static const luaL_Reg bufmetameth[] = {
+  {"__index", NULL},  /* placeholder */
+  {"__len", buf_len},
+  {"__tostring", buf_tostring},
+  {"__gc", buf_gc},
+  {"__close", buf_gc},
+  {NULL, NULL}
+};
+
+
+static void createbufmeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_STRBUFHANDLE);  /* metatable for buffers */
+  luaL_setfuncs(L, bufmetameth, 0);  /* add metamethods to new metatable */
+  luaL_newlibtable(L, bufmeth);  /* create method table */
+  lua_pushvalue(L, -5);  /* cache of compiled patterns */
+  lua_pushvalue(L, -5);  /* cache of compiled formats */
+  luaL_setfuncs(L, bufmeth, 2);  /* add buffer methods to method table */
+  lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
 /* }====================================================== */
 
 
@@ -1858,6 +3841,7 @@ static const luaL_Reg strlib[] = {
   {"len", str_len},
   {"lower", str_lower},
   {"match", str_match},
+  {"newbuffer", buf_new},
   {"rep", str_rep},
   {"reverse", str_reverse},
   {"sub", str_sub},
@@ -1865,6 +3849,8 @@ static const luaL_Reg strlib[] = {
   {"pack", str_pack},
   {"packsize", str_packsize},
   {"unpack", str_unpack},
+  {"packmany", str_packmany},
+  {"unpackmany", str_unpackmany},
   {NULL, NULL}
 };
 
@@ -1887,7 +3873,12 @@ static void createmetatable (lua_State *L) {
 ** Open string library
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
-  luaL_newlib(L, strlib);
+  luaL_newlibtable(L, strlib);
+  newcompcache(L);  /* cache of compiled patterns */
+  newcompcache(L);  /* cache of compiled formats */
+  newcompcache(L);  /* cache of compiled pack formats */
+  createbufmeta(L);  /* buffer methods share the caches */
+  luaL_setfuncs(L, strlib, 3);  /* all functions share the caches */
   createmetatable(L);
   return 1;
 }
@@ -59,7 +59,7 @@ typedef union {
   char padding[offsetof(Limbox_aux, follows_pNode)];
 } Limbox;
 
-#define haslastfree(t)     ((t)->lsizenode >= LIMFORLAST)
+#define haslastfree(t)     (logsizenode(t) >= LIMFORLAST)
 #define getlastfree(t)     ((cast(Limbox *, (t)->node) - 1)->lastfree)
 
 
@@ -119,7 +119,7 @@ typedef union {
 #define hashpointer(t,p)	hashmod(t, point2uint(p))
 
 
-#define dummynode		(&dummynode_)
+#define dummynode		(&luaH_dummynode)
 
 /*
 ** Common hash part for tables with empty hash parts. That allows all
@@ -127,7 +127,7 @@ typedef union {
 ** part?") when indexing. Its sole node has an empty value and a key
 ** (DEADKEY, NULL) that is different from any valid TValue.
 */
-static const Node dummynode_ = {
+LUAI_DDEF const Node luaH_dummynode = {
   {{NULL}, LUA_VEMPTY,  /* value's value and type */
    LUA_TDEADKEY, 0, {NULL}}  /* key type, next, and key value */
 };
@@ -358,15 +358,20 @@ static unsigned findindex (lua_State *L, Table *t, TValue *key,
 }
 
 
-int luaH_next (lua_State *L, Table *t, StkId key) {
+/*
+** Go to the first non-empty entry at or after index 'i' (as computed by
+** 'findindex'), putting its key and value in 'key' and 'key + 1'.
+** Returns the index of that entry as 'findindex' would compute it (that
+** is, the index for the next step), or 0 if there are no more entries.
+*/
+static unsigned nextfrom (lua_State *L, Table *t, StkId key, unsigned i) {
   unsigned int asize = t->asize;
-  unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
   for (; i < asize; i++) {  /* try first array part */
     lu_byte tag = *getArrTag(t, i);
     if (!tagisempty(tag)) {  /* a non-empty entry? */
       setivalue(s2v(key), cast_int(i) + 1);
       farr2val(t, i, tag, s2v(key + 1));
-      return 1;
+      return i + 1;
     }
   }
   for (i -= asize; i < sizenode(t); i++) {  /* hash part */
@@ -374,13 +379,42 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
       Node *n = gnode(t, i);
       getnodekey(L, s2v(key), n);
       setobj2s(L, key + 1, gval(n));
-      return 1;
+      return (i + 1) + asize;
     }
   }
   return 0;  /* no more elements */
 }
 
 
+int luaH_next (lua_State *L, Table *t, StkId key) {
+  unsigned i = findindex(L, t, s2v(key), t->asize);  /* find original key */
+  return (nextfrom(L, t, key, i) != 0);
+}
+
+
+/*
+** Variant of 'luaH_next' for traversals that keep the index returned by
+** the previous step ('pos'). When that index still has the given key
+** (which holds unless the table was rehashed), there is no need to
+** look up the key again.
+*/
+unsigned luaH_nextat (lua_State *L, Table *t, StkId key, unsigned pos) {
+  const TValue *k = s2v(key);
+  unsigned asize = t->asize;
+  int valid;
+  if (pos == 0)
+    valid = ttisnil(k);
+  else if (pos <= asize)
+    valid = (ttisinteger(k) && l_castS2U(ivalue(k)) == pos);
+  else
+    valid = (pos - asize <= sizenode(t) &&
+             equalkey(k, gnode(t, pos - asize - 1), 1));
+  if (!valid)
+    pos = findindex(L, t, s2v(key), asize);
+  return nextfrom(L, t, key, pos);
+}
+
+
 /* Extra space in Node array if it has a lastfree entry */
 #define extraLastfree(t)	(haslastfree(t) ? sizeof(Limbox) : 0)
 
@@ -603,7 +637,6 @@ static void setnodevector (lua_State *L, Table *t, unsigned size) {
   if (size == 0) {  /* no elements to hash part? */
     t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
     t->lsizenode = 0;
-    setdummy(t);  /* signal that it is using dummy node */
   }
   else {
     int i;
@@ -620,7 +653,6 @@ static void setnodevector (lua_State *L, Table *t, unsigned size) {
       getlastfree(t) = gnode(t, size);  /* all positions are free */
     }
     t->lsizenode = cast_byte(lsize);
-    setnodummy(t);
     for (i = 0; i < cast_int(size); i++) {
       Node *n = gnode(t, i);
       gnext(n) = 0;
@@ -651,20 +683,17 @@ static void reinserthash (lua_State *L, Table *ot, Table *t) {
 
 
 /*
-** Exchange the hash part of 't1' and 't2'. (In 'flags', only the dummy
-** bit must be exchanged:  The metamethod bits do not change during a
-** resize, so the "real" table can keep their values.)
+** Exchange the hash part of 't1' and 't2'. ('flags' need not change:
+** The metamethod bits do not change during a resize, so the "real"
+** table can keep their values. The same is true for BITLAYOUT.)
 */
 static void exchangehashpart (Table *t1, Table *t2) {
-  lu_byte lsizenode = t1->lsizenode;
+  lu_byte lsizenode = cast_byte(logsizenode(t1));
   Node *node = t1->node;
-  int bitdummy1 = t1->flags & BITDUMMY;
-  t1->lsizenode = t2->lsizenode;
+  t1->lsizenode = cast_byte((t1->lsizenode & BITLAYOUT) | logsizenode(t2));
   t1->node = t2->node;
-  t1->flags = cast_byte((t1->flags & NOTBITDUMMY) | (t2->flags & BITDUMMY));
-  t2->lsizenode = lsizenode;
+  t2->lsizenode = cast_byte((t2->lsizenode & BITLAYOUT) | lsizenode);
   t2->node = node;
-  t2->flags = cast_byte((t2->flags & NOTBITDUMMY) | bitdummy1);
 }
 
 
@@ -807,6 +836,36 @@ Table *luaH_new (lua_State *L) {
 }
 
 
+/*
+** Copy the contents of table 't' into the new (empty) table 'nt'. Both
+** parts get the same sizes, so that all entries go to the same
+** positions and can be copied as raw memory, without rehashing.
+** ('gnext' fields are offsets, so they remain valid in the copy.)
+** As 'nt' is new, it needs no barriers.
+*/
+void luaH_copy (lua_State *L, Table *nt, Table *t) {
+  lua_assert(nt->asize == 0 && isdummy(nt));
+  if (t->asize > 0) {
+    size_t size = concretesize(t->asize);
+    char *arr = luaM_newblock(L, size);
+    memcpy(arr, t->array - t->asize, size);
+    nt->array = cast(Value *, arr) + t->asize;
+    nt->asize = t->asize;
+  }
+  if (!isdummy(t)) {
+    size_t size = sizehash(t);
+    char *node = luaM_newblock(L, size);
+    memcpy(node, cast_charp(t->node) - extraLastfree(t), size);
+    nt->node = cast(Node *, node + extraLastfree(t));
+    nt->lsizenode = cast_byte(logsizenode(t));  /* (no layout) */
+    if (haslastfree(t))
+      getlastfree(nt) = nt->node + (getlastfree(t) - t->node);
+  }
+  /* same absent metamethods; not frozen and no global caches yet */
+  nt->flags = cast_byte(t->flags & maskflags);
+}
+
+
 lu_mem luaH_size (Table *t) {
   lu_mem sz = cast(lu_mem, sizeof(Table)) + concretesize(t->asize);
   if (!isdummy(t))
@@ -825,7 +884,29 @@ void luaH_free (lua_State *L, Table *t) {
 }
 
 
-static Node *getfreepos (Table *t) {
+/*
+** Number of nodes after a main position where 'getfreepos' first looks
+** for a free node.
+*/
+#define NEARFREE	4
+
+/*
+** Get a free node for a key colliding at main position 'mp'. A free
+** node right after 'mp' keeps the chain in the same region of memory
+** (ideally in the same cache line), which makes a big difference in
+** large tables. Otherwise, any free node will do. (Keys are never
+** removed from nodes, so a node that is not free stays that way, and
+** taking a node anywhere does not disturb the search with 'lastfree'.)
+*/
+static Node *getfreepos (Table *t, Node *mp) {
+  Node *limit = gnode(t, sizenode(t));
+  /* end of the near region, without forming pointers past 'limit' */
+  Node *end = (limit - mp > NEARFREE) ? mp + NEARFREE + 1 : limit;
+  Node *near;
+  for (near = mp + 1; near < end; near++) {
+    if (keyisnil(near))
+      return near;
+  }
   if (haslastfree(t)) {  /* does it have 'lastfree' information? */
     /* look for a spot before 'lastfree', updating 'lastfree' */
     while (getlastfree(t) > t->node) {
@@ -861,7 +942,7 @@ static int insertkey (Table *t, const TValue *key, TValue *value) {
   lua_assert(isabstkey(getgeneric(t, key, 0)));
   if (!isempty(gval(mp)) || isdummy(t)) {  /* main position is taken? */
     Node *othern;
-    Node *f = getfreepos(t);  /* get a free place */
+    Node *f = getfreepos(t, mp);  /* get a free place */
     if (f == NULL)  /* cannot find a free place? */
       return 0;
     lua_assert(!isdummy(t));
@@ -1055,6 +1136,8 @@ static int retpsetcode (Table *t, const TValue *slot) {
 
 static int finishnodeset (Table *t, const TValue *slot, TValue *val) {
   if (!ttisnil(slot)) {
+    if (l_unlikely(isfrozen(t)))
+      return HFROZEN;
     setobj(((lua_State*)NULL), cast(TValue*, slot), val);
     return HOK;  /* success */
   }
@@ -1096,7 +1179,9 @@ static int psetint (Table *t, lua_Integer key, TValue *val) {
 
 int luaH_psetshortstr (Table *t, TString *key, TValue *val) {
   const TValue *slot = luaH_Hgetshortstr(t, key);
-  if (!ttisnil(slot)) {  /* key already has a value? (all too common) */
+  if (l_unlikely(isfrozen(t)))
+    return ttisnil(slot) ? retpsetcode(t, slot) : HFROZEN;
+  else if (!ttisnil(slot)) {  /* key already has a value? (all too common) */
     setobj(((lua_State*)NULL), cast(TValue*, slot), val);  /* update it */
     return HOK;  /* done */
   }
@@ -1144,6 +1229,11 @@ int luaH_pset (Table *t, const TValue *key, TValue *val) {
   }
 }
 
+static l_noret frozenerror (lua_State *L) {
+  luaG_runerror(L, "attempt to modify a frozen table");
+}
+
+
 /*
 ** Finish a raw "set table" operation, where 'hres' encodes where the
 ** value should have been (the result of a previous 'pset' operation).
@@ -1153,6 +1243,9 @@ int luaH_pset (Table *t, const TValue *key, TValue *val) {
 void luaH_finishset (lua_State *L, Table *t, const TValue *key,
                                     TValue *value, int hres) {
   lua_assert(hres != HOK);
+  if (l_unlikely(isfrozen(t)))
+    frozenerror(L);
+  luaH_changed(L, t);
   if (hres == HNOTFOUND) {
     TValue aux;
     const TValue *actk = key;  /* actual key to insert */
@@ -1194,7 +1287,9 @@ void luaH_finishset (lua_State *L, Table *t, const TValue *key,
 */
 void luaH_set (lua_State *L, Table *t, const TValue *key, TValue *value) {
   int hres = luaH_pset(t, key, value);
-  if (hres != HOK)
+  if (hres == HOK)
+    luaH_changed(L, t);
+  else  /* 'luaH_finishset' signals the change itself */
     luaH_finishset(L, t, key, value, hres);
 }
 
@@ -1205,6 +1300,9 @@ void luaH_set (lua_State *L, Table *t, const TValue *key, TValue *value) {
 */
 void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
   unsigned ik = ikeyinarray(t, key);
+  if (l_unlikely(isfrozen(t)))
+    frozenerror(L);
+  luaH_changed(L, t);
   if (ik > 0)
     obj2arr(t, ik - 1, value);
   else {
@@ -1344,6 +1442,549 @@ lua_Unsigned luaH_getn (lua_State *L, Table *t) {
 
 
 
+/*
+** {======================================================
+** Sorting of array parts
+** =======================================================
+*/
+
+/*
+** 'luaH_sortarray' sorts in place the first 'n' elements of the array
+** part of a table when they are all integers, all floats (but no NaN),
+** or all strings, so that no metamethods can be involved. It is an
+** introsort: a quicksort with median-of-three pivots and insertion
+** sort for small intervals that switches to heapsort when the
+** recursion gets too deep. Arrays already sorted in either order are
+** detected upfront. As elements only change places inside the same
+** table, no barriers are needed.
+** Large arrays may also be sorted in parallel, with a sample sort:
+** a sample of the elements gives splitters that divide the values in
+** buckets; the elements are then moved to their buckets (through a
+** scratch buffer) and each bucket is sorted independently. All
+** phases are split in tasks that run through a 'lua_Parallel'
+** function given by the caller. The tasks only read and write the
+** array part and the scratch buffer; as no Lua code runs and nothing
+** is allocated during them, it is safe to run them concurrently. (For
+** strings, all elements are fixed upfront, so that comparisons do not
+** change them.)
+*/
+
+/* "less than" for two values of the same type */
+typedef int (*ValueLT) (lua_State *L, const Value *a, const Value *b);
+
+
+typedef struct SortState {
+  lua_State *L;
+  Table *t;
+  Value *v;  /* element 'k' is at 'v - k' */
+  ValueLT lt;
+  int sametag;  /* true if all elements have the same tag */
+} SortState;
+
+
+/* intervals smaller than this are sorted by insertion */
+#define INSSORTLIMIT	16
+
+
+#define sval(ss,k)	((ss)->v - (k))
+#define lessthan(ss,a,b)	((ss)->lt((ss)->L, a, b))
+#define lessidx(ss,i,j)	lessthan(ss, sval(ss, i), sval(ss, j))
+
+
+static int ltint (lua_State *L, const Value *a, const Value *b) {
+  UNUSED(L);
+  return (a->i < b->i);
+}
+
+
+static int ltflt (lua_State *L, const Value *a, const Value *b) {
+  UNUSED(L);
+  return luai_numlt(a->n, b->n);
+}
+
+
+static int ltstr (lua_State *L, const Value *a, const Value *b) {
+  TValue va, vb;
+  setsvalue(L, &va, gco2ts(a->gc));
+  setsvalue(L, &vb, gco2ts(b->gc));
+  return luaV_lessthan(L, &va, &vb);
+}
+
+
+static void swapval (SortState *ss, unsigned i, unsigned j) {
+  Value v = *sval(ss, i);
+  *sval(ss, i) = *sval(ss, j);
+  *sval(ss, j) = v;
+  if (!ss->sametag) {  /* must swap tags too? */
+    lu_byte tag = *getArrTag(ss->t, i);
+    *getArrTag(ss->t, i) = *getArrTag(ss->t, j);
+    *getArrTag(ss->t, j) = tag;
+  }
+}
+
+
+static void insertionsort (SortState *ss, unsigned lo, unsigned up) {
+  unsigned i, j;
+  for (i = lo + 1; i <= up; i++) {
+    for (j = i; j > lo && lessidx(ss, j, j - 1); j--)
+      swapval(ss, j, j - 1);
+  }
+}
+
+
+/* move down element 'i' of the heap with 'n' elements starting at 'lo' */
+static void siftdown (SortState *ss, unsigned lo, unsigned i, unsigned n) {
+  for (;;) {
+    unsigned c = 2 * i + 1;  /* first child */
+    if (c >= n)
+      break;
+    if (c + 1 < n && lessidx(ss, lo + c, lo + c + 1))
+      c++;  /* larger child */
+    if (!lessidx(ss, lo + i, lo + c))
+      break;
+    swapval(ss, lo + i, lo + c);
+    i = c;
+  }
+}
+
+
+static void heapsort (SortState *ss, unsigned lo, unsigned up) {
+  unsigned n = up - lo + 1;
+  unsigned i;
+  for (i = n / 2; i > 0; i--)
+    siftdown(ss, lo, i - 1, n);
+  while (--n > 0) {
+    swapval(ss, lo, lo + n);  /* move largest element to its place */
+    siftdown(ss, lo, 0, n);
+  }
+}
+
+
+static void introsort (SortState *ss, unsigned lo, unsigned up, int depth) {
+  while (up - lo >= INSSORTLIMIT) {  /* loop for tail recursion */
+    unsigned p = lo + (up - lo) / 2;
+    unsigned i = lo, j = up;
+    Value pivot;
+    if (depth-- == 0) {  /* too many bad partitions? */
+      heapsort(ss, lo, up);
+      return;
+    }
+    /* sort elements 'lo', 'p', and 'up' */
+    if (lessidx(ss, p, lo)) swapval(ss, p, lo);
+    if (lessidx(ss, up, p)) {
+      swapval(ss, up, p);
+      if (lessidx(ss, p, lo)) swapval(ss, p, lo);
+    }
+    pivot = *sval(ss, p);
+    /* a[lo] <= P <= a[up] work as sentinels for the loops */
+    for (;;) {
+      do i++; while (lessthan(ss, sval(ss, i), &pivot));
+      do j--; while (lessthan(ss, &pivot, sval(ss, j)));
+      if (i >= j)
+        break;
+      swapval(ss, i, j);
+    }
+    /* a[lo .. j] <= P <= a[j + 1 .. up] */
+    if (j - lo < up - j) {  /* lower interval is smaller? */
+      introsort(ss, lo, j, depth);
+      lo = j + 1;
+    }
+    else {
+      introsort(ss, j + 1, up, depth);
+      up = j;
+    }
+  }
+  insertionsort(ss, lo, up);
+}
+
+
+/*
+** Check whether the first 'n' elements are already sorted; reverse
+** them if they are in (strictly) descending order.
+*/
+static int presorted (SortState *ss, unsigned n) {
+  unsigned i;
+  for (i = 1; i < n && !lessidx(ss, i, i - 1); i++) ;
+  if (i == n)
+    return 1;  /* ascending order */
+  else if (i > 1)
+    return 0;  /* neither order */
+  for (i = 1; i < n && lessidx(ss, i, i - 1); i++) ;
+  if (i < n)
+    return 0;  /* not in descending order */
+  for (i = 0; i < n / 2; i++)
+    swapval(ss, i, n - 1 - i);
+  return 1;
+}
+
+
+/*
+** Parallel sort
+*/
+
+/* arrays smaller than this are not worth sorting in parallel */
+#define PARSORTMIN	(1u << 16)
+
+/* maximum number of buckets (bucket indices must fit in a 'lu_byte') */
+#define MAXBUCKETS	256
+
+/* buckets per worker, to balance their loads */
+#define BUCKETSPERWORKER	4
+
+/* number of samples per bucket used to choose the splitters */
+#define OVERSAMPLE	32
+
+
+typedef struct ParSort {
+  SortState *ss;
+  unsigned n;  /* number of elements */
+  unsigned nb;  /* number of buckets (and of chunks of the array) */
+  unsigned csize;  /* size of each chunk */
+  int depth;  /* depth limit for sorting each bucket */
+  Value *spl;  /* splitters between buckets ('nb - 1') */
+  Value *buf;  /* scratch buffer for values */
+  lu_byte *tbuf;  /* scratch buffer for tags (when they differ) */
+  lu_byte *bucket;  /* bucket of each element */
+  unsigned *count;  /* elements of chunk 'c' in bucket 'b' (and then
+                       their next position) at 'count[c * nb + b]' */
+  unsigned *start;  /* first position of each bucket */
+} ParSort;
+
+
+/* bucket for value 'v': number of splitters less than or equal to it */
+static unsigned findbucket (ParSort *ps, const Value *v) {
+  unsigned lo = 0;
+  unsigned hi = ps->nb - 1;
+  while (lo < hi) {
+    unsigned m = lo + (hi - lo) / 2;
+    if (lessthan(ps->ss, v, &ps->spl[m]))
+      hi = m;
+    else
+      lo = m + 1;
+  }
+  return lo;
+}
+
+
+/* limits of chunk 'c' */
+#define chunklo(ps,c)	((c) * (ps)->csize)
+#define chunkup(ps,c)  \
+	(((ps)->n - chunklo(ps,c) < (ps)->csize) ? (ps)->n \
+	                                         : chunklo(ps,c) + (ps)->csize)
+
+
+/* task: count the elements of chunk 'c' in each bucket */
+static void classifychunk (void *arg, int c) {
+  ParSort *ps = cast(ParSort *, arg);
+  unsigned *count = ps->count + cast_uint(c) * ps->nb;
+  unsigned k;
+  for (k = chunklo(ps, cast_uint(c)); k < chunkup(ps, cast_uint(c)); k++) {
+    unsigned b = findbucket(ps, sval(ps->ss, k));
+    ps->bucket[k] = cast_byte(b);
+    count[b]++;
+  }
+}
+
+
+/* task: move the elements of chunk 'c' to their buckets in the buffer */
+static void scatterchunk (void *arg, int c) {
+  ParSort *ps = cast(ParSort *, arg);
+  unsigned *pos = ps->count + cast_uint(c) * ps->nb;
+  unsigned k;
+  for (k = chunklo(ps, cast_uint(c)); k < chunkup(ps, cast_uint(c)); k++) {
+    unsigned d = pos[ps->bucket[k]]++;
+    ps->buf[d] = *sval(ps->ss, k);
+    if (ps->tbuf)
+      ps->tbuf[d] = *getArrTag(ps->ss->t, k);
+  }
+}
+
+
+/* task: move bucket 'b' back to the array and sort it */
+static void sortbucket (void *arg, int b) {
+  ParSort *ps = cast(ParSort *, arg);
+  unsigned lo = ps->start[b];
+  unsigned up = ps->start[b + 1];
+  unsigned k;
+  for (k = lo; k < up; k++) {
+    *sval(ps->ss, k) = ps->buf[k];
+    if (ps->tbuf)
+      *getArrTag(ps->ss->t, k) = ps->tbuf[k];
+  }
+  if (up - lo > 1)
+    introsort(ps->ss, lo, up - 1, ps->depth);
+}
+
+
+/*
+** Choose the splitters: sort a sample of evenly spaced elements, kept
+** in the (still unused) buffer, and take every OVERSAMPLE-th of them.
+*/
+static void choosesplitters (ParSort *ps) {
+  SortState sample = *ps->ss;
+  unsigned ns = ps->nb * OVERSAMPLE;
+  unsigned step = ps->n / ns;
+  unsigned i;
+  for (i = 0; i < ns; i++)
+    ps->buf[i] = *sval(ps->ss, i * step + step / 2);
+  sample.t = NULL;  /* sample is not in the table... */
+  sample.v = ps->buf + ns - 1;  /* ...but in the buffer */
+  sample.sametag = 1;  /* and has no tags */
+  introsort(&sample, 0, ns - 1, ps->depth);
+  for (i = 0; i < ps->nb - 1; i++)
+    ps->spl[i] = *sval(&sample, (i + 1) * OVERSAMPLE);
+}
+
+
+/*
+** Sort the 'n' elements in parallel with 'nw' workers. Returns 0
+** (without changing anything) if 'n' is too large for the buffers.
+*/
+static int parsort (SortState *ss, unsigned n, int depth, int nw,
+                    lua_Parallel pf, void *ud) {
+  ParSort ps;
+  size_t nv, nu, nt, size;
+  char *block;
+  unsigned b, c, pos;
+  ps.ss = ss;
+  ps.n = n;
+  ps.nb = (cast_uint(nw) <= MAXBUCKETS / BUCKETSPERWORKER)
+        ? cast_uint(nw) * BUCKETSPERWORKER : MAXBUCKETS;
+  ps.csize = (n + ps.nb - 1) / ps.nb;
+  ps.depth = depth;
+  /* one block with all buffers: values, then unsigneds, then bytes */
+  nv = cast_sizet(n) + ps.nb - 1;
+  nu = cast_sizet(ps.nb) * ps.nb + ps.nb + 1;
+  nt = ss->sametag ? n : cast_sizet(n) * 2;
+  if (nv > (MAX_SIZET - nu * sizeof(unsigned)) / (sizeof(Value) + 2))
+    return 0;
+  size = nv * sizeof(Value) + nu * sizeof(unsigned) + nt;
+  block = luaM_newblock(ss->L, size);
+  ps.buf = cast(Value *, block);
+  ps.spl = ps.buf + n;
+  ps.count = cast(unsigned *, ps.buf + nv);
+  ps.start = ps.count + cast_sizet(ps.nb) * ps.nb;
+  ps.bucket = cast(lu_byte *, ps.count + nu);
+  ps.tbuf = ss->sametag ? NULL : ps.bucket + n;
+  if (ss->lt == ltstr) {  /* make sure comparisons will not change strings */
+    for (pos = 0; pos < n; pos++)
+      luaS_fixstr(ss->L, gco2ts(sval(ss, pos)->gc), 1);
+  }
+  choosesplitters(&ps);
+  memset(ps.count, 0, nu * sizeof(unsigned));
+  pf(ud, cast_int(ps.nb), classifychunk, &ps);
+  pos = 0;
+  for (b = 0; b < ps.nb; b++) {  /* compute where each part goes */
+    ps.start[b] = pos;
+    for (c = 0; c < ps.nb; c++) {
+      unsigned *cnt = &ps.count[c * ps.nb + b];
+      unsigned nc = *cnt;
+      *cnt = pos;
+      pos += nc;
+    }
+  }
+  ps.start[ps.nb] = n;
+  lua_assert(pos == n);
+  pf(ud, cast_int(ps.nb), scatterchunk, &ps);
+  pf(ud, cast_int(ps.nb), sortbucket, &ps);
+  luaM_freemem(ss->L, block, size);
+  return 1;
+}
+
+
+/*
+** Sort the first 'n' elements of the array part of 't', if possible.
+** Returns 0 (without changing the table) if those elements are not all
+** present in the array part or are not of a single sortable type. With
+** 'nw' > 1 workers, large arrays are sorted in parallel through 'pf'.
+*/
+int luaH_sortarray (lua_State *L, Table *t, lua_Unsigned n,
+                                  int nw, lua_Parallel pf, void *ud) {
+  SortState ss;
+  lu_byte tag;
+  unsigned i;
+  int depth = 0;
+  if (n < 2 || n > t->asize || isfrozen(t))
+    return (n < 2);  /* nothing to sort, too large, or cannot change */
+  ss.L = L;
+  ss.t = t;
+  ss.v = getArrVal(t, 0);
+  ss.sametag = 1;
+  tag = *getArrTag(t, 0);
+  switch (tag) {
+    case LUA_VNUMINT: ss.lt = ltint; break;
+    case LUA_VNUMFLT: ss.lt = ltflt; break;
+    case ctb(LUA_VSHRSTR): case ctb(LUA_VLNGSTR): ss.lt = ltstr; break;
+    default: return 0;
+  }
+  for (i = 1; i < n; i++) {  /* check the types of the elements */
+    lu_byte tagi = *getArrTag(t, i);
+    if (tagi != tag) {
+      if (ss.lt == ltstr && novariant(tagi) == LUA_TSTRING)
+        ss.sametag = 0;  /* both short and long strings */
+      else
+        return 0;
+    }
+  }
+  if (ss.lt == ltflt) {  /* NaNs make the order inconsistent */
+    for (i = 0; i < n; i++)
+      if (luai_numisnan(sval(&ss, i)->n)) return 0;
+  }
+  if (!presorted(&ss, cast_uint(n))) {
+    for (i = cast_uint(n); i > 1; i >>= 1)
+      depth += 2;  /* 2 * log2(n) */
+    if (nw <= 1 || n < PARSORTMIN ||
+        !parsort(&ss, cast_uint(n), depth, nw, pf, ud))
+      introsort(&ss, 0, cast_uint(n) - 1, depth);
+  }
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Bulk operations on array parts
+** =======================================================
+*/
+
+/*
+** Check whether the 'n' elements starting at key 'k' are all in the
+** array part of 't', where 'n' is at least 1.
+*/
+static int inarray (Table *t, lua_Unsigned k, lua_Unsigned n) {
+  lua_Unsigned u = k - 1u;  /* C-index of the first element */
+  return (u < t->asize && n <= t->asize - u);
+}
+
+
+/* check whether any of the 'n' elements starting at C-index 'u' is empty */
+static int hasempty (Table *t, unsigned u, unsigned n) {
+  const lu_byte *tag = getArrTag(t, u);
+  unsigned i;
+  for (i = 0; i < n; i++)
+    if (tagisempty(tag[i])) return 1;
+  return 0;
+}
+
+
+/*
+** Do 'dst[t .. t + n - 1] = src[f .. f + n - 1]' when both ranges are
+** in the array parts of their tables and the copy cannot involve
+** metamethods: empty elements would call an '__index' metamethod in
+** 'src' or a '__newindex' one in 'dst'. Returns 0 (without changing
+** anything) when that is not the case. Elements are copied as by
+** 'memmove', so the ranges may overlap.
+*/
+int luaH_movearray (lua_State *L, Table *src, lua_Unsigned f,
+                    lua_Unsigned n, Table *dst, lua_Unsigned t) {
+  unsigned uf, ut, un;
+  if (n == 0 || isfrozen(dst) || !inarray(src, f, n) || !inarray(dst, t, n))
+    return 0;
+  uf = cast_uint(f - 1u); ut = cast_uint(t - 1u); un = cast_uint(n);
+  if (fasttm(L, src->metatable, TM_INDEX) != NULL && hasempty(src, uf, un))
+    return 0;
+  if (fasttm(L, dst->metatable, TM_NEWINDEX) != NULL &&
+      hasempty(dst, ut, un))
+    return 0;
+  /* values are stored in reverse order, so the last one comes first */
+  memmove(getArrVal(dst, ut + un - 1), getArrVal(src, uf + un - 1),
+          un * sizeof(Value));
+  memmove(getArrTag(dst, ut), getArrTag(src, uf), un);
+  if (src != dst && isblack(dst))
+    luaC_barrierback_(L, obj2gco(dst));  /* 'dst' may get new values */
+  return 1;
+}
+
+
+/*
+** Push 't[i .. i + n - 1]' on the stack when they are all in the array
+** part of 't' and no '__index' metamethod can be involved. Returns 0
+** (pushing nothing) otherwise. The stack must have room for the
+** values.
+*/
+int luaH_unpackarray (lua_State *L, Table *t, lua_Unsigned i,
+                                              lua_Unsigned n) {
+  StkId top = L->top.p;
+  unsigned u, k;
+  if (n == 0 || !inarray(t, i, n))
+    return 0;
+  u = cast_uint(i - 1u);
+  if (fasttm(L, t->metatable, TM_INDEX) != NULL &&
+      hasempty(t, u, cast_uint(n)))
+    return 0;
+  for (k = 0; k < n; k++) {
+    TValue *io = s2v(top + k);
+    arr2obj(t, u + k, io);
+    if (tagisempty(rawtt(io)))
+      setnilvalue(io);  /* empty elements are nil */
+  }
+  L->top.p = top + n;
+  return 1;
+}
+
+
+/*
+** Concatenate the strings 't[i .. i + n - 1]', with 'sep' between them,
+** when they are all strings in the array part of 't'. Returns NULL
+** otherwise (or if the result would be too long). The result is built
+** in a single allocation, with its final size computed upfront.
+*/
+TString *luaH_concatarray (lua_State *L, Table *t, lua_Unsigned i,
+                           lua_Unsigned n, const char *sep, size_t lsep) {
+  char buff[LUAI_MAXSHORTLEN];
+  size_t total;
+  unsigned u, k;
+  char *p;
+  TString *ts;
+  if (n == 0 || !inarray(t, i, n))
+    return NULL;
+  u = cast_uint(i - 1u);
+  if (lsep > (MAX_SIZE - sizeof(TString)) / n)
+    return NULL;  /* result would be too long */
+  total = lsep * cast_sizet(n - 1);
+  for (k = 0; k < n; k++) {  /* check elements and compute total size */
+    lu_byte tag = *getArrTag(t, u + k);
+    size_t l;
+    if (tag == ctb(LUA_VSHRSTR))
+      l = cast_sizet(gco2ts(getArrVal(t, u + k)->gc)->shrlen);
+    else if (tag == ctb(LUA_VLNGSTR))
+      l = gco2ts(getArrVal(t, u + k)->gc)->u.lnglen;
+    else
+      return NULL;  /* not a string */
+    if (l >= MAX_SIZE - sizeof(TString) - total)
+      return NULL;  /* result would be too long */
+    total += l;
+  }
+  if (total <= LUAI_MAXSHORTLEN) {  /* result is a short string? */
+    ts = NULL;
+    p = buff;
+  }
+  else {  /* create the result directly */
+    ts = luaS_createlngstrobj(L, total);
+    p = getlngstr(ts);
+  }
+  for (k = 0; k < n; k++) {
+    size_t l;
+    const char *s = getlstr(gco2ts(getArrVal(t, u + k)->gc), l);
+    if (k > 0 && lsep > 0) {
+      memcpy(p, sep, lsep);
+      p += lsep;
+    }
+    memcpy(p, s, l);
+    p += l;
+  }
+  if (ts == NULL)
+    ts = luaS_newlstr(L, buff, total);
+  return ts;
+}
+
+/* }====================================================== */
+
+
+
 #if defined(LUA_DEBUG)
 
 /* export this function for the test library */
@@ -24,16 +24,38 @@
 
 
 /*
-** Bit BITDUMMY set in 'flags' means the table is using the dummy node
-** for its hash part.
+** A table with an empty hash part uses the common dummy node.
 */
+LUAI_DDEC(const Node luaH_dummynode;)
 
-#define BITDUMMY		(1 << 6)
-#define NOTBITDUMMY		cast_byte(~BITDUMMY)
-#define isdummy(t)		((t)->flags & BITDUMMY)
+#define isdummy(t)		((t)->node == &luaH_dummynode)
 
-#define setnodummy(t)		((t)->flags &= NOTBITDUMMY)
-#define setdummy(t)		((t)->flags |= BITDUMMY)
+
+/*
+** Bit BITFROZEN set in 'flags' means the table is frozen: its contents
+** cannot change anymore. (Writes to existing keys fail in 'pset' with
+** code HFROZEN; all others fail in 'luaH_finishset'.)
+*/
+
+#define BITFROZEN		(1 << 6)
+#define isfrozen(t)		((t)->flags & BITFROZEN)
+#define setfrozen(t)		((t)->flags |= BITFROZEN)
+
+
+
+/*
+** Bit BITWATCH set in 'flags' means that global caches (see OP_GETCACHE
+** and 'luaV_finishget') may keep values read from the table. Any change
+** in the contents (or in the metatable) of such a table invalidates all
+** these caches, by changing the global cache version.
+*/
+
+#define BITWATCH		(1 << 7)
+#define setwatch(t)		((t)->flags |= BITWATCH)
+
+#define luaH_changed(L,t)  \
+	(l_unlikely((t)->flags & BITWATCH) ?  \
+	  cast_void(G(L)->cacheversion++) : cast_void(0))
 
 
 
@@ -58,9 +80,10 @@
   { Table *h = t; lua_Unsigned u = l_castS2U(k) - 1u; \
     if ((u < h->asize)) { \
       lu_byte *tag = getArrTag(h, u); \
-      if (checknoTM(h->metatable, TM_NEWINDEX) || !tagisempty(*tag)) \
+      if (l_likely(!isfrozen(h)) && \
+          (checknoTM(h->metatable, TM_NEWINDEX) || !tagisempty(*tag))) \
         { fval2arr(h, u, tag, val); hres = HOK; } \
-      else hres = ~cast_int(u); } \
+      else hres = tagisempty(*tag) ? ~cast_int(u) : HFROZEN; } \
     else { hres = luaH_psetint(h, k, val); }}
 
 
@@ -68,7 +91,8 @@
 #define HOK		0
 #define HNOTFOUND	1
 #define HNOTATABLE	2
-#define HFIRSTNODE	3
+#define HFROZEN		3
+#define HFIRSTNODE	4
 
 /*
 ** 'luaH_get*' operations set 'res', unless the value is absent, and
@@ -81,6 +105,8 @@
 ** value because there might be a metamethod.) If the slot is in the
 ** hash part, the encoding is (HFIRSTNODE + hash index); if the slot is
 ** in the array part, the encoding is (~array index), a negative value.
+** In a frozen table, 'luaH_pset*' never set a value; when the key
+** already has a value, they return HFROZEN.
 ** The value HNOTATABLE is used by the fast macros to signal that the
 ** value being indexed is not a table.
 ** (The size for the array part is limited by the maximum power of two
@@ -167,13 +193,24 @@ LUAI_FUNC void luaH_set (lua_State *L, Table *t, const TValue *key,
 LUAI_FUNC void luaH_finishset (lua_State *L, Table *t, const TValue *key,
                                               TValue *value, int hres);
 LUAI_FUNC Table *luaH_new (lua_State *L);
+LUAI_FUNC void luaH_copy (lua_State *L, Table *nt, Table *t);
 LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned nasize,
                                                     unsigned nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned nasize);
 LUAI_FUNC lu_mem luaH_size (Table *t);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
+LUAI_FUNC unsigned luaH_nextat (lua_State *L, Table *t, StkId key,
+                                                        unsigned pos);
 LUAI_FUNC lua_Unsigned luaH_getn (lua_State *L, Table *t);
+LUAI_FUNC int luaH_sortarray (lua_State *L, Table *t, lua_Unsigned n,
+                                           int nw, lua_Parallel pf, void *ud);
+LUAI_FUNC int luaH_movearray (lua_State *L, Table *src, lua_Unsigned f,
+                              lua_Unsigned n, Table *dst, lua_Unsigned t);
+LUAI_FUNC int luaH_unpackarray (lua_State *L, Table *t, lua_Unsigned i,
+                                                        lua_Unsigned n);
+LUAI_FUNC TString *luaH_concatarray (lua_State *L, Table *t, lua_Unsigned i,
+                          lua_Unsigned n, const char *sep, size_t lsep);
 
 
 #if defined(LUA_DEBUG)
@@ -11,6 +11,7 @@
 
 
 #include <limits.h>
+#include <math.h>
 #include <stddef.h>
 #include <string.h>
 
@@ -69,6 +70,119 @@ static int tcreate (lua_State *L) {
 }
 
 
+/* push a raw copy of the table at 'idx', with the same metatable */
+static void clone1 (lua_State *L, int idx) {
+  lua_clonetable(L, idx);
+  if (lua_getmetatable(L, idx))
+    lua_setmetatable(L, -2);
+}
+
+
+/*
+** With 'deep', tables that are values in the clone are cloned too,
+** each one only once, so that shared and cyclic structures are kept.
+** Clones still to be traversed go in a list (to avoid recursion), and
+** table 'seen' maps original tables to their clones.
+*/
+static int tclone (lua_State *L) {
+  int deep = lua_toboolean(L, 2);
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 1);
+  clone1(L, 1);  /* 2: result */
+  if (deep) {
+    lua_Integer n = 0;  /* number of clones to traverse */
+    lua_newtable(L);  /* 3: 'seen' */
+    lua_newtable(L);  /* 4: clones to traverse */
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, 2);
+    lua_rawset(L, 3);  /* seen[t] = result */
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, 4, ++n);
+    while (n > 0) {
+      lua_rawgeti(L, 4, n);  /* 5: table to traverse */
+      lua_pushnil(L);
+      lua_rawseti(L, 4, n--);
+      lua_pushnil(L);  /* first key */
+      while (lua_next(L, 5)) {  /* key at 6, value at 7 */
+        if (lua_type(L, 7) == LUA_TTABLE) {
+          lua_pushvalue(L, 7);
+          if (lua_rawget(L, 3) == LUA_TNIL) {  /* not cloned yet? */
+            lua_pop(L, 1);
+            clone1(L, 7);  /* 8: clone */
+            lua_pushvalue(L, 7);
+            lua_pushvalue(L, 8);
+            lua_rawset(L, 3);  /* seen[value] = clone */
+            lua_pushvalue(L, 8);
+            lua_rawseti(L, 4, ++n);  /* traverse it later */
+          }
+          lua_pushvalue(L, 6);
+          lua_insert(L, -2);
+          lua_rawset(L, 5);  /* table[key] = clone */
+        }
+        lua_pop(L, 1);  /* remove value; keep key for next iteration */
+      }
+      lua_pop(L, 1);  /* remove traversed table */
+    }
+    lua_settop(L, 2);
+  }
+  return 1;
+}
+
+
+/*
+** With 'deep', tables that are values in 't' are frozen too. Tables
+** still to be traversed go in a list (to avoid recursion), and table
+** 'seen' marks the tables already put in that list.
+*/
+static int tfreeze (lua_State *L) {
+  int deep = lua_toboolean(L, 2);
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_settop(L, 1);
+  if (deep) {
+    lua_Integer n = 0;  /* number of tables to traverse */
+    lua_newtable(L);  /* 2: 'seen' */
+    lua_newtable(L);  /* 3: tables to traverse */
+    lua_pushvalue(L, 1);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, 2);  /* seen[t] = true */
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, 3, ++n);
+    while (n > 0) {
+      lua_rawgeti(L, 3, n);  /* 4: table to traverse */
+      lua_pushnil(L);
+      lua_rawseti(L, 3, n--);
+      lua_pushnil(L);  /* first key */
+      while (lua_next(L, 4)) {  /* key at 5, value at 6 */
+        if (lua_type(L, 6) == LUA_TTABLE) {
+          lua_pushvalue(L, 6);
+          if (lua_rawget(L, 2) == LUA_TNIL) {  /* not seen yet? */
+            lua_pushvalue(L, 6);
+            lua_pushboolean(L, 1);
+            lua_rawset(L, 2);  /* seen[value] = true */
+            lua_pushvalue(L, 6);
+            lua_rawseti(L, 3, ++n);  /* traverse it later */
+          }
+          lua_pop(L, 1);  /* remove result from 'seen' */
+        }
+        lua_pop(L, 1);  /* remove value; keep key for next iteration */
+      }
+      lua_freeze(L, 4);
+      lua_pop(L, 1);  /* remove traversed table */
+    }
+    lua_settop(L, 1);
+  }
+  lua_freeze(L, 1);
+  return 1;
+}
+
+
+static int tisfrozen (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_pushboolean(L, lua_isfrozen(L, 1));
+  return 1;
+}
+
+
 static int tinsert (lua_State *L) {
   lua_Integer pos;  /* where to insert new element */
   lua_Integer e = aux_getn(L, 1, TAB_RW);
@@ -137,7 +251,12 @@ static int tmove (lua_State *L) {
     n = e - f + 1;  /* number of elements to move */
     luaL_argcheck(L, t <= LUA_MAXINTEGER - n + 1, 4,
                   "destination wrap around");
-    if (t > e || t <= f || (tt != 1 && !lua_compare(L, 1, tt, LUA_OPEQ))) {
+    if (lua_type(L, 1) == LUA_TTABLE && lua_type(L, tt) == LUA_TTABLE &&
+        lua_rawmove(L, 1, f, e, t, tt)) {
+      /* moved directly between the array parts */
+    }
+    else if (t > e || t <= f ||
+             (tt != 1 && !lua_compare(L, 1, tt, LUA_OPEQ))) {
       for (i = 0; i < n; i++) {
         lua_geti(L, 1, f + i);
         lua_seti(L, tt, t + i);
@@ -171,6 +290,9 @@ static int tconcat (lua_State *L) {
   const char *sep = luaL_optlstring(L, 2, "", &lsep);
   lua_Integer i = luaL_optinteger(L, 3, 1);
   last = luaL_optinteger(L, 4, last);
+  if (i <= last && lua_type(L, 1) == LUA_TTABLE &&
+      lua_rawconcat(L, 1, i, last, sep, lsep))
+    return 1;  /* all strings in the array part; result is on the stack */
   luaL_buffinit(L, &b);
   for (; i < last; i++) {
     addfield(L, &b, i);
@@ -211,6 +333,8 @@ static int tunpack (lua_State *L) {
   if (l_unlikely(n >= (unsigned int)INT_MAX  ||
                  !lua_checkstack(L, (int)(++n))))
     return luaL_error(L, "too many results to unpack");
+  if (lua_type(L, 1) == LUA_TTABLE && lua_rawunpack(L, 1, i, e))
+    return (int)n;  /* pushed directly from the array part */
   for (; i < e; i++) {  /* push arg[i..e - 1] (to avoid overflows) */
     lua_geti(L, 1, i);
   }
@@ -391,14 +515,369 @@ static void auxsort (lua_State *L, IdxT lo, IdxT up, unsigned rnd) {
 }
 
 
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Parallel sort
+** =======================================================
+*/
+
+/* maximum number of threads that 'sort' may use */
+#if !defined(LUA_MAXSORTTHREADS)
+#define LUA_MAXSORTTHREADS	64
+#endif
+
+
+/* number of threads for 'sort', kept in the first upvalue */
+#define sortthreads(L)	((int *)lua_touserdata(L, lua_upvalueindex(1)))
+
+
+#if defined(LUA_USE_PTHREADS)	/* { */
+
+#include <pthread.h>
+
+/* state shared by the threads running a set of tasks */
+typedef struct Workers {
+  lua_Task task;
+  void *arg;
+  int ntasks;
+  int next;  /* next task to be run */
+  pthread_mutex_t lock;
+} Workers;
+
+
+/* run tasks until there are no more tasks to run */
+static void *worker (void *ud) {
+  Workers *w = (Workers *)ud;
+  for (;;) {
+    int i;
+    pthread_mutex_lock(&w->lock);
+    i = w->next;
+    if (i < w->ntasks)
+      w->next++;
+    pthread_mutex_unlock(&w->lock);
+    if (i >= w->ntasks)
+      return NULL;
+    w->task(w->arg, i);
+  }
+}
+
+
+/*
+** Run the tasks with up to '*ud' threads, including the calling one.
+** If some thread cannot be created, the others do its share.
+*/
+static void l_parallel (void *ud, int ntasks, lua_Task task, void *arg) {
+  int nthreads = *(int *)ud;
+  Workers w;
+  w.task = task;
+  w.arg = arg;
+  w.ntasks = ntasks;
+  w.next = 0;
+  if (nthreads > 1 && pthread_mutex_init(&w.lock, NULL) == 0) {
+    pthread_t th[LUA_MAXSORTTHREADS];
+    int n = 0;  /* number of threads created */
+    while (n + 1 < nthreads && n + 1 < ntasks &&
+           pthread_create(&th[n], NULL, worker, &w) == 0)
+      n++;
+    worker(&w);  /* this thread works too */
+    while (n > 0)
+      pthread_join(th[--n], NULL);
+    pthread_mutex_destroy(&w.lock);
+  }
+  else {  /* run everything in this thread */
+    int i;
+    for (i = 0; i < ntasks; i++)
+      task(arg, i);
+  }
+}
+
+#else				/* }{ */
+
+/* no threads: sort always runs sequentially */
+#define l_parallel	NULL
+
+#endif				/* } */
+
+
 static int sort (lua_State *L) {
   lua_Integer n = aux_getn(L, 1, TAB_RW);
   if (n > 1) {  /* non-trivial interval? */
+    int *nthreads = sortthreads(L);
     luaL_argcheck(L, n < INT_MAX, 1, "array too big");
     if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
       luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
     lua_settop(L, 2);  /* make sure there are two arguments */
-    auxsort(L, 1, (IdxT)n, 0);
+    /* without a function, try to sort the array part directly */
+    if (!lua_isnil(L, 2) || lua_type(L, 1) != LUA_TTABLE ||
+        !lua_rawsort(L, 1, n, *nthreads, l_parallel, nthreads))
+      auxsort(L, 1, (IdxT)n, 0);
+  }
+  return 0;
+}
+
+
+static int tsortthreads (lua_State *L) {
+  int *nthreads = sortthreads(L);
+  int old = *nthreads;
+  if (!lua_isnoneornil(L, 1)) {
+    lua_Integer n = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, 1 <= n && n <= LUA_MAXSORTTHREADS, 1,
+                     "number of threads out of range");
+    *nthreads = (int)n;
+  }
+  lua_pushinteger(L, old);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Stable sort by keys
+** =======================================================
+*/
+
+
+/*
+** Key of an element being sorted, computed once before the sort.
+** String keys are kept alive in an auxiliary table.
+*/
+typedef struct SortKey {
+  union {
+    lua_Integer i;
+    lua_Number n;
+    const char *s;
+  } u;
+  size_t len;  /* string length */
+  int isfloat;  /* for numbers, whether the key is a float */
+  IdxT idx;  /* original position of the element */
+} SortKey;
+
+
+typedef int (*KeyLT) (const SortKey *a, const SortKey *b);
+
+
+typedef struct SortBy {
+  KeyLT lt;  /* order of the keys */
+  int desc;  /* true for descending order */
+} SortBy;
+
+
+/* kinds of keys found in an array */
+#define KINT	1	/* all keys are integers */
+#define KNUM	2	/* numbers, some of them floats */
+#define KSTR	4	/* strings */
+
+
+/* size of the runs sorted by insertion before merging */
+#define RUNLEN	32u
+
+
+static int intlt (const SortKey *a, const SortKey *b) {
+  return (a->u.i < b->u.i);
+}
+
+
+/*
+** Exact order between numbers: 'i < f <=> i < ceil(f)' and
+** 'f < i <=> floor(f) < i'; when 'ceil(f)' or 'floor(f)' are out
+** of integer range, 'f' is either greater or less than all integers.
+** (NaNs are not accepted as keys.)
+*/
+static int numlt (const SortKey *a, const SortKey *b) {
+  lua_Integer fi;
+  if (!a->isfloat) {
+    if (!b->isfloat)
+      return (a->u.i < b->u.i);
+    else if (lua_numbertointeger(l_mathop(ceil)(b->u.n), &fi))
+      return (a->u.i < fi);
+    else
+      return (b->u.n > 0);
+  }
+  else if (b->isfloat)
+    return (a->u.n < b->u.n);
+  else if (lua_numbertointeger(l_mathop(floor)(a->u.n), &fi))
+    return (fi < b->u.i);
+  else
+    return (a->u.n < 0);
+}
+
+
+/*
+** Same order as the Lua operator '<' for strings, which may contain
+** embedded zeros.
+*/
+static int strlt (const SortKey *a, const SortKey *b) {
+  const char *s1 = a->u.s;
+  size_t rl1 = a->len;
+  const char *s2 = b->u.s;
+  size_t rl2 = b->len;
+  for (;;) {  /* for each segment */
+    int temp = strcoll(s1, s2);
+    if (temp != 0)  /* not equal? */
+      return (temp < 0);
+    else {  /* strings are equal up to a '\0' */
+      size_t zl1 = strlen(s1);  /* index of first '\0' in 's1' */
+      size_t zl2 = strlen(s2);  /* index of first '\0' in 's2' */
+      if (zl2 == rl2)  /* 's2' is finished? */
+        return 0;
+      else if (zl1 == rl1)  /* 's1' is finished? */
+        return 1;  /* 's1' is less than 's2' ('s2' is not finished) */
+      /* both strings longer than 'zl'; go on comparing after the '\0' */
+      zl1++; zl2++;
+      s1 += zl1; rl1 -= zl1; s2 += zl2; rl2 -= zl2;
+    }
+  }
+}
+
+
+/* whether key 'a' must come before key 'b' in the result */
+#define before(sb,a,b)	((sb)->desc ? (sb)->lt(b, a) : (sb)->lt(a, b))
+
+
+static void insertkeys (const SortBy *sb, SortKey *a, IdxT lo, IdxT up) {
+  IdxT i;
+  for (i = lo + 1; i < up; i++) {
+    SortKey k = a[i];
+    IdxT j = i;
+    for (; j > lo && before(sb, &k, &a[j - 1]); j--)
+      a[j] = a[j - 1];
+    a[j] = k;
+  }
+}
+
+
+/*
+** Merge the sorted runs a[lo .. mid - 1] and a[mid .. up - 1], using
+** 'aux' to hold the first one. On ties, keys from the first run go
+** first, which keeps the sort stable.
+*/
+static void mergekeys (const SortBy *sb, SortKey *a, SortKey *aux,
+                       IdxT lo, IdxT mid, IdxT up) {
+  IdxT i = 0, j = mid, k = lo;
+  IdxT n = mid - lo;
+  memcpy(aux, a + lo, n * sizeof(SortKey));
+  while (i < n && j < up) {
+    if (before(sb, &a[j], &aux[i]))
+      a[k++] = a[j++];
+    else
+      a[k++] = aux[i++];
+  }
+  while (i < n)  /* copy what is left from the first run */
+    a[k++] = aux[i++];
+  /* whatever is left from the second run is already in place */
+}
+
+
+/*
+** Bottom-up merge sort: sort runs of 'RUNLEN' keys by insertion, then
+** merge them pairwise, skipping merges of runs already in order.
+*/
+static void mergesort (const SortBy *sb, SortKey *a, SortKey *aux, IdxT n) {
+  IdxT lo, width;
+  for (lo = 0; lo < n; lo += RUNLEN)
+    insertkeys(sb, a, lo, (n - lo < RUNLEN) ? n : lo + RUNLEN);
+  for (width = RUNLEN; width < n; width *= 2) {
+    for (lo = 0; lo < n - width; lo += 2 * width) {
+      IdxT mid = lo + width;
+      IdxT up = (n - mid < width) ? n : mid + width;
+      if (before(sb, &a[mid], &a[mid - 1]))  /* runs out of order? */
+        mergekeys(sb, a, aux, lo, mid, up);
+    }
+  }
+}
+
+
+/*
+** Compute the key for each element of the list at index 1, keeping
+** the original values in the table at index 4 and the string keys in
+** the table at index 5. Returns the kinds of keys found.
+*/
+static int getkeys (lua_State *L, SortKey *keys, IdxT n) {
+  int kinds = 0;
+  IdxT i;
+  for (i = 0; i < n; i++) {
+    SortKey *k = &keys[i];
+    k->idx = i + 1;
+    geti(L, 1, k->idx);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, 4, l_castU2S(k->idx));  /* save original value */
+    if (lua_isfunction(L, 2)) {
+      lua_pushvalue(L, 2);
+      lua_rotate(L, -2, 1);  /* put function below the value */
+      lua_call(L, 1, 1);
+    }
+    else {
+      lua_pushvalue(L, 2);
+      lua_gettable(L, -2);  /* get value[field] */
+      lua_remove(L, -2);  /* remove value */
+    }
+    switch (lua_type(L, -1)) {
+      case LUA_TNUMBER: {
+        if (lua_isinteger(L, -1)) {
+          k->u.i = lua_tointeger(L, -1);
+          k->isfloat = 0;
+          kinds |= KINT;
+        }
+        else {
+          k->u.n = lua_tonumber(L, -1);
+          if (l_unlikely(k->u.n != k->u.n))
+            luaL_error(L, "invalid key for element %I in 'sortby' (NaN)",
+                          (LUAI_UACINT)k->idx);
+          k->isfloat = 1;
+          kinds |= KNUM;
+        }
+        lua_pop(L, 1);
+        break;
+      }
+      case LUA_TSTRING: {
+        k->u.s = lua_tolstring(L, -1, &k->len);
+        lua_rawseti(L, 5, l_castU2S(k->idx));  /* keep the string alive */
+        kinds |= KSTR;
+        break;
+      }
+      default:
+        return luaL_error(L, "invalid key for element %I in 'sortby' (%s)",
+                             (LUAI_UACINT)k->idx, luaL_typename(L, -1));
+    }
+    if (l_unlikely((kinds & KSTR) && kinds != KSTR))
+      luaL_error(L, "attempt to compare number with string");
+  }
+  return kinds;
+}
+
+
+static int sortby (lua_State *L) {
+  lua_Integer n = aux_getn(L, 1, TAB_RW);
+  luaL_checkany(L, 2);
+  if (n > 1) {  /* non-trivial interval? */
+    SortBy sb;
+    SortKey *keys;
+    IdxT i;
+    luaL_argcheck(L, n < INT_MAX &&
+                     l_castS2U(n) <= MAX_SIZE / (2 * sizeof(SortKey)),
+                     1, "array too big");
+    sb.desc = lua_toboolean(L, 3);
+    lua_settop(L, 3);
+    lua_createtable(L, (int)n, 0);  /* 4: original values */
+    lua_newtable(L);  /* 5: string keys */
+    keys = (SortKey *)lua_newuserdatauv(L, 2 * (size_t)n * sizeof(SortKey), 0);
+    switch (getkeys(L, keys, (IdxT)n)) {
+      case KINT: sb.lt = intlt; break;
+      case KSTR: sb.lt = strlt; break;
+      default: sb.lt = numlt; break;
+    }
+    mergesort(&sb, keys, keys + n, (IdxT)n);
+    for (i = 0; i < (IdxT)n; i++) {  /* move the values to their places */
+      lua_rawgeti(L, 4, l_castU2S(keys[i].idx));
+      seti(L, 1, i + 1);
+    }
   }
   return 0;
 }
@@ -407,20 +886,27 @@ static int sort (lua_State *L) {
 
 
 static const luaL_Reg tab_funcs[] = {
+  {"clone", tclone},
   {"concat", tconcat},
   {"create", tcreate},
+  {"freeze", tfreeze},
   {"insert", tinsert},
+  {"isfrozen", tisfrozen},
   {"pack", tpack},
   {"unpack", tunpack},
   {"remove", tremove},
   {"move", tmove},
   {"sort", sort},
+  {"sortby", sortby},
+  {"sortthreads", tsortthreads},
   {NULL, NULL}
 };
 
 
 LUAMOD_API int luaopen_table (lua_State *L) {
-  luaL_newlib(L, tab_funcs);
+  luaL_newlibtable(L, tab_funcs);
+  *(int *)lua_newuserdatauv(L, sizeof(int), 0) = 1;  /* threads for sort */
+  luaL_setfuncs(L, tab_funcs, 1);
   return 1;
 }
 
@@ -316,8 +316,11 @@ static void printobj (global_State *g, GCObject *o) {
            ttypename(novariant(o->tt)), (void *)o,
            isdead(g,o) ? 'd' : isblack(o) ? 'b' : iswhite(o) ? 'w' : 'g',
            "ns01oTt"[getage(o)], o->marked);
-  if (o->tt == LUA_VSHRSTR || o->tt == LUA_VLNGSTR)
-    printf(" '%s'", getstr(gco2ts(o)));
+  if (o->tt == LUA_VSHRSTR || o->tt == LUA_VLNGSTR) {
+    size_t len;
+    const char *s = getlstr(gco2ts(o), len);
+    printf(" '%.*s'", cast_int(len), s);  /* may not end with a '\0' */
+  }
 }
 
 
@@ -337,8 +340,12 @@ void lua_printvalue (TValue *v) {
     }
     case LUA_VSHRSTR:
       printf("'%s'", getstr(tsvalue(v))); break;
-    case LUA_VLNGSTR:
-      printf("'%.30s...'", getstr(tsvalue(v))); break;
+    case LUA_VLNGSTR: {  /* may not end with a '\0' */
+      size_t len;
+      const char *s = getlstr(tsvalue(v), len);
+      printf("'%.*s...'", (len < 30) ? cast_int(len) : 30, s);
+      break;
+    }
     case LUA_VFALSE:
       printf("%s", "false"); break;
     case LUA_VTRUE:
@@ -443,6 +450,10 @@ static void checkproto (global_State *g, Proto *f) {
     checkobjrefN(g, fgc, f->p[i]);
   for (i=0; i<f->sizelocvars; i++)
     checkobjrefN(g, fgc, f->locvars[i].varname);
+  for (i=0; i<f->sizecache; i++) {
+    checkobjrefN(g, fgc, f->cache[i].env);
+    checkvalref(g, fgc, &f->cache[i].v);
+  }
 }
 
 
@@ -532,9 +543,18 @@ static void checkrefs (global_State *g, GCObject *o) {
       checkproto(g, gco2p(o));
       break;
     }
-    case LUA_VSHRSTR:
+    case LUA_VSHRSTR: {
+      assert(!isgray(o));  /* strings are never gray */
+      break;
+    }
     case LUA_VLNGSTR: {
+      TString *ts = gco2ts(o);
       assert(!isgray(o));  /* strings are never gray */
+      if (ts->shrlen == LSTRVIEW) {
+        TString *parent = getviewparent(ts);
+        assert(parent->shrlen != LSTRVIEW);
+        checkobjref(g, o, obj2gco(parent));
+      }
       break;
     }
     default: assert(0);
@@ -1731,6 +1751,12 @@ static int runC (lua_State *L, lua_State *L1, const char *pc) {
     else if EQ("isuserdata") {
       lua_pushboolean(L1, lua_isuserdata(L1, getindex));
     }
+    else if EQ("layoutfield") {
+      int t = getindex;
+      const char *s = getstring;
+      size_t offset = cast_sizet(getnum);
+      lua_layoutfield(L1, t, s, offset, getnum);
+    }
     else if EQ("len") {
       lua_len(L1, getindex);
     }
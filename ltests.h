@@ -143,6 +143,8 @@ LUA_API void *debug_realloc (void *ud, void *block,
 #define STRCACHE_N	23
 #define STRCACHE_M	5
 
+#define IDXCACHE_N	4
+
 #define MAXINDEXRK	1
 
 
@@ -93,8 +93,10 @@ const char *luaT_objtypename (lua_State *L, const TValue *o) {
   if ((ttistable(o) && (mt = hvalue(o)->metatable) != NULL) ||
       (ttisfulluserdata(o) && (mt = uvalue(o)->metatable) != NULL)) {
     const TValue *name = luaH_Hgetshortstr(mt, luaS_new(L, "__name"));
-    if (ttisstring(name))  /* is '__name' a string? */
+    if (ttisstring(name)) {  /* is '__name' a string? */
+      luaS_fixstr(L, tsvalue(name), 0);
       return getstr(tsvalue(name));  /* use it as type name */
+    }
   }
   return ttypename(ttype(o));  /* else use standard type name */
 }
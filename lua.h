@@ -154,6 +154,15 @@ typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 typedef void (*lua_WarnFunction) (void *ud, const char *msg, int tocont);
 
 
+/*
+** Type for functions that run tasks in parallel
+** 并行执行任务的回调函数指针：对 0 <= i < ntasks 各调用一次 task(arg, i)，
+** 可以在多个线程中同时进行，全部完成后才返回。任务中不会调用任何 Lua API。
+*/
+typedef void (*lua_Task) (void *arg, int i);
+typedef void (*lua_Parallel) (void *ud, int ntasks, lua_Task task, void *arg);
+
+
 /*
 ** Type used by the debug API to collect debug information
 ** 用于收集调试信息的结构体（前置声明）
@@ -304,6 +313,8 @@ LUA_API void        (lua_pushinteger) (lua_State *L, lua_Integer n); // 压入
 LUA_API const char *(lua_pushlstring) (lua_State *L, const char *s, size_t len); // 压入指定长度的字符串
 LUA_API const char *(lua_pushexternalstring) (lua_State *L, // 压入外部管理的字符串 (Lua不负责这块内存)
 		const char *s, size_t len, lua_Alloc falloc, void *ud);
+LUA_API void        (lua_pushsubstring) (lua_State *L, int idx, // 压入栈上某字符串的子串 (长子串可能与原字符串共享内存)
+		const char *s, size_t len);
 LUA_API const char *(lua_pushstring) (lua_State *L, const char *s);  // 压入以 '\0' 结尾的 C 字符串
 LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt, // 用可变参数压入格式化字符串
                                                       va_list argp);
@@ -329,6 +340,12 @@ LUA_API int (lua_rawgetp) (lua_State *L, int idx, const void *p);  // 原生获
 
 // 创建一个新表并压栈。narr 预分配数组空间，nrec 预分配哈希表空间
 LUA_API void  (lua_createtable) (lua_State *L, int narr, int nrec);
+// 原始复制栈上的表 (数组部分和哈希部分大小不变，无需重新哈希)，将新表压栈；不复制元表
+LUA_API void  (lua_clonetable) (lua_State *L, int idx);
+// 冻结栈上的表：此后任何修改其内容的操作都会报错，且不能再解冻
+LUA_API void  (lua_freeze) (lua_State *L, int idx);
+// 检查栈上的值是否为已冻结的表
+LUA_API int   (lua_isfrozen) (lua_State *L, int idx);
 // 分配指定大小(sz)的 Userdata(用户数据)内存，压栈并返回其 C 指针。nuvalue 是绑定的额外 Lua 值的数量
 LUA_API void *(lua_newuserdatauv) (lua_State *L, size_t sz, int nuvalue);
 // 获取栈上对象的元表(Metatable)并压入栈顶
@@ -352,6 +369,18 @@ LUA_API void  (lua_rawsetp) (lua_State *L, int idx, const void *p);
 LUA_API int   (lua_setmetatable) (lua_State *L, int objindex);
 // 将栈顶的值绑定到 userdata 上的第 n 个用户值槽位中
 LUA_API int   (lua_setiuservalue) (lua_State *L, int idx, int n);
+// 在 idx 处的元表中登记 userdata 字段 k：位于内存块偏移 offset 处，C 类型为 type (LUA_F*)。
+// 虚拟机直接读写这些字段，不调用 __index/__newindex
+LUA_API void  (lua_layoutfield) (lua_State *L, int idx, const char *k,
+                                 size_t offset, int type);
+
+// userdata 布局中字段的 C 类型 (见 lua_layoutfield)
+#define LUA_FINT	0	// int
+#define LUA_FINTEGER	1	// lua_Integer
+#define LUA_FNUMBER	2	// lua_Number
+#define LUA_FFLOAT	3	// float
+#define LUA_FDOUBLE	4	// double
+#define LUA_FBOOLEAN	5	// int，作为布尔值 (0 为 false)
 
 
 /*
@@ -449,11 +478,26 @@ LUA_API int   (lua_error) (lua_State *L);
 
 // 遍历表的操作 (相当于 Lua 里的 pairs)。传入前一个 key，弹出后压入下一个 key-value 组
 LUA_API int   (lua_next) (lua_State *L, int idx);
+// 登记原始的 next 函数 (基础库的 'next')。以它为迭代器的泛型 for 循环由虚拟机直接遍历，不再逐步调用
+LUA_API void  (lua_setnextf) (lua_State *L, lua_CFunction f);
 
 // 字符串拼接。从栈顶弹出 n 个字符串，拼成一个新字符串压栈
 LUA_API void  (lua_concat) (lua_State *L, int n);
 // 获取长度 (相当于 # 操作符)
 LUA_API void  (lua_len)    (lua_State *L, int idx);
+// 对表中元素 1..n 原地排序 (仅当它们都在数组部分且同为整数、浮点数或字符串时)，成功返回 1；
+// nw > 1 时可通过 pf 用 nw 个工作线程并行排序大数组
+LUA_API int   (lua_rawsort) (lua_State *L, int idx, lua_Integer n,
+                             int nw, lua_Parallel pf, void *ud);
+// 原始地把 t1[f..e] 复制到 t2[t..] (仅当两段都在数组部分且不涉及元方法时)，成功返回 1
+LUA_API int   (lua_rawmove) (lua_State *L, int idx1, lua_Integer f,
+                             lua_Integer e, lua_Integer t, int idx2);
+// 原始地压入 t[i..e] (仅当它们都在数组部分且不涉及元方法时)，成功返回 1
+LUA_API int   (lua_rawunpack) (lua_State *L, int idx, lua_Integer i,
+                                                    lua_Integer e);
+// 用分隔符 sep 连接字符串 t[i..j] 并压入结果 (仅当它们都是数组部分中的字符串时)，成功返回 1
+LUA_API int   (lua_rawconcat) (lua_State *L, int idx, lua_Integer i,
+                               lua_Integer j, const char *sep, size_t lsep);
 
 #define LUA_N2SBUFFSZ	64 // 数字转字符串所需的缓冲区大小
 // 将数字转换为 C 字符串
@@ -619,6 +663,7 @@ struct lua_Debug {
   char short_src[LUA_IDSIZE]; /* (S) */ // 精简版的源码描述（方便打印报错）
   /* private part (私有部分，开发者不应直接访问这些字段) */
   struct CallInfo *i_ci;  /* active function */ // 指向内部的调用帧结构
+  int i_inl;  /* inlined call running in 'i_ci' (if not 0) */ // 内联调用的编号
 };
 
 /* }====================================================================== */
@@ -70,6 +70,7 @@
 #if defined(LUA_USE_LINUX)
 #define LUA_USE_POSIX
 #define LUA_USE_DLOPEN		/* needs an extra library: -ldl */
+#define LUA_USE_PTHREADS	/* needs an extra library: -lpthread */
 #if !defined(LUA_READLINELIB)
 #define LUA_READLINELIB		"libreadline.so"
 #endif
@@ -79,6 +80,7 @@
 #if defined(LUA_USE_MACOSX)
 #define LUA_USE_POSIX
 #define LUA_USE_DLOPEN		/* macOS does not need -ldl */
+#define LUA_USE_PTHREADS
 #if !defined(LUA_READLINELIB)
 #define LUA_READLINELIB		"libedit.dylib"
 #endif
@@ -366,6 +368,15 @@
 /* #define LUA_COMPAT_MATHLIB */
 
 
+/*
+@@ LUA_COMPAT_FLOATFMT makes Lua convert floats to strings as in
+** previous versions, using LUA_NUMBER_FMT (or LUA_NUMBER_FMT_N when
+** needed to read back the same number) instead of the shortest numeral
+** that reads back as the same number (see LUAI_NUMSHORTEST).
+*/
+/* #define LUA_COMPAT_FLOATFMT */
+
+
 /*
 @@ The following macros supply trivial compatibility for some
 ** changes in the API. The macros themselves document how to
@@ -474,6 +485,34 @@
 #endif					/* } */
 
 
+/*
+@@ LUAI_NUMSHORTEST is true when Lua converts floats to strings with
+** the shortest numeral that reads back as the same number, using
+** its own conversion. That conversion needs IEEE 754 doubles and a
+** 64-bit integer type ('long long'). Other configurations use only
+** 'l_sprintf' with LUA_NUMBER_FMT/LUA_NUMBER_FMT_N.
+*/
+#if LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && defined(LLONG_MAX) && \
+    !defined(LUA_COMPAT_FLOATFMT)
+#define LUAI_NUMSHORTEST	1
+#else
+#define LUAI_NUMSHORTEST	0
+#endif
+
+
+/*
+@@ LUAI_NUMFASTREAD is true when Lua converts decimal numerals to floats
+** with its own conversion, which gives the same results as 'strtod'
+** but calls 'lua_str2number' only for the few numerals that it cannot
+** convert quickly. It has the same requirements as LUAI_NUMSHORTEST.
+*/
+#if LUA_FLOAT_TYPE == LUA_FLOAT_DOUBLE && defined(LLONG_MAX)
+#define LUAI_NUMFASTREAD	1
+#else
+#define LUAI_NUMFASTREAD	0
+#endif
+
+
 
 /*
 @@ LUA_UNSIGNED is the unsigned version of LUA_INTEGER.
@@ -484,7 +523,8 @@
 @@ LUA_MAXINTEGER is the maximum value for a LUA_INTEGER.
 @@ LUA_MININTEGER is the minimum value for a LUA_INTEGER.
 @@ LUA_MAXUNSIGNED is the maximum value for a LUA_UNSIGNED.
-@@ lua_integer2str converts an integer to a string.
+@@ lua_integer2str converts an integer to a string. (When it is not
+** defined, Lua uses its own conversion, equivalent to LUA_INTEGER_FMT.)
 */
 
 
@@ -494,8 +534,10 @@
 
 #define LUAI_UACINT		LUA_INTEGER
 
+/*
 #define lua_integer2str(s,sz,n)  \
 	l_sprintf((s), sz, LUA_INTEGER_FMT, (LUAI_UACINT)(n))
+*/
 
 /*
 ** use LUAI_UACINT here to avoid problems with promotions (which
@@ -306,6 +306,16 @@ static void loadDebug (LoadState *S, Proto *f) {
     }
   }
   n = loadInt(S);
+  f->inlineinfo = luaM_newvectorchecked(S->L, n, InlineInfo);
+  f->sizeinlineinfo = n;
+  for (i = 0; i < n; i++) {
+    f->inlineinfo[i].startpc = loadInt(S);
+    f->inlineinfo[i].endpc = loadInt(S);
+    f->inlineinfo[i].line = loadInt(S);
+    f->inlineinfo[i].proto = loadInt(S);
+    f->inlineinfo[i].reg = loadInt(S);
+  }
+  n = loadInt(S);
   f->locvars = luaM_newvectorchecked(S->L, n, LocVar);
   f->sizelocvars = n;
   for (i = 0; i < n; i++)
@@ -333,6 +343,7 @@ static void loadFunction (LoadState *S, Proto *f) {
     f->flag |= PF_FIXED;  /* signal that code is fixed */
   f->maxstacksize = loadByte(S);
   loadCode(S, f);
+  luaF_initcache(S->L, f);
   loadConstants(S, f);
   loadUpvalues(S, f);
   loadProtos(S, f);
@@ -80,36 +80,160 @@ static const char *utf8_decode (const char *s, l_uint32 *val, int strict) {
 
 
 /*
-** utf8len(s [, i [, j [, lax]]]) --> number of characters that
-** start in the range [i,j], or nil + current position if 's' is not
-** well formed in that interval
+** Check the UTF-8 sequence at 's', returning a pointer to its end or
+** NULL if it is not valid. It accepts the same sequences as
+** 'utf8_decode', but without computing their code points: Overlong
+** representations, surrogates, and code points too large all show
+** up in the first two bytes of a sequence.
 */
-static int utflen (lua_State *L) {
-  lua_Integer n = 0;  /* counter for the number of characters */
+static const char *utf8_skip (const char *s, int strict) {
+  unsigned int c = (unsigned char)s[0];
+  unsigned int lo = 0x80, hi = 0xBF;  /* limits for the second byte */
+  int count, i;  /* number of continuation bytes */
+  if (c < 0x80)  /* ASCII? */
+    return s + 1;
+  else if (c < 0xC2)  /* continuation byte or overlong 2-byte sequence? */
+    return NULL;
+  else if (c < 0xE0)
+    count = 1;
+  else if (c < 0xF0) {
+    count = 2;
+    if (c == 0xE0) lo = 0xA0;  /* avoid overlong sequences */
+    else if (c == 0xED && strict) hi = 0x9F;  /* avoid surrogates */
+  }
+  else if (c < 0xF8) {
+    count = 3;
+    if (c == 0xF0) lo = 0x90;  /* avoid overlong sequences */
+    else if (strict && c >= 0xF4) {  /* avoid code points too large */
+      if (c > 0xF4) return NULL;
+      hi = 0x8F;
+    }
+  }
+  else if (strict)  /* sequences longer than 4 bytes are too large */
+    return NULL;
+  else if (c < 0xFC) {
+    count = 4;
+    if (c == 0xF8) lo = 0x88;  /* avoid overlong sequences */
+  }
+  else if (c < 0xFE) {
+    count = 5;
+    if (c == 0xFC) lo = 0x84;  /* avoid overlong sequences */
+  }
+  else  /* 0xFE and 0xFF are never valid */
+    return NULL;
+  c = (unsigned char)s[1];
+  if (c < lo || c > hi)
+    return NULL;
+  for (i = 2; i <= count; i++) {  /* (stops at the string's final '\0') */
+    if (!iscontp(s + i))
+      return NULL;
+  }
+  return s + count + 1;
+}
+
+
+/* a word with the high bit of each byte set */
+#define HIGHBITS	(~(size_t)0 / 0xFF * 0x80)
+
+
+/*
+** Check the characters that start before 'e', counting them in '*n'.
+** Characters cannot end after 'lim'. Returns where it stopped: the
+** first invalid character, or the end of the last character (not
+** before 'e') if all are valid. Runs of ASCII characters are checked
+** two words at a time.
+*/
+static const char *utf8_scan (const char *s, const char *e,
+                              const char *lim, int strict,
+                              lua_Integer *n) {
+  lua_Integer count = 0;
+  while (s < e) {
+    if ((unsigned char)*s < 0x80) {  /* ASCII? */
+      while (e - s >= (ptrdiff_t)(2 * sizeof(size_t))) {
+        size_t w1, w2;
+        memcpy(&w1, s, sizeof(size_t));
+        memcpy(&w2, s + sizeof(size_t), sizeof(size_t));
+        if ((w1 | w2) & HIGHBITS)  /* some non-ASCII byte? */
+          break;
+        s += 2 * sizeof(size_t);
+        count += (lua_Integer)(2 * sizeof(size_t));
+      }
+      while (s < e && (unsigned char)*s < 0x80) {
+        s++;
+        count++;
+      }
+    }
+    else {
+      const char *s1 = utf8_skip(s, strict);
+      if (s1 == NULL || s1 > lim)  /* invalid character? */
+        break;
+      s = s1;
+      count++;
+    }
+  }
+  *n = count;
+  return s;
+}
+
+
+/*
+** Scan the range [i,j] of a string, for functions with arguments
+** (s [, i [, j [, lax]]]). If there is an invalid character, push
+** fail plus its position and return 0; otherwise, return 1 and set
+** '*n' to the number of characters. If 'whole' is true, the last
+** character cannot end after 'j'.
+*/
+static int scanrange (lua_State *L, int whole, lua_Integer *n) {
   size_t len;  /* string length in bytes */
   const char *s = luaL_checklstring(L, 1, &len);
   lua_Integer posi = u_posrelat(luaL_optinteger(L, 2, 1), len);
   lua_Integer posj = u_posrelat(luaL_optinteger(L, 3, -1), len);
   int lax = lua_toboolean(L, 4);
+  const char *e;
+  const char *stop;
   luaL_argcheck(L, 1 <= posi && --posi <= (lua_Integer)len, 2,
                    "initial position out of bounds");
   luaL_argcheck(L, --posj < (lua_Integer)len, 3,
                    "final position out of bounds");
-  while (posi <= posj) {
-    const char *s1 = utf8_decode(s + posi, NULL, !lax);
-    if (s1 == NULL) {  /* conversion error? */
-      luaL_pushfail(L);  /* return fail ... */
-      lua_pushinteger(L, posi + 1);  /* ... and current position */
-      return 2;
-    }
-    posi = ct_diff2S(s1 - s);
-    n++;
+  e = s + posj + 1;  /* characters must start before 'e' */
+  stop = utf8_scan(s + posi, e, whole ? e : s + len, !lax, n);
+  if (stop < e) {  /* conversion error? */
+    luaL_pushfail(L);  /* return fail ... */
+    lua_pushinteger(L, ct_diff2S(stop - s) + 1);  /* ... and position */
+    return 0;
   }
+  return 1;
+}
+
+
+/*
+** utf8len(s [, i [, j [, lax]]]) --> number of characters that
+** start in the range [i,j], or nil + current position if 's' is not
+** well formed in that interval
+*/
+static int utflen (lua_State *L) {
+  lua_Integer n;  /* number of characters */
+  if (!scanrange(L, 0, &n))
+    return 2;  /* fail + position */
   lua_pushinteger(L, n);
   return 1;
 }
 
 
+/*
+** validate(s [, i [, j [, lax]]]) --> true if the bytes in the range
+** [i,j] form a well-formed UTF-8 sequence, or nil + position of the
+** first invalid character
+*/
+static int utfvalidate (lua_State *L) {
+  lua_Integer n;
+  if (!scanrange(L, 1, &n))
+    return 2;  /* fail + position */
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
 /*
 ** codepoint(s, [i, [j [, lax]]]) -> returns codepoints for all
 ** characters that start in the range [i,j]
@@ -276,6 +400,7 @@ static const luaL_Reg funcs[] = {
   {"char", utfchar},
   {"len", utflen},
   {"codes", iter_codes},
+  {"validate", utfvalidate},
   /* placeholders */
   {"charpattern", NULL},
   {NULL, NULL}
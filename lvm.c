@@ -95,8 +95,17 @@ static int l_strton (const TValue *obj, TValue *result) {
   else {
     TString *st = tsvalue(obj);
     size_t stlen;
-    const char *s = getlstr(st, stlen);
-    return (luaO_str2num(s, result) == stlen + 1);
+    char *s = getlstr(st, stlen);
+    if (l_likely(s[stlen] == '\0'))
+      return (luaO_str2num(s, result) == stlen + 1);
+    else {  /* prefix of a longer string (see 'LSTRAPP' and 'LSTRVIEW') */
+      char c = s[stlen];
+      size_t res;
+      s[stlen] = '\0';  /* temporarily end the string here */
+      res = luaO_str2num(s, result);
+      s[stlen] = c;
+      return (res == stlen + 1);
+    }
   }
 }
 
@@ -285,6 +294,272 @@ static int floatforloop (StkId ra) {
 }
 
 
+/*
+** Generic 'for' loops whose iterator is the primitive 'next' (see
+** 'lua_setnextf') over a table (such as the ones created by 'pairs')
+** run without calling 'next'. The closing variable of these loops is
+** not in use (it was nil or false, so it is not in the list of
+** to-be-closed variables); it keeps the position of the current key,
+** as an integer, so that each step goes on from there (see
+** 'luaH_nextat'). When there are call hooks, they must see the calls,
+** so the loop runs as usual.
+*/
+#define isnextloop(L,ra)  \
+	(ttislcf(s2v(ra)) && fvalue(s2v(ra)) == G(L)->nextf &&  \
+	 ttistable(s2v(ra + 1)) && L->tbclist.p < (ra) + 2 &&  \
+	 !(L->hookmask & (LUA_MASKCALL | LUA_MASKRET)))
+
+
+/*
+** Execute a step of such a loop, with 'nvars' control variables.
+*/
+static void nextforloop (lua_State *L, StkId ra, int nvars) {
+  TValue *pos = s2v(ra + 2);
+  unsigned i = ttisinteger(pos) ? cast_uint(ivalue(pos)) : 0;
+  i = luaH_nextat(L, hvalue(s2v(ra + 1)), ra + 3, i);
+  if (i == 0)  /* no more elements? */
+    setnilvalue(s2v(ra + 3));  /* finish the loop */
+  else {
+    setivalue(pos, cast_Integer(i));
+    for (; nvars > 2; nvars--)  /* other variables get nil */
+      setnilvalue(s2v(ra + 2 + nvars));
+  }
+}
+
+
+/*
+** {==================================================================
+** Userdata layouts
+** ===================================================================
+*/
+
+/* size of each type of field (ORDER LUA_F) */
+static const lu_byte layoutsize[] = {
+  sizeof(int), sizeof(lua_Integer), sizeof(lua_Number),
+  sizeof(float), sizeof(double), sizeof(int)
+};
+
+
+/*
+** Get the address of field 'key' in the memory block of userdata 'u',
+** and its type in '*tp', from the layout of the metatable of 'u' (see
+** 'lua_layoutfield'). Return NULL if there is no such field. Fields
+** that do not fit in the block of this particular userdata are ignored.
+*/
+static char *layoutfield (lua_State *L, Udata *u, TString *key, int *tp) {
+  Table *mt = u->metatable;
+  TValue k, layout;
+  const TValue *d;
+  if (mt == NULL || !haslayout(mt))  /* no layout? (the common case) */
+    return NULL;
+  sethvalue(L, &k, mt);
+  if (luaH_get(G(L)->layouts, &k, &layout) != LUA_VTABLE)
+    return NULL;
+  d = luaH_Hgetshortstr(hvalue(&layout), key);
+  if (ttisinteger(d)) {
+    size_t offset = layoutoffset(ivalue(d));
+    int t = layouttype(ivalue(d));
+    lua_assert(ivalue(d) >= 0 && t <= LUA_FBOOLEAN);
+    if (offset <= u->len && layoutsize[t] <= u->len - offset) {
+      *tp = t;
+      return getudatamem(u) + offset;
+    }
+  }
+  return NULL;
+}
+
+
+/*
+** Read field 'key' of userdata 'u' into 'val'. Return 0 if 'u' does not
+** have that field.
+*/
+static int getlayoutfield (lua_State *L, Udata *u, TString *key,
+                                         TValue *val) {
+  int tp;
+  char *p = layoutfield(L, u, key, &tp);
+  if (p == NULL)
+    return 0;
+  switch (tp) {
+    case LUA_FINT: {
+      int i;
+      memcpy(&i, p, sizeof(i));
+      setivalue(val, i);
+      break;
+    }
+    case LUA_FINTEGER: {
+      lua_Integer i;
+      memcpy(&i, p, sizeof(i));
+      setivalue(val, i);
+      break;
+    }
+    case LUA_FNUMBER: {
+      lua_Number n;
+      memcpy(&n, p, sizeof(n));
+      setfltvalue(val, n);
+      break;
+    }
+    case LUA_FFLOAT: {
+      float f;
+      memcpy(&f, p, sizeof(f));
+      setfltvalue(val, cast_num(f));
+      break;
+    }
+    case LUA_FDOUBLE: {
+      double d;
+      memcpy(&d, p, sizeof(d));
+      setfltvalue(val, cast_num(d));
+      break;
+    }
+    default: {
+      int b;
+      lua_assert(tp == LUA_FBOOLEAN);
+      memcpy(&b, p, sizeof(b));
+      if (b) setbtvalue(val); else setbfvalue(val);
+      break;
+    }
+  }
+  return 1;
+}
+
+
+static l_noret layouterror (lua_State *L, TString *key, const char *what,
+                                          const TValue *v) {
+  luaG_runerror(L, "bad value for field '%s' (%s expected, got %s)",
+                   getstr(key), what, luaT_objtypename(L, v));
+}
+
+
+/*
+** Write 'v' into field 'key' of userdata 'u', converting it to the
+** type of the field. Return 0 if 'u' does not have that field.
+*/
+static int setlayoutfield (lua_State *L, Udata *u, TString *key,
+                                         const TValue *v) {
+  int tp;
+  char *p = layoutfield(L, u, key, &tp);
+  if (p == NULL)
+    return 0;
+  switch (tp) {
+    case LUA_FINT: {
+      lua_Integer i;
+      int ci;
+      if (!tointeger(v, &i))
+        layouterror(L, key, "integer", v);
+      if (!(INT_MIN <= i && i <= INT_MAX))
+        luaG_runerror(L, "value out of range for field '%s'", getstr(key));
+      ci = cast_int(i);
+      memcpy(p, &ci, sizeof(ci));
+      break;
+    }
+    case LUA_FINTEGER: {
+      lua_Integer i;
+      if (!tointeger(v, &i))
+        layouterror(L, key, "integer", v);
+      memcpy(p, &i, sizeof(i));
+      break;
+    }
+    case LUA_FNUMBER: case LUA_FFLOAT: case LUA_FDOUBLE: {
+      lua_Number n;
+      if (!tonumber(v, &n))
+        layouterror(L, key, "number", v);
+      if (tp == LUA_FNUMBER)
+        memcpy(p, &n, sizeof(n));
+      else if (tp == LUA_FFLOAT) {
+        float f = (float)n;
+        memcpy(p, &f, sizeof(f));
+      }
+      else {
+        double d = (double)n;
+        memcpy(p, &d, sizeof(d));
+      }
+      break;
+    }
+    default: {
+      int b = !l_isfalse(v);
+      lua_assert(tp == LUA_FBOOLEAN);
+      memcpy(p, &b, sizeof(b));
+      break;
+    }
+  }
+  return 1;
+}
+
+/* }================================================================== */
+
+
+/*
+** Resolve 'key' through the '__index' chain that starts at metatable
+** 'mt', filling cache entry 'c' with the result. Only chains of tables,
+** accessed raw, can be cached; otherwise (no '__index' in 'mt', whose
+** result depends on the type of the object, a function in the chain,
+** or a chain too long), return 0 and leave the access to the generic
+** code. All tables involved are marked as watched, so that any change
+** to them invalidates the entry.
+*/
+static int fillidxcache (lua_State *L, IdxCache *c, Table *mt,
+                                       TString *key) {
+  Table *h = mt;
+  TValue v;
+  int loop;
+  setnilvalue(&v);  /* result if chain ends without finding 'key' */
+  for (loop = 0; loop < MAXTAGLOOP; loop++) {
+    const TValue *tm;
+    setwatch(h);
+    tm = fasttm(L, h, TM_INDEX);
+    if (tm == NULL) {  /* no metamethod? */
+      if (loop == 0)
+        return 0;
+      break;  /* result is nil */
+    }
+    else if (!ttistable(tm))  /* function (or other value)? */
+      return 0;
+    h = hvalue(tm);
+    setwatch(h);
+    if (!tagisempty(luaH_getshortstr(h, key, &v)))
+      break;  /* found it */
+    h = h->metatable;
+    if (h == NULL)  /* no metatable? */
+      break;  /* result is nil */
+  }
+  if (loop == MAXTAGLOOP)
+    return 0;  /* let generic code raise the error */
+  c->mt = mt;
+  c->key = key;
+  setobj(L, &c->v, &v);
+  c->version = G(L)->cacheversion;
+  return 1;
+}
+
+
+/*
+** Try to get from the '__index' cache the result of 't[key]', for an
+** object 't' that does not have the short-string 'key'. Return NULL if
+** the access cannot be cached. Entries are indexed by the metatable of
+** 't', so all objects sharing a metatable (e.g., all instances of a
+** class) share the entries.
+*/
+static const TValue *cachedindex (lua_State *L, const TValue *t,
+                                                TString *key) {
+  global_State *g = G(L);
+  Table *mt;
+  IdxCache *c;
+  switch (ttype(t)) {
+    case LUA_TTABLE: mt = hvalue(t)->metatable; break;
+    case LUA_TUSERDATA: mt = uvalue(t)->metatable; break;
+    default: mt = g->mt[ttype(t)];
+  }
+  if (mt == NULL)
+    return NULL;
+  c = &g->idxcache[lmod(point2uint(mt) ^ key->hash, IDXCACHE_N)];
+  if (c->mt == mt && c->key == key && c->version == g->cacheversion)
+    return &c->v;  /* cache hit */
+  else if (fillidxcache(L, c, mt, key))
+    return &c->v;
+  else
+    return NULL;
+}
+
+
 /*
 ** Finish the table access 'val = t[key]' and return the tag of the result.
 */
@@ -292,9 +567,25 @@ lu_byte luaV_finishget (lua_State *L, const TValue *t, TValue *key,
                                       StkId val, lu_byte tag) {
   int loop;  /* counter to avoid infinite loops */
   const TValue *tm;  /* metamethod */
+  if (ttisshrstring(key)) {  /* field of a layout or in the cache? */
+    const TValue *res;
+    /* (layout fields come before the cache, which does not know them;
+       the loop checks layouts at each step of an '__index' chain) */
+    if (ttisfulluserdata(t) &&
+        getlayoutfield(L, uvalue(t), tsvalue(key), s2v(val)))
+      return ttypetag(s2v(val));
+    res = cachedindex(L, t, tsvalue(key));
+    if (res != NULL) {
+      setobj2s(L, val, res);
+      return ttypetag(res);
+    }
+  }
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     if (tag == LUA_VNOTABLE) {  /* 't' is not a table? */
       lua_assert(!ttistable(t));
+      if (ttisfulluserdata(t) && ttisshrstring(key) &&
+          getlayoutfield(L, uvalue(t), tsvalue(key), s2v(val)))
+        return ttypetag(s2v(val));  /* field of the userdata layout */
       tm = luaT_gettmbyobj(L, t, TM_INDEX);
       if (l_unlikely(notm(tm)))
         luaG_typeerror(L, t, "index");  /* no metamethod */
@@ -330,6 +621,7 @@ lu_byte luaV_finishget (lua_State *L, const TValue *t, TValue *key,
 ** the table being accessed is a field in some metatable. If this
 ** metatable is weak and the table is not anchored, this collection
 ** could collect that table while it is being updated.
+** (For a frozen table, 'luaH_finishset' raises an error.)
 */
 void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
                       TValue *val, int hres) {
@@ -339,7 +631,8 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
     if (hres != HNOTATABLE) {  /* is 't' a table? */
       Table *h = hvalue(t);  /* save 't' table */
       tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
-      if (tm == NULL) {  /* no metamethod? */
+      /* no metamethod, or key present in a frozen table? */
+      if (tm == NULL || l_unlikely(hres == HFROZEN)) {
         sethvalue2s(L, L->top.p, h);  /* anchor 't' */
         L->top.p++;  /* assume EXTRA_STACK */
         luaH_finishset(L, h, key, val, hres);  /* set new value */
@@ -350,7 +643,10 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
       }
       /* else will try the metamethod */
     }
-    else {  /* not a table; check metamethod */
+    else {  /* not a table; check its layout and metamethod */
+      if (ttisfulluserdata(t) && ttisshrstring(key) &&
+          setlayoutfield(L, uvalue(t), tsvalue(key), val))
+        return;  /* field of the userdata layout */
       tm = luaT_gettmbyobj(L, t, TM_NEWINDEX);
       if (l_unlikely(notm(tm)))
         luaG_typeerror(L, t, "index");
@@ -388,11 +684,15 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 ** of the strings. Note that segments can compare equal but still
 ** have different lengths.
 */
-static int l_strcmp (const TString *ts1, const TString *ts2) {
+static int l_strcmp (lua_State *L, TString *ts1, TString *ts2) {
   size_t rl1;  /* real length */
-  const char *s1 = getlstr(ts1, rl1);
+  const char *s1;
   size_t rl2;
-  const char *s2 = getlstr(ts2, rl2);
+  const char *s2;
+  luaS_fixstr(L, ts1, 0);  /* 'strcoll' needs ending zeros */
+  luaS_fixstr(L, ts2, 0);
+  s1 = getlstr(ts1, rl1);
+  s2 = getlstr(ts2, rl2);
   for (;;) {  /* for each segment */
     int temp = l_strcoll(s1, s2);
     if (temp != 0)  /* not equal? */
@@ -537,7 +837,7 @@ l_sinline int LEnum (const TValue *l, const TValue *r) {
 static int lessthanothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) < 0;
   else
     return luaT_callorderTM(L, l, r, TM_LT);
 }
@@ -559,7 +859,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
 static int lessequalothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) <= 0;
   else
     return luaT_callorderTM(L, l, r, TM_LE);
 }
@@ -714,8 +1014,15 @@ void luaV_concat (lua_State *L, int total) {
         ts = luaS_newlstr(L, buff, tl);
       }
       else {  /* long string; copy strings directly to final result */
-        ts = luaS_createlngstrobj(L, tl);
-        copy2buff(top, n, getlngstr(ts));
+        TString *ts1 = tsvalue(s2v(top - n));  /* first operand */
+        if (!strisshr(ts1)) {  /* can append to it? */
+          ts = luaS_appendlngstr(L, ts1, tl);
+          copy2buff(top, n - 1, getlngstr(ts) + ts1->u.lnglen);
+        }
+        else {
+          ts = luaS_createlngstrobj(L, tl);
+          copy2buff(top, n, getlngstr(ts));
+        }
       }
       setsvalue2s(L, top - n, ts);  /* create result */
     }
@@ -849,6 +1156,43 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
 }
 
 
+/*
+** Try to fill the global-cache 'slot' of an OP_GETCACHE, doing the 'n'
+** lookups that follow it ('pc' points to the first one). Only a chain
+** of raw hits can be cached; otherwise, the lookups are left to the
+** following instructions, which can call metamethods. All tables
+** involved are marked as watched, so that any change to them
+** invalidates the cache.
+*/
+static int fillcache (lua_State *L, LClosure *cl, CacheSlot *slot,
+                      const Instruction *pc, int n) {
+  const TValue *k = cl->p->k;
+  const TValue *t = cl->upvals[GETARG_B(*pc)]->v.p;
+  Table *env;
+  TValue v;
+  int i;
+  if (!ttistable(t))
+    return 0;
+  env = hvalue(t);
+  for (i = 0; i < n; i++) {
+    Table *h;
+    if (!ttistable(t))
+      return 0;
+    h = hvalue(t);
+    if (tagisempty(luaH_getshortstr(h, tsvalue(&k[GETARG_C(pc[i])]), &v)))
+      return 0;  /* absent key; lookup may need a metamethod */
+    setwatch(h);
+    t = &v;
+  }
+  setobj(L, &slot->v, &v);
+  slot->env = env;
+  slot->version = G(L)->cacheversion;
+  luaC_objbarrier(L, cl->p, env);
+  luaC_barrier(L, cl->p, &v);
+  return 1;
+}
+
+
 /*
 ** finish execution of an opcode interrupted by a yield
 */
@@ -1181,6 +1525,80 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); }
 
 
+/*
+** {==================================================================
+** Histogram of pairs of opcodes
+** (When compiled with LUAI_OPPAIRS, the interpreter counts how many
+** times each opcode is dispatched right after another one in the same
+** function; the most frequent pairs are candidates for combined
+** instructions. The histogram is printed to 'stderr' at exit.)
+** ===================================================================
+*/
+#if defined(LUAI_OPPAIRS)
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lopnames.h"
+
+/* number of pairs to print */
+#define NPAIRS		40
+
+static unsigned long oppairs[NUM_OPCODES][NUM_OPCODES];
+static const Proto *lastp = NULL;  /* function of previous instruction */
+static OpCode lastop;  /* previous opcode dispatched */
+
+
+static void dumppairs (void) {
+  int top[NPAIRS];  /* indices of the largest counts, in order */
+  int n = 0;
+  int i, j;
+  unsigned long total = 0;
+  for (i = 0; i < NUM_OPCODES * NUM_OPCODES; i++) {
+    unsigned long c = oppairs[i / NUM_OPCODES][i % NUM_OPCODES];
+    total += c;
+    if (c == 0) continue;
+    for (j = n; j > 0; j--) {  /* insertion sort into 'top' */
+      int t = top[j - 1];
+      if (oppairs[t / NUM_OPCODES][t % NUM_OPCODES] >= c) break;
+      if (j < NPAIRS) top[j] = t;
+    }
+    if (j < NPAIRS) {
+      top[j] = i;
+      if (n < NPAIRS) n++;
+    }
+  }
+  fprintf(stderr, "%lu pairs of opcodes\n", total);
+  for (i = 0; i < n; i++) {
+    unsigned long c = oppairs[top[i] / NUM_OPCODES][top[i] % NUM_OPCODES];
+    fprintf(stderr, "%-10s %-10s %12lu %6.2f%%\n",
+            opnames[top[i] / NUM_OPCODES], opnames[top[i] % NUM_OPCODES],
+            c, 100.0 * (double)c / (double)total);
+  }
+}
+
+
+static void countpair (const Proto *p, Instruction i) {
+  static int registered = 0;
+  if (!registered) {
+    registered = 1;
+    atexit(dumppairs);
+  }
+  if (p == lastp)  /* previous instruction in the same function? */
+    oppairs[lastop][GET_OPCODE(i)]++;
+  lastp = p;
+  lastop = GET_OPCODE(i);
+}
+
+#else
+
+#define countpair(p,i)	((void)0)
+
+#endif
+
+/* }================================================================== */
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   if (l_unlikely(trap)) {  /* stack reallocation or hooks? */ \
@@ -1188,6 +1606,7 @@ void luaV_finishOp (lua_State *L) {
     updatebase(ci);  /* correct stack */ \
   } \
   i = *(pc++); \
+  countpair(cl->p, i); \
 }
 
 #define vmdispatch(o)	switch(o)
@@ -1297,6 +1716,18 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         luaC_barrier(L, uv, s2v(ra));
         vmbreak;
       }
+      vmcase(OP_GETCACHE) {
+        CacheSlot *slot = &cl->p->cache[GETARG_C(i)];
+        const TValue *env = cl->upvals[GETARG_B(*pc)]->v.p;
+        int n = GETARG_B(i);  /* number of lookups */
+        if ((ttistable(env) && hvalue(env) == slot->env &&
+             slot->version == G(L)->cacheversion) ||
+            fillcache(L, cl, slot, pc, n)) {
+          setobj2s(L, base + GETARG_A(pc[n - 1]), &slot->v);
+          pc += n;  /* skip the lookups */
+        }
+        vmbreak;
+      }
       vmcase(OP_GETTABUP) {
         StkId ra = RA(i);
         TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
@@ -1881,12 +2312,16 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
            return will be the new value for the control variable.
         */
         StkId ra = RA(i);
-        setobjs2s(L, ra + 5, ra + 3);  /* copy the control variable */
-        setobjs2s(L, ra + 4, ra + 1);  /* copy state */
-        setobjs2s(L, ra + 3, ra);  /* copy function */
-        L->top.p = ra + 3 + 3;
-        ProtectNT(luaD_call(L, ra + 3, GETARG_C(i)));  /* do the call */
-        updatestack(ci);  /* stack may have changed */
+        if (isnextloop(L, ra))
+          halfProtect(nextforloop(L, ra, GETARG_C(i)));
+        else {
+          setobjs2s(L, ra + 5, ra + 3);  /* copy the control variable */
+          setobjs2s(L, ra + 4, ra + 1);  /* copy state */
+          setobjs2s(L, ra + 3, ra);  /* copy function */
+          L->top.p = ra + 3 + 3;
+          ProtectNT(luaD_call(L, ra + 3, GETARG_C(i)));  /* do the call */
+          updatestack(ci);  /* stack may have changed */
+        }
         i = *(pc++);  /* go to next instruction */
         lua_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
         goto l_tforloop;
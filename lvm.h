@@ -102,7 +102,21 @@ typedef enum {
 /*
 ** Finish a fast set operation (when fast set succeeds).
 */
-#define luaV_finishfastset(L,t,v)	luaC_barrierback(L, gcvalue(t), v)
+#define luaV_finishfastset(L,t,v)  \
+	(luaH_changed(L, hvalue(t)), luaC_barrierback(L, gcvalue(t), v))
+
+
+/*
+** Descriptors of fields in userdata layouts (see 'lua_layoutfield'):
+** the offset of the field in the memory block, shifted left by
+** LAYOUTTYPEBITS, plus its type.
+*/
+#define LAYOUTTYPEBITS	3
+#define MAXLAYOUTOFFSET	cast_sizet(LUA_MAXINTEGER >> LAYOUTTYPEBITS)
+
+#define layoutdesc(o,t)	(cast(lua_Integer, o) << LAYOUTTYPEBITS | (t))
+#define layouttype(d)	cast_int((d) & ((1 << LAYOUTTYPEBITS) - 1))
+#define layoutoffset(d)	cast_sizet((d) >> LAYOUTTYPEBITS)
 
 
 /*
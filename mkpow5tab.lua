@@ -0,0 +1,163 @@
+-- $Id: mkpow5tab.lua $
+-- See Copyright Notice in file lua.h
+
+-- Generates 'lpow5tab.h', the tables of powers of 5 used by the
+-- conversions between floats and strings in 'lobject.c'.
+-- usage: lua mkpow5tab.lua > lpow5tab.h   (or 'make pow5tab')
+
+local POW5BITS = 125      -- must match 'POW5BITS' in lobject.c
+-- sizes are the maximum indices used for doubles, plus one
+local POW5TABSIZE = 326
+local POW5INVTABSIZE = 291
+
+-- Natural numbers are arrays of LIMB-bit limbs, least significant
+-- first, with no trailing zeros (so that zero is the empty array).
+local LIMB = 24
+local BASE = 1 << LIMB
+local MASK = BASE - 1
+
+
+local function norm (a)
+  while #a > 0 and a[#a] == 0 do a[#a] = nil end
+  return a
+end
+
+
+local function mulsmall (a, m)
+  local r, carry = {}, 0
+  for i = 1, #a do
+    local x = a[i] * m + carry
+    r[i] = x & MASK
+    carry = x >> LIMB
+  end
+  while carry > 0 do r[#r + 1] = carry & MASK; carry = carry >> LIMB end
+  return r
+end
+
+
+local function bits (a)   -- number of bits of 'a'
+  if #a == 0 then return 0 end
+  local n, top = (#a - 1) * LIMB, a[#a]
+  while top > 0 do n = n + 1; top = top >> 1 end
+  return n
+end
+
+
+local function bit (a, i)   -- bit 'i' of 'a'
+  local x = a[i // LIMB + 1]
+  return x and (x >> (i % LIMB)) & 1 or 0
+end
+
+
+local function shift (a, n)   -- a * 2^n (truncated, if 'n' is negative)
+  local r = {}
+  for i = math.max(0, -n), bits(a) - 1 do
+    if bit(a, i) == 1 then
+      local j = i + n
+      local l = j // LIMB + 1
+      for k = #r + 1, l do r[k] = 0 end
+      r[l] = r[l] | (1 << (j % LIMB))
+    end
+  end
+  return norm(r)
+end
+
+
+local function less (a, b)
+  if #a ~= #b then return #a < #b end
+  for i = #a, 1, -1 do
+    if a[i] ~= b[i] then return a[i] < b[i] end
+  end
+  return false
+end
+
+
+local function sub (a, b)   -- a - b, with a >= b
+  local r, borrow = {}, 0
+  for i = 1, #a do
+    local x = a[i] - (b[i] or 0) - borrow
+    borrow = (x < 0) and 1 or 0
+    r[i] = x & MASK
+  end
+  return norm(r)
+end
+
+
+local function add1 (a)
+  local r = {table.unpack(a)}
+  local i = 1
+  while (r[i] or 0) == MASK do r[i] = 0; i = i + 1 end
+  r[i] = (r[i] or 0) + 1
+  return r
+end
+
+
+local function div2pow (e, d)   -- floor(2^e / d), by long division
+  local q, r = {}, {}
+  for i = e, 0, -1 do
+    r = shift(r, 1)
+    if i == e then r = {1} end   -- the only bit set in 2^e
+    if not less(r, d) then
+      r = sub(r, d)
+      local l = i // LIMB + 1
+      for k = #q + 1, l do q[k] = 0 end
+      q[l] = q[l] | (1 << (i % LIMB))
+    end
+  end
+  return norm(q)
+end
+
+
+local function word (a, i)   -- 64-bit word 'i' of 'a'
+  local w = 0
+  for j = 63, 0, -1 do w = (w << 1) | bit(a, 64 * i + j) end
+  return w
+end
+
+
+local function printtab (name, size, t)
+  io.write(string.format("static const l_uint64 %s[%s][2] = {\n",
+                         name, size))
+  for i = 0, #t do
+    io.write(string.format("  {0x%016xULL, 0x%016xULL}%s\n",
+             word(t[i], 0), word(t[i], 1), (i < #t) and "," or ""))
+  end
+  io.write("};\n")
+end
+
+
+local pow5, pow5inv = {}, {}
+local p = {1}   -- 5^i
+for i = 0, POW5TABSIZE - 1 do
+  local b = bits(p)
+  pow5[i] = shift(p, POW5BITS - b)
+  if i < POW5INVTABSIZE then
+    pow5inv[i] = add1(div2pow(b - 1 + POW5BITS, p))
+  end
+  p = mulsmall(p, 5)
+end
+
+io.write(string.format([[
+/*
+** $Id: lpow5tab.h $
+** Powers of 5 for the conversions between floats and strings
+** See Copyright Notice in lua.h
+*/
+
+/*
+** Generated by 'mkpow5tab.lua'; do not edit.
+** Tables used by 'ryu' and 'decimal2bits' (lobject.c), with numbers
+** of 128 bits stored as pairs {low 64 bits, high 64 bits}:
+** pow5[i] is 5^i shifted to have exactly POW5BITS (%d) bits;
+** pow5inv[q] is floor(2^(bits(5^q) - 1 + POW5BITS) / 5^q) + 1, where
+** bits(x) is the number of bits of x.
+** Their sizes are the maximum indices used for doubles, plus one.
+*/
+
+#define POW5TABSIZE	%d
+#define POW5INVTABSIZE	%d
+
+]], POW5BITS, POW5TABSIZE, POW5INVTABSIZE))
+printtab("pow5inv", "POW5INVTABSIZE", pow5inv)
+io.write("\n")
+printtab("pow5", "POW5TABSIZE", pow5)
@@ -770,6 +770,103 @@ end
 
 
 
+do print("testing userdata layouts")
+  -- field types (ORDER LUA_F)
+  local FINT, FINTEGER, FNUMBER, FFLOAT, FDOUBLE, FBOOLEAN = 0, 1, 2, 3, 4, 5
+  local mt = {}
+  -- each field in its own 8-byte slot
+  T.testC(string.format([[
+    layoutfield 2 i 0 %d; layoutfield 2 j 8 %d; layoutfield 2 n 16 %d;
+    layoutfield 2 f 24 %d; layoutfield 2 d 32 %d; layoutfield 2 b 40 %d;
+    layoutfield 2 far 48 %d
+  ]], FINT, FINTEGER, FNUMBER, FFLOAT, FDOUBLE, FBOOLEAN, FINT), mt)
+  assert(next(mt) == nil)   -- layout is not visible from Lua
+  local u = debug.setmetatable(T.newuserdata(48), mt)
+
+  assert(math.type(u.i) == "integer" and u.i == 0 and u.j == 0)
+  assert(math.type(u.n) == "float" and u.n == 0 and u.f == 0 and u.d == 0)
+  assert(u.b == false)
+  -- other fields (and fields that do not fit in the userdata) need '__index'
+  checkerr("index a userdata value", function () return u.far end)
+  checkerr("index a userdata value", function () return u.other end)
+  checkerr("index a userdata value", function () u.far = 1 end)
+
+  u.i = -10; u.j = math.mininteger; u.n = 1/3; u.f = 0.1; u.d = -2^100
+  u.b = 0
+  assert(u.i == -10 and u.j == math.mininteger and u.n == 1/3)
+  assert(u.f ~= 0.1 and u.f == string.unpack("f", string.pack("f", 0.1)))
+  assert(u.d == -2^100 and u.b == true)
+  u.b = nil; assert(u.b == false)
+  u.i = 3.0; assert(math.type(u.i) == "integer" and u.i == 3)
+  u.i = "20"; assert(u.i == 20)
+  u.n = 7; assert(math.type(u.n) == "float" and u.n == 7)
+  -- layout is visible to the API
+  assert(T.testC("getfield 2 i; return 1", u) == 20)
+  T.testC("pushnum 31; setfield 2 i", u)
+  assert(u.i == 31)
+
+  checkerr("bad value for field 'i' %(integer expected, got string%)",
+           function () u.i = "x" end)
+  checkerr("bad value for field 'j' %(integer expected, got number%)",
+           function () u.j = 1.5 end)
+  checkerr("bad value for field 'd' %(number expected, got table%)",
+           function () u.d = {} end)
+  checkerr("out of range for field 'i'", function () u.i = 1 << 40 end)
+  assert(u.i == 31 and u.j == math.mininteger and u.d == -2^100)
+
+  -- other keys go to the metamethods
+  local log = {}
+  function mt.__index (_, k) return "idx:" .. tostring(k) end
+  function mt.__newindex (_, k, v) log[k] = v end
+  assert(u.i == 31 and u.other == "idx:other" and u[1] == "idx:1")
+  assert(u.far == "idx:far")
+  u.other = 1; u.i = 32; u.far = 2
+  assert(log.other == 1 and log.i == nil and log.far == 2 and u.i == 32)
+  mt.__index = {get = function (self) return self.i end}
+  assert(u:get() == 32 and u.get ~= nil)
+
+  -- userdata reached through '__index'/'__newindex' chains
+  local proxy = setmetatable({}, {__index = u, __newindex = u})
+  assert(proxy.i == 32 and proxy.get and proxy.other == nil)
+  proxy.i = 33; proxy.other2 = 3
+  assert(u.i == 33 and rawget(proxy, "i") == nil and log.other2 == 3)
+  local proxy2 = setmetatable({}, {__index = proxy, __newindex = proxy})
+  proxy2.j = 5
+  assert(proxy2.j == 5 and u.j == 5)
+  u.i = 32; u.j = math.mininteger
+
+  -- Lua code cannot change the layout
+  mt.__layout = {i = 1}; mt.__layout = nil
+  assert(u.i == 32 and u.j == math.mininteger)
+  -- the metatable keeps its layout when it grows
+  for i = 1, 100 do mt["k" .. i] = i; mt[i] = i end
+  for i = 1, 100 do mt["k" .. i] = nil; mt[i] = nil end
+  collectgarbage()
+  assert(u.i == 32 and u.j == math.mininteger and u.b == false)
+
+  -- a metatable shared by userdata of different sizes
+  local small = debug.setmetatable(T.newuserdata(4), mt)
+  assert(small.i == 0 and small.b == nil and small.d == nil)
+
+  -- copies of the metatable do not have the layout
+  local c = debug.setmetatable(T.newuserdata(48), table.clone(mt))
+  assert(c.i == nil and c.get and u.i == 32)
+
+  -- layouts of dead metatables are collected
+  local t = setmetatable({}, {__mode = "k"})
+  do
+    local m = {}
+    T.testC(string.format("layoutfield 2 x 0 %d", FINT), m)
+    local v = debug.setmetatable(T.newuserdata(4), m)
+    v.x = 7; assert(v.x == 7)
+    t[m] = true
+  end
+  collectgarbage()
+  assert(next(t) == nil)
+  assert(u.i == 32)
+end
+
+
 -- testing get/setuservalue
 -- bug in 5.1.2
 checkerr("got number", debug.setuservalue, 3, {})
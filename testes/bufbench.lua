@@ -0,0 +1,115 @@
+-- $Id: testes/bufbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Output building throughput (not part of 'all.lua'). Builds a CSV-like
+-- output with 'table.concat' and with a string buffer, and writes it to
+-- a file, printing the output size per second (MB/s).
+-- usage: lua bufbench.lua [size in MB]
+
+global <const> *
+
+local size = (tonumber(arg and arg[1]) or 100) * 2^20
+local fname = os.tmpname()
+
+
+local function measure (name, f)
+  collectgarbage()
+  local t0 = os.clock()
+  local len = f()
+  local t = os.clock() - t0
+  assert(len >= size)
+  print(string.format("%-26s %8.1f MB/s", name, len / 2^20 / t))
+end
+
+
+measure("table.concat", function ()
+  local t, len, i = {}, 0, 0
+  while len < size do
+    i = i + 1
+    local s = "item" .. i .. "," .. i * 3 .. ",some text\n"
+    t[#t + 1] = s
+    len = len + #s
+  end
+  return #table.concat(t)
+end)
+
+measure("table.concat (pieces)", function ()
+  local t, len, i = {}, 0, 0
+  while len < size do
+    i = i + 1
+    local n = #t
+    t[n + 1] = "item"; t[n + 2] = i; t[n + 3] = ",";
+    t[n + 4] = i * 3; t[n + 5] = ",some text\n"
+    len = len + 20
+  end
+  return #table.concat(t)
+end)
+
+measure("buffer:put", function ()
+  local b, i = string.newbuffer(), 0
+  while #b < size do
+    i = i + 1
+    b:put("item", i, ",", i * 3, ",some text\n")
+  end
+  return #b:get()
+end)
+
+measure("string.format + concat", function ()
+  local t, len, i = {}, 0, 0
+  while len < size do
+    i = i + 1
+    local s = string.format("item%d,%d,some text\n", i, i * 3)
+    t[#t + 1] = s
+    len = len + #s
+  end
+  return #table.concat(t)
+end)
+
+measure("buffer:putf", function ()
+  local b, i = string.newbuffer(), 0
+  while #b < size do
+    i = i + 1
+    b:putf("item%d,%d,some text\n", i, i * 3)
+  end
+  return #b:get()
+end)
+
+
+-- writing the output to a file, in blocks of ~64 KB
+measure("file:write(concat)", function ()
+  local f = assert(io.open(fname, "w"))
+  local t, len, total, i = {}, 0, 0, 0
+  while total < size do
+    i = i + 1
+    local s = "item" .. i .. "," .. i * 3 .. ",some text\n"
+    t[#t + 1] = s
+    len = len + #s
+    if len >= 65536 then
+      f:write(table.concat(t))
+      total = total + len
+      t, len = {}, 0
+    end
+  end
+  f:close()
+  return total
+end)
+
+measure("file:write(buffer)", function ()
+  local f = assert(io.open(fname, "w"))
+  local b, total, i = string.newbuffer(), 0, 0
+  while total < size do
+    i = i + 1
+    b:put("item", i, ",", i * 3, ",some text\n")
+    if #b >= 65536 then
+      f:write(b)
+      total = total + #b
+      b:reset()
+    end
+  end
+  f:close()
+  return total
+end)
+
+os.remove(fname)
+
+print('OK')
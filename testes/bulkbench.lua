@@ -0,0 +1,57 @@
+-- $Id: testes/bulkbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Throughput of bulk table operations (not part of 'all.lua'). Runs
+-- 'table.move', 'table.unpack', and 'table.concat' over ranges of 1K
+-- and 1M elements of plain arrays (100K for 'unpack', which is limited
+-- by the stack size) and prints millions of elements per second.
+-- usage: lua bulkbench.lua [total elements per test in millions]
+
+global <const> *
+
+local total = (tonumber(arg and arg[1]) or 200) * 1e6
+
+
+local function measure (name, size, f)
+  local reps = math.max(1, total // size)
+  collectgarbage()
+  local t0 = os.clock()
+  for _ = 1, reps do f() end
+  local t = os.clock() - t0
+  print(string.format("%-28s %8d %10.1f M elements/s",
+                      name, size, reps * size / t / 1e6))
+end
+
+
+local function array (n, gen)
+  local a = table.create(n)
+  for i = 1, n do a[i] = gen(i) end
+  return a
+end
+
+
+local function id (i) return i end
+local function str (i) return string.char(65 + i % 26) .. "x" end
+
+for _, size in ipairs{1000, 1000000} do
+  local a = array(size, id)
+  local b = table.create(size)
+  local s = array(size, str)
+  measure("move (other table)", size, function ()
+    table.move(a, 1, size, 1, b)
+  end)
+  measure("move (overlapping)", size, function ()
+    table.move(a, 2, size, 1)
+    table.move(a, 1, size - 1, 2)
+  end)
+  local usize = math.min(size, 100000)
+  measure("unpack", usize, function ()
+    return select("#", table.unpack(a, 1, usize))
+  end)
+  measure("concat", size, function () return table.concat(s) end)
+  measure("concat (separator)", size, function ()
+    return table.concat(s, ", ")
+  end)
+end
+
+print('OK')
@@ -0,0 +1,51 @@
+-- $Id: testes/catbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Repeated concatenation (not part of 'all.lua'). Times loops that
+-- build a string by appending pieces to it with '..', for increasing
+-- numbers of iterations, printing the time per append. When appends
+-- take constant time, that time does not grow with the iterations.
+-- usage: lua catbench.lua [max iterations]
+
+global <const> *
+
+local max = tonumber(arg and arg[1]) or 1000000
+
+
+local function measure (name, n, f)
+  collectgarbage()
+  local t0 = os.clock()
+  local len = f(n)
+  local t = os.clock() - t0
+  print(string.format("%-16s %8d appends %8.3f s %8.1f ns/append  (%d bytes)",
+                      name, n, t, t / n * 1e9, len))
+end
+
+
+local function single (n)
+  local s = ""
+  for i = 1, n do s = s .. "x" end
+  return #s
+end
+
+
+local function multiple (n)
+  local s = ""
+  for i = 1, n do s = s .. i .. "," end
+  return #s
+end
+
+
+local n = max // 8
+while n <= max do
+  measure("s = s .. 'x'", n, single)
+  n = n * 2
+end
+
+n = max // 8
+while n <= max do
+  measure("s = s .. i .. ','", n, multiple)
+  n = n * 2
+end
+
+print('OK')
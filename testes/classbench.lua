@@ -0,0 +1,78 @@
+-- $Id: testes/classbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Method-call throughput with class hierarchies (not part of 'all.lua').
+-- Calls methods defined at each level of a 3-level hierarchy
+-- (Base <- Middle <- Leaf) on instances of the leaf class, printing
+-- millions of calls per second.
+-- usage: lua classbench.lua [millions of calls]
+
+global <const> *
+
+local N = math.floor((tonumber(arg and arg[1]) or 10) * 1e6)
+
+
+local function class (parent)
+  local c = setmetatable({}, parent)
+  c.__index = c
+  return c
+end
+
+local Base = class(nil)
+function Base:base () return self.x end
+
+local Middle = class(Base)
+function Middle:middle () return self.x + 1 end
+
+local Leaf = class(Middle)
+function Leaf:leaf () return self.x + 2 end
+
+local objs = {}
+for i = 1, 16 do objs[i] = setmetatable({x = i}, Leaf) end
+
+
+local function measure (name, f)
+  local best = math.huge
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    f()
+    best = math.min(best, os.clock() - t0)
+  end
+  print(string.format("%-26s %8.1f Mcalls/s", name, N / 1e6 / best))
+end
+
+
+measure("leaf method (1 level)", function ()
+  local s = 0
+  for i = 1, N do s = s + objs[i & 15 | 1]:leaf() end
+  return s
+end)
+
+measure("middle method (2 levels)", function ()
+  local s = 0
+  for i = 1, N do s = s + objs[i & 15 | 1]:middle() end
+  return s
+end)
+
+measure("base method (3 levels)", function ()
+  local s = 0
+  for i = 1, N do s = s + objs[i & 15 | 1]:base() end
+  return s
+end)
+
+measure("mixed methods", function ()
+  local s = 0
+  for i = 1, N, 3 do
+    local o = objs[i & 15 | 1]
+    s = s + o:base() + o:middle() + o:leaf()
+  end
+  return s
+end)
+
+measure("string method", function ()
+  local s, str = 0, "abc"
+  for i = 1, N do s = s + str:len() end
+  return s
+end)
+
+print('OK')
@@ -0,0 +1,54 @@
+-- $Id: testes/clonebench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Table copy throughput (not part of 'all.lua'). Copies a template
+-- table, like a configuration read per request, with 'pairs' and with
+-- 'table.clone', shallow and deep, printing copies per second.
+-- usage: lua clonebench.lua [number of copies]
+
+global <const> *
+
+local N = tonumber(arg and arg[1]) or 20000
+
+local template = {}
+for i = 1, 50 do template[i] = i * 2 end
+for i = 1, 100 do
+  template["key" .. i] = {name = "entry" .. i, value = i, list = {1, 2, 3}}
+end
+
+
+local function copy (t)
+  local c = {}
+  for k, v in pairs(t) do c[k] = v end
+  return c
+end
+
+local function deepcopy (t, seen)
+  seen = seen or {}
+  local c = seen[t]
+  if c then return c end
+  c = {}
+  seen[t] = c
+  for k, v in pairs(t) do
+    c[k] = (type(v) == "table") and deepcopy(v, seen) or v
+  end
+  return c
+end
+
+
+local function measure (name, f)
+  collectgarbage()
+  local t0 = os.clock()
+  for _ = 1, N do f(template) end
+  local t = os.clock() - t0
+  print(string.format("%-20s %10.0f copies/s", name, N / t))
+end
+
+
+measure("pairs (shallow)", copy)
+measure("table.clone", table.clone)
+measure("pairs (deep)", deepcopy)
+measure("table.clone (deep)",
+        function (t) return table.clone(t, true) end)
+
+print('OK')
@@ -500,5 +500,143 @@ do   print("testing code for integer limits")
 
 end
 
+do   print("testing inlining of local functions")
+  local function loadi (s) return assert(load(s, "=inline", "ti")) end
+
+  -- inlined call leaves no OP_CALL
+  local f = loadi[[
+    local function inc (x) return x + 1 end
+    local y = ...
+    return inc(y)
+  ]]
+  check(f, 'VARARGPREP', 'CLOSURE', 'VARARG', 'MOVE', 'ADDI', 'MMBINI',
+           'RETURN', 'RETURN')
+  assert(f(10) == 11 and f(-1.5) == -0.5)
+
+  -- several returns, loops, upvalues, globals, and missing arguments
+  f = loadi[[
+    local up = 10
+    local function sel (a, b) if a > b then return a end; return b end
+    local function sum (n) local s = 0; for i = 1, n do s = s + i end; return s end
+    local function acc (x) up = up + x; return up + GLOB end
+    local function dflt (a, b) if b == nil then return a end; return b end
+    return sel(1, 2) + sel(3, 1), sum(10), acc(1), up, dflt(7), dflt(7, 8)
+  ]]
+  assert(not string.find(table.concat(T.listcode(f)), "CALL"))
+  _ENV.GLOB = 100
+  for _, f in ipairs{f, load(string.dump(f))} do
+    local a, b, c, d, e, g = f()
+    assert(a == 5 and b == 55 and c == 111 and d == 11 and e == 7 and g == 8)
+  end
+  _ENV.GLOB = nil
+
+  -- calls that are not inlined
+  f = loadi[[
+    local function mr () return 1, 2, 3 end   -- more than one result
+    local function add (a, b) return a + b end
+    local function va (...) return select('#', ...) end   -- vararg
+    local function inner () return add(1, 2) end   -- 'add' is an upvalue
+    add(1, 2)   -- call statement with an inlined call
+    return add(mr()), va(mr()), inner()
+  ]]
+  local a, b, c = f()
+  assert(a == 3 and b == 3 and c == 3)
+
+  -- without the option, functions are called as usual
+  f = load("local function id (x) return x end; return id(1)")
+  assert(string.find(table.concat(T.listcode(f)), "CALL"))
+
+  -- with the option, local functions are read-only
+  local st, msg = load("local function f () end; f = nil", "=x", "ti")
+  assert(not st and string.find(msg, "const variable 'f'"))
+end
+
+
+do   print("testing global caches")
+  local f = load("local x = ...; return math.floor(x)", "=cache", "tg")
+  check(f, 'VARARGPREP', 'VARARG', 'GETCACHE', 'GETTABUP', 'GETFIELD',
+           'MOVE', 'TAILCALL', 'RETURN', 'RETURN')
+  -- field of a local table is not part of the lookup
+  f = load("local m = math; return m.pi", "=cache", "tg")
+  check(f, 'VARARGPREP', 'GETCACHE', 'GETTABUP', 'GETFIELD',
+           'RETURN', 'RETURN')
+  f = load("return math.pi", "=cache")   -- option is off
+  check(f, 'VARARGPREP', 'GETTABUP', 'GETFIELD', 'RETURN', 'RETURN')
+
+  -- caches must see all changes in the tables involved
+  local env = {lib = {f = 1}, g = 10}
+  f = load("return function () return lib.f, g end", "=cache", "tg", env)()
+  local function checkf (a, b)
+    for i = 1, 2 do   -- second call uses the cache
+      local x, y = f()
+      assert(x == a and y == b)
+    end
+  end
+  checkf(1, 10)
+  env.lib.f = 2; checkf(2, 10)
+  rawset(env, "g", 20); checkf(2, 20)
+  local lib = env.lib
+  env.lib = {f = 3}; checkf(3, 20)
+  lib.f = 4; checkf(3, 20)   -- old table does not matter anymore
+  env.lib.f = nil; checkf(nil, 20)
+  setmetatable(env.lib, {__index = function () return 5 end})
+  checkf(5, 20)   -- results from metamethods are not cached
+  setmetatable(env.lib, nil); env.lib.f = 6; checkf(6, 20)
+  T.testC("setfield -2 f; return 0", env.lib, 8); checkf(8, 20)
+  collectgarbage(); checkf(8, 20)
+  require"debug".setupvalue(f, 1, {lib = {f = 9}, g = 30}); checkf(9, 30)
+end
+
+
+do   print("testing elimination of moves")
+  -- value built directly in the variable
+  check(function () local t; t = {}; return t end,
+    'LOADNIL', 'NEWTABLE', 'EXTRAARG', 'RETURN1')
+  check(function () local f; f = function () return f end; return f end,
+    'LOADNIL', 'CLOSURE', 'RETURN')
+  -- a collection step could see 'b' as dead
+  check(function () local t, b; t = {}; b = t end,
+    'LOADNIL', 'NEWTABLE', 'EXTRAARG', 'MOVE', 'MOVE', 'RETURN0')
+  local f = function () local f; f = function () return f end; return f end
+  local g = f(); assert(g() == g)
+
+  -- results of inlined functions
+  local function loadi (s) return assert(load(s, "=inline", "ti")) end
+  f = loadi[[
+    local function len (x) return #x end
+    local function sq (x) return x * x end
+    local a = ...
+    return len(a) + sq(len(a))
+  ]]
+  check(f, 'VARARGPREP', 'CLOSURE', 'CLOSURE', 'VARARG', 'MOVE', 'LEN',
+           'MOVE', 'LEN', 'MUL', 'MMBIN', 'ADD', 'MMBIN', 'RETURN')
+  assert(f("abc") == 12)
+  -- result with several paths keeps its move
+  f = loadi[[
+    local function abs (x) if x < 0 then x = -x end return x end
+    local function eq (a, b) return a == b end
+    local x, y = ...
+    return abs(x), eq(x, y), eq(abs(x), abs(y))
+  ]]
+  local a, b, c = f(-3, 3)
+  assert(a == 3 and b == false and c == true)
+  a, b, c = f(4, 4)
+  assert(a == 4 and b == true and c == true)
+  -- closures after 'or'/'and' may not be the value of the variable
+  f = loadi[[
+    local g = function () return "g" end
+    local f <const> = g or function (x) return x + 1 end
+    return f(10)
+  ]]
+  assert(f() == "g")
+  f = loadi[[
+    local g = false
+    local f <const> = g and function (x) return x + 1 end
+    return f(10)
+  ]]
+  local st, msg = pcall(f)
+  assert(not st and string.find(msg, "call a boolean value"))
+end
+
 print 'OK'
 
@@ -1033,6 +1033,18 @@ debug.setupvalue(f, 1, g)
 assert(run(f, {"idx", "nidx", "idx"}) == 11)
 assert(g.k.AAA == 11)
 
+-- consecutive indexing operations
+do local _ENV = _ENV
+  f = function () return CCC.x end
+end
+debug.setupvalue(f, 1, g); g.k.CCC = a
+assert(run(f, {"idx"}) == 10)
+a.k.f = a; a.k.m = function (self) return self == a end
+assert(run(function () return a.f.f.x end, {"idx", "idx"}) == 10)
+local key = "f"
+assert(run(function () if a[key] then return "yes" end end, {"idx"}) == "yes")
+assert(run(function () local r = a:m(); return r end, {"idx"}) == true)
+
 print"+"
 
 print"testing yields inside 'for' iterators"
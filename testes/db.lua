@@ -1062,5 +1062,63 @@ do   -- tests for 'source' in binary dumps
          debug.getinfo(h).source == '=?')
 end
 
+
+do   print("testing inlined calls")
+  local prog = [[
+    local function sq (x)
+      return x * G(x)
+    end
+    local t = {}
+    for i = 1, 2 do
+      t[i] = sq(i)
+    end
+    return t
+  ]]
+  local f = assert(load(prog, "=inline", "ti"))
+
+  -- inlined calls appear in tracebacks and as stack levels
+  local tb, lv
+  G = function (x)
+    tb = debug.traceback()
+    lv = {}
+    for l = 2, 3 do lv[#lv + 1] = debug.getinfo(l, "nSlt") end
+    assert(debug.getlocal(2, 1) == nil)   -- no access to inlined locals
+    assert(debug.getlocal(3, 1) == "sq")
+    return 1
+  end
+  f()
+  assert(string.find(tb, "\n%s*inline:2: in local 'sq'\n%s*inline:6: in "))
+  assert(lv[1].name == "sq" and lv[1].namewhat == "local" and
+         lv[1].currentline == 2 and lv[1].what == "Lua" and
+         lv[1].linedefined == 1 and not lv[1].istailcall)
+  assert(lv[2].currentline == 6 and lv[2].what == "main")
+
+  -- errors inside inlined code
+  G = function (x) error("msg", 2) end
+  local st, msg = pcall(f)
+  assert(not st and msg == "inline:2: msg")
+
+  -- inlined calls generate call and return hooks
+  G = function (x) return x end
+  local ev = {}
+  debug.sethook(function (e)
+    local ar = debug.getinfo(2, "nl")
+    ev[#ev + 1] = string.format("%s %s %d", e, ar.name, ar.currentline)
+  end, "cr")
+  f()
+  debug.sethook()
+  assert(ev[3] == "call sq 2" and string.find(ev[4], "^call G ") and
+         string.find(ev[5], "^return G ") and ev[6] == "return sq 2" and
+         ev[7] == "call sq 2" and ev[10] == "return sq 2" and
+         string.find(ev[11], "^return f "))
+
+  -- stripped chunks lose this information
+  f = load(string.dump(f, true))
+  G = function (x) tb = debug.traceback(); return 1 end
+  f()
+  assert(not string.find(tb, "sq"))
+  G = nil
+end
+
 print"OK"
 
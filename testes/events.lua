@@ -504,6 +504,97 @@ child = setmetatable({}, parent)
 child.foo = 10      --> CRASH (on some machines)
 assert(T == parent and K == "foo" and V == 10)
 
+
+do  print("testing cache for '__index' chains")
+  local Base = {}; Base.__index = Base
+  function Base.name () return "base" end
+  function Base.who () return "base" end
+  local Mid = setmetatable({}, Base); Mid.__index = Mid
+  local Class = setmetatable({}, Mid); Class.__index = Class
+  local obj = setmetatable({}, Class)
+
+  local function who (o) return o:who() end
+  for _ = 1, 3 do assert(who(obj) == "base" and obj.name() == "base") end
+
+  -- changes to any table in the chain
+  function Mid.who () return "mid" end
+  assert(who(obj) == "mid")
+  function Class.who () return "class" end
+  assert(who(obj) == "class")
+  Class.who = nil; Mid.who = nil
+  assert(who(obj) == "base")
+  rawset(Base, "who", function () return "raw" end)
+  assert(who(obj) == "raw")
+  assert(obj.extra == nil)    -- absent keys are cached too
+  Base.extra = 10
+  assert(obj.extra == 10)
+  obj.extra = 20   -- field in the object itself
+  assert(obj.extra == 20 and setmetatable({}, Class).extra == 10)
+
+  -- changes to metatables in the chain
+  local Other = {who = function () return "other" end}; Other.__index = Other
+  setmetatable(Mid, Other)
+  assert(who(obj) == "other" and obj.extra == 20 and obj.name == nil)
+  setmetatable(Mid, nil)
+  assert(obj.who == nil and obj.name == nil)
+  setmetatable(Mid, Base)
+  assert(obj.name() == "base")
+
+  -- changes to '__index' fields
+  Mid.__index = function (_, k) return k .. "!" end
+  assert(obj.name == "name!" and obj.anything == "anything!")
+  Mid.__index = Other
+  assert(who(obj) == "other")
+  Mid.__index = Mid
+  Class.__index = nil
+  assert(obj.name == nil)
+  Class.__index = Class
+  assert(obj.name() == "base")
+
+  -- metatables separated from method tables
+  local methods = {m = 1}
+  local meta = {__index = methods}
+  local o = setmetatable({}, meta)
+  assert(o.m == 1)
+  methods.m = 2
+  assert(o.m == 2)
+  meta.__index = {m = 3}
+  assert(o.m == 3)
+
+  -- objects that are not tables
+  local u = io.stdout
+  assert(u.write == u.write and u.write == io.stdout.write)
+  assert(("x").rep == string.rep and ("x"):rep(3) == "xxx")
+  assert(not pcall(function () return (nil).x end))
+  assert(not pcall(function () return (1).x end))
+
+  -- a weak table in the chain
+  local WBase = setmetatable({}, {__mode = "v"}); WBase.__index = WBase
+  local wobj = setmetatable({}, WBase)
+  WBase.x = {}
+  assert(type(wobj.x) == "table")
+  collectgarbage()
+  assert(wobj.x == nil and WBase.x == nil)
+
+  -- many classes, created and collected, sharing the cache
+  for i = 1, 100 do
+    local C = setmetatable({id = i}, Base); C.__index = C
+    local o = setmetatable({}, C)
+    assert(o.id == i and o.name() == "base")
+    if i % 10 == 0 then collectgarbage() end
+  end
+  local classes = {}
+  for i = 1, 20 do
+    local C = setmetatable({id = i}, Base); C.__index = C
+    classes[i] = setmetatable({}, C)
+  end
+  for _ = 1, 3 do
+    for i = 1, 20 do assert(classes[i].id == i) end
+    getmetatable(classes[5]).id = 50
+    assert(classes[5].id == 50); getmetatable(classes[5]).id = 5
+  end
+end
+
 print 'OK'
 
 return 12
@@ -687,6 +687,43 @@ and the rest of the file
 assert(os.remove(file))
 collectgarbage()
 
+do   -- reading into and writing from string buffers
+  local b = string.newbuffer():put("first line\n", 12, "\nlast")
+  assert(io.open(file, "w"):write(b, "|", b):close())
+  local r = string.newbuffer()
+  local f = assert(io.open(file))
+  assert(f:read(r) == r and tostring(r) == "first line")
+  assert(f:read(r, 0) == r and tostring(r) == "first line")
+  local x, y = f:read(r, 'L', 2)
+  assert(x == r and y == r and tostring(r) == "first line12\nla")
+  assert(f:read(r, 'a') == r and f:read(r, 'a') == r)
+  assert(tostring(r) == "first line12\nlast|first line\n12\nlast")
+  assert(not f:read(r, 0) and not f:read(r, 1) and not f:read(r, 'l'))
+  checkerr("invalid format", f.read, f, r, 'n')
+  f:seek("set")
+  r:reset()
+  local n = 0
+  for l in f:lines(r, 5) do assert(l == r); n = n + 1 end
+  assert(n == 8 and tostring(r) == tostring(b) .. "|" .. tostring(b))
+  f:seek("set")
+  io.input(f)
+  assert(io.read(r:reset(), 'l', 'l') == r and tostring(r) == "first line12")
+  f:close()
+  -- large file read by chunks
+  b = string.newbuffer()
+  for i = 1, 20000 do b:putf("%d\n", i) end
+  io.output(file):write(b):close()
+  local s = tostring(b)
+  r:reset()
+  f = io.open(file)
+  while f:read(r, 1000) do end
+  assert(tostring(r) == s)
+  f:seek("set")
+  assert(f:read(r:reset(), 'a') == r and r:get() == s)
+  f:close()
+  assert(os.remove(file))
+end
+
 -- testing buffers
 do
   local f = assert(io.open(file, "w"))
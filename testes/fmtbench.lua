@@ -0,0 +1,90 @@
+-- $Id: testes/fmtbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Number-string conversion throughput (not part of 'all.lua').
+-- Converts arrays of numbers to strings and back, as JSON or CSV
+-- writers and readers do, and formats log lines, and prints the number
+-- of conversions (or lines) per second.
+-- usage: lua fmtbench.lua [number of values]
+
+global <const> *
+
+local n = tonumber(arg and arg[1]) or 200000
+
+local ints, floats, decs = {}, {}, {}
+for i = 1, n do
+  ints[i] = math.random(-1e9, 1e9)
+  floats[i] = math.random() * 10.0^math.random(-20, 20)
+  decs[i] = math.random(0, 99999) / 100   -- prices: few digits
+end
+
+
+local function measure (name, f)
+  local best = math.huge
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    f()
+    best = math.min(best, os.clock() - t0)
+  end
+  print(string.format("%-18s %10.0f conv/s", name, n / best))
+end
+
+
+local function concat (t)
+  return function () assert(#table.concat(t, ",") > n) end
+end
+
+local function tostr (t)
+  return function ()
+    for i = 1, n do local s = tostring(t[i]) end
+  end
+end
+
+local function fmt (f, t)
+  return function ()
+    for i = 1, n do local s = string.format(f, t[i]) end
+  end
+end
+
+measure("concat integers", concat(ints))
+measure("concat floats", concat(floats))
+measure("concat decimals", concat(decs))
+measure("tostring floats", tostr(floats))
+measure("format %d", fmt("%d", ints))
+measure("format %q float", fmt("%q", floats))
+measure("format %.14g", fmt("%.14g", floats))
+
+-- logging-style formats, with several conversions each
+local names = {"net", "db", "cache", "http"}
+
+local function logfmt (f)
+  return function ()
+    for i = 1, n do
+      local s = string.format(f, i, names[i % 4 + 1], decs[i],
+                                 ints[i] % 1000, ints[i])
+    end
+  end
+end
+
+measure("format log line", logfmt("[%05d] %-6s took %5.2f ms (%d items, id %x)"))
+measure("format key=value", logfmt("seq=%d mod=%s ms=%.3f n=%d id=%X"))
+
+local function tonum (t)
+  local strs = {}
+  for i = 1, n do strs[i] = tostring(t[i]) end
+  return function ()
+    for i = 1, n do local x = tonumber(strs[i]) end
+  end
+end
+
+measure("tonumber integers", tonum(ints))
+measure("tonumber floats", tonum(floats))
+measure("tonumber decimals", tonum(decs))
+
+-- results must read back as the same numbers
+for i = 1, n do
+  assert(tonumber(tostring(floats[i])) == floats[i])
+  assert(load("return " .. string.format("%q", floats[i]))() == floats[i])
+end
+
+print('OK')
@@ -293,6 +293,14 @@ do   -- invalid mode
   collectgarbage()
 end
 
+do   -- mode that is a prefix of a longer string
+  local mode = string.sub(string.rep(" ", 130) .. "k", 1, 130)
+  local a = setmetatable({}, {__mode = mode})
+  a[{}] = 1
+  collectgarbage()
+  assert(next(a) ~= nil)   -- keys are not weak
+end
+
 
 if T then   -- bug since 5.3: all-weak tables are not being revisited
   T.gcstate("propagate")
@@ -390,6 +398,14 @@ if T then
   for i = 1, 10 do assert(s[i]) end
 
   getmetatable(u).__gc = nil
+
+  -- error message that is a prefix of a longer string
+  local msg = string.sub(string.rep("x", 130) .. "@tail@", 1, 130)
+  setmetatable({}, {__gc = function () error(msg, 0) end})
+  warn("@store")
+  collectgarbage()
+  assert(string.find(_WARN, "(" .. msg .. ")", 1, true))
+  assert(not string.find(_WARN, "tail")); _WARN = false
   warn("@normal")
 
 end
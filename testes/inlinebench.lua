@@ -0,0 +1,76 @@
+-- $Id: testes/inlinebench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Call-heavy loops with and without inline mode (not part of 'all.lua').
+-- Each loop calls small local functions; the same chunk is loaded
+-- with modes "t" (regular calls) and "ti" (inlined calls), printing
+-- millions of calls per second and the speedup of inline mode.
+-- usage: lua inlinebench.lua [millions of calls]
+
+global <const> *
+
+local N = math.floor((tonumber(arg and arg[1]) or 10) * 1e6)
+
+-- each chunk gets 'N' and returns its result; functions must be local
+-- to the chunk that calls them to be inlined
+local progs = {
+  {"square", [[
+    local N = ...
+    local function sq (x) return x * x end
+    local s = 0
+    for i = 1, N do s = s + sq(i & 255) end
+    return s
+  ]]},
+  {"clamp", [[
+    local N = ...
+    local function clamp (x, lo, hi)
+      if x < lo then return lo elseif x > hi then return hi end
+      return x
+    end
+    local s = 0
+    for i = 1, N do s = s + clamp(i & 1023, 100, 900) end
+    return s
+  ]]},
+  {"dist2 (4 args)", [[
+    local N = ...
+    local function dist2 (x1, y1, x2, y2)
+      local dx, dy = x2 - x1, y2 - y1
+      return dx * dx + dy * dy
+    end
+    local s = 0
+    for i = 1, N do s = s + dist2(i, 1, 2, i & 7) end
+    return s
+  ]]},
+  {"lerp (floats)", [[
+    local N = ...
+    local function lerp (a, b, t) return a + (b - a) * t end
+    local s = 0.0
+    for i = 1, N do s = lerp(s, i, 0.5) end
+    return s
+  ]]},
+}
+
+
+local function best (f)
+  local t = math.huge
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    f(N)
+    t = math.min(t, os.clock() - t0)
+  end
+  return t
+end
+
+
+for _, b in ipairs(progs) do
+  local name, src = b[1], b[2]
+  local plain = assert(load(src, "=plain", "t"))
+  local inline = assert(load(src, "=inline", "ti"))
+  assert(plain(N) == inline(N))
+  local tp = best(plain)
+  local ti = best(inline)
+  print(string.format("%-16s call %7.1f  inline %7.1f Mcalls/s  (x%.2f)",
+                      name, N / 1e6 / tp, N / 1e6 / ti, tp / ti))
+end
+
+print('OK')
@@ -0,0 +1,56 @@
+-- $Id: testes/intkeybench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Sparse integer keys (not part of 'all.lua'). Builds tables whose keys
+-- are all integers outside the array part (random IDs, timestamps and
+-- small but sparse numbers) and prints the memory used per entry and
+-- the throughput of lookups (hits and misses) and inserts.
+-- usage: lua intkeybench.lua [number of keys in millions]
+
+global <const> *
+
+local N = math.floor((tonumber(arg and arg[1]) or 10) * 1e6)
+
+
+local function measure (name, gen)
+  local keys = {}
+  for i = 1, N do keys[i] = gen(i) end
+  collectgarbage(); collectgarbage()
+  local m0 = collectgarbage("count")
+  local t0 = os.clock()
+  local t = {}
+  for i = 1, N do t[keys[i]] = i end
+  local tins = os.clock() - t0
+  local mem = (collectgarbage("count") - m0) * 1024 / N
+  -- lookups in a different order from the insertions
+  for i = N, 2, -1 do
+    local j = math.random(i)
+    keys[i], keys[j] = keys[j], keys[i]
+  end
+  t0 = os.clock()
+  local s = 0
+  for i = 1, N do s = s + t[keys[i]] end
+  local thit = os.clock() - t0
+  assert(s == N * (N + 1) // 2)
+  t0 = os.clock()
+  local n = 0
+  for i = 1, N do
+    if t[keys[i] + 1] ~= nil then n = n + 1 end
+  end
+  local tmiss = os.clock() - t0
+  assert(n == 0)
+  print(string.format(
+    "%-12s %5.1f bytes/entry  insert %6.1f  hit %6.1f  miss %6.1f Mops/s",
+    name, mem, N / tins / 1e6, N / thit / 1e6, N / tmiss / 1e6))
+end
+
+
+math.randomseed(42)
+-- (a bijection, so that there are no repeated keys; all keys are even)
+measure("random IDs", function (i)
+  return ((i * 0x9E3779B97F4A7C15) & 0xFFFFFFFFFF) << 1
+end)
+measure("timestamps", function (i) return 1700000000000 + i * 1000 end)
+measure("stride 16", function (i) return i * 16 end)   -- all keys even
+
+print('OK')
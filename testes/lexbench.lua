@@ -0,0 +1,68 @@
+-- $Id: testes/lexbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Lexing throughput (not part of 'all.lua'). Generates a data file
+-- with table constructors, like the ones written by serializers, and
+-- measures how fast 'load' compiles it, in MB/s.
+-- usage: lua lexbench.lua [size in MB]
+
+global <const> *
+
+local size = (tonumber(arg and arg[1]) or 8) * 2^20
+local n   -- number of items in the data
+
+local function gendata ()
+  local t = {"-- generated data\nreturn {\n"}
+  local len = #t[1]
+  local i = 0
+  while len < size do
+    i = i + 1
+    local item = string.format(
+      "  { id = %d, name = \"item_number_%d\", value = %.17g,\n" ..
+      "    tags = {'alpha', 'beta', 'gamma'}, flag = %s,  -- entry %d\n" ..
+      "    text = [[a longer text for item %d\nwith two lines]] },\n",
+      i, i, i / 7, tostring(i % 2 == 0), i, i)
+    t[#t + 1] = item
+    len = len + #item
+  end
+  t[#t + 1] = "}\n"
+  return table.concat(t), i
+end
+
+
+-- 'f' must return the compiled chunk
+local function measure (name, f)
+  local best = math.huge
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    local chunk = assert(f())
+    best = math.min(best, os.clock() - t0)
+    assert(#chunk() == n)
+  end
+  print(string.format("%-20s %8.1f MB/s", name, size / 2^20 / best))
+end
+
+
+local src
+src, n = gendata()
+size = #src
+
+measure("load (string)", function () return load(src) end)
+
+measure("load (4K blocks)", function ()
+  local i = 1
+  return load(function ()
+    local p = string.sub(src, i, i + 4095)
+    i = i + 4096
+    return p
+  end)
+end)
+
+local fname = os.tmpname()
+local file = assert(io.open(fname, "w"))
+file:write(src)
+file:close()
+measure("loadfile", function () return loadfile(fname) end)
+os.remove(fname)
+
+print('OK')
@@ -0,0 +1,93 @@
+/*
+** userdata with the same fields accessed through a layout and through
+** C '__index'/'__newindex' functions (used by udatabench.lua)
+*/
+
+#include <stddef.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+
+typedef struct Point {
+  double x, y;
+  int id;
+  int visible;
+} Point;
+
+
+static const luaL_Field fields[] = {
+  {"x", offsetof(Point, x), LUA_FDOUBLE},
+  {"y", offsetof(Point, y), LUA_FDOUBLE},
+  {"id", offsetof(Point, id), LUA_FINT},
+  {"visible", offsetof(Point, visible), LUA_FBOOLEAN},
+  {NULL, 0, 0}
+};
+
+
+static int cindex (lua_State *L) {
+  Point *p = (Point *)luaL_checkudata(L, 1, "Point.c");
+  const char *k = luaL_checkstring(L, 2);
+  if (strcmp(k, "x") == 0) lua_pushnumber(L, p->x);
+  else if (strcmp(k, "y") == 0) lua_pushnumber(L, p->y);
+  else if (strcmp(k, "id") == 0) lua_pushinteger(L, p->id);
+  else if (strcmp(k, "visible") == 0) lua_pushboolean(L, p->visible);
+  else lua_pushnil(L);
+  return 1;
+}
+
+
+static int cnewindex (lua_State *L) {
+  Point *p = (Point *)luaL_checkudata(L, 1, "Point.c");
+  const char *k = luaL_checkstring(L, 2);
+  if (strcmp(k, "x") == 0) p->x = luaL_checknumber(L, 3);
+  else if (strcmp(k, "y") == 0) p->y = luaL_checknumber(L, 3);
+  else if (strcmp(k, "id") == 0) p->id = (int)luaL_checkinteger(L, 3);
+  else if (strcmp(k, "visible") == 0) p->visible = lua_toboolean(L, 3);
+  else return luaL_error(L, "no field '%s'", k);
+  return 0;
+}
+
+
+static int newpoint (lua_State *L, const char *tname) {
+  Point *p = (Point *)lua_newuserdatauv(L, sizeof(Point), 0);
+  p->x = luaL_optnumber(L, 1, 0);
+  p->y = luaL_optnumber(L, 2, 0);
+  p->id = 0;
+  p->visible = 1;
+  luaL_setmetatable(L, tname);
+  return 1;
+}
+
+
+static int newlayout (lua_State *L) {
+  return newpoint(L, "Point.layout");
+}
+
+
+static int newc (lua_State *L) {
+  return newpoint(L, "Point.c");
+}
+
+
+static const struct luaL_Reg funcs[] = {
+  {"newlayout", newlayout},
+  {"newc", newc},
+  {NULL, NULL}
+};
+
+
+LUAMOD_API int luaopen_udata (lua_State *L) {
+  luaL_newmetatable(L, "Point.layout");
+  luaL_setlayout(L, fields);
+  lua_pop(L, 1);
+  luaL_newmetatable(L, "Point.c");
+  lua_pushcfunction(L, cindex);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, cnewindex);
+  lua_setfield(L, -2, "__newindex");
+  lua_pop(L, 1);
+  luaL_newlib(L, funcs);
+  return 1;
+}
@@ -342,4 +342,29 @@ malformednum("0xe-", "near <eof>")
 malformednum("0xep-p", "malformed number")
 malformednum("1print()", "malformed number")
 
+
+-- tokens split across blocks of the input
+do
+  local code = "local a_long_name, b = 'a plain string', \"an \\n escape\"\n" ..
+    "  \t\f\v-- a comment\r\n" ..
+    "local c = [==[long\n]] string]==] --[[ long\r\ncomment ]]\n" ..
+    "local d = 1234567890 + 0x7fff + 3.25e2 + 12.5\n" ..
+    "return a_long_name, b, c, d\n"
+  local function loadby (s, n)   -- read 's' in blocks of 'n' bytes
+    local i = 1
+    return load(function ()
+      local p = string.sub(s, i, i + n - 1)
+      i = i + n
+      return p
+    end, "=split")
+  end
+  for _, n in ipairs{1, 2, 3, 5, 7, 16, 1000} do
+    local a, b, c, d = loadby(code, n)()
+    assert(a == 'a plain string' and b == "an \n escape" and
+           c == "long\n]] string" and d == 1234567890 + 0x7fff + 325 + 12.5)
+    local _, msg = loadby(code .. "x = = 1", n)
+    assert(string.find(msg, "^split:8:"))
+  end
+end
+
 print('OK')
@@ -454,6 +454,51 @@ if not _ENV._soft then
   assert(tonumber('0x.' .. string.rep('0', 1000) .. '74p4004') == 0x7.4)
 end
 
+
+do   -- decimal numerals
+  -- a numeral padded to more than 19 significant digits is converted
+  -- by 'lua_str2number' ('strtod'); other numerals may not be
+  local function strtod (s)
+    local m, e = string.match(s, "^([^eE]*)(.*)$")
+    if not string.find(m, "%.") then m = m .. "." end
+    return tonumber(m .. string.rep("0", 20) .. e)
+  end
+  local function check (s)
+    local x, y = tonumber(s), strtod(s)
+    assert(math.type(x) == "float" and x == y)
+    assert(string.format("%a", x) == string.format("%a", y))
+  end
+  for _, s in pairs{"0.1", "0.3", ".5", "5.", "1e23", "1.5e-3", "0.0",
+      "9007199254740993.0", "9007199254740995.0", "18446744073709549568.0",
+      "2.2250738585072014e-308", "2.2250738585072011e-308",
+      "4.9e-324", "2.4703282292062327e-324", "1.7976931348623157e308",
+      "1.7976931348623159e308", "1e-290", "1e-300", "1e308", "1e400",
+      "123456789012345678e-300", "0.000000000000000000000001234",
+      "1" .. string.rep("0", 400) .. ".0e-400"} do
+    check(s); check("-" .. s)
+  end
+  assert(1/tonumber("-0.0") == -1/0 and 1/tonumber("0e999999") == 1/0)
+  for _ = 1, 5000 do
+    local s = ""
+    for _ = 1, math.random(19) do s = s .. math.random(0, 9) end
+    local dot = math.random(0, #s)
+    s = s:sub(1, dot) .. "." .. s:sub(dot + 1) .. "e" .. math.random(-330, 330)
+    check(s)
+    local x = math.random() * 10.0^math.random(-300, 300)
+    check(string.format("%.18e", x))
+    check(string.format("%.16e", x))
+  end
+  if floatbits == 53 and intbits == 64 then
+    -- halfway between two consecutive floats
+    for e = 1, 11 do
+      for _ = 1, 200 do
+        local m = math.random(1 << 52, (1 << 53) - 1)
+        check(string.format("%d.0", (2 * m + 1) << (e - 1)))
+      end
+    end
+  end
+end
+
 -- testing 'tonumber' for invalid formats
 
 local function f (...)
@@ -304,6 +304,27 @@ do
 end
 
 
+do   -- colliding keys go to free nodes near their main positions
+  local size = 2^10
+  local a = table.create(0, size)
+  check(a, 0, size)
+  local keys = {10, 300, 600, 1000}
+  for _, k in ipairs(keys) do
+    a[k] = true
+    a[k + size - 1] = true   -- same main position (see 'hashint')
+  end
+  local pos = {}
+  for i = 0, size - 1 do
+    local k = T.querytab(a, i)
+    if k then pos[k] = i end
+  end
+  for _, k in ipairs(keys) do
+    local d = pos[k + size - 1] - pos[k]
+    assert(0 < d and d <= 4)
+  end
+end
+
+
 -- size tests for vararg
 lim = 35
 local function foo (n, ...)
@@ -954,4 +975,103 @@ do
 
 end
 
+
+-- testing traversals with the primitive 'next' in generic 'for' loops
+-- (which the VM runs without calling 'next')
+do
+  local function keys (t)   -- keys in traversal order, using 'next'
+    local res = {}
+    local k = next(t)
+    while k ~= nil do res[#res + 1] = k; k = next(t, k) end
+    return res
+  end
+
+  local t = {10, 20, 30, nil, 50, x = 1, y = 2, [1.5] = 3, [true] = 4,
+             [print] = 5, [{}] = 6, [string.rep("k", 50)] = 7, [-1] = 8}
+  local ks = keys(t)
+  local i = 0
+  for k, v in pairs(t) do
+    i = i + 1
+    assert(k == ks[i] and v == t[k])
+  end
+  assert(i == #ks and i == 12)
+  i = 0
+  for k in next, t do i = i + 1; assert(k == ks[i]) end   -- one variable
+  assert(i == #ks)
+  i = 0
+  for k, v, x, y in next, t, nil, false do   -- extra variables
+    i = i + 1
+    assert(k == ks[i] and v == t[k] and x == nil and y == nil)
+  end
+  assert(i == #ks)
+
+  -- starting from a given key
+  i = 3
+  for k in next, t, ks[3] do i = i + 1; assert(k == ks[i]) end
+  assert(i == #ks)
+  checkerror("invalid key", function () for k in next, t, 100 do end end)
+  checkerror("table expected", function () for k in next, 10 do end end)
+  checkerror("table expected", next)
+  checkerror("table expected, got number", next, 10)
+  -- same messages as 'luaL_checktype'
+  checkerror("^bad argument #1 to 'next' %(table expected, got no value%)$",
+             next)
+  checkerror("got FILE%*", next, io.stdout)
+  checkerror("^[^:]+:%d+: bad argument #1 to 'n' %(table expected",
+             function () local n = next; local x = n(10) end)
+  string.next = next
+  checkerror("calling 'next' on bad self %(table expected, got string%)",
+             function () local x = ("a"):next() end)
+  string.next = nil
+
+  -- clearing and changing fields during the traversal
+  for _ = 1, 2 do
+    local t = {}
+    for i = 1, 100 do t[i] = i; t["k" .. i] = i; t[{}] = i end
+    i = 0
+    for k, v in pairs(t) do
+      i = i + 1
+      t[k] = nil
+      collectgarbage()   -- removed keys may become dead
+    end
+    assert(i == 300 and next(t) == nil)
+    for i = 1, 100 do t[i] = i; t["k" .. i] = i end
+    for k, v in pairs(t) do t[k] = v * 2 end
+    for i = 1, 100 do assert(t[i] == 2 * i and t["k" .. i] == 2 * i) end
+  end
+
+  -- nested traversals of the same table
+  i = 0
+  for k1 in pairs(t) do
+    for k2 in pairs(t) do i = i + 1 end
+  end
+  assert(i == #ks * #ks)
+  t = {a = 1, b = 2}
+
+  -- a real closing value
+  local closed = 0
+  local cv = setmetatable({}, {__close = function () closed = closed + 1 end})
+  i = 0
+  for k in next, t, nil, cv do i = i + 1 end
+  assert(i == 2 and closed == 1)
+
+  -- yields inside the loop
+  local co = coroutine.wrap(function ()
+    local n = 0
+    for k, v in pairs(t) do n = n + v; coroutine.yield(k) end
+    return n
+  end)
+  assert(co() and co() and co() == 3)
+
+  -- call hooks still see 'next' being called
+  local debug = require'debug'
+  local calls = 0
+  debug.sethook(function ()
+    if debug.getinfo(2, "f").func == next then calls = calls + 1 end
+  end, "c")
+  for k in pairs(t) do end
+  debug.sethook()
+  assert(calls == 3)
+end
+
 print"OK"
@@ -0,0 +1,75 @@
+-- $Id: testes/packbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Binary record throughput (not part of 'all.lua'). Packs and unpacks
+-- fixed-size records with 'string.pack'/'string.unpack', one record per
+-- call, and with 'string.packmany'/'string.unpackmany', printing the
+-- number of records per second.
+-- usage: lua packbench.lua [number of records in millions]
+
+global <const> *
+
+local n = math.floor((tonumber(arg and arg[1]) or 1) * 1e6)
+local fmt = "<i4 I2 I2 d"   -- 16-byte records
+local pack, unpack = string.pack, string.unpack
+
+
+local function measure (name, f)
+  collectgarbage()
+  local best = math.huge
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    f()
+    best = math.min(best, os.clock() - t0)
+  end
+  print(string.format("%-24s %8.2f Mrec/s", name, n / 1e6 / best))
+end
+
+
+local values = {}
+for i = 1, n do
+  local k = 4 * (i - 1)
+  values[k + 1] = i; values[k + 2] = i % 65536
+  values[k + 3] = 7; values[k + 4] = i / 8
+end
+
+local data
+measure("pack (loop)", function ()
+  local t = {}
+  for i = 1, n do
+    local k = 4 * (i - 1)
+    t[i] = pack(fmt, values[k + 1], values[k + 2],
+                     values[k + 3], values[k + 4])
+  end
+  data = table.concat(t)
+end)
+assert(#data == 16 * n)
+
+if string.packmany then
+  measure("packmany", function ()
+    assert(string.packmany(fmt, values) == data)
+  end)
+end
+
+measure("unpack (loop)", function ()
+  local t, pos = {}, 1
+  for i = 1, n do
+    local k = 4 * (i - 1)
+    t[k + 1], t[k + 2], t[k + 3], t[k + 4], pos = unpack(fmt, data, pos)
+  end
+  assert(pos == #data + 1 and t[#t] == n / 8)
+end)
+
+if string.unpackmany then
+  measure("unpackmany", function ()
+    local t, pos = string.unpackmany(fmt, data)
+    assert(pos == #data + 1 and t[#t] == n / 8)
+  end)
+  local t = table.create(4 * n)
+  measure("unpackmany (reuse)", function ()
+    local _, pos = string.unpackmany(fmt, data, 1, n, t)
+    assert(pos == #data + 1 and t[#t] == n / 8)
+  end)
+end
+
+print('OK')
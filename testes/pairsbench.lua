@@ -0,0 +1,48 @@
+-- $Id: testes/pairsbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Table traversal speed (not part of 'all.lua'). Traverses tables with
+-- string keys, with integer keys in the hash part, and with an array,
+-- both with 'pairs' and with explicit calls to 'next', printing
+-- millions of keys per second.
+-- usage: lua pairsbench.lua [number of keys in millions]
+
+global <const> *
+
+local N = math.floor((tonumber(arg and arg[1]) or 10) * 1e6)
+
+
+local function measure (name, t)
+  collectgarbage()
+  local best = math.huge
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    local n = 0
+    for _ in pairs(t) do n = n + 1 end
+    best = math.min(best, os.clock() - t0)
+    assert(n == N)
+  end
+  local t0 = os.clock()
+  local n = 0
+  local k = next(t)
+  while k ~= nil do n = n + 1; k = next(t, k) end
+  local tn = os.clock() - t0
+  assert(n == N)
+  print(string.format("%-14s pairs %8.1f Mkeys/s   next %8.1f Mkeys/s",
+                      name, N / best / 1e6, N / tn / 1e6))
+end
+
+
+local t = {}
+for i = 1, N do t["k" .. i] = i end
+measure("string keys", t)
+
+t = {}
+for i = 1, N do t[i * 7] = i end
+measure("integer keys", t)
+
+t = table.create(N)
+for i = 1, N do t[i] = i end
+measure("array", t)
+
+print('OK')
@@ -0,0 +1,54 @@
+-- $Id: testes/parsortbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Scaling of the parallel 'table.sort' (not part of 'all.lua'). Sorts
+-- the same arrays of integers, floats, and strings with 1 to 16
+-- threads (see 'table.sortthreads') and prints the wall-clock time of
+-- each sort and its speedup over one thread. Wall-clock time comes from
+-- 'date', so this script needs a POSIX shell.
+-- usage: lua parsortbench.lua [number of elements in millions]
+
+global <const> *
+
+local N = math.floor((tonumber(arg and arg[1]) or 20) * 1e6)
+
+
+-- wall-clock time in seconds
+local function now ()
+  local f = io.popen("date +%s.%N")
+  if f then
+    local t = tonumber(f:read("l"))
+    f:close()
+    if t then return t end
+  end
+  return os.time()
+end
+
+
+local function bench (name, n, gen)
+  local src = {}
+  for i = 1, n do src[i] = gen(i) end
+  local base
+  for _, nt in ipairs{1, 2, 4, 8, 16} do
+    local a = table.move(src, 1, n, 1, table.create(n))
+    collectgarbage()
+    table.sortthreads(nt)
+    local t0 = now()
+    table.sort(a)
+    local t = now() - t0
+    for i = 2, n, n // 1000 + 1 do assert(not (a[i] < a[i - 1])) end
+    base = base or t
+    print(string.format("%-10s %9d  %2d threads %9.1f ms  x%.2f",
+                        name, n, nt, t * 1000, base / t))
+  end
+  table.sortthreads(1)
+end
+
+
+bench("integers", N, function () return math.random(0, 1 << 40) end)
+bench("floats", N, function () return math.random() end)
+bench("strings", N // 10, function ()
+  return string.format("key%x", math.random(0, 1 << 40))
+end)
+
+print('OK')
@@ -0,0 +1,102 @@
+-- $Id: testes/patbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Pattern-matching throughput (not part of 'all.lua'). Parses a
+-- generated log with the same few patterns many times, like a log
+-- analyzer does, and prints the number of calls per second. Then
+-- measures plain searches, in MB/s, on typical and adversarial inputs.
+-- usage: lua patbench.lua [number of lines]
+
+global <const> *
+
+local nlines = tonumber(arg and arg[1]) or 100000
+
+local levels = {"INFO", "WARN", "ERROR", "DEBUG"}
+local lines = {}
+for i = 1, nlines do
+  lines[i] = string.format(
+    "2024-01-%02d 12:%02d:%02d [%s] worker-%d: request id=%d took %dms",
+    i % 28 + 1, i % 60, (i * 7) % 60, levels[i % 4 + 1], i % 16, i, i % 997)
+end
+local text = table.concat(lines, "\n")
+
+
+local function measure (name, ncalls, f)
+  local best = math.huge
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    f()
+    best = math.min(best, os.clock() - t0)
+  end
+  print(string.format("%-12s %10.0f calls/s", name, ncalls / best))
+end
+
+
+measure("match", nlines * 3, function ()
+  local n = 0
+  for i = 1, nlines do
+    local l = lines[i]
+    local d, t = string.match(l, "^(%d+%-%d+%-%d+) (%d+:%d+:%d+)")
+    local lvl = string.match(l, "%[(%u+)%]")
+    local ms = string.match(l, "took (%d+)ms$")
+    if lvl == "ERROR" and d and t then n = n + tonumber(ms) end
+  end
+  assert(n > 0)
+end)
+
+measure("find", nlines * 2, function ()
+  local n = 0
+  for i = 1, nlines do
+    if string.find(lines[i], "worker%-1%d?:") then n = n + 1 end
+    if string.find(lines[i], "id=%d*7 ") then n = n + 1 end
+  end
+  assert(n > 0)
+end)
+
+measure("gmatch", nlines, function ()
+  local n = 0
+  for k, v in string.gmatch(text, "(%a+)=(%d+)") do n = n + 1 end
+  assert(n == nlines)
+end)
+
+measure("gsub", nlines, function ()
+  local _, n = string.gsub(text, "%d+ms", "?")
+  assert(n == nlines)
+end)
+
+
+-- plain searches; 'f' must return the number of bytes searched
+local function measureMB (name, f)
+  local best, size = math.huge
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    size = f()
+    best = math.min(best, os.clock() - t0)
+  end
+  print(string.format("%-12s %10.1f MB/s", name, size / 2^20 / best))
+end
+
+local http = string.rep("X-Header: some value\r\n", 40) .. "\r\n" ..
+             string.rep("body\r\n", 200)
+measureMB("http", function ()
+  local size = 0
+  for _ = 1, 2000 do
+    local _, e = string.find(http, "\r\n\r\n", 1, true)
+    size = size + e
+  end
+  return size
+end)
+
+measureMB("text", function ()
+  assert(not string.find(text, "worker-99:", 1, true))
+  return #text
+end)
+
+local as = string.rep("a", 2^20)
+local ap = string.rep("a", 300) .. "b" .. string.rep("a", 300)
+measureMB("adversarial", function ()
+  assert(not string.find(as, ap, 1, true))
+  return #as
+end)
+
+print('OK')
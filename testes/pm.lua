@@ -38,6 +38,39 @@ assert(not string.find('', '\0'))
 assert(string.find('alo123alo', '12') == 4)
 assert(not string.find('alo123alo', '^12'))
 
+do   -- plain searches with many partial matches
+  local function naive (s, p, init)
+    for i = init, #s - #p + 1 do
+      if string.sub(s, i, i + #p - 1) == p then return i end
+    end
+    return nil
+  end
+  local s = string.rep("a", 3000)
+  local p = string.rep("a", 100) .. "b" .. string.rep("a", 100)
+  assert(not string.find(s, p, 1, true))
+  assert(string.find(s .. p, p, 1, true) == 3001)
+  assert(string.find(s .. "b" .. s, p, 1, true) == 2901)
+  assert(string.find(string.rep("ab", 1000) .. "abb", "abababb", 1, true)
+         == 1997)
+  -- compare with a naive search, on strings with small alphabets
+  for _, a in ipairs{"ab", "aab", "a\0b"} do
+    local function r (n)
+      local t = {}
+      for i = 1, n do
+        local k = math.random(#a)
+        t[i] = string.sub(a, k, k)
+      end
+      return table.concat(t)
+    end
+    for _ = 1, 200 do
+      local s = string.rep("a", math.random(0, 500)) .. r(math.random(0, 50))
+      local p = r(math.random(1, 30))
+      local init = math.random(1, #s + 1)
+      assert(string.find(s, p, init, true) == naive(s, p, init))
+    end
+  end
+end
+
 assert(string.match("aaab", ".*b") == "aaab")
 assert(string.match("aaa", ".*a") == "aaa")
 assert(string.match("b", ".*b") == "b")
@@ -395,6 +428,59 @@ malform("%ba")
 malform("%")
 malform("%f", "missing")
 
+do  print("testing compiled patterns")
+  -- errors are raised only when the matcher reaches them
+  assert(not string.find("abc", "x%"))
+  assert(not string.find("abc", "x[a"))
+  assert(not string.match("abc", "x%f"))
+  malform("a%", "ends with")
+
+  -- patterns too long to be compiled must give the same results: pad
+  -- them with items that match only the empty string in these subjects
+  local pad = string.rep("\1*", 70)
+  local subjects = {"", "hello world", "  key = value  ", "(a(b)c)d",
+                    "x1y22z333", "THE (quick) fox", "aaa\0bbb", "^^a$$"}
+  local patterns = {"o", "l+", "%w+", "(%w+)%s*=%s*(%w+)", "%b()",
+                    "%f[%w]%w+", "[%a_][%w_]*", "(%d)%1", "%d-z", ".-%s",
+                    "()ll()", "[^%s]+", "[a-f]+", "%u+", "^%s*", "^a",
+                    "%^+", "a?b", "[%]]", "%$+", ".*o", "[\0-\1]"}
+  for _, p in ipairs(patterns) do
+    for _, s in ipairs(subjects) do
+      local r1 = table.pack(string.find(s, p))
+      local r2 = table.pack(string.find(s, p .. pad))
+      assert(r1.n == r2.n)
+      for i = 1, r1.n do assert(r1[i] == r2[i]) end
+      assert(string.gsub(s, p, "<%0>") == string.gsub(s, p .. pad, "<%0>"))
+      local t = {}
+      for a, b in string.gmatch(s, p) do t[#t + 1] = tostring(a) .. tostring(b) end
+      for a, b in string.gmatch(s, p .. pad) do
+        assert(table.remove(t, 1) == tostring(a) .. tostring(b))
+      end
+      assert(#t == 0)
+    end
+  end
+
+  -- other patterns can replace a pattern in the cache while it is in use
+  local function other (x)
+    for i = 1, 20 do   -- more patterns than fit in the cache
+      assert(string.find(x, string.rep("%w?", i)))
+    end
+    return x:upper()
+  end
+  assert(string.gsub("ab cd ef", "%w+", other) == "AB CD EF")
+  local t = {}
+  for w in string.gmatch("one two three", "%a+") do
+    t[#t + 1] = other(w)
+  end
+  assert(table.concat(t, " ") == "ONE TWO THREE")
+
+  -- recursion limit
+  local p = string.rep("a?", 199)
+  assert(string.match(string.rep("a", 199), p) == string.rep("a", 199))
+  checkerror("too complex", string.match, string.rep("a", 300),
+             string.rep("a?", 300))
+end
+
 -- \0 in patterns
 assert(string.match("ab\0\1\2c", "[\0-\2]+") == "\0\1\2")
 assert(string.match("ab\0\1\2c", "[\0-\0]+") == "\0")
@@ -42,6 +42,204 @@ do print "testing 'table.create'"
 end
 
 
+do print "testing 'table.clone'"
+  local function checkclone (t, c)
+    assert(c ~= t and getmetatable(c) == getmetatable(t))
+    -- same layout: same traversal order
+    local k1, v1 = next(t)
+    local k2, v2 = next(c)
+    while k1 ~= nil do
+      assert(rawequal(k1, k2) and rawequal(v1, v2))
+      k1, v1 = next(t, k1)
+      k2, v2 = next(c, k2)
+    end
+    assert(k2 == nil)
+    if T then
+      local a1, h1 = T.querytab(t)
+      local a2, h2 = T.querytab(c)
+      assert(a1 == a2 and h1 == h2)
+    end
+  end
+
+  checkclone({}, table.clone{})
+  local t = {10, 20, 30, nil, 50, x = 1, y = "a", [2.5] = true, [print] = 0}
+  checkclone(t, table.clone(t))
+  t = {}
+  for i = 1, 300 do t[i] = i; t["k" .. i] = {i} end
+  for i = 1, 300, 3 do t["k" .. i] = nil end    -- dead keys
+  local c = table.clone(t)
+  checkclone(t, c)
+  -- clone and original are independent
+  for i = 1, 1000 do c["new" .. i] = i end    -- use free positions, rehash
+  c[1] = "x"
+  for i = 1, 300 do
+    assert(t[i] == i and t["new" .. i] == nil and c["new" .. i] == i)
+    assert(rawequal(t["k" .. i], c["k" .. i]))
+  end
+  t.k2[1] = "shared"; assert(c.k2[1] == "shared")    -- shallow
+
+  -- metatables are kept (and are not cloned)
+  local mt = {__index = function (_, k) return k .. "!" end}
+  t = setmetatable({a = 1}, mt)
+  c = table.clone(t)
+  assert(getmetatable(c) == mt and c.a == 1 and c.b == "b!")
+  mt = {__index = {i = 1}, __metatable = "locked"}
+  c = table.clone(setmetatable({}, mt))
+  assert(getmetatable(c) == "locked" and c.i == 1)
+  mt.__metatable = nil
+  local count = 0
+  mt.__gc = function () count = count + 1 end
+  c = table.clone(setmetatable({}, mt))   -- clone also has a finalizer
+  t = nil; c = nil
+  collectgarbage()
+  assert(count == 2)
+  -- metamethods cached as absent stay absent; present ones are seen
+  t = {__index = function () return "mm" end}
+  c = table.clone(t)
+  assert(setmetatable({}, c).x == "mm")
+
+  -- weak tables stay weak
+  t = setmetatable({}, {__mode = "k"})
+  c = table.clone(t)
+  t[{}] = 1; c[{}] = 1
+  collectgarbage()
+  assert(next(t) == nil and next(c) == nil)
+
+  -- deep clones
+  local shared = {"shared"}
+  local key = {}
+  t = {1, {2, {3}}, a = shared, b = shared, [key] = {4}}
+  t.self = t
+  t[2].up = t
+  c = table.clone(t, true)
+  assert(c ~= t and c.self == c and c[2].up == c)
+  assert(c[2] ~= t[2] and c[2][2] ~= t[2][2] and c[2][2][1] == 3)
+  assert(c.a ~= shared and c.a == c.b and c.a[1] == "shared")
+  assert(c[key] ~= t[key] and c[key][1] == 4)   -- keys are not cloned
+  assert(next({}, nil) == nil and table.clone({}, true) ~= nil)
+  local deep = {}
+  local p = deep
+  for i = 1, 10000 do p.next = {i}; p = p.next end   -- no recursion
+  c = table.clone(deep, true)
+  for i = 1, 10000 do c = c.next; assert(c[1] == i) end
+  mt = {}
+  c = table.clone(setmetatable({setmetatable({}, mt)}, mt), true)
+  assert(getmetatable(c) == mt and getmetatable(c[1]) == mt)
+
+  checkerror("table expected", table.clone)
+  checkerror("table expected", table.clone, "abc")
+end
+
+
+do print "testing 'table.freeze'"
+  local t = {10, 20, 30, x = 1, [100] = 2, [2.5] = 3, [true] = 4,
+             [string.rep("k", 50)] = 5}
+  t[2] = nil   -- an empty slot in the array part
+  assert(not table.isfrozen(t))
+  assert(table.freeze(t) == t and table.isfrozen(t))
+  assert(table.freeze(t) == t)   -- freezing again is harmless
+
+  -- reads are not affected
+  assert(t[1] == 10 and t[2] == nil and t.x == 1 and t[100] == 2 and
+         t[2.5] == 3 and t[true] == 4 and t[string.rep("k", 50)] == 5)
+  local n = 0
+  for _ in pairs(t) do n = n + 1 end
+  assert(n == 7 and #table.clone(t) >= 1)
+
+  -- no write succeeds, for existing or new keys, raw or not
+  local function w (k, v) t[k] = v end
+  for _, k in ipairs{1, 2, 3, 4, 100, 101, 2.5, 3.0, 0.5, true, false,
+                     "x", "y", string.rep("k", 50), string.rep("y", 50),
+                     t, print} do
+    checkerror("frozen table", w, k, 1)
+    checkerror("frozen table", w, k, nil)
+    checkerror("frozen table", rawset, t, k, 1)
+  end
+  checkerror("frozen table", w, nil, 1)
+  if T then   -- raw writes through the C API
+    checkerror("frozen table", T.testC, "pushnum 0; rawseti 2 1", t)
+    checkerror("frozen table", T.testC, "pushnum 0; rawseti 2 4", t)
+    checkerror("frozen table", T.testC, "pushnum 0; rawsetp 2 1", t)
+    checkerror("frozen table", T.testC, "newtable; setmetatable 2", t)
+  end
+  checkerror("frozen table", table.insert, t, 1)
+  checkerror("frozen table", table.remove, t)
+  checkerror("frozen table", table.move, {1, 2, 3}, 1, 3, 1, t)
+  checkerror("frozen table", table.sort, table.freeze{3, 1, 2})
+  checkerror("frozen table", table.sort, table.freeze{"b", "a"})
+  checkerror("frozen table", table.sort, table.freeze{{}, {}},
+                             function (a, b) return a ~= b end)
+  checkerror("frozen table", setmetatable, t, {})
+  checkerror("frozen table", require"debug".setmetatable, t, {})
+  checkerror("frozen table", require"debug".setmetatable, t, nil)
+  assert(t[1] == 10 and t[2] == nil and t[3] == 30 and t[4] == nil)
+  assert(t.x == 1 and t.y == nil and t[string.rep("y", 50)] == nil)
+  table.move(t, 1, 3, 1, {})   -- can still be a source
+
+  -- globals in a frozen environment
+  local env = table.freeze{x = 1}
+  assert(load("return x", "", "t", env)() == 1)
+  checkerror("frozen table", load("x = 2", "", "t", env))
+  checkerror("frozen table", load("y = 2", "", "t", env))
+
+  -- '__newindex' is still called for absent keys
+  local log = {}
+  local mt = {__newindex = function (_, k, v) log[k] = v end}
+  t = table.freeze(setmetatable({a = 1, 10}, mt))
+  t.b = 2; t[2] = 20
+  assert(log.b == 2 and log[2] == 20 and rawget(t, "b") == nil)
+  checkerror("frozen table", w, "a", 3)
+  checkerror("frozen table", w, 1, 3)
+  assert(t.a == 1 and t[1] == 10)
+  -- a frozen table can be a metatable (and keeps its cache of absent
+  -- metamethods)
+  mt = table.freeze{__index = {x = "mm"}}
+  assert(setmetatable({}, mt).x == "mm" and setmetatable({}, mt).y == nil)
+  -- a frozen table can be a '__newindex' target only for absent keys
+  t = setmetatable({}, {__newindex = table.freeze{a = 1}})
+  checkerror("frozen table", w, "a", 2)
+  checkerror("frozen table", w, "b", 2)
+
+  -- clones of frozen tables are not frozen
+  local c = table.clone(table.freeze{1, 2, x = 3})
+  assert(not table.isfrozen(c))
+  c[1] = 10; c.x = 30; c.y = 40
+  assert(c[1] == 10 and c[2] == 2 and c.x == 30 and c.y == 40)
+
+  -- deep freeze, with cycles and shared subtables
+  local shared = {1}
+  local k = {}
+  t = {a = {b = {c = shared}}, shared, [k] = {}}
+  t.a.b.up = t
+  table.freeze(t, true)
+  assert(table.isfrozen(t) and table.isfrozen(t.a) and
+         table.isfrozen(t.a.b) and table.isfrozen(shared) and
+         table.isfrozen(t[k]) and not table.isfrozen(k))
+  checkerror("frozen table", function () shared[2] = 1 end)
+  -- subtables that are already frozen are traversed too
+  t = table.freeze{{{}}}
+  table.freeze({t}, true)
+  assert(table.isfrozen(t[1]) and table.isfrozen(t[1][1]))
+  -- a deep chain
+  t = {}
+  local p = t
+  for i = 1, 10000 do p.next = {i}; p = p.next end
+  table.freeze(t, true)
+  assert(table.isfrozen(p))
+
+  -- contents of frozen tables are still collected and kept alive
+  t = table.freeze{{"alive"}, string.rep("x", 100)}
+  collectgarbage(); collectgarbage()
+  assert(t[1][1] == "alive" and t[2] == string.rep("x", 100))
+  t = table.freeze(setmetatable({{}}, {__mode = "v"}))
+  collectgarbage()
+  assert(t[1] == nil)   -- weak entries are still cleared
+
+  checkerror("table expected", table.freeze)
+  checkerror("table expected", table.isfrozen, 1)
+end
+
+
 print "testing unpack"
 
 local unpack = table.unpack
@@ -218,6 +416,132 @@ checkerror("wrap around", table.move, {}, 1, 2, maxI)
 checkerror("wrap around", table.move, {}, minI, -2, 2)
 
 
+do   print "testing bulk operations on array parts"
+  -- reference implementation of 'move'
+  local function refmove (a1, f, e, t, a2)
+    a2 = a2 or a1
+    local tmp = {}
+    for i = f, e do tmp[i - f] = a1[i] end
+    for i = 0, e - f do a2[t + i] = tmp[i] end
+    return a2
+  end
+
+  local function newarray (n, gen)
+    local a = table.create(n)
+    for i = 1, n do a[i] = gen(i) end
+    return a
+  end
+
+  local function eqA (a, b, n)
+    for i = 1, n do
+      assert(rawequal(a[i], b[i]) and math.type(a[i]) == math.type(b[i]))
+    end
+  end
+
+  local objs = {}
+  for i = 1, 100 do objs[i] = {} end
+  local gens = {
+    function (i) return i end,
+    function (i) return i * 1.5 end,
+    function (i) return (i % 3 == 0) and objs[i] or tostring(i) end,
+    function (i) if i % 4 ~= 0 then return i end end,   -- holes
+  }
+  for _, gen in ipairs(gens) do
+    for _, m in ipairs{{1, 50, 30}, {30, 80, 1}, {10, 60, 11}, {11, 60, 10},
+                       {1, 100, 1}, {5, 5, 100}, {90, 100, 95}} do
+      local f, e, t = m[1], m[2], m[3]
+      local a, b = newarray(100, gen), newarray(100, gen)
+      table.move(a, f, e, t)
+      refmove(b, f, e, t)
+      eqA(a, b, 100)
+      local c, d = newarray(100, gen), newarray(100, gen)
+      table.move(newarray(100, gen), f, e, t, c)
+      refmove(newarray(100, gen), f, e, t, d)
+      eqA(c, d, 100)
+    end
+  end
+
+  -- metamethods are called for empty elements
+  local log = {}
+  local src = setmetatable(newarray(10, gens[4]),
+                {__index = function (_, k) log[#log + 1] = k; return -k end})
+  local dst = table.move(src, 1, 10, 1, table.create(10))
+  assert(#log == 2 and log[1] == 4 and log[2] == 8)
+  assert(dst[4] == -4 and dst[8] == -8 and dst[5] == 5)
+  log = {}
+  dst = setmetatable(newarray(10, gens[4]),
+          {__newindex = function (t, k, v) log[#log + 1] = k; rawset(t, k, v) end})
+  table.move(newarray(10, gens[1]), 1, 10, 1, dst)
+  assert(#log == 2 and dst[4] == 4 and dst[8] == 8)
+  log = {}
+  table.move(newarray(10, gens[1]), 1, 10, 1, dst)    -- no empty elements
+  assert(#log == 0)
+
+  -- moving new objects into an old table
+  local old = newarray(1000, gens[1])
+  collectgarbage()
+  for round = 1, 20 do
+    local new = newarray(1000, function (i) return {i + round} end)
+    collectgarbage("step", 0)
+    table.move(new, 1, 1000, 1, old)
+    new = nil
+    collectgarbage("step", 0)
+  end
+  collectgarbage()
+  for i = 1, 1000 do assert(old[i][1] == i + 20) end
+
+  if T then   -- moving new objects into a traversed (black) table
+    local mode = collectgarbage("incremental")
+    collectgarbage(); collectgarbage("stop")
+    old = newarray(10, gens[1])
+    T.gcstate("enteratomic")   -- 'old' was traversed
+    local new = newarray(10, function (i) return {i} end)
+    table.move(new, 1, 10, 1, old)
+    new = nil
+    T.gcstate("pause")   -- finish the cycle; objects must be alive
+    T.checkmemory()
+    for i = 1, 10 do assert(old[i][1] == i) end
+    collectgarbage("restart")
+    collectgarbage(mode)
+  end
+
+  -- unpack
+  local a = newarray(200, gens[4])
+  local t = {table.unpack(a, 1, 200)}
+  eqA(t, a, 200)
+  assert(select("#", table.unpack(a, 1, 200)) == 200)
+  assert(select("#", table.unpack(a, 150, 250)) == 101)
+  a = setmetatable(newarray(20, gens[4]), {__index = function (_, k) return -k end})
+  t = {table.unpack(a, 1, 20)}
+  assert(t[4] == -4 and t[8] == -8 and t[20] == -20 and t[19] == 19)
+  local x, y, z = table.unpack(newarray(3, gens[2]))
+  assert(x == 1.5 and y == 3.0 and z == 4.5)
+
+  -- concat
+  local long = string.rep("long", 20)
+  local pieces = {"", "a", "\0", long, string.sub(long, 3), long .. "x",
+                  "b", ""}
+  for _, sep in ipairs{"", ",", "\0", long} do
+    local r = ""
+    for i = 1, #pieces do r = r .. (i > 1 and sep or "") .. pieces[i] end
+    assert(table.concat(pieces, sep) == r)
+    assert(table.concat(pieces, sep, 2, 3) == "a" .. sep .. "\0")
+    assert(table.concat(pieces, sep, 4, 4) == long)
+  end
+  assert(table.concat(newarray(10, tostring)) == "12345678910")
+  local keys = {ab = 1, ["a,b"] = 2}     -- short results are internalized
+  assert(keys[table.concat({"a", "b"})] == 1)
+  assert(keys[table.concat({"a", "b"}, ",")] == 2)
+  assert(table.concat({1, "a", 2.5}, "-") == "1-a-2.5")
+  checkerror("invalid value %(nil%) at index 4",
+             table.concat, newarray(8, gens[4]), "", 1, 8)
+  a = setmetatable({"x", nil, "z"}, {__index = function () return "y" end})
+  assert(table.concat(a, "", 1, 3) == "xyz")
+  a = newarray(100000, function (i) return string.char(65 + i % 26) end)
+  assert(#table.concat(a) == 100000 and #table.concat(a, "--") == 299998)
+end
+
+
 print"testing sort"
 
 
@@ -338,4 +662,213 @@ table.sort(a)
 check(a, tt.__lt)
 check(a)
 
+do   print"testing direct sort of array parts"
+  -- compare with a sort using a function, which never uses the fast path
+  local function cmp (a, b) return a < b end
+  local function same (t)
+    local t1 = {unpack(t)}
+    local t2 = {unpack(t)}
+    table.sort(t1)
+    table.sort(t2, cmp)
+    assert(#t1 == #t2)
+    for i = 1, #t1 do
+      assert(t1[i] == t2[i] and math.type(t1[i]) == math.type(t2[i]))
+      assert(type(t1[i]) ~= "string" or #t1[i] == #t2[i])   -- right tags
+    end
+    check(t1)
+  end
+
+  local N = _soft and 500 or 5000
+  local t = {}
+  for i = 1, N do t[i] = math.random(-100, 100) end
+  same(t)
+  t[1] = maxI; t[2] = minI; t[3] = 0; t[N] = minI
+  same(t)
+  for i = 1, N do t[i] = math.random(minI, maxI) end
+  same(t)
+
+  for i = 1, N do t[i] = math.random() * 1e10 - 5e9 end
+  t[1] = math.huge; t[2] = -math.huge; t[3] = -0.0; t[4] = 0.0
+  same(t)
+
+  for i = 1, N do
+    local s = string.format("%x\0%d", math.random(1000), i % 7)
+    if i % 3 == 0 then s = string.rep(s, 20) end   -- long strings
+    t[i] = s
+  end
+  t[1] = ""; t[2] = "\0"; t[3] = "\xff\xfe"
+  same(t)
+
+  -- presorted, reversed, and equal elements
+  for i = 1, N do t[i] = i end
+  same(t)
+  for i = 1, N do t[i] = N - i end
+  same(t)
+  for i = 1, N do t[i] = 3.5 end
+  same(t)
+  for i = 1, N do t[i] = i // 10 end
+  same(t)
+  for i = 1, N do t[i] = -(i // 10) end
+  same(t)
+  for i = 1, N do t[i] = (i % 100 == 0) and -i or i end
+  same(t)
+
+  -- small arrays
+  for n = 0, 20 do
+    local a = {}
+    for i = 1, n do a[i] = math.random(5) end
+    same(a)
+  end
+
+  -- cases that must use the generic sort
+  same{3, 1.5, 2, -1, 0.0, 10}      -- mixed integers and floats
+  checkerror("invalid order function", table.sort, {1, 0/0, 2, 0/0, 3},
+             function (a, b) return true end)
+  local a = {3, 0/0, 1}
+  table.sort(a)    -- NaN: result is undefined, but it must not crash
+  checkerror("attempt to compare", table.sort, {1, "x", 2})
+
+  a = {}            -- elements in the hash part
+  for i = 10, 1, -1 do a[i] = i end
+  table.sort(a)
+  for i = 1, 10 do assert(a[i] == i) end
+
+  -- proxies must go through their metamethods
+  local inner = {5, 2, 8, 1}
+  local proxy = setmetatable({}, {
+    __index = inner,
+    __newindex = inner,
+    __len = function () return #inner end,
+  })
+  table.sort(proxy)
+  assert(inner[1] == 1 and inner[2] == 2 and inner[3] == 5 and inner[4] == 8)
+  assert(rawlen(proxy) == 0)
+end
+
+do   print"testing sortby"
+  -- check order and stability against the original positions
+  local function checkby (t, key, desc)
+    local pos = {}
+    for i = 1, #t do pos[t[i]] = i end
+    local r = {unpack(t)}
+    table.sortby(r, key, desc)
+    local kf = (type(key) == "function") and key or
+               function (x) return x[key] end
+    assert(#r == #t)
+    for i = 2, #r do
+      local a, b = kf(r[i - 1]), kf(r[i])
+      if desc then a, b = b, a end
+      assert(a < b or (not (b < a) and pos[r[i - 1]] < pos[r[i]]))
+    end
+    return r
+  end
+
+  local N = _soft and 500 or 5000
+  local t = {}
+  for i = 1, N do t[i] = {k = math.random(50), s = tostring(i % 37)} end
+  checkby(t, "k")
+  checkby(t, "k", true)
+  checkby(t, "s")
+  checkby(t, "s", true)
+  checkby(t, function (x) return x.k / 3 end)
+  checkby(t, function (x) return -x.k end, true)
+  checkby(t, function (x) return x.s .. "\0" .. x.k end)
+  checkby(t, function () return 1 end)   -- all equal: keep the order
+
+  -- exact order between integers and floats
+  local nums = {1.5, maxI, minI, 2^63, -2^63, 0, -0.0, -0.5, 3, 2^53,
+                2^53 + 1, math.huge, -math.huge, maxI - 1, 1e100, -1e100}
+  for i = 1, #nums do nums[i] = {v = nums[i]} end
+  checkby(nums, "v")
+  checkby(nums, "v", true)
+
+  -- keys taken with any field, including integers and metamethods
+  local rows = {{"b", 2}, {"a", 3}, {"c", 1}}
+  table.sortby(rows, 2)
+  assert(rows[1][1] == "c" and rows[2][1] == "b" and rows[3][1] == "a")
+  local mt = {__index = function (x, k) return x[1] end}
+  rows = {setmetatable({3}, mt), setmetatable({1}, mt), setmetatable({2}, mt)}
+  table.sortby(rows, "x")
+  assert(rows[1][1] == 1 and rows[2][1] == 2 and rows[3][1] == 3)
+
+  -- small and empty lists
+  table.sortby({}, "x")
+  local a = {10}
+  table.sortby(a, error)   -- should not compute any key
+  assert(a[1] == 10)
+
+  -- errors do not change the list
+  a = {3, 2, 1, "x"}
+  checkerror("compare number with string", table.sortby, a,
+             function (x) return x end)
+  assert(a[1] == 3 and a[4] == "x")
+  checkerror("element 2 in 'sortby' %(nil%)", table.sortby, {{k = 1}, {}}, "k")
+  checkerror("NaN", table.sortby, {1, 2}, function () return 0/0 end)
+  checkerror("boom", table.sortby, a, function (x)
+    if x == 1 then error("boom") end; return 0
+  end)
+  assert(a[1] == 3 and a[3] == 1)
+  checkerror("bad argument #2", table.sortby, {})
+  checkerror("table expected", table.sortby, 1, "x")
+
+  -- proxies
+  local inner = {{k = 2}, {k = 1}, {k = 3}}
+  local proxy = setmetatable({}, {
+    __index = inner,
+    __newindex = inner,
+    __len = function () return #inner end,
+  })
+  table.sortby(proxy, "k", true)
+  assert(inner[1].k == 3 and inner[2].k == 2 and inner[3].k == 1)
+
+  -- key function collecting garbage while string keys are alive
+  local strs = {}
+  for i = 1, 100 do strs[i] = string.rep("x", i % 10) .. i end
+  table.sortby(strs, function (s)
+    collectgarbage()
+    return string.upper(s)
+  end)
+  for i = 2, #strs do assert(strs[i - 1]:upper() <= strs[i]:upper()) end
+end
+
+do   print"testing parallel sort"
+  checkerror("out of range", table.sortthreads, 0)
+  checkerror("out of range", table.sortthreads, 1000)
+  checkerror("number expected", table.sortthreads, {})
+  assert(table.sortthreads() == 1)    -- default
+  assert(table.sortthreads(4) == 1)
+  assert(table.sortthreads() == 4)
+
+  -- compare with a sequential sort
+  local N = 70000     -- above the minimum size for a parallel sort
+  local function same (gen)
+    local t1, t2 = {}, {}
+    for i = 1, N do t1[i] = gen(i); t2[i] = t1[i] end
+    table.sort(t1)
+    local nt = table.sortthreads(1)
+    table.sort(t2)
+    table.sortthreads(nt)
+    for i = 1, N do
+      assert(t1[i] == t2[i] and math.type(t1[i]) == math.type(t2[i]))
+      assert(type(t1[i]) ~= "string" or #t1[i] == #t2[i])   -- right tags
+    end
+  end
+
+  same(function () return math.random(minI, maxI) end)
+  same(function () return math.random(3) end)     -- few distinct values
+  same(function () return 7 end)
+  same(function (i) return (i % 1000 == 0) and -i or i end)
+  same(function () return math.random() * 2 - 1 end)
+  same(function (i)    -- short and long strings
+    local s = string.format("%x", math.random(1 << 20))
+    return (i % 5 == 0) and string.rep(s, 10) or s
+  end)
+  same(function (i) return string.sub(string.rep("xyz", 100), i % 7 + 1) end)
+  for _, nt in ipairs{2, 3, 16, 64} do
+    table.sortthreads(nt)
+    same(function () return math.random(1000) end)
+  end
+  assert(table.sortthreads(1) == 64)
+end
+
 print"OK"
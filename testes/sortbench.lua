@@ -0,0 +1,69 @@
+-- $Id: testes/sortbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Sorting throughput (not part of 'all.lua'). Sorts arrays of random
+-- integers, floats, and strings, plus already sorted and reversed ones,
+-- with 'table.sort' without and with an order function, and records by
+-- a field with 'table.sort' and 'table.sortby', and prints the time for
+-- each sort.
+-- usage: lua sortbench.lua [number of elements in millions]
+
+global <const> *
+
+local N = math.floor((tonumber(arg and arg[1]) or 10) * 1e6)
+
+
+local function lt (a, b) return a < b end
+
+local function measure (name, n, gen, f)
+  local a = {}
+  for i = 1, n do a[i] = gen(i) end
+  collectgarbage()
+  local t0 = os.clock()
+  table.sort(a, f)
+  local t = os.clock() - t0
+  for i = 2, n, n // 1000 + 1 do assert(not (a[i] < a[i - 1])) end
+  print(string.format("%-28s %9d %9.1f ms", name, n, t * 1000))
+end
+
+
+local function rint () return math.random(0, 1 << 40) end
+local function rflt () return math.random() end
+local function rstr () return string.format("key%x", math.random(0, 1 << 40)) end
+
+local NS = N // 10    -- strings use more memory
+
+measure("integers", N, rint)
+measure("integers (comp)", N, rint, lt)
+measure("floats", N, rflt)
+measure("floats (comp)", N, rflt, lt)
+measure("strings", NS, rstr)
+measure("strings (comp)", NS, rstr, lt)
+measure("sorted integers", N, function (i) return i end)
+measure("reversed integers", N, function (i) return N - i end)
+measure("few distinct integers", N, function () return math.random(10) end)
+
+
+local function measureby (name, n, gen, f)
+  local a = {}
+  for i = 1, n do a[i] = {k = gen(i), i = i} end
+  collectgarbage()
+  local t0 = os.clock()
+  f(a)
+  local t = os.clock() - t0
+  for i = 2, n, n // 1000 + 1 do assert(not (a[i].k < a[i - 1].k)) end
+  print(string.format("%-28s %9d %9.1f ms", name, n, t * 1000))
+end
+
+local function sortk (a) table.sort(a, function (x, y) return x.k < y.k end) end
+local function sortbyk (a) table.sortby(a, "k") end
+local function sortbyf (a) table.sortby(a, function (x) return x.k end) end
+
+local NR = N // 5    -- records
+measureby("records (sort)", NR, rint, sortk)
+measureby("records (sortby field)", NR, rint, sortbyk)
+measureby("records (sortby function)", NR, rint, sortbyf)
+measureby("string records (sort)", NS, rstr, sortk)
+measureby("string records (sortby)", NS, rstr, sortbyk)
+
+print('OK')
@@ -157,6 +157,30 @@ else   -- compatible coercion
   assert(tostring(-1203 + 0.0) == "-1203")
 end
 
+if tostring(5e-324) == "5e-324" then   -- shortest float->string conversion
+  assert(tostring(0.1) == "0.1" and tostring(1/3) == "0.3333333333333333")
+  assert(tostring(0.3 + 0.6) == "0.8999999999999999")   -- 16 digits
+  assert(tostring(100000000000000.5) == "100000000000000.5")
+  assert(tostring(2^63) == "9.223372036854776e+18")
+  assert(tostring(1e15) == "1e+15" and tostring(-1e100) == "-1e+100")
+  assert(tostring(-1.5e-7) == "-1.5e-07" and tostring(1e-4) == "0.0001")
+  assert(tostring(2.2250738585072014e-308) == "2.2250738585072014e-308")
+  assert(tostring(1.7976931348623157e308) == "1.7976931348623157e+308")
+  assert(tostring(-0.0) == "-0.0" and tostring(1e300 * 1e10) == "inf")
+  assert(string.format("%q", 0.1) == "0.1")
+  for _ = 1, 1000 do   -- random bit patterns read back as the same float
+    local x = string.unpack("d", string.pack("i8", math.random(0)))
+    assert(x ~= x or tonumber(tostring(x)) == x)
+  end
+end
+
+-- integers are converted without 'sprintf' in common cases
+for _, i in ipairs{0, 7, -7, 10, 99, 100, -101, 123456789,
+                   math.maxinteger, math.mininteger} do
+  assert(tostring(i) == string.format("%5d", i):match("%S+"))
+  assert(string.format("%d", i) == tostring(i))
+end
+
 
 local function topointer (s)
   return string.format("%p", s)
@@ -233,6 +257,10 @@ do
   checkQ(math.mininteger)
   checkQ(math.pi)
   checkQ(0.1)
+  checkQ(-0.0)
+  checkQ(0.3 + 0.6)
+  checkQ(2^-1074)
+  checkQ(2^63)
   checkQ(true)
   checkQ(nil)
   checkQ(false)
@@ -367,6 +395,55 @@ assert(string.match(string.format("% 1.0E", 100), "^ 1E%+0+2$"))
 assert(string.match(string.format("% .1g", 2^10), "^ 1e%+0+3$"))
 
 
+do  -- compiled formats give the same results as 'sprintf'
+  -- (formats longer than 256 bytes are not compiled)
+  local pad = string.rep(" ", 300)
+  local function check (fmt, ...)
+    local res = string.format(fmt .. pad, ...)
+    assert(string.format(fmt, ...) == string.sub(res, 1, -301))
+  end
+  local ints = {0, 1, -1, 255, -4096, 123456789, math.maxinteger,
+                math.mininteger}
+  local floats = {0.0, 0.5, 1.5, 2.5, -0.5, 0.125, 2.675, -9.995, 0.005,
+                  1/3, -2/3, 1e15, 2^53, 2^63, 1e300, 1e-5, 1e-20, -0.0,
+                  1/0, -1/0, 0/0}
+  for i = 1, 200 do
+    floats[#floats + 1] = (math.random() - 0.5) * 10.0^math.random(-6, 16)
+    floats[#floats + 1] = math.random(-99999, 99999) / 100
+  end
+  for _, f in pairs{"%5d", "%-5d", "%05d", "%+d", "% d", "%.3d", "%.0d",
+                    "%-+8.3d", "%3i", "%x", "%08X", "%-8x", "%.5X"} do
+    for _, n in pairs(ints) do check(f, n) end
+  end
+  for _, f in pairs{"%f", "%.2f", "%5.2f", "%-9.3f", "%+.1f", "% .0f",
+                    "%010.4f", "%.19f", "%.20f"} do
+    for _, n in pairs(floats) do check(f, n) end
+  end
+  for _, f in pairs{"%s", "%5s", "%-5s", "%.2s", "%10.3s", "%-10.3s"} do
+    for _, v in pairs{"", "hello", "hello world!", 12, 1.5, true} do
+      check(f, v)
+    end
+  end
+  check("a%%b%d%%%s%%%5.1f|", 1, "x", 2.25)
+  -- default precision
+  assert(string.format("%f", 1.0) == "1.000000")
+  assert(string.format("%f", -0.1) == "-0.100000")
+  assert(string.format("%f", 2^-7) == "0.007812")   -- tie to even
+  assert(string.format("%f", 3 * 2^-8) == "0.011719")
+  assert(string.format("%f", 1e-7) == "0.000000")
+  assert(string.format("%f", 123456.789) == "123456.789000")
+  assert(string.format("%f", 1e13) == "10000000000000.000000")
+  assert(string.format("%f", 1e15) == "1000000000000000.000000")
+  assert(string.format("%.19f", 0.1) == "0.1000000000000000056")
+  assert(string.format("%10f|%-12f|", 2.5, 1/3) ==
+         "  2.500000|0.333333    |")
+  assert(string.format("[%05d] %-6s took %5.2f ms (id %x)", 7, "db", 1.005,
+                       255) == "[00007] db     took  1.00 ms (id ff)")
+  checkerror("no value", string.format, "%d %5.2f", 10)
+  checkerror("contains zeros", string.format, "%10s", "a\0")
+end
+
+
 -- errors in format
 
 local function check (fmt, msg)
@@ -559,5 +636,175 @@ else
   assert(next(t) == nil)
 end
 
+
+do print("testing appends to long strings")
+  -- results of concatenations may share memory with their first operand
+  local base = string.rep("x", 50)
+  local s = base
+  local all = {}
+  for i = 1, 200 do
+    s = s .. i .. ","
+    all[i] = s
+  end
+  local p = base
+  for i = 1, 200 do
+    p = p .. i .. ","
+    assert(all[i] == p and #all[i] == #p)
+  end
+  -- appending to old strings does not change newer ones
+  local a1 = all[10] .. "!"
+  assert(all[10] .. "!" == a1 and all[11] ~= a1 and a1 < all[11])
+  assert(string.sub(all[11], -3) == "11," and string.sub(a1, -4) == "10,!")
+
+  -- older strings are not followed by a '\0'
+  local z = base .. "1"
+  local z1 = z .. "\0" .. 2
+  local z2 = z1 .. "3"   -- 'z1' is no longer the last one
+  assert(#z1 == 53 and #z2 == 54 and z1 < z2 and z < z1)
+  assert(string.len(z1) == 53 and string.find(z1, "2$") == 53)
+  assert(z1 .. "" == z1 and string.format("%s", z1) == z1)
+  local num = string.rep(" ", 40) .. "12"
+  local n1 = num .. "34"
+  local n2 = n1 .. "56"
+  local n3 = n2 .. "e"
+  assert(math.abs(n2) == 123456 and select('#', string.byte(n3, 1, n2)) == 47)
+  assert(n1 + 0 == 1234 and n2 * 1 == 123456 and not pcall(function ()
+    return n3 + 1 end))
+  assert(math.type(n1 // 1) == "integer" and tonumber(n2) == 123456)
+  local t = {[n1] = 1, [n2] = 2}
+  assert(t[num .. "34"] == 1 and t[num .. "3456"] == 2)
+  -- old string as a type name
+  local tn = base .. "T"; local tn1 = tn .. "a"; local _ = tn1 .. "b"
+  local obj = setmetatable({}, {__name = tn1})
+  checkerror("two " .. tn1 .. " values", function () return obj < obj end)
+
+  -- a string given to C is not changed by later appends
+  local c = base .. "a"; c = c .. "b"
+  assert(string.len(c) == 52)   -- 'c' exported as a C string
+  local c1 = c .. "c"
+  assert(c == base .. "ab" and c1 == base .. "abc" and string.byte(c, -1) == 98)
+  collectgarbage()
+  assert(string.rep("ab", 10000) == (function ()
+    local r = string.rep("ab", 25)
+    for i = 1, 9975 do r = r .. "ab" end
+    return r
+  end)())
+end
+
+
+do print("testing long substrings")
+  -- long substrings may share memory with their original strings
+  local function check (s, i, j)
+    local sub = string.sub(s, i, j)
+    local copy = string.rep(" ", 0) .. string.sub(s, i, j)
+    assert(sub == copy and #sub == #copy and not (sub < copy))
+    return sub
+  end
+  local reg = string.rep("abcdefghij", 100)   -- regular long string
+  local app = string.rep("a", 50) .. string.rep("0123456789", 100)
+  local ext = T and T.externstr(reg)   -- external string from Lua's allocator
+  for _, s in ipairs{reg, app, ext or reg} do
+    for _, i in ipairs{1, 2, 300, 500} do
+      for _, j in ipairs{-1, -2, 499, 700} do
+        check(s, i, j)
+      end
+    end
+    local sub = check(s, 100, 899)
+    check(sub, 2, -2); check(sub, 150, 300)   -- substrings of substrings
+    local t = {[sub] = true}
+    assert(t[string.sub(s, 100, 899)] and string.len(sub) == 800)
+    assert(sub == string.sub(s, 100, 899))   -- after given to C
+  end
+
+  -- contents stay alive after their original strings are collected
+  local subs = {}
+  do
+    local s = string.rep("xyz", 1000) .. "!"
+    for i = 1, 100 do subs[i] = string.sub(s, i, i + 199) end
+    s = string.rep("xyz", 1000)
+    for i = 101, 200 do subs[i] = string.sub(s, -i) end
+  end
+  collectgarbage()
+  for i = 1, 100 do
+    assert(subs[i] == string.sub(string.rep("xyz", 100), i, i + 199))
+    assert(subs[i + 100] == string.sub(string.rep("xyz", 1000), -i - 100))
+  end
+
+  -- captures
+  local s = string.rep("a", 200) .. "=" .. string.rep("b", 300) .. ";"
+  local k, v = string.match(s, "(%w+)=(%w+)")
+  assert(k == string.rep("a", 200) and v == string.rep("b", 300))
+  for w in string.gmatch(s, "%w+") do assert(#w >= 200) end
+  assert(string.gsub(s, "%w+", function (w) return #w end) == "200=300;")
+
+  -- numerals, comparisons, and appends
+  local num = string.rep(" ", 200) .. "12" .. string.rep(" ", 200) .. "x"
+  local n = string.sub(num, 1, -2)
+  assert(n + 1 == 13 and math.type(n // 1) == "integer" and tonumber(n) == 12)
+  assert(string.sub(num, 1, -3) < n and n < num)
+  local base = string.rep("a", 50) .. string.rep("y", 300)
+  local tail = string.sub(base, -300)
+  local tail1 = tail .. "z"
+  assert(tail1 == string.rep("y", 300) .. "z" and tail == string.rep("y", 300))
+  assert(base == string.rep("a", 50) .. tail and string.len(base) == 350)
+
+  -- substrings do not copy their contents
+  local s = string.rep("abcdefghij", 100001)
+  collectgarbage(); collectgarbage()
+  local m0 = collectgarbage("count")
+  local t = {}
+  for i = 1, 1000 do t[i] = string.sub(s, i * 500, i * 500 + 299) end
+  assert(collectgarbage("count") - m0 < 150)   -- copies would use ~330K
+  assert(t[1000] == string.sub(s, 10, 309))
+end
+
+
+do print("testing string buffers")
+  local b = string.newbuffer()
+  assert(#b == 0 and tostring(b) == "" and b:get() == "")
+  assert(b:put("abc", 10, 2.5, "") == b and tostring(b) == "abc102.5")
+  assert(b:putf("[%d|%s|%5.1f]", 42, "x", 1.25) == b)
+  assert(tostring(b) == "abc102.5[42|x|  1.2]" and #b == 20)
+  assert(string.format("%s", b) == tostring(b))
+  assert(b:sub(1, 3) == "abc" and b:sub(-3) == ".2]" and b:sub(5, 4) == "")
+  b:put(b)   -- append itself
+  assert(tostring(b) == string.rep("abc102.5[42|x|  1.2]", 2))
+  assert(b:skip(3) == b and b:sub(1, 3) == "102" and #b == 37)
+  assert(b:get(3) == "102" and b:get(2) == ".5" and #b == 32)
+  assert(b:skip(100) == b and #b == 0 and b:get() == "")
+  assert(b:reset():put("xuxu"):get(0) == "" and b:get(10) == "xuxu")
+  checkerror("string expected", b.put, b, {})
+  checkerror("string buffer expected", b.put, "x")
+  checkerror("out of range", b.skip, b, -1)
+  checkerror("out of range", string.newbuffer, -1)
+  checkerror("no value", b.putf, b, "%d")
+  assert(#b == 0)   -- nothing added by failed 'putf'
+  -- 'lua_tolstring' does not convert buffers
+  assert(not pcall(string.len, b) and not pcall(function () return b .. "" end))
+
+  -- many small pieces, interleaved with removals
+  local t = {}
+  b = string.newbuffer(10)
+  for i = 1, 3000 do
+    b:put(i, ",")
+    t[#t + 1] = i .. ","
+    if i % 7 == 0 then
+      local s = table.concat(t)
+      local n = i % 13
+      assert(b:get(n) == string.sub(s, 1, n))
+      t = {string.sub(s, n + 1)}
+    end
+  end
+  assert(tostring(b) == table.concat(t) and b:get() == table.concat(t))
+
+  -- large contents go to a string without copies
+  local s = string.rep("abcdefghij", 10000)
+  b:reserve(#s):put(s)
+  local s1 = b:get()
+  assert(s1 == s and #b == 0 and b:put("a"):get() == "a")
+
+  do local c <close> = string.newbuffer(100); c:put(s) end
+end
+
 print('OK')
 
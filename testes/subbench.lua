@@ -0,0 +1,76 @@
+-- $Id: testes/subbench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Memory used by substrings (not part of 'all.lua'). Splits a text
+-- into lines with 'string.sub', 'string.find' and 'string.gmatch',
+-- keeping all lines, and prints the memory they use beyond the text
+-- itself (as a percentage of the text size) and the time taken.
+-- usage: lua subbench.lua [size in MB]
+
+global <const> *
+
+local size = (tonumber(arg and arg[1]) or 8) * 2^20
+
+local function gendata ()
+  local t, len, i = {}, 0, 0
+  while len < size do
+    i = i + 1
+    local line = string.format("%d,%s,%.3f,%s\n", i,
+                   string.rep(string.char(97 + i % 26), 100 + i % 150),
+                   i / 3, string.rep("z", 40 + i % 60))
+    t[#t + 1] = line
+    len = len + #line
+  end
+  return table.concat(t), i
+end
+
+local text, nlines = gendata()
+
+
+local function measure (name, f)
+  collectgarbage(); collectgarbage()
+  local m0 = collectgarbage("count")
+  local t0 = os.clock()
+  local lines = f()
+  local t = os.clock() - t0
+  collectgarbage()
+  local m = (collectgarbage("count") - m0) * 1024
+  assert(#lines == nlines)
+  print(string.format("%-16s %7.1f%% of text  %7.3f s", name,
+                      m / #text * 100, t))
+end
+
+
+measure("sub", function ()
+  local lines, i = {}, 1
+  while true do
+    local e = string.find(text, "\n", i, true)
+    if not e then break end
+    lines[#lines + 1] = string.sub(text, i, e - 1)
+    i = e + 1
+  end
+  return lines
+end)
+
+measure("gmatch", function ()
+  local lines = {}
+  for l in string.gmatch(text, "([^\n]*)\n") do
+    lines[#lines + 1] = l
+  end
+  return lines
+end)
+
+measure("sub + find", function ()
+  local lines, i = {}, 1
+  while true do
+    local e = string.find(text, "\n", i, true)
+    if not e then break end
+    local l = string.sub(text, i, e - 1)
+    assert(string.find(l, ",", 1, true))   -- lines used by C functions
+    lines[#lines + 1] = l
+    i = e + 1
+  end
+  return lines
+end)
+
+print('OK')
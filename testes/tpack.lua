@@ -319,5 +319,85 @@ do    -- testing initial position
  
 end
 
+do    -- compiled formats x interpreted formats (too long to be compiled)
+  local long = string.rep(" ", 300)
+  local function check (fmt, ...)
+    local s = pack(fmt, ...)
+    assert(pack(fmt .. long, ...) == s)
+    local t1 = table.pack(unpack(fmt, s))
+    local t2 = table.pack(unpack(fmt .. long, s))
+    assert(t1.n == t2.n)
+    for i = 1, t1.n do assert(t1[i] == t2[i]) end
+  end
+  check("<i4 >i4 =i4", 1, -2, 3)
+  check("<j >J <i3 >I5 i16", math.mininteger, -1, -100, 3 << 30, -7)
+  check("!8 b d h n i2 f !1 <i7", 1, 2.5, -3, 1e100, 5, 0.25, -9)
+  check("!4 i1 Xi8 s2 z c3 x", 3, "hi", "there", "abc")
+  check("  ", nil)
+  -- errors from the compiled forms use the same messages
+  checkerror("integer overflow", pack, "i1", 200)
+  checkerror("unsigned overflow", pack, "I1", -1)
+  checkerror("contains zeros", pack, "z", "a\0")
+  checkerror("longer than given size", pack, "c2", "abc")
+  checkerror("does not fit", pack, "s1", string.rep("a", 256))
+  checkerror("#3 .-number expected, got string", pack, "i i", 1, "a")
+  checkerror("data string too short", unpack, "i4 i4", "12345")
+  checkerror("unfinished string", unpack, "z", "abc")
+end
+
+do    -- packing and unpacking many records
+  local packmany, unpackmany = string.packmany, string.unpackmany
+  local fmt = "!4 <i2 Xi4 d z"
+  local t = {1, 1.5, "one", -2, 2.5, "two", 3, 3.5, "three"}
+  local s = packmany(fmt, t)
+  assert(s == pack(fmt:rep(3), table.unpack(t)))
+  assert(packmany(fmt, t, 4) == pack(fmt:rep(2), table.unpack(t, 4)))
+  assert(packmany(fmt, t, 4, 6) == pack(fmt, table.unpack(t, 4, 6)))
+  assert(packmany(fmt, t, 4, 3) == "")
+  local r, p = unpackmany(fmt, s)
+  assert(#r == #t and p == #s + 1)
+  for i = 1, #t do assert(r[i] == t[i]) end
+  -- given count and table
+  local r1 = {}
+  local r2, p = unpackmany(fmt, s, 1, 2, r1)
+  assert(r1 == r2 and #r1 == 6 and r1[6] == "two" and r1[7] == nil)
+  assert(unpack(fmt, s, p) == 3)
+  r, p = unpackmany(fmt, s, p)
+  assert(#r == 3 and r[3] == "three" and p == #s + 1)
+  r, p = unpackmany(fmt, s, -0)
+  assert(#r == 9)
+  r, p = unpackmany(fmt, s, 1, 0)
+  assert(next(r) == nil and p == 1)
+  r, p = unpackmany("c0", "abc")   -- empty records
+  assert(#r == 1 and r[1] == "" and p == 1)
+  r, p = unpackmany("c0 c1", "abc")
+  assert(#r == 6 and r[5] == "" and r[6] == "c" and p == 4)
+  -- long formats are not cached
+  local long = string.rep(" ", 300) .. "i3"
+  assert(packmany(long, {1, 2, 3}) == pack("i3i3i3", 1, 2, 3))
+  assert(#unpackmany(long, pack("i3i3", 1, 2)) == 2)
+  -- do not use metamethods
+  local proxy = setmetatable({}, {__index = t, __len = function () return 3 end})
+  assert(packmany(fmt, proxy) == "")
+  -- errors
+  checkerror("multiple of record size", packmany, fmt, t, 1, 4)
+  checkerror("has no values", packmany, "x!4", {})
+  checkerror("has no values", unpackmany, "", "abc", 1, math.maxinteger)
+  checkerror("has no values", unpackmany, "x", "abc")
+  checkerror("invalid format option 'w'", packmany, "i w", {1})
+  checkerror("invalid format option 'w'", unpackmany, "i w", "1234")
+  checkerror("index 5%) in table for 'packmany' %(number expected, got nil",
+             packmany, fmt, {1, 1.5, "one", 2}, 1, 6)
+  checkerror("index 1%) in table for 'packmany' %(integer overflow",
+             packmany, "i1", {1000})
+  checkerror("index 3%) in table for 'packmany' %(string contains zeros",
+             packmany, fmt, {1, 2, "\0"})
+  checkerror("table expected", packmany, fmt, "x")
+  checkerror("data string too short", unpackmany, "i4", "12345")
+  checkerror("data string too short", unpackmany, "i4", "1234", 1, 2)
+  checkerror("out of range", unpackmany, "i4", "1234", 1, -1)
+  checkerror("out of string", unpackmany, "i4", "1234", 6)
+end
+
 print "OK"
 
@@ -0,0 +1,50 @@
+-- $Id: testes/udatabench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- Userdata field access (not part of 'all.lua'). Reads and writes the
+-- fields of a C struct through a userdata layout and through C
+-- '__index'/'__newindex' functions, printing millions of accesses per
+-- second. Needs the C library 'libs/udata.so' (run 'make' in 'libs').
+-- usage: lua udatabench.lua [millions of accesses]
+
+global <const> *
+
+package.cpath = "./libs/?.so;" .. package.cpath
+local udata = require"udata"
+
+local N = math.floor((tonumber(arg and arg[1]) or 10) * 1e6)
+
+
+local function measure (name, f)
+  local best = math.huge
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    f()
+    best = math.min(best, os.clock() - t0)
+  end
+  print(string.format("%-24s %8.1f Macc/s", name, N / 1e6 / best))
+end
+
+
+local function bench (kind, new)
+  local p = new(1, 2)
+
+  measure(kind .. " read", function ()
+    local s = 0
+    for _ = 1, N, 2 do s = s + p.x + p.y end
+    return s
+  end)
+
+  measure(kind .. " write", function ()
+    for i = 1, N, 2 do p.x = i; p.id = i end
+  end)
+
+  measure(kind .. " read/write", function ()
+    for _ = 1, N, 2 do p.x = p.x + 1 end
+  end)
+end
+
+bench("layout", udata.newlayout)
+bench("C __index", udata.newc)
+
+print('OK')
@@ -276,5 +276,89 @@ for p, c in string.gmatch(x, "()(" .. utf8.charpattern .. ")") do
   end
 end
 
+
+do    -- 'utf8.len' and 'utf8.validate' x decoding one character at a time
+  -- reference: decode with 'utf8.codepoint'; returns number of
+  -- characters (or nil), position where it stopped, and start of the
+  -- last character
+  local function decode (s, i, j, lax)
+    local n, last = 0, i
+    while i <= j do
+      local ok, c = pcall(utf8.codepoint, s, i, i, lax)
+      if not ok then return nil, i end
+      last = i
+      i = i + #utf8.char(c)
+      n = n + 1
+    end
+    return n, i, last
+  end
+
+  local function checkrange (s, i, j, lax)
+    local n, p, last = decode(s, i, j, lax)
+    local l, lp = utf8.len(s, i, j, lax)
+    local v, vp = utf8.validate(s, i, j, lax)
+    if n then
+      assert(l == n and lp == nil)
+      if p == j + 1 then assert(v == true and vp == nil)
+      else assert(v == nil and vp == last)   -- last character too long
+      end
+    else
+      assert(l == nil and lp == p and v == nil and vp == p)
+    end
+  end
+
+  local function checkall (s)
+    checkrange(s, 1, #s); checkrange(s, 1, #s, true)
+  end
+
+  -- all lead bytes followed by interesting bytes
+  local seconds = {0x00, 0x41, 0x7F, 0x80, 0x83, 0x84, 0x87, 0x88, 0x8F,
+                   0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xFF}
+  for c = 0x80, 0xFF do
+    for _, c1 in ipairs(seconds) do
+      for rest = 0, 5 do
+        local s = string.char(c, c1) .. string.rep("\x80", rest)
+        checkall(s); checkall("ab" .. s .. "c"); checkall(s .. s)
+        checkrange(s, 1, 1); checkrange(s, 1, 2, true)
+      end
+    end
+  end
+
+  -- extreme values
+  for _, c in ipairs{0x7F, 0x80, 0x7FF, 0x800, 0xD7FF, 0xD800, 0xDFFF,
+                     0xE000, 0xFFFF, 0x10000, 0x10FFFF, 0x110000, 0x1FFFFF,
+                     0x200000, 0x3FFFFFF, 0x4000000, 0x7FFFFFFF} do
+    local s = utf8.char(c)
+    checkall(s); checkall(string.rep("x", 31) .. s .. string.rep("y", 17))
+  end
+
+  -- random sequences, with runs of ASCII and of valid characters
+  local random = math.random
+  local chars = {"a", "\0", "é", "日", "𠜎", "\u{D800}", "\u{7FFFFFFF}"}
+  for _ = 1, 2000 do
+    local t = {}
+    for k = 1, random(0, 10) do
+      local r = random(4)
+      if r == 1 then t[k] = string.rep("x", random(0, 40))
+      elseif r == 2 then t[k] = chars[random(#chars)]
+      elseif r == 3 then t[k] = string.char(random(0, 255))
+      else t[k] = string.rep(chars[random(#chars)], random(1, 20))
+      end
+    end
+    local s = table.concat(t)
+    checkall(s)
+    if #s > 0 then
+      local i = random(#s)
+      checkrange(s, i, random(i - 1, #s), random(2) == 1)
+    end
+  end
+
+  assert(utf8.validate(""))
+  assert(utf8.validate("abc", 4))
+  assert(utf8.validate("日本", 1, 3) and not utf8.validate("日本", 1, 4))
+  checkerror("out of bounds", utf8.validate, "abc", 0, 2)
+  checkerror("out of bounds", utf8.validate, "abc", 1, 4)
+end
+
 print'ok'
 
@@ -0,0 +1,54 @@
+-- $Id: testes/utf8bench.lua,v $
+-- See Copyright Notice in file lua.h
+
+-- UTF-8 validation throughput (not part of 'all.lua'). Measures
+-- 'utf8.len' (and 'utf8.validate', when present) over texts that are
+-- pure ASCII, mostly ASCII, and mostly multibyte, in MB/s.
+-- usage: lua utf8bench.lua [size in MB]
+
+global <const> *
+
+local size = (tonumber(arg and arg[1]) or 16) * 2^20
+
+local function gentext (pieces)
+  local t, len, i = {}, 0, 0
+  while len < size do
+    i = i + 1
+    local p = pieces[i % #pieces + 1]
+    t[#t + 1] = p
+    len = len + #p
+  end
+  return table.concat(t)
+end
+
+local texts = {
+  {"ASCII", gentext{"The quick brown fox jumps over the lazy dog. ",
+                    "{\"id\": 12345, \"name\": \"value\"}\n"}},
+  {"mostly ASCII", gentext{"Some text with a few accents: café, ",
+                           "naïve, résumé; and more plain text.\n"}},
+  {"multibyte", gentext{"日本語のテキスト、", "汉字和标点。",
+                        "Ελληνικά κείμενα ", "𠜎𠱓𡁻 "}},
+}
+
+
+local function measure (name, text, f)
+  local best = math.huge
+  for _ = 1, 3 do
+    local t0 = os.clock()
+    assert(f(text))
+    best = math.min(best, os.clock() - t0)
+  end
+  print(string.format("%-30s %9.1f MB/s", name, #text / 2^20 / best))
+end
+
+
+for _, t in ipairs(texts) do
+  measure("len      " .. t[1], t[2], utf8.len)
+  measure("len lax  " .. t[1], t[2],
+          function (s) return utf8.len(s, 1, -1, true) end)
+  if utf8.validate then
+    measure("validate " .. t[1], t[2], utf8.validate)
+  end
+end
+
+print('OK')